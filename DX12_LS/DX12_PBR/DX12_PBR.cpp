@@ -15,6 +15,9 @@
 // 3 = Especular PBR only            // Solo brillo especular (Cook–Torrance GGX + Fresnel).
 // 4 = Direct PBR (difuso+spec)      // Luz directa PBR (difuso + especular), sin ambiente/IBL.
 // 5 = PBR completo básico           // Ambiente simple (placeholder) + luz directa PBR. (Luego se reemplaza por IBL).
+// Nota: cada modo es una permutación compilada del PS (su propio PSO, creado la primera vez que se usa); -permutation-selftest prueba las claves.
+
+// PRESIONAR N para usar el color debug por normal como albedo (feature NORMAL_ALBEDO del PS, otra permutación)
 
 // PRESIONAR M para alternar valores de Metallic
 // Nota: Metallic representa si el material es dieléctrico (≈0) o metálico (≈1).
@@ -32,10 +35,19 @@
 
 // PRESIONAR P para frenar la rotación del Cubo
 
-// PRESIONAR G para alternar entre cubo y esfera
+// PRESIONAR G para alternar entre cubo, esfera y modelo
+// Nota: el modelo se carga en segundo plano; mientras tanto se dibuja el cubo y el título dice "loading".
+
+// PRESIONAR S para activar/desactivar el barrido de materiales (grilla metallic × roughness de esferas, un solo draw instanciado)
+// PRESIONAR + / - para agrandar/achicar la grilla del barrido (4×4 = presets, después rampas lineales hasta 256×256)
 
 // PRESIONAR F para fijar la luz frente a la cámara
 
+// PRESIONAR C para activar/desactivar el culling por meshlet del modelo (frustum + cono de normales, en CPU)
+
+// PRESIONAR L para recorrer los LODs del modelo y de la esfera (automático por error en pantalla → LOD 0 → ... → LOD 5 → automático)
+// Nota: la esfera es una icosfera; -cube-sphere / -uv-sphere eligen los otros generadores y -benchmark-sphere los compara.
+
 //--------------------------------------------------------------------------------------
 // Ayuda teórica para DX12:
 //--------------------------------------------------------------------------------------
@@ -167,14 +179,27 @@
 #include <DirectXMath.h>
 #include <string>
 #include <vector>
+#include <deque>
 #include <chrono>
 #include <cassert>
 #include <cstdio> // sprintf_s
+#include <algorithm>
+#include <cfloat>
+#include <intrin.h> // _BitScanReverse64 / _BitScanForward64 (TLSF)
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
 
 //Assimp
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/fast_atof.h> // parser OBJ nativo
 
 #pragma comment(lib, "d3d12.lib")
 #pragma comment(lib, "dxgi.lib")
@@ -189,8 +214,16 @@ using namespace DirectX;
 static const UINT FrameCount = 2; // Cantidad de back buffers del swap chain.
 static const UINT Width = 1280;
 static const UINT Height = 720;
+// Resolución de render: la de la ventana, salvo en -batch-render, que dibuja offscreen al tamaño pedido con -size=.
+static UINT g_renderWidth = Width;
+static UINT g_renderHeight = Height;
+static const UINT64 UploadPageSize = 8ull * 1024 * 1024; // Bytes del upload allocator disponibles por frame en vuelo.
+static const UINT64 StagingRingSize = 16ull * 1024 * 1024; // Ring UPLOAD de donde la cola de copia lleva la geometría a DEFAULT.
+static const UINT MaxRecordLists = 16; // Command lists de grabación en paralelo por frame: rangos de draws + la continuación del frame.
+static const UINT MinDrawsPerList = 256; // Por debajo de 2 × esto los draws de la pasada principal se graban en una sola lista.
 
 int g_mode = 5;
+uint32_t g_shaderFeatures = 0; // ShaderFeature activas (tecla N): junto con g_mode eligen la permutación del PS
 
 //--------------------------------------------------------------------------------------
 // Util
@@ -209,926 +242,10587 @@ inline void ThrowIfFailed(HRESULT hr) { if (FAILED(hr)) { assert(false); ExitPro
 inline UINT Align256(UINT size) { return (size + 255) & ~255u; }
 
 //--------------------------------------------------------------------------------------
-// Vertex / Const Buffer Definition
+// Archivos (caches en disco): mapeo en memoria, hash de contenido y escritura atómica
 //--------------------------------------------------------------------------------------
-struct Vertex {
-    XMFLOAT3 pos; //Espacio local
-    XMFLOAT3 color; //RGB
-    XMFLOAT3 normal;
-};
 
+inline uint64_t Align16(uint64_t v) { return (v + 15) & ~15ull; }
 
-// Definición del CBV - un CBV es un bloque de memoria en el GPU que tiene valores constantes por draw y es accesible desde shaders.
-// Sería como un buffer de uniforms en OpenGL.
-// Se usa alignas porque quiero que esta struct comience en memoria en una dirección múltiplo de 256 bytes.
-// Esto es una regla de DX12.
+// Archivo mapeado en memoria de solo lectura (CreateFileMapping + MapViewOfFile). Se desmapea al destruirse.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
 
-struct alignas(256) CBData {
-    // Aclaración: Cada variable dentro de un cbuffer debe ocupar un múltiplo de 16 bytes (Constant buffer packing rules):
+    bool Open(const std::string& path)
+    {
+        Close();
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) return false;
 
-    XMMATRIX mvp; // Matriz Model - View - Projection (XMMATRIX is auto aligned on a 16-byte boundary)
-    XMMATRIX world; // Matriz World: necesaria para transformar normales y posición en PBR.
-    
-    XMFLOAT3 lightDir; // (12 bytes)
-    float    ambient; // Tal vez no se use en PBR, queda para compatibilidad (4 bytes)
-    
-    int      mode; // Modo 1-5 (4 bytes)
-    XMFLOAT3 _pad1; // (padding de 12 bytes)
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) { Close(); return false; }
+        m_size = (size_t)size.QuadPart;
 
-    XMFLOAT3 viewPos;  // Posición de la cámara en mundo (p/ PBR y Fresnel).
-    float    shininess; // Para especular
-    float    specIntensity; // Para especular 
-    XMFLOAT3 _pad2;
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping) { Close(); return false; }
 
-    XMFLOAT3 baseColor; // baseColor: F0 para metales y albedo difuso para dieléctricos.
-    float metallic;  // metallic: 0 = dieléctrico, 1 = metal.
-    float roughness; // controla la microrrugosidad de la superficie.
-    float ao; // atenúa SOLO la luz ambiental en oquedades y contactos.
-    XMFLOAT2 _pad3;
+        m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!m_data) { Close(); return false; }
+        return true;
+    }
 
-    // luz puntual física
-    XMFLOAT3 lightPos;     
-    float lightIntensity; // intensidad en unidades arbitrarias
-    XMFLOAT3 lightColor;  // RGB de la luz
-    float _pad4;          
-};
+    void Close()
+    {
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+        m_data = nullptr; m_mapping = nullptr; m_file = INVALID_HANDLE_VALUE; m_size = 0;
+    }
 
-//--------------------------------------------------------------------------------------
-// Globals DX12
-//--------------------------------------------------------------------------------------
-HWND                                g_hWnd = nullptr; //Handler de la ventana
-UINT                                g_frameIndex = 0; //Indice del backbuffer actual
-UINT                                g_rtvDescriptorSize = 0; //Tamaño en bytes entre descriptores RTV dentro del descriptor heap (lo da el device)
-UINT                                g_dsvDescriptorSize = 0; //Tamaño en bytes entre descriptores DSV dentro del descriptor heap (lo da el device)
-D3D12_VIEWPORT                      g_viewport = { 0.0f, 0.0f, (float)Width, (float)Height, 0.0f, 1.0f }; // Viewport de rasterización: área de la pantalla donde se dibuja
-D3D12_RECT                          g_scissorRect = { 0, 0, (LONG)Width, (LONG)Height }; //Rectángulo de scissor: recorta el dibujo a esta región
+    const uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
 
-// Objetos base de la plataforma DX12 (device, factory, swapchain, cola, etc.)
+private:
+    HANDLE         m_file = INVALID_HANDLE_VALUE;
+    HANDLE         m_mapping = nullptr;
+    const uint8_t* m_data = nullptr;
+    size_t         m_size = 0;
+};
 
-ComPtr<IDXGIFactory7>               g_factory; // Factory DXGI: permite enumerar adaptadores (GPU) y crear el swap chain.
-ComPtr<ID3D12Device>                g_device; // Device de D3D12: representa la conexión lógica con la GPU. Crea recursos (buffers, textures, heaps, PSO, etc.).
-ComPtr<ID3D12CommandQueue>          g_cmdQueue; // Command Queue: cola donde se envían command lists ya grabadas para que la GPU las ejecute.
-ComPtr<IDXGISwapChain3>             g_swapChain; // Swap chain: conjunto de backbuffers que se alternan entre render y presentación en pantalla.
-ComPtr<ID3D12DescriptorHeap>        g_rtvHeap; // Descriptor heap que contiene los descriptores RTV (Render Target View) de los backbuffers.
-ComPtr<ID3D12Resource>              g_renderTargets[FrameCount]; // Recursos de GPU para cada backbuffer del swap chain (las texturas donde se dibuja el frame).
-ComPtr<ID3D12CommandAllocator>      g_cmdAlloc[FrameCount]; // Command allocator por frame: administra la memoria donde se graban las commands de la command list.
-ComPtr<ID3D12GraphicsCommandList>   g_cmdList; // Command list de tipo gráfico: se graban aquí las órdenes de dibujo (set pipeline, draw, clears, etc.).
-ComPtr<ID3D12Fence>                 g_fence; // Fence de sincronización CPU/GPU: permite saber cuándo la GPU terminó de procesar comandos.
-UINT64                              g_fenceValue = 0; // Contador asociado a la fence. Cada submit incrementa este valor para trackear el progreso.
-HANDLE                              g_fenceEvent = nullptr; // Event de Win32 usado para bloquear la CPU hasta que la fence llegue a un valor dado.
+// FNV-1a de 64 bits sobre palabras de 8 bytes (no es el FNV estándar, pero es ~8 veces más rápido y alcanza para detectar cambios).
+uint64_t HashBytes64(const uint8_t* data, size_t size)
+{
+    uint64_t h = 14695981039346656037ull;
+    const uint64_t prime = 1099511628211ull;
 
-// Recursos de depth/stencil
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * prime;
+    }
+    for (; i < size; ++i)
+        h = (h ^ data[i]) * prime;
+    return h ^ (uint64_t)size;
+}
 
-ComPtr<ID3D12DescriptorHeap>        g_dsvHeap; // Descriptor heap para el DSV (depth-stencil view).
-ComPtr<ID3D12Resource>              g_depthTex; // Textura de depth (Z-buffer) donde se almacena la información de profundidad del frame.
+// Escribe el archivo a un .tmp y lo renombra: si el proceso muere a mitad de camino no queda un archivo a medias.
+// El destino no puede estar mapeado (Windows no deja reemplazar un archivo con vistas abiertas).
+bool WriteFileAtomic(const std::string& path, const std::vector<uint8_t>& blob)
+{
+    const std::string tmpPath = path + ".tmp";
+    HANDLE f = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
 
-// Root Signature + PSO (estado de pipeline)
+    bool ok = true;
+    for (size_t done = 0; ok && done < blob.size();)
+    {
+        const DWORD chunk = (DWORD)(std::min)(blob.size() - done, (size_t)1 << 30);
+        DWORD written = 0;
+        ok = WriteFile(f, blob.data() + done, chunk, &written, nullptr) && written == chunk;
+        done += written;
+    }
+    CloseHandle(f);
 
-ComPtr<ID3D12RootSignature>         g_rootSig; // Root signature: describe qué recursos (CBVs (constant buffer view), SRVs (shader resolution view), samplers, etc.) puede ver el shader
-                                               // y cómo se van a enlazar (root parameters, descriptor tables, etc.).
-ComPtr<ID3D12PipelineState>         g_pso; // Pipeline State Object: estado completo del pipeline gráfico (shaders, input layout,
-                                           // rasterizer, depth-stencil, blend, formatos RT/DS, topology, etc.).
+    if (!ok || !MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
 
-// Constants buffer
-ComPtr<ID3D12Resource>              g_cb;    // Recurso de tipo buffer usado como constant buffer (CBV). Está en memoria UPLOAD y se deja mapeado.
-                                             // para poder escribirle datos cada frame.
+//--------------------------------------------------------------------------------------
+// Job system (work stealing): una cola por hilo, contadores de dependencias y ParallelFor
+//--------------------------------------------------------------------------------------
 
-CBData* g_cbMapped = nullptr; // Puntero CPU al constant buffer mapeado. Cada frame se escribe CBData aquí y la GPU lo lee en el shader.
+// Contador de jobs pendientes: Run lo sube, el job lo baja al terminar y Wait espera a que llegue a 0. Los jobs
+// encadenados con RunAfter esperan en 'continuations' y se encolan cuando el contador llega a 0. No se puede volver a
+// armar un contador mientras alguien lo espera.
+struct JobCounter
+{
+    struct Continuation { std::function<void()> fn; JobCounter* counter; const void* owner; };
 
-XMMATRIX                            g_proj; // Matriz de proyección (perspectiva).
-XMMATRIX                            g_view; // Matriz de vista (cámara).
+    std::atomic<int> pending{ 0 };
+    std::mutex mutex; // protege continuations y el paso a 0
+    std::vector<Continuation> continuations;
 
-XMFLOAT3 g_eyeWS; // Posición de la cámara en espacio mundo (world space). Se pasa al shader para PBR (Fresnel, view vector, etc.).
+    bool Done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
 
+static thread_local const void* t_jobSystem = nullptr; // sistema al que pertenece el hilo actual (nullptr: hilo externo)
+static thread_local UINT t_jobSlot = 0;                // su cola en ese sistema
+static thread_local const void* t_jobOwner = nullptr;  // hilo externo que originó el job que corre este hilo
+
+// Pool de 'threads' hilos de trabajo: threads - 1 workers propios más el hilo que espera (Wait ejecuta jobs mientras
+// espera, así que un Wait dentro de un job no bloquea a un worker). Cada worker apila en su cola y saca del final
+// (LIFO, lo recién encolado todavía está en cache); cuando se queda sin trabajo roba del principio de la cola de otro,
+// empezando por una víctima al azar. Los hilos externos (main, el loader del modelo, el rebuild de shaders) encolan en
+// la cola 0 y cada job lleva de dueño al hilo externo que lo originó (los que encola un job o un RunAfter heredan el
+// dueño). El Wait de un hilo externo solo corre jobs suyos: el render thread no puede terminar compilando un shader
+// del rebuild ni parseando un pedazo de OBJ del loader dentro de un frame. Los workers corren cualquier cosa. Las
+// colas tienen un mutex cada una: con jobs de decenas de microsegundos o más no hace falta un deque lock-free.
+class JobSystem
+{
+public:
+    explicit JobSystem(UINT threads = 0)
+    {
+        if (threads == 0) threads = (std::max)(1u, std::thread::hardware_concurrency());
+        m_queues = std::vector<Queue>(threads);
+        for (UINT slot = 1; slot < threads; ++slot)
+            m_workers.emplace_back([this, slot]() { WorkerMain(slot); });
+    }
 
+    ~JobSystem()
+    {
+        m_stop = true;
+        { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+        m_wake.notify_all();
+        for (std::thread& w : m_workers) w.join();
+    }
 
-//--------------------------------------------------------------------------------------
-// Parámetros de escena (material, luz, animación, selección de geometría)
-//--------------------------------------------------------------------------------------
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
 
-// Timing
-auto g_t0 = std::chrono::high_resolution_clock::now();
+    UINT ThreadCount() const { return (UINT)m_queues.size(); }
 
-// Presets de material y estado actual (para cambiar un runtime)
-static const float g_metallicPresets[] = { 0.0f, 0.1f, 0.5f, 1.0f };
-static const float g_roughnessPresets[] = { 0.08f, 0.35f, 0.6f, 0.9f };
-static const float g_aoPresets[] = { 0.0f, 0.5f, 0.8f, 1.0f };
+    void Run(std::function<void()> fn, JobCounter* counter = nullptr)
+    {
+        if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+        Push(Slot(), Job{ std::move(fn), counter, Owner() });
+    }
 
-// Indices de presets
-static int   g_metallicIdx = 0;
-static int   g_roughnessIdx = 1;
-static int   g_aoIdx = 3;
+    // Corre fn cuando 'dependency' llega a 0 (enseguida si ya está en 0). 'counter' cuenta el job desde ahora.
+    void RunAfter(JobCounter& dependency, std::function<void()> fn, JobCounter* counter = nullptr)
+    {
+        if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (dependency.pending.load(std::memory_order_acquire) != 0)
+            {
+                dependency.continuations.push_back(JobCounter::Continuation{ std::move(fn), counter, Owner() });
+                return;
+            }
+        }
+        Push(Slot(), Job{ std::move(fn), counter, Owner() });
+    }
 
-// Valores de presets
-static float g_metallic = g_metallicPresets[g_metallicIdx];
-static float g_roughness = g_roughnessPresets[g_roughnessIdx];
-static float g_ao = g_aoPresets[g_aoIdx];
+    // Ejecuta jobs (propios o robados) hasta que el contador llega a 0. Desde un hilo externo, solo los que originó él.
+    void Wait(JobCounter& counter)
+    {
+        const UINT slot = Slot();
+        const void* only = t_jobSystem == this ? nullptr : Owner();
+        uint32_t rng = slot * 2654435761u + 1;
+        while (!counter.Done())
+            if (!TryRunOne(slot, rng, only)) std::this_thread::yield();
+        std::lock_guard<std::mutex> lock(counter.mutex); // el último Complete ya lo soltó: se puede destruir
+    }
 
-// Color base 
-static XMFLOAT3 g_baseColor = XMFLOAT3(0.95f, 0.25f, 0.20f);
+    uint64_t Executed() const { return m_executed; }
+    uint64_t Steals() const { return m_steals; }
 
-// Luz: parámetros base
-static XMFLOAT3 g_lightColor = XMFLOAT3(1.0f, 1.0f, 1.0f);
-static float    g_lightIntensity = 30.0f; //10 - 100 aprox
+private:
+    struct Job { std::function<void()> fn; JobCounter* counter; const void* owner; };
+    struct alignas(64) Queue { std::mutex mutex; std::deque<Job> jobs; }; // una línea de cache por cola
 
-// control de rotación del cubo
-static bool g_pauseRotation = false;
-static float g_rotTime = 0.0f; // tiempo acumulado para la rotación del cubo
-static std::chrono::high_resolution_clock::time_point g_prevTick; //ticker para control animación
+    UINT Slot() const { return t_jobSystem == this ? t_jobSlot : 0; }
+    // Un worker encola a nombre del dueño del job que está corriendo; un hilo externo, a su nombre (la dirección de su
+    // thread_local lo identifica mientras viva).
+    const void* Owner() const { return t_jobSystem == this ? t_jobOwner : &t_jobOwner; }
 
-// Buffers de geometría
-ComPtr<ID3D12Resource>              g_vb; // Vertex buffer del cubo (posiciones, colores, normales).
-ComPtr<ID3D12Resource>              g_ib; // Index buffer del cubo (definición de triángulos por índices).
-D3D12_VERTEX_BUFFER_VIEW            g_vbView = {}; // Vista del vertex buffer: GPU address + stride (tamaño entre objetos) + tamaño total.
-D3D12_INDEX_BUFFER_VIEW             g_ibView = {}; // Vista del index buffer: GPU address + formato (R16_UINT) + tamaño total.
+    void Push(UINT slot, Job job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queues[slot].mutex);
+            m_queues[slot].jobs.push_back(std::move(job));
+        }
+        m_queued.fetch_add(1);
+        if (m_sleeping.load() > 0) // con el mutex tomado y soltado, el worker que se estaba por dormir ya ve m_queued
+        {
+            { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+            m_wake.notify_one();
+        }
+    }
 
-// Creamos buffers de geometría adicionales para probar una esfera
-ComPtr<ID3D12Resource> g_sphereVB;
-ComPtr<ID3D12Resource> g_sphereIB;
-D3D12_VERTEX_BUFFER_VIEW g_sphereVBView = {};
-D3D12_INDEX_BUFFER_VIEW  g_sphereIBView = {};
-UINT g_sphereIndexCount = 0;
+    // Con 'only' solo toma jobs de ese dueño (recorre la cola: en la 0 hay a lo sumo unos pocos productores externos).
+    bool TryRunOne(UINT slot, uint32_t& rng, const void* only = nullptr)
+    {
+        Job job;
+        auto take = [&job, only](Queue& q, bool newest)
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            for (size_t i = 0, n = q.jobs.size(); i < n; ++i)
+            {
+                const size_t at = newest ? n - 1 - i : i;
+                if (only && q.jobs[at].owner != only) continue;
+                job = std::move(q.jobs[at]);
+                q.jobs.erase(q.jobs.begin() + at);
+                return true;
+            }
+            return false;
+        };
 
-// Creamos buffers de geometría adicionales para probar un modelo
-ComPtr<ID3D12Resource> g_modelVB;
-ComPtr<ID3D12Resource> g_modelIB;
-D3D12_VERTEX_BUFFER_VIEW g_modelVBView = {};
-D3D12_INDEX_BUFFER_VIEW  g_modelIBView = {};
-UINT g_modelIndexCount = 0;
+        bool found = take(m_queues[slot], true);
+        const UINT count = (UINT)m_queues.size();
+        rng = rng * 1664525u + 1013904223u;
+        for (UINT i = 0, start = (rng >> 8) % count; !found && i < count; ++i)
+        {
+            const UINT victim = (start + i) % count;
+            if (victim == slot || !take(m_queues[victim], false)) continue;
+            found = true;
+            ++m_steals;
+        }
+        if (!found) return false;
+
+        m_queued.fetch_sub(1);
+        const void* outerOwner = t_jobOwner; // un Wait anidado corre un job dentro de otro
+        t_jobOwner = job.owner;
+        job.fn();
+        t_jobOwner = outerOwner;
+        ++m_executed;
+        Complete(job.counter, slot);
+        return true;
+    }
 
-// Selector de geometría: 0=Cubo, 1=Esfera
-static int g_geomMode = 0;
+    void Complete(JobCounter* counter, UINT slot)
+    {
+        if (!counter) return;
+        std::vector<JobCounter::Continuation> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter->mutex);
+            if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) ready.swap(counter->continuations);
+        }
+        for (auto& r : ready) Push(slot, Job{ std::move(r.fn), r.counter, r.owner }); // su contador ya se subió en RunAfter
+    }
 
-// Manipular fuente de luz
-static bool  g_lightPinnedFront = false; // luz fija frente a cámara
-static float g_lightFrontDist = 1.2f;  // distancia desde la cámara al origen
+    void WorkerMain(UINT slot)
+    {
+        t_jobSystem = this;
+        t_jobSlot = slot;
+        uint32_t rng = slot * 2654435761u + 1;
+        while (!m_stop)
+        {
+            if (TryRunOne(slot, rng)) continue;
 
-//--------------------------------------------------------------------------------------
-// Helpers
-//--------------------------------------------------------------------------------------
-void WaitForGPU()
-{
-    //Bloquea la CPU hasta que la GPU termine todo lo que tiene pendiente en la command queue.
-    const UINT64 fenceToWait = ++g_fenceValue;
-    ThrowIfFailed(g_cmdQueue->Signal(g_fence.Get(), fenceToWait)); //Cuando se haya ejecutado todo lo que hay antes de este punto, marcar la fence con el valor
+            bool found = false; // un rato de spin antes de dormir: entre frames llegan ráfagas de jobs
+            for (int spin = 0; spin < 64 && !found && !m_stop; ++spin)
+            {
+                std::this_thread::yield();
+                found = TryRunOne(slot, rng);
+            }
+            if (found) continue;
 
-    if (g_fence->GetCompletedValue() < fenceToWait) { // La GPU ya alcanzó o pasó este valor de fence
-        ThrowIfFailed(g_fence->SetEventOnCompletion(fenceToWait, g_fenceEvent)); //Registra un evento de Win32 que se disparará cuando la fence llegue a ese valor
-        WaitForSingleObject(g_fenceEvent, INFINITE); //Bloquea el hilo actual (CPU) hasta que la GPU termine y la fence dispare el evento
+            ++m_sleeping;
+            {
+                std::unique_lock<std::mutex> lock(m_sleepMutex);
+                m_wake.wait(lock, [this]() { return m_queued.load() > 0 || m_stop; });
+            }
+            --m_sleeping;
+        }
     }
-}
 
-void Transition(ID3D12GraphicsCommandList* cl, ID3D12Resource* res,
-    D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after)
+    std::vector<Queue>       m_queues;  // 0: hilos externos; 1..: workers
+    std::vector<std::thread> m_workers;
+    std::mutex               m_sleepMutex;
+    std::condition_variable  m_wake;
+    std::atomic<int>         m_queued{ 0 };   // jobs en las colas (para dormir y despertar workers)
+    std::atomic<int>         m_sleeping{ 0 };
+    std::atomic<bool>        m_stop{ false };
+    std::atomic<uint64_t>    m_executed{ 0 };
+    std::atomic<uint64_t>    m_steals{ 0 };
+};
+
+// Sistema del proceso: uno por núcleo, creado la primera vez que se usa. El benchmark de escalado lo reemplaza un rato
+// por uno con menos hilos (g_jobSystemOverride) para medir el mismo código con 1..N núcleos.
+static JobSystem* g_jobSystemOverride = nullptr;
+
+JobSystem& Jobs()
 {
-    // En DX12 cada recurso tiene un “estado de uso”(READ, WRITE, PRESENT, etc.).
-    // Esta función mete una barrera de transición para cambiar correctamente de un estado a otro
-    
-    D3D12_RESOURCE_BARRIER b = {};
-    b.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    b.Transition.pResource = res;
-    b.Transition.StateBefore = before;
-    b.Transition.StateAfter = after;
-    b.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-    cl->ResourceBarrier(1, &b);
+    static JobSystem jobs;
+    return g_jobSystemOverride ? *g_jobSystemOverride : jobs;
 }
 
-DXGI_FORMAT ChooseBackbufferFormat() { return DXGI_FORMAT_R8G8B8A8_UNORM; } //8 bits por canal(RGB) + alpha. Color “normalizado”[0..1].
-DXGI_FORMAT ChooseDepthFormat() { return DXGI_FORMAT_D32_FLOAT; } //32 bits en float para profundidad.
+// Reparte [0, count) en bloques contiguos de al menos minPerThread elementos, hasta 4 por hilo para que el robo
+// balancee bloques desparejos. El hilo que llama hace el primero y ayuda con el resto. Con poco trabajo corre todo
+// en el hilo actual.
+template <class Fn>
+void ParallelFor(JobSystem& jobs, UINT count, UINT minPerThread, Fn&& fn)
+{
+    const UINT blocks = (std::min)(jobs.ThreadCount() * 4, count / (std::max)(1u, minPerThread));
+    if (blocks <= 1) { if (count) fn(0u, count); return; }
+
+    auto begin = [count, blocks](UINT b) { return (UINT)((uint64_t)count * b / blocks); };
+    JobCounter done;
+    for (UINT b = 1; b < blocks; ++b)
+        jobs.Run([&fn, &begin, b]() { fn(begin(b), begin(b + 1)); }, &done);
+    fn(0u, begin(1));
+    jobs.Wait(done);
+}
 
-void UpdateWindowTitle() //Just set title of window with current values
+template <class Fn>
+void ParallelFor(UINT count, UINT minPerThread, Fn&& fn)
 {
-    wchar_t buffer[256];
-    swprintf_s(buffer, L"DX12 PBR  |  Mode: %d  |  metallic=%.2f  roughness=%.2f  ao=%.2f",
-        g_mode, g_metallic, g_roughness, g_ao); 
-    SetWindowText(g_hWnd, buffer);
+    ParallelFor(Jobs(), count, minPerThread, std::forward<Fn>(fn));
 }
 
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
-// Fin: Includes, configuración global y tipos(Vertex, CBData, globals DX12, helpers)
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
+// Chequeo del job system sin ventana ni GPU (-job-selftest), con 1, 2, N y 2N hilos (sobresuscrito): ParallelFor
+// cubre cada índice una sola vez; miles de jobs chicos encolados por un solo hilo (el resto roba todo) y por varios
+// hilos externos a la vez corren exactamente una vez; un árbol de jobs que esperan a sus hijos (Wait anidado) termina;
+// las dependencias (diamante y cadena con RunAfter) respetan el orden aunque se registren mientras la dependencia
+// ya está corriendo; y el Wait de un hilo externo nunca corre los jobs largos que encoló otro hilo externo (el render
+// thread no se come un compile del rebuild). Devuelve el exit code del proceso.
+int RunJobSystemSelfTest()
+{
+    bool ok = true;
+    char buf[256];
+    auto report = [&](UINT threads, const char* step, bool pass)
+    {
+        sprintf_s(buf, "Job system [%2u threads] %-16s %s\n", threads, step, pass ? "OK" : "FAIL");
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
 
-//--------------------------------------------------------------------------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------------------------------------------------------------------------
+    const UINT hw = (std::max)(1u, std::thread::hardware_concurrency());
+    std::vector<UINT> threadCounts = { 1u, 2u, hw, 2 * hw };
+    std::sort(threadCounts.begin(), threadCounts.end());
+    threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+    for (UINT threads : threadCounts)
+    {
+        JobSystem jobs(threads);
 
+        // 1) ParallelFor: cada índice exactamente una vez, con conteos y granularidades que no dividen parejo
+        {
+            bool pass = true;
+            for (UINT count : { 0u, 1u, 7u, 1000u, 100003u })
+                for (UINT minPer : { 1u, 64u })
+                {
+                    std::vector<std::atomic<uint32_t>> hits(count);
+                    ParallelFor(jobs, count, minPer, [&](UINT begin, UINT end) { for (UINT i = begin; i < end; ++i) hits[i]++; });
+                    for (auto& h : hits) pass = pass && h == 1;
+                }
+            report(threads, "parallel-for", pass);
+        }
 
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
-// Inicio: Plataforma y DX12 core
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
+        // 2) Contención de robo: un job encola la mitad en la cola de su hilo y no la atiende hasta que alguien le robe
+        //    (con 2+ hilos el robo está garantizado); la otra mitad la encola el hilo externo mientras tanto
+        {
+            const UINT n = 20000;
+            std::vector<std::atomic<uint32_t>> hits(n);
+            std::atomic<uint32_t> firstHalf{ 0 };
+            const uint64_t stealsBefore = jobs.Steals();
+            JobCounter done;
+            jobs.Run([&]()
+            {
+                for (UINT i = 0; i < n / 2; ++i) jobs.Run([&hits, &firstHalf, i]() { hits[i]++; firstHalf++; }, &done);
+                while (threads > 1 && firstHalf == 0) std::this_thread::yield();
+            }, &done);
+            for (UINT i = n / 2; i < n; ++i) jobs.Run([&hits, i]() { hits[i]++; }, &done);
+            jobs.Wait(done);
+            bool pass = true;
+            for (auto& h : hits) pass = pass && h == 1;
+            report(threads, "steal", pass && (threads == 1 || jobs.Steals() > stealsBefore));
+        }
 
-//--------------------------------------------------------------------------------------
-// Events / Windowing
-//--------------------------------------------------------------------------------------
+        // 3) Varios hilos externos encolan y esperan a la vez (comparten la cola 0)
+        {
+            std::atomic<uint64_t> sum{ 0 };
+            std::vector<std::thread> producers;
+            for (UINT p = 0; p < 4; ++p)
+                producers.emplace_back([&jobs, &sum]()
+                {
+                    JobCounter done;
+                    for (UINT i = 1; i <= 5000; ++i) jobs.Run([&sum, i]() { sum += i; }, &done);
+                    jobs.Wait(done);
+                });
+            for (auto& p : producers) p.join();
+            report(threads, "external", sum == 4ull * 5000 * 5001 / 2);
+        }
 
-LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) // Handle Window callbacks
-{
-    switch (msg)
-    {
-        case WM_DESTROY: PostQuitMessage(0); return 0; // Post WM_QUIT para finalizar end loop
-        case WM_KEYDOWN: //Manejar inputs de usuario.
+        // 4) Árbol binario de profundidad 14: cada job lanza dos hijos y los espera (Wait dentro de un job)
         {
-            if (wParam == 'T') {
-                g_mode = (g_mode + 1) % 6; // 0..5
-                UpdateWindowTitle();
-            }
-            else if (wParam == 'M') {
-                g_metallicIdx = (g_metallicIdx + 1) % (int)(sizeof(g_metallicPresets) / sizeof(float));
-                g_metallic = g_metallicPresets[g_metallicIdx];
-                UpdateWindowTitle();
-            }
-            else if (wParam == 'R') {
-                g_roughnessIdx = (g_roughnessIdx + 1) % (int)(sizeof(g_roughnessPresets) / sizeof(float));
-                g_roughness = g_roughnessPresets[g_roughnessIdx];
-                UpdateWindowTitle();
-            }
-            else if (wParam == 'A') {
-                g_aoIdx = (g_aoIdx + 1) % (int)(sizeof(g_aoPresets) / sizeof(float));
-                g_ao = g_aoPresets[g_aoIdx];
-                UpdateWindowTitle();
-            }
-            else if (wParam == 'P') {       // Pause/Resume cube rotation
-                g_pauseRotation = !g_pauseRotation;
-                UpdateWindowTitle();
-            }
-            else if (wParam == 'G') { // alternar geometría
-                g_geomMode = (g_geomMode + 1) % 3; // 0..2
-                UpdateWindowTitle();
-            }
-            else if (wParam == 'F') { // F = fijar/liberar luz frente a cámara
-                g_lightPinnedFront = !g_lightPinnedFront;
-                UpdateWindowTitle();
+            std::atomic<uint32_t> leaves{ 0 };
+            std::function<void(int)> node = [&](int depth)
+            {
+                if (depth == 0) { ++leaves; return; }
+                JobCounter children;
+                jobs.Run([&node, depth]() { node(depth - 1); }, &children);
+                jobs.Run([&node, depth]() { node(depth - 1); }, &children);
+                jobs.Wait(children);
+            };
+            node(14);
+            report(threads, "nested wait", leaves == (1u << 14));
+        }
+
+        // 5) Dependencias: diamante A → (B, C) → D mil veces (registrado mientras A corre) y una cadena de 1000 jobs
+        {
+            bool pass = true;
+            for (int iter = 0; iter < 1000 && pass; ++iter)
+            {
+                std::atomic<int> clock{ 0 };
+                int a = -1, b = -1, c = -1, d = -1;
+                JobCounter ca, cbc, cd;
+                jobs.Run([&]() { a = clock++; }, &ca);
+                jobs.RunAfter(ca, [&]() { b = clock++; }, &cbc);
+                jobs.RunAfter(ca, [&]() { c = clock++; }, &cbc);
+                jobs.RunAfter(cbc, [&]() { d = clock++; }, &cd);
+                jobs.Wait(cd);
+                pass = a == 0 && b > a && c > a && d == 3;
             }
-            return 0;
+
+            const UINT chain = 1000;
+            std::vector<JobCounter> links(chain);
+            std::vector<int> order;
+            jobs.Run([&order]() { order.push_back(0); }, &links[0]);
+            for (UINT i = 1; i < chain; ++i) jobs.RunAfter(links[i - 1], [&order, i]() { order.push_back((int)i); }, &links[i]);
+            jobs.Wait(links[chain - 1]);
+            for (UINT i = 0; i < chain && pass; ++i) pass = order.size() == chain && order[i] == (int)i;
+            report(threads, "dependencies", pass);
         }
-    }
 
-    return DefWindowProc(hWnd, msg, wParam, lParam); //Deja que windows maneje el mensaje
+        // 6) Jobs ajenos: el hilo principal encola uno suyo, otro hilo externo (el "loader") encola jobs largos detrás en
+        //    la misma cola y recién entonces el principal espera. Con LIFO sin dueño su Wait tomaría primero los del loader.
+        {
+            const std::thread::id mainThread = std::this_thread::get_id();
+            std::atomic<uint32_t> foreignOnMain{ 0 }, foreignRan{ 0 }, mineRan{ 0 };
+            std::atomic<bool> queued{ false };
+            JobCounter mine;
+            jobs.Run([&mineRan]() { ++mineRan; }, &mine);
+            std::thread loader([&]()
+            {
+                JobCounter slow;
+                for (int i = 0; i < 4; ++i)
+                    jobs.Run([&, mainThread]()
+                    {
+                        if (std::this_thread::get_id() == mainThread) ++foreignOnMain;
+                        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                        ++foreignRan;
+                    }, &slow);
+                queued = true;
+                jobs.Wait(slow);
+            });
+            while (!queued) std::this_thread::yield();
+            jobs.Wait(mine);
+            std::atomic<uint32_t> hits{ 0 }; // y un ParallelFor del principal mientras el loader sigue con lo suyo
+            ParallelFor(jobs, 64, 1, [&hits](UINT begin, UINT end) { hits += end - begin; });
+            const bool mainDone = foreignOnMain == 0 && mineRan == 1 && hits == 64;
+            loader.join();
+            report(threads, "foreign jobs", mainDone && foreignRan == 4);
+        }
+
+        sprintf_s(buf, "Job system [%2u threads] %llu jobs executed, %llu stolen\n", threads,
+            (unsigned long long)jobs.Executed(), (unsigned long long)jobs.Steals());
+        OutputDebugStringA(buf);
+    }
+    return ok ? 0 : 1;
 }
 
-void CreateAppWindow(HINSTANCE hInst)
+//--------------------------------------------------------------------------------------
+// Frames in flight (sincronización CPU/GPU)
+//--------------------------------------------------------------------------------------
+
+// Interfaz mínima "cola + fence". El scheduler de frames solo habla con esto, así que se puede
+// ejercitar sin device (SimulatedQueueFence) y usar la misma lógica con la cola real de DX12.
+struct IQueueFence
 {
-    //Obtenemos un handler a una nueva ventana de windows en g_hWnd con una Width y un Height determinados
+    virtual ~IQueueFence() = default;
+    virtual UINT64 Signal() = 0;                   // Encola un Signal con el próximo valor y lo devuelve.
+    virtual UINT64 GetCompletedValue() = 0;        // Último valor que la GPU ya completó.
+    virtual void   WaitForValue(UINT64 value) = 0; // Bloquea la CPU hasta que la fence llegue a value.
+};
 
-    WNDCLASS wc = {}; //Creamos tipo WNDCLASS
-    wc.lpfnWndProc = WndProc; // Funcion handler de eventos
-    wc.hInstance = hInst; // Handler a instancia
-    wc.lpszClassName = L"DX12CubeWndClass"; // Nombre de clase a crear
-    wc.hCursor = LoadCursor(nullptr, IDC_ARROW);
+// Implementación real: command queue + ID3D12Fence + evento Win32.
+class D3D12QueueFence : public IQueueFence
+{
+public:
+    void Init(ID3D12Device* device, ID3D12CommandQueue* queue)
+    {
+        m_queue = queue;
+        ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence)));
+        m_value = 0;
+        m_event = CreateEvent(nullptr, FALSE, FALSE, nullptr); //evento de Win32 asociado a la fence
+    }
+
+    void Shutdown()
+    {
+        if (m_event) { CloseHandle(m_event); m_event = nullptr; }
+    }
+
+    UINT64 Signal() override
+    {
+        const UINT64 v = ++m_value;
+        ThrowIfFailed(m_queue->Signal(m_fence.Get(), v)); // Cuando la GPU llegue a este punto de la cola, la fence pasa a v
+        return v;
+    }
+
+    UINT64 GetCompletedValue() override { return m_fence->GetCompletedValue(); }
+
+    void WaitForValue(UINT64 value) override
+    {
+        if (m_fence->GetCompletedValue() < value) {
+            ThrowIfFailed(m_fence->SetEventOnCompletion(value, m_event)); // El evento se dispara cuando la fence llegue a value
+            WaitForSingleObject(m_event, INFINITE);
+        }
+    }
+
+    ID3D12Fence* Fence() const { return m_fence.Get(); }
+
+private:
+    ID3D12CommandQueue*  m_queue = nullptr;
+    ComPtr<ID3D12Fence>  m_fence;
+    UINT64               m_value = 0;      // Último valor encolado con Signal
+    HANDLE               m_event = nullptr;
+};
+
+// Fence simulada para correr el scheduler sin GPU: cada Signal se "completa" delayTicks
+// ticks después de encolarse. Con inOrder la cola ejecuta un frame detrás de otro, como una GPU saturada: el
+// Signal se completa delayTicks después de encolarse o de completarse el anterior, lo que pase más tarde.
+// El reloj avanza con Advance() o saltando hasta el valor pedido en WaitForValue().
+// OnComplete (opcional) se llama con cada valor en el momento en que se completa: ahí "ejecuta" la cola simulada.
+class SimulatedQueueFence : public IQueueFence
+{
+public:
+    explicit SimulatedQueueFence(UINT64 delayTicks = 1, bool inOrder = false) : m_delay(delayTicks), m_inOrder(inOrder) {}
+
+    UINT64 Signal() override
+    {
+        m_lastDoneAt = (m_inOrder ? (std::max)(m_now, m_lastDoneAt) : m_now) + m_delay;
+        m_pending.push_back({ ++m_value, m_lastDoneAt });
+        return m_value;
+    }
+
+    UINT64 GetCompletedValue() override
+    {
+        while (!m_pending.empty() && m_pending.front().doneAt <= m_now) {
+            m_completed = m_pending.front().value;
+            m_pending.erase(m_pending.begin());
+            if (m_onComplete) m_onComplete(m_completed);
+        }
+        return m_completed;
+    }
+
+    void WaitForValue(UINT64 value) override
+    {
+        while (GetCompletedValue() < value && !m_pending.empty()) {
+            m_waitedTicks += m_pending.front().doneAt - m_now;
+            m_now = m_pending.front().doneAt;
+        }
+    }
+
+    void   Advance(UINT64 ticks) { m_now += ticks; }
+    UINT64 Now() const { return m_now; }
+    UINT64 WaitedTicks() const { return m_waitedTicks; } // Tiempo total que la CPU estuvo bloqueada
+    void   OnComplete(std::function<void(UINT64)> fn) { m_onComplete = std::move(fn); }
+
+private:
+    struct Pending { UINT64 value; UINT64 doneAt; };
+    std::function<void(UINT64)> m_onComplete;
+    UINT64 m_delay;
+    bool   m_inOrder;
+    UINT64 m_lastDoneAt = 0;
+    UINT64 m_now = 0;
+    UINT64 m_value = 0;
+    UINT64 m_completed = 0;
+    UINT64 m_waitedTicks = 0;
+    std::vector<Pending> m_pending;
+};
+
+// N frames en vuelo: cada slot (uno por backbuffer) recuerda el valor de fence de su último submit.
+// Antes de reutilizar un slot se espera SOLO si la GPU todavía no terminó el frame que lo usó,
+// así la CPU puede grabar el frame N+1 mientras la GPU ejecuta el N.
+template <UINT SlotCount>
+class FrameScheduler
+{
+public:
+    void Init(IQueueFence* queueFence)
+    {
+        m_qf = queueFence;
+        for (UINT i = 0; i < SlotCount; ++i) m_slotFence[i] = 0;
+        m_waits = 0;
+    }
+
+    // Llamar después de hacer ExecuteCommandLists del frame que usa 'slot'.
+    void EndFrame(UINT slot) { m_slotFence[slot] = m_qf->Signal(); }
+
+    // Llamar antes de grabar sobre 'slot'. Devuelve true si tuvo que esperar a la GPU.
+    bool BeginFrame(UINT slot)
+    {
+        if (m_qf->GetCompletedValue() >= m_slotFence[slot]) return false;
+        m_qf->WaitForValue(m_slotFence[slot]);
+        ++m_waits;
+        return true;
+    }
+
+    // Espera a que la GPU termine absolutamente todo (shutdown, recrear recursos, etc.).
+    void WaitIdle() { m_qf->WaitForValue(m_qf->Signal()); }
+
+    UINT64 SlotFenceValue(UINT slot) const { return m_slotFence[slot]; }
+    UINT64 WaitCount() const { return m_waits; }
+
+private:
+    IQueueFence* m_qf = nullptr;
+    UINT64       m_slotFence[SlotCount] = {};
+    UINT64       m_waits = 0;
+};
+
+// Corre 'frames' frames de BeginFrame/EndFrame sobre SlotCount slots contra 'fence', con 1 tick de CPU por frame
+// (entre BeginFrame y el Signal de EndFrame). Devuelve false si el scheduler esperó sin que hiciera falta, no esperó
+// con el frame anterior del slot en vuelo o dejó en un slot otro valor de fence que el de su último frame.
+template <UINT SlotCount>
+bool TraceFrameScheduler(SimulatedQueueFence& fence, UINT frames, UINT64& waits)
+{
+    FrameScheduler<SlotCount> scheduler;
+    scheduler.Init(&fence);
+    bool pass = true;
+    for (UINT f = 0; f < frames; ++f)
+    {
+        const UINT slot = f % SlotCount;
+        const UINT64 previous = f >= SlotCount ? f - SlotCount + 1 : 0; // Signal del frame que usó el slot antes (uno por frame)
+        pass = pass && scheduler.SlotFenceValue(slot) == previous;
+        const bool busy = fence.GetCompletedValue() < previous;
+        pass = pass && scheduler.BeginFrame(slot) == busy && fence.GetCompletedValue() >= previous;
+        fence.Advance(1);
+        scheduler.EndFrame(slot);
+        pass = pass && scheduler.SlotFenceValue(slot) == f + 1;
+    }
+    waits = scheduler.WaitCount();
+    return pass;
+}
+
+// Chequeo del scheduler de frames sin ventana ni GPU (-frame-scheduler-selftest), con 2 y 3 slots y varias demoras:
+// - latencia (la GPU tarda 'delay' ticks por frame pero solapa frames): con delay < slots nunca se espera; con
+//   delay >= slots se espera una vez por vuelta, en el primer slot que se reusa (los demás ya terminaron).
+// - GPU saturada (en orden) con delay >= slots: se espera en cada reuso; con delay = 1 tick (lo que tarda la CPU),
+//   nunca.
+// Devuelve el exit code del proceso.
+int RunFrameSchedulerSelfTest()
+{
+    bool ok = true;
+    char buf[192];
+    const UINT frames = 24;
+    auto check = [&](UINT slots, const char* model, UINT64 delay, bool pass, UINT64 waits, UINT64 expected)
+    {
+        pass = pass && waits == expected;
+        sprintf_s(buf, "Frame scheduler [%u slots, %s, delay %llu]: %s (%llu waits, expected %llu)\n", slots, model,
+            (unsigned long long)delay, pass ? "OK" : "FAIL", (unsigned long long)waits, (unsigned long long)expected);
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
+    auto run = [&](UINT slots, bool inOrder, UINT64 delay, UINT64& waits)
+    {
+        SimulatedQueueFence fence(delay, inOrder);
+        return slots == 2 ? TraceFrameScheduler<2>(fence, frames, waits) : TraceFrameScheduler<3>(fence, frames, waits);
+    };
+
+    for (UINT slots : { 2u, 3u })
+    {
+        for (UINT64 delay : { 0ull, (UINT64)slots - 1, (UINT64)slots, (UINT64)slots + 1, 4ull * slots })
+        {
+            UINT64 waits = 0;
+            const bool pass = run(slots, false, delay, waits);
+            check(slots, "latency", delay, pass, waits, delay < slots ? 0 : (frames - 1) / slots);
+        }
+        for (UINT64 delay : { 1ull, (UINT64)slots, 2ull * slots + 1 })
+        {
+            UINT64 waits = 0;
+            const bool pass = run(slots, true, delay, waits);
+            check(slots, "GPU-bound", delay, pass, waits, delay <= 1 ? 0 : frames - slots);
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+// Objetos reemplazados en caliente (PSOs y buffers de un hot reload) que todavía pueden estar en uso por frames en
+// vuelo: se guardan con el último valor de fence enviado y se sueltan recién cuando la GPU lo pasa. Nunca se espera.
+class DeferredReleaseQueue
+{
+public:
+    void Retire(ComPtr<IUnknown> object, UINT64 fence)
+    {
+        if (object) m_pending.push_back({ std::move(object), fence });
+    }
+
+    // Llamar una vez por frame con el valor completado de la fence.
+    void Collect(UINT64 completedFence)
+    {
+        m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(),
+            [completedFence](const Pending& p) { return p.fence <= completedFence; }), m_pending.end());
+    }
+
+    size_t PendingCount() const { return m_pending.size(); }
+
+private:
+    struct Pending { ComPtr<IUnknown> object; UINT64 fence; };
+    std::vector<Pending> m_pending;
+};
+
+//--------------------------------------------------------------------------------------
+// Upload allocator lineal por frame (constant buffers y datos dinámicos)
+//--------------------------------------------------------------------------------------
+
+// Sub-asignación dentro del buffer UPLOAD: puntero CPU para escribir + dirección GPU para bindear.
+struct UploadAllocation
+{
+    uint8_t*                  cpu = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS gpu = 0;
+    UINT64                    offset = 0; // offset desde el inicio del buffer
+    UINT64                    size = 0;
+};
+
+// Un buffer UPLOAD grande y mapeado de forma persistente, partido en una página por frame en vuelo.
+// Cada frame asigna linealmente (bump pointer) dentro de su página; la página se resetea recién
+// cuando la fence del frame que la usó por última vez ya se completó.
+// No toca el device: recibe punteros CPU/GPU base, así que funciona igual sobre memoria CPU común
+// con una dirección GPU falsa.
+class LinearUploadAllocator
+{
+public:
+    void Init(uint8_t* cpuBase, D3D12_GPU_VIRTUAL_ADDRESS gpuBase, UINT64 pageSize, UINT pageCount)
+    {
+        m_cpuBase = cpuBase;
+        m_gpuBase = gpuBase;
+        m_pageSize = pageSize;
+        m_pages.assign(pageCount, Page{});
+        m_current = 0;
+        m_highWater = 0;
+        m_overflows = 0;
+    }
+
+    // Empieza a usar la página 'page'. Solo la resetea si su último frame ya terminó en la GPU
+    // (completedFence >= fence con la que se cerró). Devuelve false si todavía está en vuelo.
+    bool BeginFrame(UINT page, UINT64 completedFence)
+    {
+        Page& p = m_pages[page];
+        if (completedFence < p.fence) return false;
+        p.offset = 0;
+        m_current = page;
+        return true;
+    }
+
+    // Cierra la página actual con el valor de fence del submit que la usa.
+    void EndFrame(UINT64 fenceValue)
+    {
+        Page& p = m_pages[m_current];
+        p.fence = fenceValue;
+        if (p.offset > p.highWater) p.highWater = p.offset;
+        if (p.offset > m_highWater) m_highWater = p.offset;
+    }
+
+    // alignment tiene que ser potencia de 2 (256 para CBVs). Si la página se llena devuelve una asignación vacía (cpu == nullptr).
+    UploadAllocation Allocate(UINT64 size, UINT64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT)
+    {
+        Page& p = m_pages[m_current];
+        const UINT64 begin = (p.offset + alignment - 1) & ~(alignment - 1);
+        if (begin + size > m_pageSize) { ++m_overflows; return {}; }
+        p.offset = begin + size;
+
+        UploadAllocation a;
+        a.offset = (UINT64)m_current * m_pageSize + begin;
+        a.cpu = m_cpuBase + a.offset;
+        a.gpu = m_gpuBase + a.offset;
+        a.size = size;
+        return a;
+    }
+
+    // Atajo para un CBData (o cualquier struct) alineado a 256.
+    template <class T>
+    T* AllocateConstants(D3D12_GPU_VIRTUAL_ADDRESS& outGpu)
+    {
+        UploadAllocation a = Allocate(sizeof(T), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+        outGpu = a.gpu;
+        return reinterpret_cast<T*>(a.cpu);
+    }
+
+    UINT64 PageSize() const { return m_pageSize; }
+    UINT64 UsedBytes() const { return m_pages[m_current].offset; }      // Bytes usados en el frame actual
+    UINT64 HighWaterMark() const { return m_highWater; }                // Máximo usado por un frame desde el inicio
+    UINT64 PageHighWaterMark(UINT page) const { return m_pages[page].highWater; }
+    UINT64 OverflowCount() const { return m_overflows; }                // Asignaciones que no entraron en la página
+
+private:
+    struct Page { UINT64 offset = 0; UINT64 fence = 0; UINT64 highWater = 0; };
+
+    uint8_t*                  m_cpuBase = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS m_gpuBase = 0;
+    UINT64                    m_pageSize = 0;
+    std::vector<Page>         m_pages;
+    UINT                      m_current = 0;
+    UINT64                    m_highWater = 0;
+    UINT64                    m_overflows = 0;
+};
+
+// Chequeo del upload allocator sin ventana ni GPU (-upload-allocator-selftest), sobre memoria CPU común con una
+// dirección GPU falsa: alineación a 256, que una página no se resetee antes de que se complete su fence (y sí después),
+// high-water por página y global, y que una asignación que no entra devuelva null y sume en OverflowCount sin mover
+// la página. Devuelve el exit code del proceso.
+int RunUploadAllocatorSelfTest()
+{
+    struct Constants { float data[40]; }; // 160 bytes, como un CB chico
+    bool ok = true;
+    char buf[256];
+    auto report = [&](const char* step, bool pass, const char* detail = "")
+    {
+        sprintf_s(buf, "Upload allocator [%s]: %s%s\n", step, pass ? "OK" : "FAIL", detail);
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
+
+    const UINT64 pageSize = 4096;
+    const D3D12_GPU_VIRTUAL_ADDRESS gpuBase = 0x100000000ull; // alineada como la de un recurso real (64 KB)
+    std::vector<uint8_t> memory((size_t)pageSize * 2);
+    LinearUploadAllocator alloc;
+    alloc.Init(memory.data(), gpuBase, pageSize, 2);
+
+    // 1) Alineación: tamaños impares con la alineación por defecto (CBV) y AllocateConstants; CPU y GPU con el mismo
+    //    offset, dentro de la página y sin pisarse
+    {
+        bool pass = alloc.BeginFrame(0, 0);
+        UINT64 prevEnd = 0;
+        for (UINT64 size : { 1ull, 17ull, 255ull, 256ull, 300ull, 4ull })
+        {
+            const UploadAllocation a = alloc.Allocate(size);
+            pass = pass && a.cpu && a.gpu % 256 == 0 && (UINT64)(a.cpu - memory.data()) == a.gpu - gpuBase &&
+                a.offset >= prevEnd && a.offset + size <= pageSize && a.size == size;
+            prevEnd = a.offset + size;
+        }
+        D3D12_GPU_VIRTUAL_ADDRESS cbAddr = 0;
+        Constants* cb = alloc.AllocateConstants<Constants>(cbAddr);
+        pass = pass && cb && cbAddr % 256 == 0 && reinterpret_cast<uint8_t*>(cb) - memory.data() == (ptrdiff_t)(cbAddr - gpuBase);
+        const UploadAllocation small = alloc.Allocate(3, 4); // alineación chica pedida explícitamente
+        pass = pass && small.cpu && small.offset % 4 == 0 && small.offset >= cbAddr - gpuBase + sizeof(Constants);
+        char detail[96];
+        sprintf_s(detail, " (%llu bytes used)", (unsigned long long)alloc.UsedBytes());
+        report("256-byte alignment", pass, detail);
+    }
+
+    // 2) Fences: la página 0 se cierra con la fence 5; con 4 completada no se resetea (lo que sigue no cae sobre sus
+    //    datos), con 5 sí y vuelve a empezar en el offset 0
+    {
+        alloc.Init(memory.data(), gpuBase, pageSize, 2);
+        alloc.BeginFrame(0, 0);
+        UploadAllocation inFlight = alloc.Allocate(768);
+        memset(inFlight.cpu, 0xAB, 768);
+        alloc.EndFrame(5);
+
+        bool pass = alloc.BeginFrame(1, 0); // página 1 nunca usada
+        alloc.Allocate(256);
+        alloc.EndFrame(6);
+
+        const bool refused = !alloc.BeginFrame(0, 4);
+        const UploadAllocation after = alloc.Allocate(256); // sigue en la página actual (la 1), no en la 0
+        const bool untouched = after.cpu && after.offset >= pageSize &&
+            std::all_of(memory.begin(), memory.begin() + 768, [](uint8_t b) { return b == 0xAB; });
+        const bool reset = alloc.BeginFrame(0, 5) && alloc.UsedBytes() == 0 && alloc.Allocate(256).offset == 0;
+        pass = pass && refused && untouched && reset;
+        report("reset only after fence", pass, refused ? (untouched ? (reset ? "" : " (not reset after the fence)") : " (in-flight data reused)") : " (reset before the fence)");
+    }
+
+    // 3) High-water: página 0 con 768 y después 256 bytes, página 1 con 2148
+    {
+        alloc.Init(memory.data(), gpuBase, pageSize, 2);
+        alloc.BeginFrame(0, 0);
+        for (int i = 0; i < 3; ++i) alloc.Allocate(256);
+        alloc.EndFrame(1);
+        alloc.BeginFrame(1, 0);
+        alloc.Allocate(2048);
+        alloc.Allocate(100);
+        alloc.EndFrame(2);
+        alloc.BeginFrame(0, 1);
+        alloc.Allocate(256);
+        alloc.EndFrame(3);
+        char detail[128];
+        sprintf_s(detail, " (page 0 %llu, page 1 %llu, global %llu)", (unsigned long long)alloc.PageHighWaterMark(0),
+            (unsigned long long)alloc.PageHighWaterMark(1), (unsigned long long)alloc.HighWaterMark());
+        report("high-water marks", alloc.PageHighWaterMark(0) == 768 && alloc.PageHighWaterMark(1) == 2148 && alloc.HighWaterMark() == 2148, detail);
+    }
+
+    // 4) Overflow: lo que no entra devuelve null, suma uno y no mueve la página; lo que entra justo sigue funcionando
+    {
+        alloc.Init(memory.data(), gpuBase, pageSize, 2);
+        alloc.BeginFrame(0, 0);
+        bool pass = alloc.Allocate(4000).cpu != nullptr;
+        pass = pass && alloc.Allocate(256).cpu == nullptr && alloc.OverflowCount() == 1 && alloc.UsedBytes() == 4000;
+        pass = pass && alloc.Allocate(96, 4).cpu != nullptr && alloc.UsedBytes() == pageSize; // llena la página exacto
+        D3D12_GPU_VIRTUAL_ADDRESS cbAddr = 1;
+        pass = pass && alloc.AllocateConstants<Constants>(cbAddr) == nullptr && cbAddr == 0 && alloc.OverflowCount() == 2;
+        pass = pass && alloc.Allocate(pageSize + 1).cpu == nullptr && alloc.OverflowCount() == 3;
+        alloc.EndFrame(1);
+        pass = pass && alloc.HighWaterMark() == pageSize;
+        char detail[64];
+        sprintf_s(detail, " (%llu overflows)", (unsigned long long)alloc.OverflowCount());
+        report("overflow", pass, detail);
+    }
+    return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Subidas a memoria DEFAULT: ring de staging + lotes en la cola de copia
+//--------------------------------------------------------------------------------------
+
+// Una copia de un lote: 'size' bytes del ring (srcOffset) a 'dst' (dstOffset). El destino lo interpreta el submitter:
+// un ID3D12Resource* en la app, cualquier puntero en el test.
+struct StagedCopy
+{
+    void*  dst = nullptr;
+    UINT64 dstOffset = 0;
+    UINT64 srcOffset = 0;
+    UINT64 size = 0;
+};
+
+// Lado GPU de un lote: grabar las copias y mandarlas a la cola de copia. El Signal con 'fenceValue' lo hace después
+// CopyUploadBatcher sobre la IQueueFence de esa misma cola.
+struct ICopySubmitter
+{
+    virtual ~ICopySubmitter() = default;
+    virtual void Submit(const StagedCopy* copies, size_t count, UINT64 fenceValue) = 0;
+};
+
+// Ring sobre el buffer UPLOAD de staging. Se asigna en orden; lo asignado desde el último Close queda atado a la fence
+// de ese lote y vuelve al ring cuando Retire ve esa fence completada. Un bloque nunca se parte en el borde: el resto
+// hasta el final se pierde hasta que se retire su lote. Como LinearUploadAllocator, no toca el device.
+class StagingRing
+{
+public:
+    static const UINT64 Invalid = ~0ull;
+
+    void Init(UINT64 capacity) { m_capacity = capacity; m_head = m_used = m_open = m_peak = 0; m_closed.clear(); }
+
+    // alignment potencia de 2. Invalid si no hay lugar contiguo hasta que se retire algún lote.
+    UINT64 Allocate(UINT64 size, UINT64 alignment)
+    {
+        if (size == 0 || size > m_capacity) return Invalid;
+        if (m_used == 0) m_head = 0; // vacío: arranca desde el principio y entra cualquier tamaño <= capacity
+
+        UINT64 begin = (m_head + alignment - 1) & ~(alignment - 1);
+        if (begin + size > m_capacity) begin = 0; // no entra antes del final: salta al principio
+        const UINT64 consumed = (begin >= m_head ? begin - m_head : m_capacity - m_head) + size;
+        if (m_used + consumed > m_capacity) return Invalid;
+
+        m_head = begin + size;
+        m_used += consumed;
+        m_open += consumed;
+        m_peak = (std::max)(m_peak, m_used);
+        return begin;
+    }
+
+    // Lo asignado desde el último Close pertenece al lote que se completa con 'fence'.
+    void Close(UINT64 fence)
+    {
+        if (m_open) m_closed.push_back({ fence, m_open });
+        m_open = 0;
+    }
+
+    void Retire(UINT64 completedFence)
+    {
+        while (!m_closed.empty() && m_closed.front().fence <= completedFence)
+        {
+            m_used -= m_closed.front().bytes;
+            m_closed.pop_front();
+        }
+    }
+
+    // Fence del lote más viejo que todavía ocupa el ring (0 si no hay ninguno cerrado).
+    UINT64 OldestFence() const { return m_closed.empty() ? 0 : m_closed.front().fence; }
+    UINT64 Capacity() const { return m_capacity; }
+    UINT64 UsedBytes() const { return m_used; }
+    UINT64 PeakBytes() const { return m_peak; }
+
+private:
+    struct Closed { UINT64 fence; UINT64 bytes; };
+    UINT64 m_capacity = 0;
+    UINT64 m_head = 0;
+    UINT64 m_used = 0;  // asignado y todavía no retirado (incluye lo perdido al saltar al principio)
+    UINT64 m_open = 0;  // parte de m_used del lote que se está armando
+    UINT64 m_peak = 0;
+    std::deque<Closed> m_closed;
+};
+
+// Subidas a buffers DEFAULT: Upload copia los datos al ring y anota la copia en el lote actual; Flush manda el lote
+// entero (una command list, un Signal) a la cola de copia. Las subidas grandes se parten en bloques de MaxChunk para
+// que pasen por el ring aunque no entren enteras: si no hay lugar se manda el lote y se espera al más viejo.
+// Cada subida devuelve el valor de fence que la completa (el del próximo Flush). Solo esta clase hace Signal en la
+// fence de la cola de copia, así que ese valor se conoce de antemano. Para subidas de varios ring (el modelo) está
+// Enqueue + Pump: nunca esperan, pasan a lo sumo un presupuesto por llamada y el resto queda para el próximo frame.
+class CopyUploadBatcher
+{
+public:
+    void Init(uint8_t* stagingCpu, UINT64 capacity, IQueueFence* copyFence, ICopySubmitter* submitter)
+    {
+        m_cpu = stagingCpu;
+        m_ring.Init(capacity);
+        m_fence = copyFence;
+        m_submitter = submitter;
+        m_maxChunk = (std::max)(capacity / 4, (UINT64)Alignment);
+        m_batch.clear();
+        m_queued.clear();
+        m_lastSubmitted = m_fence->GetCompletedValue();
+        m_batches = m_copies = m_bytes = m_stalls = 0;
+    }
+
+    UINT64 Upload(void* dst, UINT64 dstOffset, const void* src, UINT64 size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(src);
+        while (size)
+        {
+            const UINT64 chunk = (std::min)(size, m_maxChunk);
+            UINT64 at = m_ring.Allocate(chunk, Alignment);
+            while (at == StagingRing::Invalid)
+            {
+                if (!m_batch.empty()) Flush(); // lo que ocupa el ring es del lote actual: hay que mandarlo
+                else { m_fence->WaitForValue(m_ring.OldestFence()); ++m_stalls; }
+                Collect();
+                at = m_ring.Allocate(chunk, Alignment);
+            }
+            Stage(dst, dstOffset, bytes, chunk, at);
+            bytes += chunk; dstOffset += chunk; size -= chunk;
+        }
+        return m_lastSubmitted + 1;
+    }
+
+    // Como Upload pero sin copiar todavía: la subida queda en cola hasta que Pump la pase al ring. 'src' tiene que
+    // seguir vivo hasta que Pump devuelva true (o hasta DropQueued).
+    void Enqueue(void* dst, UINT64 dstOffset, const void* src, UINT64 size)
+    {
+        if (size) m_queued.push_back({ dst, dstOffset, static_cast<const uint8_t*>(src), size });
+    }
+
+    // Pasa al lote actual hasta 'budget' bytes de lo encolado, en orden y sin esperar nunca a la cola de copia: si el
+    // ring está lleno se sigue en la próxima llamada (una por frame, antes del Flush). Devuelve true cuando ya no queda
+    // nada en cola; 'fence' es entonces la que completa todo lo encolado.
+    bool Pump(UINT64 budget, UINT64& fence)
+    {
+        Collect();
+        while (!m_queued.empty() && budget)
+        {
+            QueuedUpload& q = m_queued.front();
+            const UINT64 chunk = (std::min)({ q.size, m_maxChunk, budget });
+            const UINT64 at = m_ring.Allocate(chunk, Alignment);
+            if (at == StagingRing::Invalid) break;
+            Stage(q.dst, q.dstOffset, q.src, chunk, at);
+            q.src += chunk; q.dstOffset += chunk; q.size -= chunk;
+            budget -= chunk;
+            if (q.size == 0) m_queued.pop_front();
+        }
+        fence = m_batch.empty() ? m_lastSubmitted : m_lastSubmitted + 1;
+        return m_queued.empty();
+    }
+
+    // Olvida lo encolado que Pump todavía no pasó al ring (al salir, antes de soltar los datos de origen).
+    void DropQueued() { m_queued.clear(); }
+
+    // Manda el lote actual (si hay algo) y devuelve la fence que lo completa. Una vez por frame alcanza.
+    UINT64 Flush()
+    {
+        if (m_batch.empty()) return m_lastSubmitted;
+        m_submitter->Submit(m_batch.data(), m_batch.size(), m_lastSubmitted + 1);
+        m_lastSubmitted = m_fence->Signal();
+        m_ring.Close(m_lastSubmitted);
+        ++m_batches;
+        m_copies += m_batch.size();
+        m_batch.clear();
+        return m_lastSubmitted;
+    }
+
+    // Devuelve al ring lo de los lotes que la cola de copia ya terminó.
+    void Collect() { m_ring.Retire(m_fence->GetCompletedValue()); }
+
+    // Shutdown o antes de destruir destinos: manda el lote actual y espera a la cola de copia (lo encolado con Enqueue
+    // y todavía no pasado al ring no se sube).
+    void WaitIdle()
+    {
+        m_fence->WaitForValue(Flush());
+        Collect();
+    }
+
+    bool   IsComplete(UINT64 fence) { return m_fence->GetCompletedValue() >= fence; }
+    UINT64 LastSubmitted() const { return m_lastSubmitted; }
+    size_t PendingCopies() const { return m_batch.size(); }
+    size_t QueuedUploads() const { return m_queued.size(); }
+    const StagingRing& Ring() const { return m_ring; }
+    UINT64 Batches() const { return m_batches; }
+    UINT64 Copies() const { return m_copies; }
+    UINT64 Bytes() const { return m_bytes; }
+    UINT64 Stalls() const { return m_stalls; } // veces que la CPU esperó a la cola de copia por lugar en el ring
+
+private:
+    static const UINT64 Alignment = 16; // CopyBufferRegion no pide alineación en buffers; 16 es para el memcpy
+
+    struct QueuedUpload { void* dst; UINT64 dstOffset; const uint8_t* src; UINT64 size; }; // lo que falta pasar al ring
+
+    // Copia 'size' bytes al ring (en 'at', ya asignado) y anota la copia en el lote.
+    void Stage(void* dst, UINT64 dstOffset, const uint8_t* src, UINT64 size, UINT64 at)
+    {
+        memcpy(m_cpu + at, src, (size_t)size);
+
+        StagedCopy* last = m_batch.empty() ? nullptr : &m_batch.back();
+        if (last && last->dst == dst && last->dstOffset + last->size == dstOffset && last->srcOffset + last->size == at)
+            last->size += size; // contiguo en origen y destino: una sola copia
+        else
+            m_batch.push_back({ dst, dstOffset, at, size });
+        m_bytes += size;
+    }
+
+    uint8_t*                 m_cpu = nullptr;
+    StagingRing              m_ring;
+    IQueueFence*             m_fence = nullptr;
+    ICopySubmitter*          m_submitter = nullptr;
+    UINT64                   m_maxChunk = 0;
+    std::vector<StagedCopy>  m_batch;
+    std::deque<QueuedUpload> m_queued;
+    UINT64                   m_lastSubmitted = 0;
+    UINT64                   m_batches = 0, m_copies = 0, m_bytes = 0, m_stalls = 0;
+};
+
+// Implementación real: una command list de copia por lote sobre el buffer de staging. Los allocators se reciclan
+// cuando la fence del lote que los usó ya se completó. Los destinos son buffers creados en COMMON: la cola de copia
+// los promueve a COPY_DEST y al terminar vuelven a COMMON, de donde la cola gráfica los promueve a VB/IB sin barreras.
+class D3D12CopySubmitter : public ICopySubmitter
+{
+public:
+    void Init(ID3D12Device* device, ID3D12CommandQueue* queue, IQueueFence* fence, ID3D12Resource* staging)
+    {
+        m_device = device;
+        m_queue = queue;
+        m_fence = fence;
+        m_staging = staging;
+    }
+
+    void Submit(const StagedCopy* copies, size_t count, UINT64 fenceValue) override
+    {
+        const UINT64 completed = m_fence->GetCompletedValue();
+        auto slot = std::find_if(m_allocators.begin(), m_allocators.end(), [completed](const Allocator& a) { return a.fence <= completed; });
+        if (slot == m_allocators.end())
+        {
+            m_allocators.push_back({});
+            slot = m_allocators.end() - 1;
+            ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&slot->allocator)));
+        }
+        ThrowIfFailed(slot->allocator->Reset());
+        slot->fence = fenceValue;
+
+        if (!m_list)
+            ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, slot->allocator.Get(), nullptr, IID_PPV_ARGS(&m_list)));
+        else
+            ThrowIfFailed(m_list->Reset(slot->allocator.Get(), nullptr));
+
+        for (size_t i = 0; i < count; ++i)
+            m_list->CopyBufferRegion(static_cast<ID3D12Resource*>(copies[i].dst), copies[i].dstOffset, m_staging, copies[i].srcOffset, copies[i].size);
+        ThrowIfFailed(m_list->Close());
+
+        ID3D12CommandList* lists[] = { m_list.Get() };
+        m_queue->ExecuteCommandLists(1, lists);
+    }
+
+private:
+    struct Allocator { ComPtr<ID3D12CommandAllocator> allocator; UINT64 fence = 0; };
+
+    ID3D12Device*                     m_device = nullptr;
+    ID3D12CommandQueue*               m_queue = nullptr;
+    IQueueFence*                      m_fence = nullptr;
+    ID3D12Resource*                   m_staging = nullptr;
+    std::vector<Allocator>            m_allocators;
+    ComPtr<ID3D12GraphicsCommandList> m_list;
+};
+
+// Chequeo del staging sin ventana ni GPU (-upload-selftest): CopyUploadBatcher contra una cola de copia simulada que
+// ejecuta cada lote recién cuando su fence se completa, leyendo el ring en ese momento (si el ring reusara espacio de
+// un lote en vuelo, el destino terminaría con datos ajenos). Casos: muchas subidas chicas en un lote con copias
+// fusionadas, una subida 5 veces más grande que el ring, la misma encolada y pasada de a medio ring por frame sin esperar,
+// y un fuzz contra una copia en CPU de los destinos.
+// Devuelve el exit code del proceso.
+int RunUploadSelfTest()
+{
+    bool ok = true;
+    char buf[384];
+    auto report = [&](const char* step, bool pass, const char* detail = "")
+    {
+        sprintf_s(buf, "Upload staging [%s]: %s%s\n", step, pass ? "OK" : "FAIL", detail);
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
+
+    // Cola simulada: guarda cada lote con su fence y lo ejecuta en OnComplete
+    struct SimulatedCopyQueue : ICopySubmitter
+    {
+        std::vector<uint8_t> staging;
+        std::map<UINT64, std::vector<StagedCopy>> inFlight;
+        size_t maxBatch = 0;
+
+        void Submit(const StagedCopy* copies, size_t count, UINT64 fenceValue) override
+        {
+            inFlight[fenceValue].assign(copies, copies + count);
+            maxBatch = (std::max)(maxBatch, count);
+        }
+        void Execute(UINT64 fence)
+        {
+            auto it = inFlight.find(fence);
+            if (it == inFlight.end()) return;
+            for (const StagedCopy& c : it->second)
+                memcpy(static_cast<std::vector<uint8_t>*>(c.dst)->data() + c.dstOffset, staging.data() + c.srcOffset, (size_t)c.size);
+            inFlight.erase(it);
+        }
+    };
+    auto setup = [](SimulatedQueueFence& fence, SimulatedCopyQueue& queue, CopyUploadBatcher& batcher, UINT64 capacity)
+    {
+        queue.staging.assign((size_t)capacity, 0);
+        fence.OnComplete([&queue](UINT64 v) { queue.Execute(v); });
+        batcher.Init(queue.staging.data(), capacity, &fence, &queue);
+    };
+    auto fill = [](std::vector<uint8_t>& v, uint32_t seed)
+    {
+        for (size_t i = 0; i < v.size(); ++i) { seed = seed * 1664525u + 1013904223u; v[i] = (uint8_t)(seed >> 24); }
+    };
+
+    // 1) 10 destinos × 100 subidas contiguas de 1 KB: un lote, una copia por destino, completo recién con su fence
+    {
+        SimulatedQueueFence fence(2);
+        SimulatedCopyQueue queue;
+        CopyUploadBatcher batcher;
+        setup(fence, queue, batcher, 4ull << 20);
+        std::vector<std::vector<uint8_t>> dst(10, std::vector<uint8_t>(100 * 1024)), src = dst;
+        UINT64 ticket = 0;
+        for (size_t d = 0; d < dst.size(); ++d)
+        {
+            fill(src[d], (uint32_t)d + 1);
+            for (UINT64 k = 0; k < 100; ++k) ticket = batcher.Upload(&dst[d], k * 1024, src[d].data() + k * 1024, 1024);
+        }
+        const bool ticketed = batcher.Flush() == ticket && !batcher.IsComplete(ticket) && dst[0] != src[0];
+        fence.Advance(2);
+        const bool done = batcher.IsComplete(ticket) && dst == src;
+        batcher.Collect();
+        char detail[128];
+        sprintf_s(detail, " (%llu batch, %llu copies for 1000 uploads)", (unsigned long long)batcher.Batches(), (unsigned long long)batcher.Copies());
+        report("batching", ticketed && done && batcher.Batches() == 1 && batcher.Copies() == 10 && batcher.Ring().UsedBytes() == 0, detail);
+    }
+
+    // 2) Una subida de 5× el ring: pasa en bloques, con esperas, y llega entera
+    {
+        SimulatedQueueFence fence(3);
+        SimulatedCopyQueue queue;
+        CopyUploadBatcher batcher;
+        setup(fence, queue, batcher, 1ull << 20);
+        std::vector<uint8_t> src(5ull << 20), dst(src.size());
+        fill(src, 7);
+        batcher.Upload(&dst, 0, src.data(), src.size());
+        batcher.WaitIdle();
+        char detail[128];
+        sprintf_s(detail, " (%llu batches, %llu stalls, ring peak %llu KB)", (unsigned long long)batcher.Batches(),
+            (unsigned long long)batcher.Stalls(), (unsigned long long)(batcher.Ring().PeakBytes() >> 10));
+        report("streaming", dst == src && batcher.Batches() >= 5 && batcher.Stalls() > 0 && batcher.Ring().PeakBytes() <= (1ull << 20)
+            && batcher.Ring().UsedBytes() == 0 && queue.inFlight.empty(), detail);
+    }
+
+    // 3) La misma subida con Enqueue + Pump, un Pump por frame con presupuesto de medio ring: la CPU nunca espera, ningún
+    //    frame pasa más que el presupuesto y el destino está completo recién cuando la fence del último Pump se cumple
+    {
+        SimulatedQueueFence fence(2, true);
+        SimulatedCopyQueue queue;
+        CopyUploadBatcher batcher;
+        const UINT64 capacity = 1ull << 20;
+        setup(fence, queue, batcher, capacity);
+        std::vector<uint8_t> src(5ull << 20), dst(src.size());
+        fill(src, 11);
+        batcher.Enqueue(&dst, 0, src.data(), src.size());
+
+        UINT64 ticket = 0;
+        UINT frames = 0;
+        bool bounded = true, staged = false;
+        while (!staged && frames < 100)
+        {
+            const UINT64 before = batcher.Bytes();
+            staged = batcher.Pump(capacity / 2, ticket);
+            bounded = bounded && batcher.Bytes() - before <= capacity / 2;
+            batcher.Flush();
+            ++frames;
+            if (!staged) fence.Advance(1);
+        }
+        const bool inFlight = staged && batcher.LastSubmitted() >= ticket && !batcher.IsComplete(ticket) && dst != src;
+        const bool neverWaited = batcher.Stalls() == 0 && fence.WaitedTicks() == 0;
+        fence.WaitForValue(ticket);
+        batcher.Collect();
+        char detail[128];
+        sprintf_s(detail, " (%u frames, %llu batches, %llu stalls)", frames, (unsigned long long)batcher.Batches(), (unsigned long long)batcher.Stalls());
+        report("queued", inFlight && neverWaited && bounded && frames >= 10 && batcher.IsComplete(ticket) && dst == src
+            && batcher.QueuedUploads() == 0 && batcher.Ring().UsedBytes() == 0, detail);
+    }
+
+    // 4) Fuzz: destinos, offsets y tamaños al azar (hasta 1.5 bloques), Flush y avance del reloj al azar. Las
+    //    escrituras que se pisan tienen que quedar en el orden en que se pidieron.
+    for (uint32_t seed = 1; seed <= 4; ++seed)
+    {
+        SimulatedQueueFence fence(1 + seed % 3);
+        SimulatedCopyQueue queue;
+        CopyUploadBatcher batcher;
+        const UINT64 capacity = 256ull << 10;
+        setup(fence, queue, batcher, capacity);
+        std::vector<std::vector<uint8_t>> dst(6, std::vector<uint8_t>(1u << 20)), expected = dst;
+        std::vector<uint8_t> src(96u << 10);
+
+        uint32_t state = seed * 2654435761u;
+        auto next = [&state]() { state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state; };
+        bool bounded = true;
+        for (int op = 0; op < 3000; ++op)
+        {
+            const size_t d = next() % dst.size();
+            const UINT64 size = 1 + next() % src.size();
+            const UINT64 offset = next() % (dst[d].size() - size + 1);
+            fill(src, next());
+            batcher.Upload(&dst[d], offset, src.data(), size);
+            memcpy(expected[d].data() + offset, src.data(), (size_t)size);
+
+            if (next() % 8 == 0) batcher.Flush();
+            fence.Advance(next() % 3);
+            batcher.Collect();
+            bounded = bounded && batcher.Ring().UsedBytes() <= capacity;
+        }
+        batcher.WaitIdle();
+        char step[32], detail[160];
+        sprintf_s(step, "fuzz seed %u", seed);
+        sprintf_s(detail, " (%llu MB in %llu batches, %llu copies, %llu stalls, max %zu copies per batch)",
+            (unsigned long long)(batcher.Bytes() >> 20), (unsigned long long)batcher.Batches(), (unsigned long long)batcher.Copies(),
+            (unsigned long long)batcher.Stalls(), queue.maxBatch);
+        report(step, bounded && dst == expected && batcher.Ring().UsedBytes() == 0 && queue.inFlight.empty(), detail);
+    }
+
+    return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Estados de recursos: barreras inferidas, en lote y divididas
+//--------------------------------------------------------------------------------------
+
+// En DX12 cada recurso tiene un "estado de uso" (RENDER_TARGET, COPY_SOURCE, PRESENT, etc.) y cambiarlo es una barrera
+// de transición. En lugar de que cada llamador diga el estado de antes y el de después, se pide solo el de después: el
+// tracker conoce el actual (por subrecurso), infiere la barrera y las junta en un solo ResourceBarrier por pasada.
+
+// Estado de un recurso: uno para todos los subrecursos (subs vacío) o uno por subrecurso.
+struct TrackedState
+{
+    D3D12_RESOURCE_STATES all = D3D12_RESOURCE_STATE_COMMON;
+    std::vector<D3D12_RESOURCE_STATES> subs;
+
+    D3D12_RESOURCE_STATES Get(UINT sub) const { return subs.empty() ? all : subs[sub]; }
+};
+
+// Estados de solo lectura: se pueden combinar (VERTEX | INDEX) y un pedido ya incluido en el actual no necesita barrera.
+inline bool IsReadOnlyState(D3D12_RESOURCE_STATES s)
+{
+    const UINT writes = D3D12_RESOURCE_STATE_RENDER_TARGET | D3D12_RESOURCE_STATE_UNORDERED_ACCESS | D3D12_RESOURCE_STATE_DEPTH_WRITE |
+        D3D12_RESOURCE_STATE_STREAM_OUT | D3D12_RESOURCE_STATE_COPY_DEST | D3D12_RESOURCE_STATE_RESOLVE_DEST;
+    return s != D3D12_RESOURCE_STATE_COMMON && ((UINT)s & writes) == 0;
+}
+
+inline bool StateSatisfies(D3D12_RESOURCE_STATES current, D3D12_RESOURCE_STATES wanted)
+{
+    return current == wanted || (IsReadOnlyState(current) && IsReadOnlyState(wanted) && (current & wanted) == wanted);
+}
+
+// Estado de cada recurso al final de la última command list cerrada: las listas se ejecutan en el orden en que se
+// cierran, así que es el estado con el que arranca la próxima. Los recursos se registran al crearse con su cantidad
+// de subrecursos y su estado inicial; uno sin registrar se toma como COMMON con un subrecurso (buffers DEFAULT).
+class ResourceStateRegistry
+{
+public:
+    void Register(ID3D12Resource* res, UINT subresources, D3D12_RESOURCE_STATES initial)
+    {
+        Entry& e = m_entries[res];
+        e.subresources = (std::max)(1u, subresources);
+        e.state.all = initial;
+        e.state.subs.clear();
+    }
+
+    void Unregister(ID3D12Resource* res) { m_entries.erase(res); }
+
+    UINT Subresources(ID3D12Resource* res) const
+    {
+        auto it = m_entries.find(res);
+        return it == m_entries.end() ? 1u : it->second.subresources;
+    }
+
+    TrackedState State(ID3D12Resource* res) const
+    {
+        auto it = m_entries.find(res);
+        return it == m_entries.end() ? TrackedState() : it->second.state;
+    }
+
+    void Set(ID3D12Resource* res, const TrackedState& state)
+    {
+        Entry& e = m_entries[res];
+        e.subresources = (std::max)(e.subresources, (UINT)state.subs.size());
+        e.state = state;
+    }
+
+private:
+    struct Entry { UINT subresources = 1; TrackedState state; };
+    std::unordered_map<ID3D12Resource*, Entry> m_entries;
+};
+
+// Tracker de una command list. Uso: Begin; por pasada, Transition de lo que usa y Flush (una sola ResourceBarrier) antes
+// de grabarla; Close al cerrar la lista. El estado de partida de cada recurso sale del registry; Close le devuelve el final.
+//  - Transition a un estado que ya se cumple no emite nada.
+//  - Dentro de un mismo lote A→B y B→C se funden en A→C (y A→B→A desaparece): nada usa el recurso hasta el Flush.
+//  - BeginTransition emite la mitad BEGIN_ONLY de una barrera dividida; el Transition que lo pide más adelante (en otra
+//    pasada) emite la mitad END_ONLY, y la GPU puede hacer la transición en el medio. Entre las dos el recurso no se usa.
+//    Si las dos mitades caen en el mismo lote queda una barrera común.
+class ResourceStateTracker
+{
+public:
+    void Begin(ResourceStateRegistry* registry)
+    {
+        m_registry = registry;
+        m_local.clear();
+        m_pending.clear();
+    }
+
+    void Transition(ID3D12Resource* res, D3D12_RESOURCE_STATES after, UINT sub = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+    {
+        ++m_requested;
+        Local& l = Get(res);
+        FinishSplits(res, l, sub);
+        ForEachTarget(l, sub, [&](UINT s, D3D12_RESOURCE_STATES cur) { return Apply(res, s, cur, after); });
+    }
+
+    void BeginTransition(ID3D12Resource* res, D3D12_RESOURCE_STATES after, UINT sub = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+    {
+        ++m_requested;
+        Local& l = Get(res);
+        FinishSplits(res, l, sub);
+        const bool all = sub == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+        if (all && !l.state.subs.empty())
+        {
+            for (UINT s = 0; s < l.count; ++s) BeginSplit(res, l, s, l.state.subs[s], after);
+        }
+        else BeginSplit(res, l, sub, l.state.Get(all ? 0 : sub), after);
+    }
+
+    // Barrera de aliasing: 'after' pasa a ocupar memoria que usaba 'before' (nullptr = cualquier recurso placed).
+    // Va antes de las transiciones de 'after' del mismo lote.
+    void Aliasing(ID3D12Resource* before, ID3D12Resource* after)
+    {
+        D3D12_RESOURCE_BARRIER b = {};
+        b.Type = D3D12_RESOURCE_BARRIER_TYPE_ALIASING;
+        b.Aliasing.pResourceBefore = before;
+        b.Aliasing.pResourceAfter = after;
+        m_pending.push_back(b);
+    }
+
+    // Agrega a 'out' las barreras pendientes y las descarta. Devuelve cuántas eran.
+    size_t Flush(std::vector<D3D12_RESOURCE_BARRIER>& out)
+    {
+        const size_t n = m_pending.size();
+        out.insert(out.end(), m_pending.begin(), m_pending.end());
+        m_emitted += n;
+        if (n) ++m_calls;
+        m_pending.clear();
+        return n;
+    }
+
+    // Un solo ResourceBarrier con todo lo pendiente (nada si no hay barreras).
+    void Flush(ID3D12GraphicsCommandList* cl)
+    {
+        if (m_pending.empty()) return;
+        cl->ResourceBarrier((UINT)m_pending.size(), m_pending.data());
+        m_emitted += m_pending.size();
+        ++m_calls;
+        m_pending.clear();
+    }
+
+    // Al cerrar la lista (después del último Flush): el estado final de cada recurso tocado pasa al registry.
+    void Close()
+    {
+        assert(m_pending.empty());
+        for (auto& kv : m_local)
+        {
+            assert(kv.second.splits.empty()); // una barrera dividida sin su END dejaría el recurso a medio camino
+            m_registry->Set(kv.first, kv.second.state);
+        }
+        m_local.clear();
+    }
+
+    UINT64 Requested() const { return m_requested; } // Transition + BeginTransition pedidos
+    UINT64 Emitted() const { return m_emitted; }     // barreras que llegaron a la command list
+    UINT64 Calls() const { return m_calls; }         // llamadas a ResourceBarrier
+    UINT64 Skipped() const { return m_skipped; }     // pedidos que ya se cumplían
+    UINT64 Merged() const { return m_merged; }       // barreras fundidas con una pendiente del mismo lote
+
+private:
+    struct Split { UINT sub; D3D12_RESOURCE_STATES before, after; };
+    struct Local { UINT count = 1; TrackedState state; std::vector<Split> splits; };
+
+    Local& Get(ID3D12Resource* res)
+    {
+        auto it = m_local.find(res);
+        if (it != m_local.end()) return it->second;
+        Local& l = m_local[res];
+        l.count = m_registry->Subresources(res);
+        l.state = m_registry->State(res);
+        return l;
+    }
+
+    // Aplica fn(subrecurso, estado actual) → estado nuevo a 'sub' (o a todos) y vuelve a un estado único si quedan iguales.
+    template <class Fn>
+    void ForEachTarget(Local& l, UINT sub, Fn fn)
+    {
+        if (sub == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES && l.state.subs.empty())
+        {
+            l.state.all = fn(sub, l.state.all);
+            return;
+        }
+        if (l.state.subs.empty()) l.state.subs.assign(l.count, l.state.all);
+        for (UINT s = 0; s < l.count; ++s)
+            if (sub == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES || s == sub) l.state.subs[s] = fn(s, l.state.subs[s]);
+        if (std::all_of(l.state.subs.begin(), l.state.subs.end(), [&](D3D12_RESOURCE_STATES s) { return s == l.state.subs[0]; }))
+        {
+            l.state.all = l.state.subs[0];
+            l.state.subs.clear();
+        }
+    }
+
+    static D3D12_RESOURCE_BARRIER Barrier(ID3D12Resource* res, UINT sub, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after,
+        D3D12_RESOURCE_BARRIER_FLAGS flags)
+    {
+        D3D12_RESOURCE_BARRIER b = {};
+        b.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+        b.Flags = flags;
+        b.Transition.pResource = res;
+        b.Transition.Subresource = sub;
+        b.Transition.StateBefore = before;
+        b.Transition.StateAfter = after;
+        return b;
+    }
+
+    // Barrera cur → after para (res, sub), fundida con la pendiente del mismo subrecurso si la hay. Devuelve el estado nuevo.
+    D3D12_RESOURCE_STATES Apply(ID3D12Resource* res, UINT sub, D3D12_RESOURCE_STATES cur, D3D12_RESOURCE_STATES after)
+    {
+        if (StateSatisfies(cur, after)) { ++m_skipped; return cur; }
+        for (size_t i = m_pending.size(); i-- > 0;)
+        {
+            D3D12_RESOURCE_BARRIER& p = m_pending[i];
+            if (p.Type == D3D12_RESOURCE_BARRIER_TYPE_ALIASING)
+            {
+                if (p.Aliasing.pResourceAfter == res || p.Aliasing.pResourceBefore == res) break; // no se funde a través del aliasing
+                continue;
+            }
+            if (p.Transition.pResource != res) continue;
+            if (p.Transition.Subresource != sub || p.Flags != D3D12_RESOURCE_BARRIER_FLAG_NONE) break; // se pisan: el orden importa
+            ++m_merged;
+            p.Transition.StateAfter = after;
+            if (p.Transition.StateBefore == after) m_pending.erase(m_pending.begin() + i);
+            return after;
+        }
+        m_pending.push_back(Barrier(res, sub, cur, after, D3D12_RESOURCE_BARRIER_FLAG_NONE));
+        return after;
+    }
+
+    void BeginSplit(ID3D12Resource* res, Local& l, UINT sub, D3D12_RESOURCE_STATES cur, D3D12_RESOURCE_STATES after)
+    {
+        if (StateSatisfies(cur, after)) { ++m_skipped; return; }
+        m_pending.push_back(Barrier(res, sub, cur, after, D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY));
+        l.splits.push_back({ sub, cur, after });
+    }
+
+    // Termina las barreras divididas en vuelo que tocan 'sub': END_ONLY, o barrera común si el BEGIN no salió todavía.
+    void FinishSplits(ID3D12Resource* res, Local& l, UINT sub)
+    {
+        for (size_t i = 0; i < l.splits.size();)
+        {
+            const Split sp = l.splits[i];
+            if (sub != D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES && sp.sub != D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES && sp.sub != sub) { ++i; continue; }
+            l.splits.erase(l.splits.begin() + i);
+
+            auto begin = std::find_if(m_pending.begin(), m_pending.end(), [&](const D3D12_RESOURCE_BARRIER& p)
+                { return p.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION && p.Transition.pResource == res && p.Transition.Subresource == sp.sub &&
+                    p.Flags == D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY; });
+            if (begin != m_pending.end()) begin->Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+            else m_pending.push_back(Barrier(res, sp.sub, sp.before, sp.after, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY));
+            ForEachTarget(l, sp.sub, [&](UINT, D3D12_RESOURCE_STATES) { return sp.after; });
+        }
+    }
+
+    ResourceStateRegistry*                  m_registry = nullptr;
+    std::unordered_map<ID3D12Resource*, Local> m_local;
+    std::vector<D3D12_RESOURCE_BARRIER>     m_pending;
+    UINT64                                  m_requested = 0, m_emitted = 0, m_calls = 0, m_skipped = 0, m_merged = 0;
+};
+
+// Chequeo del tracker sin ventana ni GPU (-barrier-selftest): secuencias de pedidos contra las barreras que tienen que
+// salir en cada Flush (recursos falsos: el tracker nunca desreferencia los punteros). Devuelve el exit code del proceso.
+int RunBarrierSelfTest()
+{
+    bool ok = true;
+    char buf[512];
+    ID3D12Resource* A = reinterpret_cast<ID3D12Resource*>(0x1000);
+    ID3D12Resource* B = reinterpret_cast<ID3D12Resource*>(0x2000);
+    ID3D12Resource* T = reinterpret_cast<ID3D12Resource*>(0x3000); // textura de 4 subrecursos
+    const UINT All = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+    const D3D12_RESOURCE_STATES Present = D3D12_RESOURCE_STATE_PRESENT, Rt = D3D12_RESOURCE_STATE_RENDER_TARGET,
+        CopySrc = D3D12_RESOURCE_STATE_COPY_SOURCE, CopyDst = D3D12_RESOURCE_STATE_COPY_DEST, Srv = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+        Vb = D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, Ib = D3D12_RESOURCE_STATE_INDEX_BUFFER;
+    const D3D12_RESOURCE_BARRIER_FLAGS None = D3D12_RESOURCE_BARRIER_FLAG_NONE, BeginOnly = D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY,
+        EndOnly = D3D12_RESOURCE_BARRIER_FLAG_END_ONLY;
+
+    struct Expected { ID3D12Resource* res; UINT sub; D3D12_RESOURCE_STATES before, after; D3D12_RESOURCE_BARRIER_FLAGS flags; };
+    ResourceStateRegistry registry;
+    ResourceStateTracker tracker;
+    auto reset = [&]()
+    {
+        registry = ResourceStateRegistry();
+        registry.Register(A, 1, Present);
+        registry.Register(B, 1, Present);
+        registry.Register(T, 4, Srv);
+        tracker.Begin(&registry);
+    };
+    // Compara un Flush con lo esperado; en el detalle, lo que salió
+    auto check = [&](const char* step, std::initializer_list<Expected> expected)
+    {
+        std::vector<D3D12_RESOURCE_BARRIER> got;
+        tracker.Flush(got);
+        bool pass = got.size() == expected.size();
+        size_t i = 0;
+        for (const Expected& e : expected)
+        {
+            if (i >= got.size()) break;
+            const D3D12_RESOURCE_BARRIER& g = got[i++];
+            pass = pass && g.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION && g.Transition.pResource == e.res && g.Transition.Subresource == e.sub &&
+                g.Transition.StateBefore == e.before && g.Transition.StateAfter == e.after && g.Flags == e.flags;
+        }
+        std::string detail;
+        for (const D3D12_RESOURCE_BARRIER& g : got)
+        {
+            char one[96];
+            sprintf_s(one, " %llx[%d] 0x%x->0x%x%s", (unsigned long long)(uintptr_t)g.Transition.pResource, (int)g.Transition.Subresource,
+                (UINT)g.Transition.StateBefore, (UINT)g.Transition.StateAfter,
+                g.Flags == D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY ? " begin" : g.Flags == D3D12_RESOURCE_BARRIER_FLAG_END_ONLY ? " end" : "");
+            detail += one;
+        }
+        sprintf_s(buf, "Barrier tracker [%s]: %s (%zu barriers:%s)\n", step, pass ? "OK" : "FAIL", got.size(), detail.c_str());
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
+
+    // 1) Estado inferido, pedido redundante y lote de varios recursos en un solo Flush
+    reset();
+    tracker.Transition(A, Rt);
+    tracker.Transition(A, Rt);
+    tracker.Transition(B, CopyDst);
+    check("infer + batch", { { A, All, Present, Rt, None }, { B, All, Present, CopyDst, None } });
+    check("nothing pending", {});
+
+    // 2) Fusión dentro del lote: A→B→C queda A→C y A→B→A desaparece
+    reset();
+    tracker.Transition(A, Rt);
+    tracker.Transition(A, CopySrc);
+    tracker.Transition(B, Rt);
+    tracker.Transition(B, Present);
+    check("merge chain", { { A, All, Present, CopySrc, None } });
+
+    // 3) Lecturas combinadas: VB|IB ya cumple IB
+    reset();
+    tracker.Transition(A, Vb | Ib);
+    check("combined read", { { A, All, Present, Vb | Ib, None } });
+    tracker.Transition(A, Ib);
+    check("read already satisfied", {});
+
+    // 4) Subrecursos: uno solo, después todos (solo sale el que difiere) y después todos juntos
+    reset();
+    tracker.Transition(T, Rt, 2);
+    check("one subresource", { { T, 2, Srv, Rt, None } });
+    tracker.Transition(T, Srv);
+    check("all back to uniform", { { T, 2, Rt, Srv, None } });
+    tracker.Transition(T, CopyDst);
+    check("whole resource", { { T, All, Srv, CopyDst, None } });
+
+    // 5) Barrera dividida entre dos pasadas; y las dos mitades en el mismo lote
+    reset();
+    tracker.BeginTransition(A, CopySrc);
+    tracker.Transition(B, Rt);
+    check("split begin", { { A, All, Present, CopySrc, BeginOnly }, { B, All, Present, Rt, None } });
+    tracker.Transition(A, CopySrc);
+    check("split end", { { A, All, Present, CopySrc, EndOnly } });
+    tracker.BeginTransition(A, Present);
+    tracker.Transition(A, Present);
+    check("split in one batch", { { A, All, CopySrc, Present, None } });
+    tracker.BeginTransition(B, CopySrc);
+    check("split begin 2", { { B, All, Rt, CopySrc, BeginOnly } });
+    tracker.Transition(B, Present); // pide otro estado: termina la dividida y sigue
+    check("split end + next", { { B, All, Rt, CopySrc, EndOnly }, { B, All, CopySrc, Present, None } });
+
+    // 6) Entre listas: el estado final de una es el inicial de la siguiente
+    reset();
+    tracker.Transition(A, CopySrc);
+    tracker.Transition(T, Rt, 1);
+    check("list 1", { { A, All, Present, CopySrc, None }, { T, 1, Srv, Rt, None } });
+    tracker.Close();
+    tracker.Begin(&registry);
+    tracker.Transition(A, Present);
+    tracker.Transition(T, Srv);
+    check("list 2 starts from list 1", { { A, All, CopySrc, Present, None }, { T, 1, Rt, Srv, None } });
+    tracker.Close();
+
+    // 7) RecordRender con -batch-render: PRESENT→RT, RT→COPY_SOURCE para el readback y COPY_SOURCE→PRESENT directo
+    //    (antes eran cuatro barreras en cuatro llamadas: volvía a RT para pasar a PRESENT)
+    reset();
+    const UINT64 callsBefore = tracker.Calls();
+    tracker.Transition(A, Rt);
+    check("frame: main pass", { { A, All, Present, Rt, None } });
+    tracker.Transition(A, CopySrc);
+    check("frame: readback", { { A, All, Rt, CopySrc, None } });
+    tracker.Transition(A, Present);
+    check("frame: present", { { A, All, CopySrc, Present, None } });
+    tracker.Close();
+    ok = ok && tracker.Calls() - callsBefore == 3;
+
+    return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Vertex / Const Buffer Definition
+//--------------------------------------------------------------------------------------
+// Formato de trabajo en CPU (import, generación, optimización de mallas). A la GPU sube como PackedVertex.
+// El color ya no se guarda: era 0.5*(n+1) y el VS lo deriva de la normal.
+struct Vertex {
+    XMFLOAT3 pos; //Espacio local
+    XMFLOAT3 normal;
+};
+
+// Formato de vértice en GPU: 12 bytes contra los 36 del Vertex original (pos + color + normal en float).
+//  - pos: UNORM16 relativo al AABB de la malla → pos = q * posScale + posBias (posScale/posBias van en CBData).
+//  - oct: normal unitaria proyectada al octaedro y guardada en SNORM16.
+struct PackedVertex {
+    uint16_t pos[4]; // R16G16B16A16_UNORM (w sin uso, queda en 0)
+    int16_t  oct[2]; // R16G16_SNORM
+};
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex tiene que coincidir con el input layout de CreateRootSigAndPSO");
+
+
+// Definición del CBV - un CBV es un bloque de memoria en el GPU que tiene valores constantes por draw y es accesible desde shaders.
+// Sería como un buffer de uniforms en OpenGL.
+// Se usa alignas porque quiero que esta struct comience en memoria en una dirección múltiplo de 256 bytes.
+// Esto es una regla de DX12.
+
+struct alignas(256) CBData {
+    // Aclaración: Cada variable dentro de un cbuffer debe ocupar un múltiplo de 16 bytes (Constant buffer packing rules):
+
+    XMMATRIX viewProj; // Matriz View - Projection (XMMATRIX is auto aligned on a 16-byte boundary). El VS arma el MVP con la world de cada instancia.
+    XMMATRIX world; // Matriz World del objeto: necesaria para transformar normales y posición en PBR. Se aplica después de la de la instancia.
+    
+    XMFLOAT3 lightDir; // (12 bytes)
+    float    ambient; // Tal vez no se use en PBR, queda para compatibilidad (4 bytes)
+    
+    int      mode; // Modo 1-5 (4 bytes)
+    XMFLOAT3 _pad1; // (padding de 12 bytes)
+
+    XMFLOAT3 viewPos;  // Posición de la cámara en mundo (p/ PBR y Fresnel).
+    float    shininess; // Para especular
+    float    specIntensity; // Para especular 
+    XMFLOAT3 _pad2;
+
+    // El material (baseColor, metallic, roughness, ao) ya no va acá: viene por instancia en InstanceData.
+
+    // luz puntual física
+    XMFLOAT3 lightPos;     
+    float lightIntensity; // intensidad en unidades arbitrarias
+    XMFLOAT3 lightColor;  // RGB de la luz
+    float _pad4;          
+
+    // Decuantización de PackedVertex::pos para la malla que se dibuja este frame
+    XMFLOAT3 posScale;    // extensión del AABB
+    float _pad5;
+    XMFLOAT3 posBias;     // mínimo del AABB
+    float _pad6;
+};
+
+// Datos por instancia: se leen en el VS desde un StructuredBuffer (t0) indexado con SV_InstanceID.
+// Con esto una grilla entera de materiales es un solo DrawIndexedInstanced, sin tocar CBData por draw.
+struct InstanceData {
+    XMFLOAT4X4 world;       // Transform de la instancia (transpuesta, igual que las matrices del CB). Se aplica antes de CBData.world.
+    XMFLOAT4X4 normalWorld; // Inversa transpuesta del 3x3 de world (también guardada transpuesta): normales con escala no uniforme.
+
+    XMFLOAT3 baseColor;   // baseColor: F0 para metales y albedo difuso para dieléctricos.
+    float    metallic;    // metallic: 0 = dieléctrico, 1 = metal.
+    float    roughness;   // controla la microrrugosidad de la superficie.
+    float    ao;          // atenúa SOLO la luz ambiental en oquedades y contactos.
+    XMFLOAT2 _pad;
+};
+static_assert(sizeof(InstanceData) == 160, "InstanceData tiene que coincidir con el struct de PBR.hlsl");
+
+// Escribe world y normalWorld de una instancia a partir de su transform (convención de DirectXMath, sin transponer).
+// La matriz de normales es (M^-1)^T; guardada transpuesta como las demás queda M^-1 tal cual. La traslación no molesta:
+// el VS usa solo el 3x3.
+inline void SetInstanceTransform(InstanceData& inst, FXMMATRIX m)
+{
+    XMStoreFloat4x4(&inst.world, XMMatrixTranspose(m));
+    XMStoreFloat4x4(&inst.normalWorld, XMMatrixInverse(nullptr, m));
+}
+
+// normalWorld a partir de una world ya guardada transpuesta (ModelInstance::world, que va así en el cache).
+inline XMFLOAT4X4 NormalWorldFromStored(const XMFLOAT4X4& world)
+{
+    XMFLOAT4X4 n;
+    XMStoreFloat4x4(&n, XMMatrixInverse(nullptr, XMMatrixTranspose(XMLoadFloat4x4(&world))));
+    return n;
+}
+
+//--------------------------------------------------------------------------------------
+// Vertex comprimido: posición cuantizada al AABB + normal octaédrica
+//--------------------------------------------------------------------------------------
+
+// Decuantización de una malla: pos = q * scale + bias, con q en [0,1] (UNORM16 leído por el IA).
+struct VertexQuantization
+{
+    XMFLOAT3 scale = XMFLOAT3(1, 1, 1); // extensión del AABB (nunca 0)
+    XMFLOAT3 bias = XMFLOAT3(0, 0, 0);  // mínimo del AABB
+};
+
+// Cotas del error de ida y vuelta Vertex → PackedVertex → Vertex (las chequea VerifyPackedVertices).
+// Posición: medio paso de UNORM16 por eje, o sea |scale| / 65535 / 2.
+// Normal: medio paso de SNORM16 en el octaedro, estirado por la proyección a la esfera (se mide ~0.004°).
+static const float OctNormalMaxErrorDeg = 0.005f;
+
+inline float SignNotZero(float v) { return v >= 0.0f ? 1.0f : -1.0f; }
+
+// Normal unitaria → cuadrado [-1,1]^2: proyecta sobre el octaedro |x|+|y|+|z|=1 y pliega la mitad z<0 sobre las esquinas.
+inline XMFLOAT2 OctEncode(const XMFLOAT3& n)
+{
+    const float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (l1 <= 0.0f) return XMFLOAT2(0, 0); // normal nula → +Z
+
+    float x = n.x / l1, y = n.y / l1;
+    if (n.z < 0.0f)
+    {
+        const float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+        const float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+        x = fx; y = fy;
+    }
+    return XMFLOAT2(x, y);
+}
+
+// Inversa de OctEncode. Misma formulación que OctDecode() en PBR.hlsl.
+inline XMFLOAT3 OctDecode(const XMFLOAT2& e)
+{
+    XMFLOAT3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+    const float t = (std::max)(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    const float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+    return XMFLOAT3(n.x / len, n.y / len, n.z / len);
+}
+
+// Conversiones con las reglas de D3D para UNORM/SNORM (SNORM: -32768 y -32767 valen -1)
+inline uint16_t FloatToUnorm16(float v) { v = (std::min)((std::max)(v, 0.0f), 1.0f); return (uint16_t)(v * 65535.0f + 0.5f); }
+inline float    Unorm16ToFloat(uint16_t q) { return q / 65535.0f; }
+inline int16_t  FloatToSnorm16(float v) { v = (std::min)((std::max)(v, -1.0f), 1.0f); return (int16_t)lroundf(v * 32767.0f); }
+inline float    Snorm16ToFloat(int16_t q) { return (std::max)(q / 32767.0f, -1.0f); }
+
+VertexQuantization ComputeVertexQuantization(const Vertex* verts, size_t count)
+{
+    VertexQuantization q;
+    if (count == 0) return q;
+
+    XMFLOAT3 mn(FLT_MAX, FLT_MAX, FLT_MAX), mx(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const XMFLOAT3& p = verts[i].pos;
+        mn.x = (std::min)(mn.x, p.x); mn.y = (std::min)(mn.y, p.y); mn.z = (std::min)(mn.z, p.z);
+        mx.x = (std::max)(mx.x, p.x); mx.y = (std::max)(mx.y, p.y); mx.z = (std::max)(mx.z, p.z);
+    }
+
+    // Un eje plano (ej. un quad) tendría extensión 0: cualquier escala chica sirve porque q queda en 0.
+    q.bias = mn;
+    q.scale = XMFLOAT3((std::max)(mx.x - mn.x, 1e-6f), (std::max)(mx.y - mn.y, 1e-6f), (std::max)(mx.z - mn.z, 1e-6f));
+    return q;
+}
+
+PackedVertex PackVertex(const Vertex& v, const VertexQuantization& q)
+{
+    PackedVertex p;
+    p.pos[0] = FloatToUnorm16((v.pos.x - q.bias.x) / q.scale.x);
+    p.pos[1] = FloatToUnorm16((v.pos.y - q.bias.y) / q.scale.y);
+    p.pos[2] = FloatToUnorm16((v.pos.z - q.bias.z) / q.scale.z);
+    p.pos[3] = 0;
+
+    const XMFLOAT2 e = OctEncode(v.normal);
+    p.oct[0] = FloatToSnorm16(e.x);
+    p.oct[1] = FloatToSnorm16(e.y);
+    return p;
+}
+
+// Lo mismo que hace el IA + VSMain: sirve para medir el error y para cualquier lectura de vuelta en CPU.
+Vertex UnpackVertex(const PackedVertex& p, const VertexQuantization& q)
+{
+    Vertex v;
+    v.pos = XMFLOAT3(
+        Unorm16ToFloat(p.pos[0]) * q.scale.x + q.bias.x,
+        Unorm16ToFloat(p.pos[1]) * q.scale.y + q.bias.y,
+        Unorm16ToFloat(p.pos[2]) * q.scale.z + q.bias.z);
+    v.normal = OctDecode(XMFLOAT2(Snorm16ToFloat(p.oct[0]), Snorm16ToFloat(p.oct[1])));
+    return v;
+}
+
+void PackVertices(const Vertex* verts, size_t count, const VertexQuantization& q, std::vector<PackedVertex>& out)
+{
+    out.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        out[i] = PackVertex(verts[i], q);
+}
+
+// Test de ida y vuelta en CPU: decodifica todo, mide el error máximo de posición y de normal (en grados)
+// y lo compara contra las cotas de arriba. Loguea el resultado y el ahorro de memoria; devuelve false si alguna cota se rompe.
+bool VerifyPackedVertices(const char* name, const Vertex* verts, const PackedVertex* packed, size_t count, const VertexQuantization& q)
+{
+    const float halfStepX = 0.5f * q.scale.x / 65535.0f;
+    const float halfStepY = 0.5f * q.scale.y / 65535.0f;
+    const float halfStepZ = 0.5f * q.scale.z / 65535.0f;
+
+    // + margen por el redondeo float de q * scale + bias
+    const float maxCoord = (std::max)({ fabsf(q.bias.x) + q.scale.x, fabsf(q.bias.y) + q.scale.y, fabsf(q.bias.z) + q.scale.z });
+    const float posBound = sqrtf(halfStepX * halfStepX + halfStepY * halfStepY + halfStepZ * halfStepZ) + 4.0f * FLT_EPSILON * maxCoord;
+
+    float posErr = 0.0f, nrmErrDeg = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Vertex d = UnpackVertex(packed[i], q);
+        const XMFLOAT3& p = verts[i].pos;
+        const float dx = d.pos.x - p.x, dy = d.pos.y - p.y, dz = d.pos.z - p.z;
+        posErr = (std::max)(posErr, sqrtf(dx * dx + dy * dy + dz * dz));
+
+        const XMFLOAT3& n = verts[i].normal;
+        const float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+        if (len < 1e-6f) continue; // normal nula: no hay dirección que comparar
+        // atan2(|n x d|, n . d): acos pierde toda la precisión de float cerca de 1 (no resuelve menos de ~0.02°)
+        const float cx = n.y * d.normal.z - n.z * d.normal.y;
+        const float cy = n.z * d.normal.x - n.x * d.normal.z;
+        const float cz = n.x * d.normal.y - n.y * d.normal.x;
+        const float dot = n.x * d.normal.x + n.y * d.normal.y + n.z * d.normal.z;
+        nrmErrDeg = (std::max)(nrmErrDeg, XMConvertToDegrees(atan2f(sqrtf(cx * cx + cy * cy + cz * cz), dot)));
+    }
+
+    const bool ok = posErr <= posBound && nrmErrDeg <= OctNormalMaxErrorDeg;
+
+    char buf[320];
+    sprintf_s(buf, "PackedVertex [%s]: %zu verts | VB %zu -> %zu bytes | pos err %.3g (bound %.3g) | normal err %.4f deg (bound %.4f)%s\n",
+        name, count, count * sizeof(float) * 9 /* Vertex original: pos + color + normal */, count * sizeof(PackedVertex), posErr, posBound, nrmErrDeg, OctNormalMaxErrorDeg,
+        ok ? "" : " | FAILED");
+    OutputDebugStringA(buf);
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------
+// Permutaciones de shaders (clave de pipeline + cache de PSOs)
+//--------------------------------------------------------------------------------------
+
+// El PS ya no elige el modo de iluminación con una cadena de if por pixel: PBR.hlsl se compila una vez por combinación
+// de SHADING_MODE y features (defines) y cada combinación es un PSO. Las teclas T y N solo cambian la clave; el PSO se
+// construye la primera vez que se pide y después sale del cache.
+static const uint32_t ShadingModeCount = 6; // modos 0..5 de la tecla T
+
+enum ShaderFeature : uint32_t
+{
+    ShaderFeatureNormalAlbedo = 1u << 0, // NORMAL_ALBEDO: baseColor = color debug por normal (tecla N)
+    ShaderFeatureAll = ShaderFeatureNormalAlbedo,
+};
+
+// Todo lo que distingue un PSO de otro, empaquetado en 64 bits:
+// [0,8) modo | [8,24) features | [24,40) formato RT | [40,56) formato DS | [56,64) libre
+struct PipelineKey
+{
+    uint32_t    mode = 5;
+    uint32_t    features = 0;
+    DXGI_FORMAT rtvFormat = DXGI_FORMAT_UNKNOWN;
+    DXGI_FORMAT dsvFormat = DXGI_FORMAT_UNKNOWN;
+
+    uint64_t Pack() const
+    {
+        return (uint64_t)(mode & 0xFFu) | ((uint64_t)(features & 0xFFFFu) << 8) |
+            ((uint64_t)(rtvFormat & 0xFFFFu) << 24) | ((uint64_t)(dsvFormat & 0xFFFFu) << 40);
+    }
+
+    static PipelineKey Unpack(uint64_t packed)
+    {
+        PipelineKey k;
+        k.mode = (uint32_t)(packed & 0xFFu);
+        k.features = (uint32_t)((packed >> 8) & 0xFFFFu);
+        k.rtvFormat = (DXGI_FORMAT)((packed >> 24) & 0xFFFFu);
+        k.dsvFormat = (DXGI_FORMAT)((packed >> 40) & 0xFFFFu);
+        return k;
+    }
+};
+
+// Las claves difieren en pocos bits y std::hash<uint64_t> suele ser la identidad: mezclamos con el finalizador de
+// splitmix64 para que se repartan bien en los buckets.
+struct PipelineKeyHash
+{
+    size_t operator()(uint64_t k) const
+    {
+        k ^= k >> 30; k *= 0xBF58476D1CE4E5B9ull;
+        k ^= k >> 27; k *= 0x94D049BB133111EBull;
+        k ^= k >> 31;
+        return (size_t)k;
+    }
+};
+
+// Defines del PS para una clave (nombre, valor). También entran en la clave del cache de bytecode.
+std::vector<std::pair<std::string, std::string>> ShaderDefines(const PipelineKey& key)
+{
+    std::vector<std::pair<std::string, std::string>> defines;
+    defines.push_back({ "SHADING_MODE", std::to_string(key.mode) });
+    if (key.features & ShaderFeatureNormalAlbedo) defines.push_back({ "NORMAL_ALBEDO", "1" });
+    return defines;
+}
+
+// Cache perezoso de pipelines por clave de 64 bits. Solo el builder toca el device, así que claves, hits y misses se
+// pueden probar sin GPU (RunPermutationSelfTest usa un builder falso).
+template <class Pipeline>
+class PermutationCache
+{
+public:
+    using Builder = std::function<Pipeline(uint64_t key)>;
+
+    void SetBuilder(Builder builder) { m_builder = std::move(builder); }
+
+    // Pipeline de la clave; si todavía no existe lo construye (miss) y lo guarda.
+    const Pipeline& Get(uint64_t key)
+    {
+        auto it = m_pipelines.find(key);
+        if (it != m_pipelines.end()) { ++m_hits; return it->second; }
+
+        ++m_misses;
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        Pipeline p = m_builder(key);
+        m_buildMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        return m_pipelines.emplace(key, std::move(p)).first->second;
+    }
+
+    // Cambia el pipeline de una clave (hot reload) y devuelve el anterior, para soltarlo cuando la GPU termine con él.
+    Pipeline Replace(uint64_t key, Pipeline p)
+    {
+        Pipeline& slot = m_pipelines[key];
+        std::swap(slot, p);
+        return p;
+    }
+
+    // Saca una clave del cache (la próxima búsqueda la vuelve a construir) y devuelve su pipeline.
+    Pipeline Erase(uint64_t key)
+    {
+        Pipeline p = Pipeline();
+        auto it = m_pipelines.find(key);
+        if (it != m_pipelines.end()) { p = std::move(it->second); m_pipelines.erase(it); }
+        return p;
+    }
+
+    std::vector<uint64_t> Keys() const
+    {
+        std::vector<uint64_t> keys;
+        for (const auto& p : m_pipelines) keys.push_back(p.first);
+        return keys;
+    }
+
+    bool   Contains(uint64_t key) const { return m_pipelines.count(key) != 0; }
+    size_t Size() const { return m_pipelines.size(); }
+    void   Clear() { m_pipelines.clear(); }
+
+    uint64_t Hits() const { return m_hits; }
+    uint64_t Misses() const { return m_misses; }
+    double   BuildMs() const { return m_buildMs; } // Tiempo total dentro del builder (compilar PS + crear PSO)
+
+private:
+    Builder m_builder;
+    std::unordered_map<uint64_t, Pipeline, PipelineKeyHash> m_pipelines;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    double   m_buildMs = 0.0;
+};
+
+// Chequeo de claves y cache sin ventana ni GPU (-permutation-selftest): ida y vuelta Pack/Unpack de todas las
+// combinaciones, claves y hashes sin colisiones, y un builder falso para contar hits/misses mientras se recorren los
+// modos como con la tecla T. Devuelve el exit code del proceso.
+int RunPermutationSelfTest()
+{
+    const DXGI_FORMAT rtvFormats[] = { DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_B8G8R8A8_UNORM, DXGI_FORMAT_R16G16B16A16_FLOAT };
+    const DXGI_FORMAT dsvFormats[] = { DXGI_FORMAT_D32_FLOAT, DXGI_FORMAT_D24_UNORM_S8_UINT };
+
+    bool ok = true;
+    std::vector<uint64_t> keys, hashes;
+    for (DXGI_FORMAT rtv : rtvFormats)
+        for (DXGI_FORMAT dsv : dsvFormats)
+            for (uint32_t features = 0; features <= ShaderFeatureAll; ++features)
+                for (uint32_t mode = 0; mode < ShadingModeCount; ++mode)
+                {
+                    PipelineKey k;
+                    k.mode = mode; k.features = features; k.rtvFormat = rtv; k.dsvFormat = dsv;
+                    const uint64_t packed = k.Pack();
+                    const PipelineKey u = PipelineKey::Unpack(packed);
+                    ok = ok && u.mode == mode && u.features == features && u.rtvFormat == rtv && u.dsvFormat == dsv;
+                    keys.push_back(packed);
+                    hashes.push_back(PipelineKeyHash()(packed));
+                }
+    std::sort(keys.begin(), keys.end());
+    std::sort(hashes.begin(), hashes.end());
+    const bool uniqueKeys = std::adjacent_find(keys.begin(), keys.end()) == keys.end();
+    const bool uniqueHashes = std::adjacent_find(hashes.begin(), hashes.end()) == hashes.end();
+
+    // Builder falso: devuelve la clave y cuenta cuántas veces se lo llamó.
+    PermutationCache<uint64_t> cache;
+    uint32_t builds = 0;
+    cache.SetBuilder([&builds](uint64_t key) { ++builds; return key; });
+
+    const uint32_t laps = 3, lookups = laps * (ShaderFeatureAll + 1) * ShadingModeCount;
+    for (uint32_t lap = 0; lap < laps; ++lap)
+        for (uint32_t features = 0; features <= ShaderFeatureAll; ++features)
+            for (uint32_t mode = 0; mode < ShadingModeCount; ++mode)
+            {
+                PipelineKey k;
+                k.mode = mode; k.features = features; k.rtvFormat = rtvFormats[0]; k.dsvFormat = dsvFormats[0];
+                ok = ok && cache.Get(k.Pack()) == k.Pack();
+            }
+    const uint32_t permutations = (ShaderFeatureAll + 1) * ShadingModeCount;
+    const bool counts = builds == permutations && cache.Misses() == permutations && cache.Hits() == lookups - permutations &&
+        cache.Size() == permutations;
+
+    cache.Clear(); // después de un Clear (p. ej. shaders recargados) la próxima búsqueda vuelve a construir
+    cache.Get(keys.front());
+    const bool cleared = builds == permutations + 1 && cache.Size() == 1;
+
+    ok = ok && uniqueKeys && uniqueHashes && counts && cleared;
+
+    char buf[256];
+    sprintf_s(buf, "Permutations: %zu keys (unique %s, hashes unique %s) | cache %u lookups (+1 after Clear): %llu misses, %llu hits, %u builds%s | %s\n",
+        keys.size(), uniqueKeys ? "yes" : "no", uniqueHashes ? "yes" : "no", lookups + 1, (unsigned long long)cache.Misses(),
+        (unsigned long long)cache.Hits(), builds, cleared ? "" : " | Clear FAILED", ok ? "OK" : "FAIL");
+    OutputDebugStringA(buf);
+    return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Heaps de GPU: recursos placed sub-asignados con TLSF
+//--------------------------------------------------------------------------------------
+
+// Bit más alto / más bajo en 1 (v != 0).
+inline int HighestBit64(uint64_t v) { unsigned long i; _BitScanReverse64(&i, v); return (int)i; }
+inline int LowestBit64(uint64_t v) { unsigned long i; _BitScanForward64(&i, v); return (int)i; }
+inline uint64_t AlignUp64(uint64_t v, uint64_t alignment) { return (v + alignment - 1) & ~(alignment - 1); } // alignment potencia de 2
+
+struct TlsfStats
+{
+    uint64_t capacity = 0;
+    uint64_t usedBytes = 0;      // bloques asignados (cada pedido redondeado a la granularidad)
+    uint64_t requestedBytes = 0; // lo que pidieron los llamadores
+    uint64_t freeBytes = 0;
+    uint64_t largestFree = 0;
+    uint32_t allocations = 0;
+    uint32_t freeBlocks = 0;
+
+    uint64_t Wasted() const { return usedBytes - requestedBytes; } // redondeo interno, no se puede usar
+    // 0 = todo lo libre es un solo bloque; cerca de 1 = lo libre está picado en huecos chicos
+    double Fragmentation() const { return freeBytes ? 1.0 - (double)largestFree / (double)freeBytes : 0.0; }
+};
+
+// Two-Level Segregated Fit sobre un rango [0, capacity) de offsets: no toca memoria, solo decide dónde va cada cosa,
+// así que la política se prueba en CPU y la usa GpuHeapAllocator para ubicar recursos dentro de un ID3D12Heap.
+// Los bloques libres están en listas por (potencia de 2, 1/16 de esa potencia) con un bitmap por nivel: asignar y
+// liberar son O(1). Al liberar se fusiona con los vecinos físicos libres (nunca hay dos bloques libres seguidos).
+// Todo offset y tamaño es múltiplo de la granularidad; la alineación pedida puede ser mayor (clases de 64 KB y 4 MB
+// en los heaps de D3D12): se busca size + alignment - granularity y el hueco de adelante vuelve a la lista libre.
+class TlsfAllocator
+{
+public:
+    static const uint64_t Invalid = ~0ull;
+
+    explicit TlsfAllocator(uint64_t capacity = 0, uint64_t granularity = 256) { Reset(capacity, granularity); }
+
+    // granularity: potencia de 2. Descarta todas las asignaciones.
+    void Reset(uint64_t capacity, uint64_t granularity)
+    {
+        m_granularity = granularity;
+        m_capacity = capacity / granularity * granularity;
+        m_blocks.clear();
+        m_unusedBlocks.clear();
+        m_used.clear();
+        m_flBitmap = 0;
+        for (int fl = 0; fl < FlCount; ++fl)
+        {
+            m_slBitmap[fl] = 0;
+            for (int sl = 0; sl < SlCount; ++sl) m_heads[fl][sl] = Nil;
+        }
+        m_usedBytes = m_requestedBytes = 0;
+        if (m_capacity) InsertFree(NewBlock(0, m_capacity, Nil, Nil));
+    }
+
+    // Offset alineado a 'alignment' o Invalid si no hay un bloque libre que alcance.
+    uint64_t Allocate(uint64_t size, uint64_t alignment = 1)
+    {
+        if (size == 0 || size > m_capacity) return Invalid;
+        alignment = (std::max)(alignment, m_granularity);
+        const uint64_t search = SearchSize(size, alignment);
+        if (search > m_capacity) return Invalid;
+
+        const uint32_t b = FindFree(search);
+        if (b == Nil) return Invalid;
+        return Carve(b, AlignUp64(m_blocks[b].offset, alignment), size, alignment);
+    }
+
+    void Free(uint64_t offset)
+    {
+        auto it = m_used.find(offset);
+        assert(it != m_used.end() && "TlsfAllocator::Free de un offset no asignado");
+        if (it == m_used.end()) return;
+        uint32_t b = it->second;
+        m_used.erase(it);
+        m_usedBytes -= m_blocks[b].size;
+        m_requestedBytes -= m_blocks[b].requested;
+        m_blocks[b].free = true;
+
+        const uint32_t prev = m_blocks[b].prevPhys;
+        if (prev != Nil && m_blocks[prev].free) { RemoveFree(prev); b = Merge(prev, b); }
+        const uint32_t next = m_blocks[b].nextPhys;
+        if (next != Nil && m_blocks[next].free) { RemoveFree(next); b = Merge(b, next); }
+        InsertFree(b);
+    }
+
+    // Tamaño de bloque libre que garantiza encontrar lugar para (size, alignment): el pedido más el peor hueco de
+    // alineación, redondeado al próximo límite de lista. Si Allocate falla, no queda ningún bloque libre de este tamaño.
+    uint64_t SearchSize(uint64_t size, uint64_t alignment) const
+    {
+        alignment = (std::max)(alignment, m_granularity);
+        uint64_t units = (AlignUp64(size, m_granularity) + alignment - m_granularity) / m_granularity;
+        const int fl = HighestBit64(units);
+        if (fl > SlBits) units = AlignUp64(units, 1ull << (fl - SlBits));
+        return units * m_granularity;
+    }
+
+    // Hook de desfragmentación: baja cada asignación (de la más alta a la más baja) al primer hueco libre de menor
+    // dirección donde entra con su alineación, y avisa cada movimiento con move(from, to, size); los rangos no se
+    // pisan. Quien llama copia los datos y actualiza sus referencias (en la GPU: recurso placed nuevo + CopyBufferRegion).
+    size_t Defragment(const std::function<void(uint64_t from, uint64_t to, uint64_t size)>& move, size_t maxMoves = SIZE_MAX)
+    {
+        std::vector<uint64_t> offsets;
+        for (const auto& u : m_used) offsets.push_back(u.first);
+        std::sort(offsets.begin(), offsets.end(), std::greater<uint64_t>());
+
+        size_t moves = 0;
+        for (uint64_t from : offsets)
+        {
+            if (moves >= maxMoves) break;
+            const Block used = m_blocks[m_used[from]];
+            for (uint32_t f = FirstBlock(); f != Nil && m_blocks[f].offset < from; f = m_blocks[f].nextPhys)
+            {
+                if (!m_blocks[f].free) continue;
+                const uint64_t to = AlignUp64(m_blocks[f].offset, used.alignment);
+                if (to + used.size > m_blocks[f].offset + m_blocks[f].size) continue;
+
+                Free(from); // si el hueco era el vecino de abajo se fusiona con él: f sigue siendo el bloque que empieza antes
+                Carve(f, to, used.requested, used.alignment);
+                move(from, to, used.requested);
+                ++moves;
+                break;
+            }
+        }
+        return moves;
+    }
+
+    TlsfStats Stats() const
+    {
+        TlsfStats s;
+        s.capacity = m_capacity;
+        s.usedBytes = m_usedBytes;
+        s.requestedBytes = m_requestedBytes;
+        s.freeBytes = m_capacity - m_usedBytes;
+        s.allocations = (uint32_t)m_used.size();
+        for (uint32_t b = FirstBlock(); b != Nil; b = m_blocks[b].nextPhys)
+            if (m_blocks[b].free) { ++s.freeBlocks; s.largestFree = (std::max)(s.largestFree, m_blocks[b].size); }
+        return s;
+    }
+
+    bool Empty() const { return m_used.empty(); }
+
+    // Invariantes (para los tests): los bloques físicos cubren [0, capacity) sin huecos, no hay dos libres seguidos,
+    // cada libre está en la lista de su tamaño, los bitmaps coinciden con las listas y los contadores con los bloques.
+    bool Validate() const
+    {
+        uint64_t expected = 0, used = 0, requested = 0;
+        size_t freeCount = 0, usedCount = 0;
+        bool prevFree = false;
+        for (uint32_t b = FirstBlock(), prev = Nil; b != Nil; prev = b, b = m_blocks[b].nextPhys)
+        {
+            const Block& k = m_blocks[b];
+            if (k.offset != expected || k.size == 0 || k.size % m_granularity || k.prevPhys != prev) return false;
+            if (k.free && prevFree) return false;
+            if (k.free) ++freeCount;
+            else
+            {
+                auto it = m_used.find(k.offset);
+                if (it == m_used.end() || it->second != b || k.offset % k.alignment) return false;
+                ++usedCount; used += k.size; requested += k.requested;
+            }
+            prevFree = k.free;
+            expected += k.size;
+        }
+        if (expected != m_capacity || usedCount != m_used.size() || used != m_usedBytes || requested != m_requestedBytes) return false;
+
+        size_t listed = 0;
+        for (int fl = 0; fl < FlCount; ++fl)
+        {
+            if (((m_flBitmap >> fl) & 1) != (m_slBitmap[fl] != 0)) return false;
+            for (int sl = 0; sl < SlCount; ++sl)
+            {
+                if (((m_slBitmap[fl] >> sl) & 1) != (m_heads[fl][sl] != Nil)) return false;
+                for (uint32_t b = m_heads[fl][sl], prev = Nil; b != Nil; prev = b, b = m_blocks[b].nextFree)
+                {
+                    int f, s;
+                    Mapping(m_blocks[b].size / m_granularity, f, s);
+                    if (!m_blocks[b].free || f != fl || s != sl || m_blocks[b].prevFree != prev) return false;
+                    ++listed;
+                }
+            }
+        }
+        return listed == freeCount;
+    }
+
+private:
+    static const int SlBits = 4, SlCount = 1 << SlBits, FlCount = 64;
+    static const uint32_t Nil = ~0u;
+
+    struct Block
+    {
+        uint64_t offset, size;
+        uint64_t requested, alignment; // solo bloques asignados
+        uint32_t prevPhys, nextPhys;   // vecinos por dirección
+        uint32_t prevFree, nextFree;   // lista libre de su (fl, sl)
+        bool free;
+    };
+
+    // (fl, sl) de un tamaño en unidades de granularidad: fl = log2, sl = los 4 bits que siguen al más alto.
+    static void Mapping(uint64_t units, int& fl, int& sl)
+    {
+        fl = HighestBit64(units);
+        sl = (fl < SlBits) ? (int)((units << (SlBits - fl)) & (SlCount - 1)) : (int)((units >> (fl - SlBits)) & (SlCount - 1));
+    }
+
+    // Primer bloque libre de tamaño >= search (ya redondeado por SearchSize: cualquier bloque de su lista alcanza).
+    uint32_t FindFree(uint64_t search) const
+    {
+        int fl, sl;
+        Mapping(search / m_granularity, fl, sl);
+        uint32_t slMap = m_slBitmap[fl] & (~0u << sl);
+        if (!slMap)
+        {
+            const uint64_t flMap = (fl + 1 < FlCount) ? (m_flBitmap & (~0ull << (fl + 1))) : 0;
+            if (!flMap) return Nil;
+            fl = LowestBit64(flMap);
+            slMap = m_slBitmap[fl];
+        }
+        return m_heads[fl][LowestBit64(slMap)];
+    }
+
+    // Asigna [offset, offset + AlignUp(size)) dentro del bloque libre b: lo saca de la lista y devuelve a la lista
+    // libre lo que sobre adelante (alineación) y atrás.
+    uint64_t Carve(uint32_t b, uint64_t offset, uint64_t size, uint64_t alignment)
+    {
+        RemoveFree(b);
+        if (offset > m_blocks[b].offset)
+        {
+            const uint32_t front = b;
+            b = Split(front, offset - m_blocks[front].offset);
+            InsertFree(front);
+        }
+        const uint64_t rounded = AlignUp64(size, m_granularity);
+        if (m_blocks[b].size > rounded) InsertFree(Split(b, rounded));
+
+        Block& k = m_blocks[b];
+        k.free = false;
+        k.requested = size;
+        k.alignment = alignment;
+        m_used[k.offset] = b;
+        m_usedBytes += k.size;
+        m_requestedBytes += size;
+        return k.offset;
+    }
+
+    // Corta b en [0, size) (queda en b) y el resto (bloque nuevo, devuelto, marcado libre y fuera de las listas).
+    uint32_t Split(uint32_t b, uint64_t size)
+    {
+        const uint32_t n = NewBlock(m_blocks[b].offset + size, m_blocks[b].size - size, b, m_blocks[b].nextPhys);
+        if (m_blocks[n].nextPhys != Nil) m_blocks[m_blocks[n].nextPhys].prevPhys = n;
+        m_blocks[b].nextPhys = n;
+        m_blocks[b].size = size;
+        return n;
+    }
+
+    // Junta b con su vecino físico siguiente 'next' (los dos fuera de las listas); sobrevive b.
+    uint32_t Merge(uint32_t b, uint32_t next)
+    {
+        m_blocks[b].size += m_blocks[next].size;
+        m_blocks[b].nextPhys = m_blocks[next].nextPhys;
+        if (m_blocks[b].nextPhys != Nil) m_blocks[m_blocks[b].nextPhys].prevPhys = b;
+        m_unusedBlocks.push_back(next);
+        return b;
+    }
+
+    uint32_t NewBlock(uint64_t offset, uint64_t size, uint32_t prevPhys, uint32_t nextPhys)
+    {
+        const Block k = { offset, size, 0, 0, prevPhys, nextPhys, Nil, Nil, true };
+        if (!m_unusedBlocks.empty())
+        {
+            const uint32_t b = m_unusedBlocks.back();
+            m_unusedBlocks.pop_back();
+            m_blocks[b] = k;
+            return b;
+        }
+        m_blocks.push_back(k);
+        return (uint32_t)m_blocks.size() - 1;
+    }
+
+    void InsertFree(uint32_t b)
+    {
+        int fl, sl;
+        Mapping(m_blocks[b].size / m_granularity, fl, sl);
+        Block& k = m_blocks[b];
+        k.free = true;
+        k.prevFree = Nil;
+        k.nextFree = m_heads[fl][sl];
+        if (k.nextFree != Nil) m_blocks[k.nextFree].prevFree = b;
+        m_heads[fl][sl] = b;
+        m_slBitmap[fl] |= 1u << sl;
+        m_flBitmap |= 1ull << fl;
+    }
+
+    void RemoveFree(uint32_t b)
+    {
+        int fl, sl;
+        Mapping(m_blocks[b].size / m_granularity, fl, sl);
+        const Block& k = m_blocks[b];
+        if (k.prevFree != Nil) m_blocks[k.prevFree].nextFree = k.nextFree;
+        else m_heads[fl][sl] = k.nextFree;
+        if (k.nextFree != Nil) m_blocks[k.nextFree].prevFree = k.prevFree;
+        if (m_heads[fl][sl] == Nil)
+        {
+            m_slBitmap[fl] &= ~(1u << sl);
+            if (!m_slBitmap[fl]) m_flBitmap &= ~(1ull << fl);
+        }
+    }
+
+    // El bloque de offset 0: al fusionar sobrevive siempre el de menor dirección, así que es el 0 mientras haya capacidad.
+    uint32_t FirstBlock() const { return m_blocks.empty() ? Nil : 0; }
+
+    uint64_t m_capacity = 0, m_granularity = 256;
+    std::vector<Block> m_blocks;          // pool de bloques (libres y asignados); índices estables
+    std::vector<uint32_t> m_unusedBlocks; // entradas de m_blocks sin usar
+    std::unordered_map<uint64_t, uint32_t> m_used; // offset asignado → bloque
+    uint64_t m_flBitmap = 0;
+    uint32_t m_slBitmap[FlCount];
+    uint32_t m_heads[FlCount][SlCount];
+    uint64_t m_usedBytes = 0, m_requestedBytes = 0;
+};
+
+// Categorías de heap de D3D12 (resource heap tier 1 no deja mezclarlas en un mismo heap)
+enum GpuResourceCategory { GpuCategoryBuffers, GpuCategoryRtDsTextures, GpuCategoryOtherTextures, GpuCategoryCount };
+
+// Dueño de una región de heap. Se guarda como private data del recurso placed, así que D3D lo suelta cuando el
+// recurso se destruye (el último Release del ComPtr, también el de DeferredReleaseQueue) y recién ahí la región vuelve
+// al TLSF. El resto del código sigue manejando ComPtr<ID3D12Resource> igual que con recursos committed.
+class GpuRegionToken : public IUnknown
+{
+public:
+    explicit GpuRegionToken(std::function<void()> onRelease) : m_onRelease(std::move(onRelease)) {}
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** out) override
+    {
+        if (!IsEqualGUID(riid, IID_IUnknown)) { *out = nullptr; return E_NOINTERFACE; }
+        AddRef();
+        *out = static_cast<IUnknown*>(this);
+        return S_OK;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return ++m_refs; }
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        const ULONG refs = --m_refs;
+        if (refs == 0) { m_onRelease(); delete this; }
+        return refs;
+    }
+
+private:
+    std::atomic<ULONG> m_refs{ 1 };
+    std::function<void()> m_onRelease;
+};
+
+// {6A1E3F52-9C4D-4B7A-8E21-5D3C7094B1E6}: clave del GpuRegionToken en la private data del recurso
+static const GUID GpuRegionTokenGuid = { 0x6a1e3f52, 0x9c4d, 0x4b7a, { 0x8e, 0x21, 0x5d, 0x3c, 0x70, 0x94, 0xb1, 0xe6 } };
+
+// Recursos placed en heaps grandes (HeapSize) por tipo de memoria (DEFAULT, UPLOAD, READBACK) y categoría. Cada heap
+// reparte su espacio con un TlsfAllocator de granularidad 64 KB (la alineación de un buffer placed); lo que pide 4 MB
+// (MSAA) usa esa clase de alineación dentro del mismo heap. Lo que no entra en un heap, los tipos de heap custom y
+// -committed-resources van a CreateCommittedResource como antes. Un heap que queda vacío se libera si su pool tiene otro.
+class GpuHeapAllocator
+{
+public:
+    static const UINT64 HeapSize = 64ull << 20;
+
+    void Init(ID3D12Device* device, bool placed)
+    {
+        m_device = device;
+        m_placed = placed;
+    }
+
+    HRESULT CreateResource(D3D12_HEAP_TYPE type, const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES state,
+        const D3D12_CLEAR_VALUE* clear, ComPtr<ID3D12Resource>& out)
+    {
+        out.Reset();
+        const D3D12_RESOURCE_ALLOCATION_INFO info = m_device->GetResourceAllocationInfo(0, 1, &desc);
+        const int typeIndex = (int)type - (int)D3D12_HEAP_TYPE_DEFAULT; // DEFAULT, UPLOAD, READBACK son 1, 2, 3
+        if (!m_placed || typeIndex < 0 || typeIndex >= HeapTypeCount || info.SizeInBytes > HeapSize)
+            return CreateCommitted(type, desc, state, clear, info.SizeInBytes, out);
+
+        const GpuResourceCategory category = CategoryOf(desc);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::unique_ptr<Heap>>& pool = m_pools[typeIndex][category];
+
+        Heap* heap = nullptr;
+        uint64_t offset = TlsfAllocator::Invalid;
+        for (auto& h : pool)
+        {
+            if (!h->heap) continue;
+            offset = h->tlsf.Allocate(info.SizeInBytes, info.Alignment);
+            if (offset != TlsfAllocator::Invalid) { heap = h.get(); break; }
+        }
+        if (!heap)
+        {
+            D3D12_HEAP_DESC hd = {};
+            hd.SizeInBytes = HeapSize;
+            hd.Properties.Type = type;
+            hd.Alignment = (category == GpuCategoryRtDsTextures) ? D3D12_DEFAULT_MSAA_RESOURCE_PLACEMENT_ALIGNMENT : 0;
+            hd.Flags = (category == GpuCategoryBuffers) ? D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS :
+                (category == GpuCategoryRtDsTextures) ? D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES : D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES;
+
+            auto slot = std::find_if(pool.begin(), pool.end(), [](const std::unique_ptr<Heap>& h) { return !h->heap; });
+            if (slot == pool.end()) { pool.emplace_back(new Heap()); slot = pool.end() - 1; }
+            heap = slot->get();
+            HRESULT hr = m_device->CreateHeap(&hd, IID_PPV_ARGS(&heap->heap));
+            if (FAILED(hr)) return hr;
+            heap->tlsf.Reset(HeapSize, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+            offset = heap->tlsf.Allocate(info.SizeInBytes, info.Alignment);
+            ++m_heapsCreated;
+        }
+
+        HRESULT hr = m_device->CreatePlacedResource(heap->heap.Get(), offset, &desc, state, clear, IID_PPV_ARGS(&out));
+        if (SUCCEEDED(hr))
+        {
+            GpuRegionToken* token = new GpuRegionToken([this, typeIndex, category, heap, offset]() { Release(typeIndex, category, heap, offset); });
+            hr = out->SetPrivateDataInterface(GpuRegionTokenGuid, token); // el recurso toma su referencia
+            token->Release();
+            if (FAILED(hr)) out.Reset(); // sin token nadie devolvería la región: se devuelve abajo
+            else { ++m_placedCount; return S_OK; }
+        }
+        heap->tlsf.Free(offset);
+        return hr;
+    }
+
+    // Una línea por pool con heaps: uso, bytes perdidos por redondeo, fragmentación y lo que movería una
+    // desfragmentación (Defragment sobre una copia del TLSF: hoy ningún recurso de la app se reubica).
+    void LogStats(const char* when) const
+    {
+        static const char* typeNames[] = { "DEFAULT", "UPLOAD", "READBACK" };
+        static const char* categoryNames[] = { "buffers", "rt/ds", "textures" };
+        const double mb = 1.0 / (1024.0 * 1024.0);
+        char buf[384];
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sprintf_s(buf, "GPU heaps (%s): %s | %llu placed alive, %llu heaps created | %llu committed created (%.2f MB)\n", when,
+            m_placed ? "placed" : "committed only (-committed-resources)", (unsigned long long)m_placedCount,
+            (unsigned long long)m_heapsCreated, (unsigned long long)m_committedCount, m_committedBytes * mb);
+        OutputDebugStringA(buf);
+
+        for (int t = 0; t < HeapTypeCount; ++t)
+            for (int c = 0; c < GpuCategoryCount; ++c)
+            {
+                UINT heaps = 0;
+                TlsfStats total;
+                size_t moves = 0;
+                uint64_t movedBytes = 0, largestAfter = 0;
+                for (const auto& h : m_pools[t][c])
+                {
+                    if (!h->heap) continue;
+                    const TlsfStats s = h->tlsf.Stats();
+                    ++heaps;
+                    total.capacity += s.capacity; total.usedBytes += s.usedBytes; total.requestedBytes += s.requestedBytes;
+                    total.freeBytes += s.freeBytes; total.allocations += s.allocations; total.freeBlocks += s.freeBlocks;
+                    total.largestFree = (std::max)(total.largestFree, s.largestFree);
+
+                    TlsfAllocator plan = h->tlsf;
+                    moves += plan.Defragment([&movedBytes](uint64_t, uint64_t, uint64_t size) { movedBytes += size; });
+                    largestAfter = (std::max)(largestAfter, plan.Stats().largestFree);
+                }
+                if (!heaps) continue;
+                sprintf_s(buf, "GPU heaps %-8s %-8s: %u x %llu MB | %u allocs, %.2f MB used (%.2f MB requested, %.2f MB wasted) | "
+                    "%.2f MB free in %u blocks, largest %.2f MB, fragmentation %.1f%% | defrag: %zu moves (%.2f MB) -> largest %.2f MB\n",
+                    typeNames[t], categoryNames[c], heaps, (unsigned long long)(HeapSize >> 20), total.allocations, total.usedBytes * mb,
+                    total.requestedBytes * mb, total.Wasted() * mb, total.freeBytes * mb, total.freeBlocks, total.largestFree * mb,
+                    total.Fragmentation() * 100.0, moves, movedBytes * mb, largestAfter * mb);
+                OutputDebugStringA(buf);
+            }
+    }
+
+private:
+    static const int HeapTypeCount = 3;
+    struct Heap { ComPtr<ID3D12Heap> heap; TlsfAllocator tlsf; };
+
+    static GpuResourceCategory CategoryOf(const D3D12_RESOURCE_DESC& desc)
+    {
+        if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER) return GpuCategoryBuffers;
+        return (desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)) ?
+            GpuCategoryRtDsTextures : GpuCategoryOtherTextures;
+    }
+
+    HRESULT CreateCommitted(D3D12_HEAP_TYPE type, const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES state,
+        const D3D12_CLEAR_VALUE* clear, UINT64 size, ComPtr<ID3D12Resource>& out)
+    {
+        D3D12_HEAP_PROPERTIES hp = {};
+        hp.Type = type;
+        const HRESULT hr = m_device->CreateCommittedResource(&hp, D3D12_HEAP_FLAG_NONE, &desc, state, clear, IID_PPV_ARGS(&out));
+        if (SUCCEEDED(hr)) { std::lock_guard<std::mutex> lock(m_mutex); ++m_committedCount; m_committedBytes += size; }
+        return hr;
+    }
+
+    // Desde GpuRegionToken, cuando D3D destruye el recurso placed (en cualquier hilo).
+    void Release(int typeIndex, int category, Heap* heap, uint64_t offset)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        heap->tlsf.Free(offset);
+        --m_placedCount;
+        if (!heap->tlsf.Empty()) return;
+
+        const auto& pool = m_pools[typeIndex][category];
+        const bool another = std::any_of(pool.begin(), pool.end(), [heap](const std::unique_ptr<Heap>& h) { return h.get() != heap && h->heap; });
+        if (another) heap->heap.Reset(); // el slot queda para el próximo heap del pool
+    }
+
+    ID3D12Device* m_device = nullptr;
+    bool m_placed = true;
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Heap>> m_pools[HeapTypeCount][GpuCategoryCount];
+    uint64_t m_placedCount = 0, m_heapsCreated = 0, m_committedCount = 0, m_committedBytes = 0;
+};
+
+// Fuzz de la política de heaps en CPU, sin device (-heap-selftest). Casos fijos (lleno exacto, tamaños inválidos,
+// alineaciones), después secuencias aleatorias de Allocate/Free con tamaños de 1 byte a 8 MB y las clases de
+// alineación de D3D12, contra un modelo de referencia: sin solapamientos, alineación respetada, invariantes internos
+// (Validate), contadores exactos y que un fallo solo pase si de verdad no queda un bloque de SearchSize. Al final se
+// libera todo (tiene que quedar un solo bloque) y se prueba Defragment. Devuelve el exit code del proceso.
+int RunHeapAllocatorSelfTest()
+{
+    bool ok = true;
+    char buf[384];
+    auto report = [&](const char* step, bool pass, const char* detail = "")
+    {
+        sprintf_s(buf, "Heap allocator [%s]: %s%s\n", step, pass ? "OK" : "FAIL", detail);
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
+
+    // 1) Casos fijos
+    {
+        TlsfAllocator t(1 << 20, 256);
+        const uint64_t all = t.Allocate(1 << 20);
+        const bool full = all == 0 && t.Allocate(1) == TlsfAllocator::Invalid && t.Validate();
+        t.Free(all);
+        const bool invalid = t.Allocate(0) == TlsfAllocator::Invalid && t.Allocate((1 << 20) + 1) == TlsfAllocator::Invalid;
+        const uint64_t a = t.Allocate(100), b = t.Allocate(300, 65536), c = t.Allocate(256);
+        const bool aligned = a % 256 == 0 && b % 65536 == 0 && b != TlsfAllocator::Invalid && c != TlsfAllocator::Invalid && t.Validate();
+        const TlsfStats s = t.Stats();
+        const bool counted = s.allocations == 3 && s.requestedBytes == 656 && s.usedBytes == 256 + 512 + 256 && s.Wasted() == 368;
+        t.Free(b); t.Free(a); t.Free(c);
+        const bool merged = t.Validate() && t.Stats().freeBlocks == 1 && t.Stats().largestFree == (1 << 20);
+        report("fixed cases", full && invalid && aligned && counted && merged);
+    }
+
+    // 2) Fuzz contra un modelo (offset → tamaño pedido, alineación)
+    struct Live { uint64_t size, alignment; };
+    static const uint64_t alignments[] = { 1, 256, 4096, 65536, 4ull << 20 };
+    uint64_t totalOps = 0, failures = 0;
+    for (uint32_t seed = 1; seed <= 8; ++seed)
+    {
+        const uint64_t granularity = (seed & 1) ? 256 : 65536; // general y la de los heaps de GPU
+        TlsfAllocator t(256ull << 20, granularity);
+        std::map<uint64_t, Live> live;
+        uint64_t requested = 0;
+        uint32_t rng = seed * 2654435761u;
+        auto next = [&rng]() { rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5; return rng; };
+
+        bool pass = true;
+        for (int op = 0; op < 100000 && pass; ++op)
+        {
+            const bool alloc = live.empty() || (next() % 100) < (op < 20000 ? 70u : 50u); // crece y después se mantiene casi lleno
+            if (alloc)
+            {
+                const uint64_t size = 1 + (next() % (1u << (next() % 24)));      // log-uniforme hasta 8 MB
+                const uint64_t alignment = alignments[next() % 5];
+                const uint64_t off = t.Allocate(size, alignment);
+                if (off == TlsfAllocator::Invalid)
+                {
+                    ++failures;
+                    pass = t.Stats().largestFree < t.SearchSize(size, alignment);
+                    continue;
+                }
+                pass = off % (std::max)(alignment, granularity) == 0 && off + size <= (256ull << 20);
+                auto it = live.lower_bound(off);
+                if (it != live.end()) pass = pass && off + size <= it->first;
+                if (it != live.begin()) { --it; pass = pass && it->first + it->second.size <= off; }
+                live[off] = { size, alignment };
+                requested += size;
+            }
+            else
+            {
+                auto it = live.begin();
+                std::advance(it, next() % live.size());
+                requested -= it->second.size;
+                t.Free(it->first);
+                live.erase(it);
+            }
+            if (op % 1000 == 0) pass = pass && t.Validate() && t.Stats().requestedBytes == requested && t.Stats().allocations == live.size();
+            ++totalOps;
+        }
+
+        // 3) Desfragmentación sobre lo que quedó: solo baja, no pisa nada, respeta la alineación y no empeora
+        const TlsfStats before = t.Stats();
+        std::map<uint64_t, Live> moved;
+        t.Defragment([&](uint64_t from, uint64_t to, uint64_t size)
+        {
+            auto it = live.find(from);
+            pass = pass && it != live.end() && it->second.size == size && to < from && to % (std::max)(it->second.alignment, granularity) == 0;
+            if (it == live.end()) return;
+            const Live l = it->second;
+            live.erase(it);
+            live[to] = l;
+        });
+        const TlsfStats after = t.Stats();
+        for (auto it = live.begin(); pass && it != live.end(); ++it)
+        {
+            auto n = std::next(it);
+            pass = n == live.end() || it->first + it->second.size <= n->first;
+        }
+        pass = pass && t.Validate() && after.largestFree >= before.largestFree && after.allocations == before.allocations;
+
+        for (const auto& l : live) t.Free(l.first);
+        pass = pass && t.Validate() && t.Stats().freeBlocks == 1 && t.Stats().usedBytes == 0;
+
+        char step[32], detail[256];
+        sprintf_s(step, "fuzz seed %u", seed);
+        sprintf_s(detail, " (granularity %llu, %u live: fragmentation %.1f%% -> %.1f%% after defrag, largest free %.1f -> %.1f MB, wasted %.2f MB)",
+            (unsigned long long)granularity, before.allocations, before.Fragmentation() * 100.0, after.Fragmentation() * 100.0,
+            before.largestFree / 1048576.0, after.largestFree / 1048576.0, before.Wasted() / 1048576.0);
+        report(step, pass, detail);
+    }
+
+    // 4) Costo sin chequeos: 1M pares Allocate/Free sobre un heap a medio llenar (tamaños de 64 KB a 4 MB)
+    {
+        TlsfAllocator t(1ull << 30, 65536);
+        std::vector<uint64_t> slots(4096, TlsfAllocator::Invalid);
+        uint32_t rng = 12345;
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < 1000000; ++i)
+        {
+            rng = rng * 1664525u + 1013904223u;
+            uint64_t& slot = slots[(rng >> 8) % slots.size()];
+            if (slot != TlsfAllocator::Invalid) { t.Free(slot); slot = TlsfAllocator::Invalid; }
+            else slot = t.Allocate(65536ull << ((rng >> 20) % 7));
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        sprintf_s(buf, "Heap allocator: %llu fuzz ops (%llu out-of-space) | 1M unchecked ops in %.1f ms (%.0f ns/op), fragmentation %.1f%%\n",
+            (unsigned long long)totalOps, (unsigned long long)failures, ms, ms * 1e6 / 1000000.0, t.Stats().Fragmentation() * 100.0);
+        OutputDebugStringA(buf);
+        ok = ok && t.Validate();
+    }
+    return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Render graph: orden de pasadas, culling y aliasing de transitorios
+//--------------------------------------------------------------------------------------
+
+// El frame se declara como pasadas que leen y escriben recursos (con el estado en que los necesitan) y Compile decide,
+// sin device: qué pasadas sobran (nada de lo que producen se usa), en qué orden van, dónde vive cada textura
+// transitoria dentro de un heap compartido (dos que no están vivas a la vez pueden ocupar la misma memoria) y qué
+// barreras pide cada pasada. Execute las graba en una command list a través del ResourceStateTracker.
+//  - Los recursos importados (backbuffer, readback) vienen de afuera y su estado lo lleva el registry entre frames.
+//  - Los transitorios los crea el grafo: solo texturas RT/DS (el heap es ALLOW_ONLY_RT_DS_TEXTURES) y su contenido no
+//    sobrevive al frame. La primera pasada que usa uno tiene que escribirlo.
+//  - Los accesos a un mismo recurso se ordenan como se declararon (RAW, WAR, WAW, y lecturas en estados distintos),
+//    salvo lecturas en el mismo estado, que pueden ir en cualquier orden entre ellas.
+
+typedef UINT RgHandle;
+
+// Textura transitoria del grafo.
+struct RgTextureDesc
+{
+    UINT width = 0, height = 0;
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+    D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE; // ALLOW_RENDER_TARGET o ALLOW_DEPTH_STENCIL
+    D3D12_CLEAR_VALUE clear = {};                           // clear optimizado (Format = format)
+
+    bool operator==(const RgTextureDesc& o) const
+    {
+        return width == o.width && height == o.height && format == o.format && flags == o.flags && memcmp(&clear, &o.clear, sizeof(clear)) == 0;
+    }
+};
+
+inline D3D12_RESOURCE_DESC TextureDesc(const RgTextureDesc& d)
+{
+    D3D12_RESOURCE_DESC rd = {};
+    rd.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+    rd.Width = d.width; rd.Height = d.height; rd.DepthOrArraySize = 1;
+    rd.MipLevels = 1; rd.Format = d.format; rd.SampleDesc = { 1, 0 };
+    rd.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN; rd.Flags = d.flags;
+    return rd;
+}
+
+// Uso de un recurso por una pasada.
+struct RgAccess { RgHandle res; D3D12_RESOURCE_STATES state; bool write; };
+
+// Una pasada del orden compilado y lo que hay que pedirle al tracker antes de grabarla.
+struct RgScheduledPass
+{
+    UINT pass = 0;                                                         // índice de declaración
+    std::vector<RgAccess> states;                                          // un pedido por recurso (lecturas combinadas)
+    std::vector<std::pair<RgHandle, D3D12_RESOURCE_STATES>> splitBegins;   // BEGIN de barreras que terminan en una pasada posterior
+    std::vector<std::pair<RgHandle, RgHandle>> aliasing;                   // (anterior, nuevo); anterior = RenderGraph::None si eran varios
+    std::vector<RgHandle> discards;                                        // transitorios con memoria compartida que nacen acá
+};
+
+// Transitorio usado por alguna pasada viva: vida [first, last] en posiciones del orden y lugar en el heap.
+struct RgTransient
+{
+    RgHandle res = 0;
+    UINT first = 0, last = 0;
+    UINT64 offset = 0, size = 0, alignment = 0;
+    bool aliased = false; // comparte memoria con otro transitorio
+};
+
+class RenderGraph
+{
+public:
+    static const RgHandle None = ~0u;
+    typedef std::function<void(ID3D12GraphicsCommandList*)> ExecuteFn;
+    typedef std::function<D3D12_RESOURCE_ALLOCATION_INFO(const RgTextureDesc&)> SizeFn; // GetResourceAllocationInfo (o uno falso)
+
+    // Borra las pasadas y los recursos declarados (las estadísticas de compilación quedan).
+    void Reset()
+    {
+        m_resources.clear();
+        m_passes.clear();
+        m_order.clear();
+        m_culled.clear();
+        m_transients.clear();
+        m_errors.clear();
+        m_heapSize = m_unaliasedSize = 0;
+    }
+
+    RgHandle Import(const char* name, ID3D12Resource* res = nullptr)
+    {
+        Resource r;
+        r.name = name;
+        r.imported = true;
+        r.physical = res;
+        m_resources.push_back(std::move(r));
+        return (RgHandle)m_resources.size() - 1;
+    }
+
+    RgHandle CreateTexture(const char* name, const RgTextureDesc& desc)
+    {
+        Resource r;
+        r.name = name;
+        r.desc = desc;
+        m_resources.push_back(std::move(r));
+        return (RgHandle)m_resources.size() - 1;
+    }
+
+    // Una pasada con side effects (present, readback) nunca se descarta aunque nadie lea lo que escribe.
+    UINT AddPass(const char* name, ExecuteFn execute, bool sideEffect = false)
+    {
+        Pass p;
+        p.name = name;
+        p.execute = std::move(execute);
+        p.sideEffect = sideEffect;
+        m_passes.push_back(std::move(p));
+        return (UINT)m_passes.size() - 1;
+    }
+
+    void Read(UINT pass, RgHandle res, D3D12_RESOURCE_STATES state) { m_passes[pass].accesses.push_back({ res, state, false }); }
+    void Write(UINT pass, RgHandle res, D3D12_RESOURCE_STATES state) { m_passes[pass].accesses.push_back({ res, state, true }); }
+
+    // Recurso físico de un handle: los importados lo traen de Import, los transitorios los pone el que los crea (después de Compile).
+    void Bind(RgHandle res, ID3D12Resource* physical) { m_resources[res].physical = physical; }
+    ID3D12Resource* Physical(RgHandle res) const { return res == None ? nullptr : m_resources[res].physical; }
+
+    // Culling, orden, vidas, heap y barreras. Devuelve false (y deja Errors) si el grafo está mal declarado.
+    bool Compile(const SizeFn& sizeOf)
+    {
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        const UINT passCount = (UINT)m_passes.size(), resCount = (UINT)m_resources.size();
+        m_order.clear();
+        m_culled.clear();
+        m_transients.clear();
+        m_errors.clear();
+        m_heapSize = m_unaliasedSize = 0;
+
+        // 1) Productores: la última pasada declarada antes que escribió cada recurso que se usa. Una escritura también
+        //    depende de la anterior (puede ser parcial).
+        std::vector<std::vector<UINT>> producers(passCount);
+        {
+            std::vector<UINT> writer(resCount, None);
+            for (UINT p = 0; p < passCount; ++p)
+                for (const RgAccess& a : m_passes[p].accesses)
+                {
+                    const UINT w = writer[a.res];
+                    if (w != None && w != p) producers[p].push_back(w);
+                    else if (w == None && !a.write && !m_resources[a.res].imported)
+                        Error("pass '%s' reads transient '%s' before any pass writes it", m_passes[p].name.c_str(), m_resources[a.res].name.c_str());
+                    if (a.write) writer[a.res] = p;
+                }
+        }
+
+        // 2) Culling: quedan las pasadas con side effects o que escriben un importado, y hacia atrás sus productores.
+        std::vector<char> live(passCount, 0);
+        std::vector<UINT> stack;
+        for (UINT p = 0; p < passCount; ++p)
+        {
+            const Pass& pass = m_passes[p];
+            const bool root = pass.sideEffect || std::any_of(pass.accesses.begin(), pass.accesses.end(),
+                [&](const RgAccess& a) { return a.write && m_resources[a.res].imported; });
+            if (root) { live[p] = 1; stack.push_back(p); }
+        }
+        while (!stack.empty())
+        {
+            const UINT p = stack.back();
+            stack.pop_back();
+            for (UINT q : producers[p])
+                if (!live[q]) { live[q] = 1; stack.push_back(q); }
+        }
+        for (UINT p = 0; p < passCount; ++p)
+            if (!live[p]) m_culled.push_back(p);
+
+        // 3) Aristas de orden entre pasadas vivas (siempre de una declarada antes a una después: no hay ciclos).
+        std::vector<std::vector<UINT>> next(passCount);
+        std::vector<UINT> indegree(passCount, 0);
+        {
+            // readers = lecturas desde la última escritura en el estado actual; prevReaders = las del estado anterior
+            struct Cursor { UINT writer = None; std::vector<UINT> readers, prevReaders; D3D12_RESOURCE_STATES readState = D3D12_RESOURCE_STATE_COMMON; };
+            std::vector<Cursor> cursors(resCount);
+            auto edge = [&](UINT from, UINT to) { if (from != to) { next[from].push_back(to); ++indegree[to]; } };
+            for (UINT p = 0; p < passCount; ++p)
+            {
+                if (!live[p]) continue;
+                for (const RgAccess& a : m_passes[p].accesses)
+                {
+                    Cursor& c = cursors[a.res];
+                    if (c.writer != None) edge(c.writer, p);
+                    if (a.write)
+                    {
+                        for (UINT r : c.readers) edge(r, p); // WAR
+                        c.readers.clear();
+                        c.prevReaders.clear();
+                        c.writer = p;
+                    }
+                    else
+                    {
+                        if (!c.readers.empty() && c.readState != a.state) // en el medio hay una transición
+                        {
+                            c.prevReaders.swap(c.readers);
+                            c.readers.clear();
+                        }
+                        for (UINT r : c.prevReaders) edge(r, p);
+                        c.readers.push_back(p);
+                        c.readState = a.state;
+                    }
+                }
+            }
+        }
+
+        // 4) Orden topológico. Entre las listas, primero la que más usa lo que escribió la última ordenada (así el
+        //    consumidor sigue al productor y los transitorios viven menos) y después la declarada antes.
+        {
+            std::vector<UINT> ready;
+            std::vector<char> justWritten(resCount, 0);
+            for (UINT p = 0; p < passCount; ++p)
+                if (live[p] && indegree[p] == 0) ready.push_back(p);
+            UINT last = None;
+            while (!ready.empty())
+            {
+                size_t best = 0;
+                int bestScore = -1;
+                for (size_t i = 0; i < ready.size(); ++i)
+                {
+                    int score = 0;
+                    for (const RgAccess& a : m_passes[ready[i]].accesses) score += justWritten[a.res];
+                    if (score > bestScore || (score == bestScore && ready[i] < ready[best])) { best = i; bestScore = score; }
+                }
+                const UINT p = ready[best];
+                ready.erase(ready.begin() + best);
+
+                if (last != None)
+                    for (const RgAccess& a : m_passes[last].accesses) justWritten[a.res] = 0;
+                for (const RgAccess& a : m_passes[p].accesses)
+                    if (a.write) justWritten[a.res] = 1;
+                last = p;
+
+                RgScheduledPass sp;
+                sp.pass = p;
+                m_order.push_back(std::move(sp));
+                for (UINT s : next[p])
+                    if (--indegree[s] == 0) ready.push_back(s);
+            }
+            assert(m_order.size() + m_culled.size() == passCount);
+        }
+
+        // 5) Un pedido de estado por recurso y pasada (lecturas: los estados combinados; si además escribe, el de la
+        //    escritura) y la secuencia de usos de cada recurso en el orden final.
+        std::vector<std::vector<std::pair<UINT, D3D12_RESOURCE_STATES>>> uses(resCount);
+        for (UINT i = 0; i < (UINT)m_order.size(); ++i)
+        {
+            RgScheduledPass& sp = m_order[i];
+            for (const RgAccess& a : m_passes[sp.pass].accesses)
+            {
+                auto it = std::find_if(sp.states.begin(), sp.states.end(), [&](const RgAccess& s) { return s.res == a.res; });
+                if (it == sp.states.end()) sp.states.push_back(a);
+                else if (a.write) { it->state = a.state; it->write = true; }
+                else if (!it->write) it->state = it->state | a.state;
+            }
+            for (const RgAccess& s : sp.states) uses[s.res].push_back({ i, s.state });
+        }
+
+        // 6) Barreras divididas: si entre dos usos en estados distintos hay pasadas que no tocan el recurso, la
+        //    transición empieza al terminar el primero y termina antes del segundo.
+        for (RgHandle r = 0; r < resCount; ++r)
+            for (size_t k = 1; k < uses[r].size(); ++k)
+            {
+                const UINT i = uses[r][k - 1].first, j = uses[r][k].first;
+                if (j > i + 1 && !StateSatisfies(uses[r][k - 1].second, uses[r][k].second))
+                    m_order[i + 1].splitBegins.push_back({ r, uses[r][k].second });
+            }
+
+        // 7) Transitorios vivos y su lugar en el heap: de mayor a menor, en el offset alineado más bajo que no pisa a
+        //    ninguno ya ubicado cuya vida se superpone con la suya.
+        m_transientIndex.assign(resCount, None);
+        m_firstState.assign(resCount, D3D12_RESOURCE_STATE_COMMON);
+        for (RgHandle r = 0; r < resCount; ++r)
+        {
+            if (m_resources[r].imported || uses[r].empty()) continue;
+            const D3D12_RESOURCE_ALLOCATION_INFO info = sizeOf(m_resources[r].desc);
+            RgTransient t;
+            t.res = r;
+            t.first = uses[r].front().first;
+            t.last = uses[r].back().first;
+            t.size = info.SizeInBytes;
+            t.alignment = (std::max)((UINT64)info.Alignment, (UINT64)1);
+            m_transientIndex[r] = (UINT)m_transients.size();
+            m_firstState[r] = uses[r].front().second;
+            m_transients.push_back(t);
+            m_unaliasedSize = AlignUp64(m_unaliasedSize, t.alignment) + t.size;
+        }
+        auto livesOverlap = [](const RgTransient& a, const RgTransient& b) { return a.first <= b.last && b.first <= a.last; };
+        auto memoryOverlaps = [](const RgTransient& a, const RgTransient& b) { return a.offset < b.offset + b.size && b.offset < a.offset + a.size; };
+        {
+            std::vector<UINT> bySize(m_transients.size());
+            for (UINT i = 0; i < (UINT)bySize.size(); ++i) bySize[i] = i;
+            std::sort(bySize.begin(), bySize.end(), [&](UINT a, UINT b)
+                {
+                    const RgTransient& ta = m_transients[a], &tb = m_transients[b];
+                    return ta.size != tb.size ? ta.size > tb.size : ta.first != tb.first ? ta.first < tb.first : a < b;
+                });
+            std::vector<UINT> placed;
+            std::vector<std::pair<UINT64, UINT64>> busy;
+            for (UINT x : bySize)
+            {
+                RgTransient& t = m_transients[x];
+                busy.clear();
+                for (UINT y : placed)
+                    if (livesOverlap(t, m_transients[y])) busy.push_back({ m_transients[y].offset, m_transients[y].offset + m_transients[y].size });
+                std::sort(busy.begin(), busy.end());
+                UINT64 offset = 0;
+                for (const auto& b : busy)
+                {
+                    if (AlignUp64(offset, t.alignment) + t.size <= b.first) break;
+                    offset = (std::max)(offset, b.second);
+                }
+                t.offset = AlignUp64(offset, t.alignment);
+                m_heapSize = (std::max)(m_heapSize, t.offset + t.size);
+                placed.push_back(x);
+            }
+        }
+
+        // 8) Aliasing: un transitorio que comparte memoria con otros la toma con una barrera de aliasing antes de su
+        //    primer uso (de un solo anterior si es uno, de cualquiera si son varios) y se inicializa con un Discard.
+        for (RgTransient& t : m_transients)
+        {
+            RgHandle before = None;
+            UINT overlaps = 0;
+            for (const RgTransient& o : m_transients)
+                if (&o != &t && memoryOverlaps(t, o)) { before = o.res; ++overlaps; }
+            if (overlaps == 0) continue;
+            t.aliased = true;
+            m_order[t.first].aliasing.push_back({ overlaps == 1 ? before : None, t.res });
+            m_order[t.first].discards.push_back(t.res);
+        }
+
+        m_compileUs += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - t0).count();
+        ++m_compiles;
+        return m_errors.empty();
+    }
+
+    // Barreras de la pasada 'i' del orden (después va tracker.Flush): aliasing, BEGIN de las divididas y los estados.
+    void RequestBarriers(size_t i, ResourceStateTracker& tracker) const
+    {
+        const RgScheduledPass& sp = m_order[i];
+        for (const auto& a : sp.aliasing) tracker.Aliasing(Physical(a.first), Physical(a.second));
+        for (const auto& b : sp.splitBegins) tracker.BeginTransition(Physical(b.first), b.second);
+        for (const RgAccess& a : sp.states) tracker.Transition(Physical(a.res), a.state);
+    }
+
+    // Graba las pasadas vivas en orden: una ResourceBarrier por pasada, Discard de los transitorios que toman memoria
+    // de otro y la función de la pasada. El tracker tiene que estar en Begin. 'list' da la lista donde sigue el frame:
+    // una pasada que graba en varias listas en paralelo deja la continuación en otra.
+    void Execute(const std::function<ID3D12GraphicsCommandList*()>& list, ResourceStateTracker& tracker) const
+    {
+        for (size_t i = 0; i < m_order.size(); ++i)
+        {
+            ID3D12GraphicsCommandList* cl = list();
+            RequestBarriers(i, tracker);
+            tracker.Flush(cl);
+            for (RgHandle d : m_order[i].discards) cl->DiscardResource(Physical(d), nullptr);
+            const Pass& pass = m_passes[m_order[i].pass];
+            if (pass.execute) pass.execute(cl);
+        }
+    }
+
+    void Execute(ID3D12GraphicsCommandList* cl, ResourceStateTracker& tracker) const
+    {
+        Execute([cl]() { return cl; }, tracker);
+    }
+
+    const std::vector<RgScheduledPass>& Order() const { return m_order; }
+    const std::vector<UINT>& Culled() const { return m_culled; }           // índices de declaración
+    const std::vector<RgTransient>& Transients() const { return m_transients; }
+    const std::vector<std::string>& Errors() const { return m_errors; }
+    const std::string& PassName(UINT pass) const { return m_passes[pass].name; }
+    const std::vector<RgAccess>& Accesses(UINT pass) const { return m_passes[pass].accesses; } // como se declararon
+    const RgTextureDesc& Desc(RgHandle res) const { return m_resources[res].desc; }
+    const RgTransient* Transient(RgHandle res) const { return m_transientIndex[res] == None ? nullptr : &m_transients[m_transientIndex[res]]; }
+    D3D12_RESOURCE_STATES FirstState(RgHandle res) const { return m_firstState[res]; } // estado de creación de un transitorio
+    UINT PassCount() const { return (UINT)m_passes.size(); }
+    UINT64 HeapSize() const { return m_heapSize; }           // heap de transitorios con aliasing
+    UINT64 UnaliasedSize() const { return m_unaliasedSize; } // lo que ocuparían uno detrás de otro
+    double CompileUsAvg() const { return m_compiles ? m_compileUs / m_compiles : 0.0; }
+
+private:
+    struct Resource { std::string name; bool imported = false; RgTextureDesc desc; ID3D12Resource* physical = nullptr; };
+    struct Pass { std::string name; ExecuteFn execute; bool sideEffect = false; std::vector<RgAccess> accesses; };
+
+    void Error(const char* fmt, const char* a, const char* b)
+    {
+        char buf[256];
+        sprintf_s(buf, fmt, a, b);
+        m_errors.push_back(buf);
+    }
+
+    std::vector<Resource>               m_resources;
+    std::vector<Pass>                   m_passes;
+    std::vector<RgScheduledPass>        m_order;
+    std::vector<UINT>                   m_culled;
+    std::vector<RgTransient>            m_transients;
+    std::vector<UINT>                   m_transientIndex;
+    std::vector<D3D12_RESOURCE_STATES>  m_firstState;
+    std::vector<std::string>            m_errors;
+    UINT64                              m_heapSize = 0, m_unaliasedSize = 0;
+    double                              m_compileUs = 0.0;
+    UINT64                              m_compiles = 0;
+};
+const RgHandle RenderGraph::None; // definición fuera de la clase: Compile la pasa por referencia (vector(n, None), assign)
+
+// Memoria de los transitorios del grafo: un heap RT/DS con recursos placed en los offsets que decidió Compile. Los
+// recursos se reusan entre frames mientras coincidan desc y offset (el grafo del frame casi nunca cambia); lo que deja
+// de usarse, y el heap entero si hace falta uno más grande, se suelta con la cola de liberación diferida.
+class RgTransientPool
+{
+public:
+    void Init(ID3D12Device* device, ResourceStateRegistry* states, DeferredReleaseQueue* retired)
+    {
+        m_device = device;
+        m_states = states;
+        m_retired = retired;
+    }
+
+    // Crea (o reusa) y enlaza el recurso de cada transitorio. 'fence' = último valor enviado a la cola.
+    void Realize(RenderGraph& graph, UINT64 fence)
+    {
+        if (graph.HeapSize() > m_heapSize)
+        {
+            for (Entry& e : m_entries) Release(e, fence);
+            m_entries.clear();
+            m_retired->Retire(m_heap, fence);
+            D3D12_HEAP_DESC hd = {};
+            hd.SizeInBytes = AlignUp64(graph.HeapSize(), D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+            hd.Properties.Type = D3D12_HEAP_TYPE_DEFAULT;
+            hd.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+            hd.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES;
+            m_heap.Reset();
+            ThrowIfFailed(m_device->CreateHeap(&hd, IID_PPV_ARGS(&m_heap)));
+            m_heapSize = hd.SizeInBytes;
+        }
+
+        for (Entry& e : m_entries) e.used = false;
+        for (const RgTransient& t : graph.Transients())
+        {
+            const RgTextureDesc& desc = graph.Desc(t.res);
+            auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                [&](const Entry& e) { return !e.used && e.offset == t.offset && e.desc == desc; });
+            if (it == m_entries.end())
+            {
+                Entry e;
+                e.desc = desc;
+                e.offset = t.offset;
+                const D3D12_RESOURCE_DESC rd = TextureDesc(desc);
+                ThrowIfFailed(m_device->CreatePlacedResource(m_heap.Get(), t.offset, &rd, graph.FirstState(t.res), &desc.clear,
+                    IID_PPV_ARGS(&e.res)));
+                m_states->Register(e.res.Get(), 1, graph.FirstState(t.res));
+                m_entries.push_back(std::move(e));
+                it = m_entries.end() - 1;
+                ++m_generation;
+            }
+            it->used = true;
+            graph.Bind(t.res, it->res.Get());
+        }
+
+        for (size_t i = 0; i < m_entries.size();)
+        {
+            if (m_entries[i].used) { ++i; continue; }
+            Release(m_entries[i], fence);
+            m_entries.erase(m_entries.begin() + i);
+        }
+    }
+
+    UINT64 HeapSize() const { return m_heapSize; }
+    UINT64 Generation() const { return m_generation; } // cambia cuando se crea algún recurso (hay que rehacer las vistas)
+
+private:
+    struct Entry { RgTextureDesc desc; UINT64 offset = 0; ComPtr<ID3D12Resource> res; bool used = false; };
+
+    void Release(Entry& e, UINT64 fence)
+    {
+        m_states->Unregister(e.res.Get());
+        m_retired->Retire(e.res, fence);
+    }
+
+    ID3D12Device*           m_device = nullptr;
+    ResourceStateRegistry*  m_states = nullptr;
+    DeferredReleaseQueue*   m_retired = nullptr;
+    ComPtr<ID3D12Heap>      m_heap;
+    UINT64                  m_heapSize = 0;
+    UINT64                  m_generation = 0;
+    std::vector<Entry>      m_entries;
+};
+
+// Tamaño falso para compilar sin device: 4 bytes por texel en bloques de 64 KB (una textura 2D sin MSAA).
+inline D3D12_RESOURCE_ALLOCATION_INFO RgFakeAllocationInfo(const RgTextureDesc& d)
+{
+    D3D12_RESOURCE_ALLOCATION_INFO info = {};
+    info.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+    info.SizeInBytes = AlignUp64((UINT64)d.width * d.height * 4, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+    return info;
+}
+
+inline RgTextureDesc RgTestTexture(UINT size, bool depth)
+{
+    RgTextureDesc d;
+    d.width = d.height = size;
+    d.format = depth ? DXGI_FORMAT_D32_FLOAT : DXGI_FORMAT_R8G8B8A8_UNORM;
+    d.flags = depth ? D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL : D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+    d.clear.Format = d.format;
+    return d;
+}
+
+// Grafo sintético de 'passCount' pasadas para el fuzz y el benchmark: 4 importados y transitorios de 64² a 2048²;
+// cada pasada lee hasta 3 recursos ya escritos (en estados de lectura al azar) y escribe 1 o 2. Algunas tienen side
+// effects y alrededor de un tercio termina en un importado: el resto se puede descartar.
+inline void BuildRandomRenderGraph(RenderGraph& g, UINT passCount, uint32_t seed)
+{
+    uint32_t rng = seed * 2654435761u + 1;
+    auto next = [&rng](UINT n) { rng = rng * 1664525u + 1013904223u; return (UINT)((rng >> 8) % n); };
+    const D3D12_RESOURCE_STATES reads[] = { D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+        D3D12_RESOURCE_STATE_COPY_SOURCE };
+
+    g.Reset();
+    std::vector<RgHandle> written;
+    std::vector<char> depth;
+    for (UINT i = 0; i < 4; ++i) { written.push_back(g.Import("imported")); depth.push_back(0); }
+    const UINT firstTransient = (UINT)written.size();
+    const UINT transientCount = (std::max)(4u, passCount / 2);
+    for (UINT i = 0; i < transientCount; ++i)
+    {
+        const bool d = next(4) == 0;
+        g.CreateTexture("transient", RgTestTexture(64u << next(6), d));
+        depth.push_back(d);
+    }
+
+    for (UINT p = 0; p < passCount; ++p)
+    {
+        const UINT pass = g.AddPass("pass", nullptr, next(16) == 0);
+        const UINT readCount = next(4);
+        for (UINT r = 0; r < readCount; ++r)
+        {
+            const RgHandle res = written[next((UINT)written.size())];
+            g.Read(pass, res, depth[res] ? D3D12_RESOURCE_STATE_DEPTH_READ : reads[next(3)]);
+        }
+        const UINT writeCount = 1 + next(2);
+        for (UINT w = 0; w < writeCount; ++w)
+        {
+            const RgHandle res = next(3) == 0 ? next(firstTransient) : firstTransient + next(transientCount);
+            g.Write(pass, res, depth[res] ? D3D12_RESOURCE_STATE_DEPTH_WRITE : D3D12_RESOURCE_STATE_RENDER_TARGET);
+            if (std::find(written.begin(), written.end(), res) == written.end()) written.push_back(res);
+        }
+    }
+}
+
+// Chequeo del render graph sin ventana ni GPU (-render-graph-selftest): culling, orden que acorta vidas con aliasing
+// de dos sombras, WAR que el orden no puede romper, barreras divididas y de aliasing emitidas por el tracker (con
+// recursos falsos) durante dos frames, error de declaración, y un fuzz de grafos al azar contra las reglas de orden,
+// culling y memoria. Devuelve el exit code del proceso.
+int RunRenderGraphSelfTest()
+{
+    bool ok = true;
+    char buf[768];
+    const D3D12_RESOURCE_STATES Rt = D3D12_RESOURCE_STATE_RENDER_TARGET, Dsv = D3D12_RESOURCE_STATE_DEPTH_WRITE,
+        DepthRead = D3D12_RESOURCE_STATE_DEPTH_READ, Srv = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, Present = D3D12_RESOURCE_STATE_PRESENT;
+
+    auto report = [&](const char* step, bool pass, const std::string& detail)
+    {
+        sprintf_s(buf, "Render graph [%s]: %s (%s)\n", step, pass ? "OK" : "FAIL", detail.c_str());
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
+    auto orderString = [](const RenderGraph& g)
+    {
+        std::string s;
+        for (const RgScheduledPass& sp : g.Order()) s += (s.empty() ? "" : " ") + g.PassName(sp.pass);
+        return s;
+    };
+    // Las barreras de 'frames' frames seguidos como texto: "pasada: barrera, barrera | ..." (los recursos por nombre)
+    auto barrierString = [](const RenderGraph& g, ResourceStateRegistry& registry, const std::vector<std::pair<ID3D12Resource*, const char*>>& names,
+        int frames)
+    {
+        auto name = [&](ID3D12Resource* r) -> std::string
+        {
+            for (const auto& n : names) if (n.first == r) return n.second;
+            return r ? "?" : "*";
+        };
+        ResourceStateTracker tracker;
+        std::string s;
+        for (int f = 0; f < frames; ++f)
+        {
+            tracker.Begin(&registry);
+            for (size_t i = 0; i < g.Order().size(); ++i)
+            {
+                g.RequestBarriers(i, tracker);
+                std::vector<D3D12_RESOURCE_BARRIER> got;
+                tracker.Flush(got);
+                s += (s.empty() ? "" : " | ") + g.PassName(g.Order()[i].pass) + ":";
+                for (const D3D12_RESOURCE_BARRIER& b : got)
+                {
+                    char one[128];
+                    if (b.Type == D3D12_RESOURCE_BARRIER_TYPE_ALIASING)
+                        sprintf_s(one, " alias %s>%s", name(b.Aliasing.pResourceBefore).c_str(), name(b.Aliasing.pResourceAfter).c_str());
+                    else
+                        sprintf_s(one, " %s %x>%x%s", name(b.Transition.pResource).c_str(), (UINT)b.Transition.StateBefore, (UINT)b.Transition.StateAfter,
+                            b.Flags == D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY ? "/begin" : b.Flags == D3D12_RESOURCE_BARRIER_FLAG_END_ONLY ? "/end" : "");
+                    s += one;
+                }
+            }
+            tracker.Close();
+        }
+        return s;
+    };
+    ID3D12Resource* fake[4] = { reinterpret_cast<ID3D12Resource*>(0x1000), reinterpret_cast<ID3D12Resource*>(0x2000),
+        reinterpret_cast<ID3D12Resource*>(0x3000), reinterpret_cast<ID3D12Resource*>(0x4000) };
+    RenderGraph g;
+
+    // 1) Culling: c escribe algo que nadie lee y b solo alimenta a c; d y present quedan, y a porque d lo lee
+    {
+        g.Reset();
+        const RgHandle bb = g.Import("backbuffer");
+        const RgHandle t1 = g.CreateTexture("t1", RgTestTexture(256, false)), t2 = g.CreateTexture("t2", RgTestTexture(256, false)),
+            t3 = g.CreateTexture("t3", RgTestTexture(256, false));
+        const UINT a = g.AddPass("a", nullptr);
+        g.Write(a, t1, Rt);
+        const UINT b = g.AddPass("b", nullptr);
+        g.Read(b, t1, Srv); g.Write(b, t2, Rt);
+        const UINT c = g.AddPass("c", nullptr);
+        g.Read(c, t2, Srv); g.Write(c, t3, Rt);
+        const UINT d = g.AddPass("d", nullptr);
+        g.Read(d, t1, Srv); g.Write(d, bb, Rt);
+        const UINT present = g.AddPass("present", nullptr, true);
+        g.Read(present, bb, Present);
+        const bool compiled = g.Compile(RgFakeAllocationInfo);
+        const std::string order = orderString(g);
+        sprintf_s(buf, "%s; %zu culled, %zu transients", order.c_str(), g.Culled().size(), g.Transients().size());
+        report("culling", compiled && order == "a d present" && g.Culled() == std::vector<UINT>({ b, c }) && g.Transients().size() == 1 &&
+            g.Transient(t2) == nullptr, buf);
+    }
+
+    // 2) Dos sombras declaradas juntas: el orden intercala cada una con su consumidor y las dos comparten memoria;
+    //    cada frame, cada una toma la memoria de la otra con una barrera de aliasing
+    {
+        g.Reset();
+        const RgHandle color = g.Import("color", fake[0]);
+        const RgHandle sa = g.CreateTexture("shadowA", RgTestTexture(1024, true)), sb = g.CreateTexture("shadowB", RgTestTexture(1024, true));
+        const UINT shadowA = g.AddPass("shadowA", nullptr);
+        g.Write(shadowA, sa, Dsv);
+        const UINT shadowB = g.AddPass("shadowB", nullptr);
+        g.Write(shadowB, sb, Dsv);
+        const UINT mainA = g.AddPass("mainA", nullptr);
+        g.Read(mainA, sa, Srv); g.Write(mainA, color, Rt);
+        const UINT mainB = g.AddPass("mainB", nullptr);
+        g.Read(mainB, sb, Srv); g.Write(mainB, color, Rt);
+        const UINT present = g.AddPass("present", nullptr, true);
+        g.Read(present, color, Present);
+        const bool compiled = g.Compile(RgFakeAllocationInfo);
+        const std::string order = orderString(g);
+        const RgTransient* ta = g.Transient(sa), *tb = g.Transient(sb);
+        sprintf_s(buf, "%s; heap %llu KB of %llu KB", order.c_str(), g.HeapSize() / 1024, g.UnaliasedSize() / 1024);
+        report("lifetime order + aliasing", compiled && order == "shadowA mainA shadowB mainB present" && ta && tb && ta->offset == tb->offset &&
+            ta->aliased && tb->aliased && g.HeapSize() == 4ull << 20 && g.UnaliasedSize() == 8ull << 20, buf);
+
+        ResourceStateRegistry registry;
+        registry.Register(fake[0], 1, Present);
+        g.Bind(sa, fake[1]); registry.Register(fake[1], 1, g.FirstState(sa));
+        g.Bind(sb, fake[2]); registry.Register(fake[2], 1, g.FirstState(sb));
+        const std::string got = barrierString(g, registry, { { fake[0], "color" }, { fake[1], "shadowA" }, { fake[2], "shadowB" } }, 2);
+        const std::string expected =
+            "shadowA: alias shadowB>shadowA | mainA: shadowA 10>80 color 0>4 | shadowB: alias shadowA>shadowB | mainB: shadowB 10>80 | present: color 4>0 | "
+            "shadowA: alias shadowB>shadowA shadowA 80>10 | mainA: shadowA 10>80 color 0>4 | shadowB: alias shadowA>shadowB shadowB 80>10 | "
+            "mainB: shadowB 10>80 | present: color 4>0";
+        report("aliasing barriers", got == expected, got);
+    }
+
+    // 3) WAR: 'update' lee lo que acaba de escribir 'gen' (el orden lo pondría primero), pero escribe 'history', que
+    //    'resolve' lee antes en la declaración. 'present' sigue a 'resolve' (lee lo que escribió) y 'update' va al final
+    {
+        g.Reset();
+        const RgHandle bb = g.Import("backbuffer"), history = g.Import("history");
+        const RgHandle t = g.CreateTexture("t", RgTestTexture(256, false));
+        const UINT gen = g.AddPass("gen", nullptr);
+        g.Write(gen, t, Rt);
+        const UINT resolve = g.AddPass("resolve", nullptr);
+        g.Read(resolve, history, Srv); g.Write(resolve, bb, Rt);
+        const UINT update = g.AddPass("update", nullptr);
+        g.Read(update, t, Srv); g.Write(update, history, Rt);
+        const UINT present = g.AddPass("present", nullptr, true);
+        g.Read(present, bb, Present);
+        const bool compiled = g.Compile(RgFakeAllocationInfo);
+        const std::string order = orderString(g);
+        report("write after read", compiled && order == "gen resolve present update", order);
+    }
+
+    // 4) Barrera dividida: entre 'shadow' y 'main' va 'prepass', así que la sombra empieza a pasar a SRV al terminar
+    //    'shadow' y termina antes de 'main'
+    {
+        g.Reset();
+        const RgHandle color = g.Import("color", fake[0]);
+        const RgHandle s = g.CreateTexture("shadow", RgTestTexture(1024, true)), z = g.CreateTexture("depth", RgTestTexture(512, true));
+        const UINT shadow = g.AddPass("shadow", nullptr);
+        g.Write(shadow, s, Dsv);
+        const UINT prepass = g.AddPass("prepass", nullptr);
+        g.Write(prepass, z, Dsv);
+        const UINT main = g.AddPass("main", nullptr);
+        g.Read(main, s, Srv); g.Read(main, z, DepthRead); g.Write(main, color, Rt);
+        const UINT present = g.AddPass("present", nullptr, true);
+        g.Read(present, color, Present);
+        const bool compiled = g.Compile(RgFakeAllocationInfo);
+        ResourceStateRegistry registry;
+        registry.Register(fake[0], 1, Present);
+        g.Bind(s, fake[1]); registry.Register(fake[1], 1, g.FirstState(s));
+        g.Bind(z, fake[2]); registry.Register(fake[2], 1, g.FirstState(z));
+        const std::string got = barrierString(g, registry, { { fake[0], "color" }, { fake[1], "shadow" }, { fake[2], "depth" } }, 1);
+        report("split barrier", compiled && got == "shadow: | prepass: shadow 10>80/begin | main: shadow 10>80/end depth 10>20 color 0>4 | present: color 4>0" &&
+            !g.Transient(s)->aliased && g.HeapSize() == 5ull << 20, got);
+    }
+
+    // 5) Un transitorio leído antes de que alguien lo escriba es un error de declaración
+    {
+        g.Reset();
+        const RgHandle bb = g.Import("backbuffer");
+        const RgHandle t = g.CreateTexture("t", RgTestTexture(256, false));
+        const UINT use = g.AddPass("use", nullptr, true);
+        g.Read(use, t, Srv); g.Write(use, bb, Rt);
+        const bool compiled = g.Compile(RgFakeAllocationInfo);
+        report("read before write", !compiled && g.Errors().size() == 1, g.Errors().empty() ? "no error" : g.Errors()[0]);
+    }
+
+    // 6) Fuzz: grafos al azar contra las reglas (orden de accesos que chocan, productores de lo vivo, memoria)
+    {
+        UINT graphs = 0, violations = 0;
+        UINT64 heapTotal = 0, unaliasedTotal = 0;
+        std::string firstViolation;
+        auto fail = [&](UINT seed, const char* what)
+        {
+            if (violations++ == 0) { sprintf_s(buf, "seed %u: %s", seed, what); firstViolation = buf; }
+        };
+        for (UINT seed = 1; seed <= 300; ++seed)
+        {
+            const UINT passCount = 1 + seed % 97;
+            BuildRandomRenderGraph(g, passCount, seed);
+            ++graphs;
+            if (!g.Compile(RgFakeAllocationInfo)) { fail(seed, g.Errors()[0].c_str()); continue; }
+
+            std::vector<int> pos(passCount, -1);
+            for (size_t i = 0; i < g.Order().size(); ++i) pos[g.Order()[i].pass] = (int)i;
+            std::vector<char> culled(passCount, 0);
+            for (UINT p : g.Culled()) culled[p] = 1;
+            for (UINT p = 0; p < passCount; ++p) if ((pos[p] < 0) != (culled[p] != 0)) fail(seed, "pass neither scheduled nor culled");
+
+            // Por recurso, los accesos de las pasadas vivas en orden de declaración; y el último que escribió cada
+            // recurso antes de cada acceso vivo, que también tiene que estar vivo
+            struct Use { UINT pass; D3D12_RESOURCE_STATES state; bool write; };
+            std::map<RgHandle, std::vector<Use>> uses;
+            std::map<RgHandle, UINT> lastWriter;
+            for (UINT p = 0; p < passCount; ++p)
+                for (const RgAccess& a : g.Accesses(p))
+                {
+                    auto w = lastWriter.find(a.res);
+                    if (pos[p] >= 0)
+                    {
+                        if (w != lastWriter.end() && w->second != p && pos[w->second] < 0) fail(seed, "producer of a live pass culled");
+                        uses[a.res].push_back({ p, a.state, a.write });
+                    }
+                    if (a.write) lastWriter[a.res] = p;
+                }
+            for (const auto& kv : uses)
+            {
+                const std::vector<Use>& u = kv.second;
+                for (size_t i = 0; i < u.size(); ++i)
+                    for (size_t j = i + 1; j < u.size(); ++j)
+                        if (u[i].pass != u[j].pass && (u[i].write || u[j].write || u[i].state != u[j].state) && pos[u[i].pass] >= pos[u[j].pass])
+                            fail(seed, "conflicting accesses reordered");
+
+                // Vida del transitorio = primer y último uso en el orden
+                const RgTransient* t = g.Transient(kv.first);
+                if (!t) continue;
+                int first = INT_MAX, last = -1;
+                for (const Use& x : u) { first = (std::min)(first, pos[x.pass]); last = (std::max)(last, pos[x.pass]); }
+                if ((int)t->first != first || (int)t->last != last) fail(seed, "wrong lifetime");
+            }
+
+            // Memoria: vidas superpuestas → rangos disjuntos, offsets alineados y dentro del heap
+            const std::vector<RgTransient>& ts = g.Transients();
+            for (size_t i = 0; i < ts.size(); ++i)
+            {
+                if (ts[i].offset % ts[i].alignment != 0 || ts[i].offset + ts[i].size > g.HeapSize()) fail(seed, "misplaced transient");
+                for (size_t j = i + 1; j < ts.size(); ++j)
+                {
+                    const bool lives = ts[i].first <= ts[j].last && ts[j].first <= ts[i].last;
+                    const bool memory = ts[i].offset < ts[j].offset + ts[j].size && ts[j].offset < ts[i].offset + ts[i].size;
+                    if (lives && memory) fail(seed, "live transients share memory");
+                }
+            }
+            if (g.HeapSize() > g.UnaliasedSize()) fail(seed, "heap larger than unaliased");
+            heapTotal += g.HeapSize();
+            unaliasedTotal += g.UnaliasedSize();
+        }
+        sprintf_s(buf, "%u graphs, %u violations%s%s, heap %.0f%% of unaliased", graphs, violations, firstViolation.empty() ? "" : ", first: ",
+            firstViolation.c_str(), unaliasedTotal ? 100.0 * heapTotal / unaliasedTotal : 0.0);
+        report("fuzz", violations == 0, buf);
+    }
+    return ok ? 0 : 1;
+}
+
+// Costo de compilar el grafo (-benchmark-render-graph, sin ventana ni GPU): grafos sintéticos de 16 a 1024 pasadas,
+// declaración + Compile repetidos al menos 200 ms por tamaño. Devuelve el exit code del proceso.
+int RunRenderGraphBenchmark()
+{
+    char buf[320];
+    RenderGraph g;
+    for (UINT passes : { 16u, 64u, 256u, 1024u })
+    {
+        UINT reps = 0;
+        double ms = 0.0;
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        while (ms < 200.0 || reps < 3)
+        {
+            BuildRandomRenderGraph(g, passes, 7);
+            if (!g.Compile(RgFakeAllocationInfo)) return 1;
+            ++reps;
+            ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        }
+        sprintf_s(buf, "Render graph: %4u passes (%zu culled, %zu transients) | declare + compile %.1f us (compile %.1f us) | heap %.1f MB of %.1f MB\n",
+            passes, g.Culled().size(), g.Transients().size(), ms * 1000.0 / reps, g.CompileUsAvg(), g.HeapSize() / (1024.0 * 1024.0),
+            g.UnaliasedSize() / (1024.0 * 1024.0));
+        OutputDebugStringA(buf);
+        g = RenderGraph(); // promedio de compilación por tamaño
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Grabación de draws en paralelo: varias command lists por frame, enviadas en orden
+//--------------------------------------------------------------------------------------
+
+// Con muchos draws (submeshes e instancias del modelo) una sola command list deja la grabación en un hilo. Los draws
+// de la pasada principal se parten en rangos contiguos y cada rango se graba en su propia lista en un job; las listas
+// se envían en orden en un solo ExecuteCommandLists, así que la GPU ve la misma secuencia que con una lista. Cada
+// lista empieza sin estado: repite root signature, viewport, targets, etc. (RecordPassState) antes de sus draws.
+// RecordPassState y RecordDraws son templates sobre la lista para medirlos sin GPU con CommandLog.
+
+// Estado de pipeline que necesita cualquier lista que grabe draws de la pasada principal. El PSO va en el Reset.
+struct PassState
+{
+    ID3D12PipelineState*        pso = nullptr;
+    ID3D12RootSignature*        rootSig = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS   cb = 0;         // CBData del frame (root param 0)
+    D3D12_GPU_VIRTUAL_ADDRESS   instances = 0;  // InstanceData por defecto (root param 1)
+    D3D12_VIEWPORT              viewport = {};
+    D3D12_RECT                  scissor = {};
+    D3D12_CPU_DESCRIPTOR_HANDLE rtv = {}, dsv = {};
+    bool                        targets = false; // rtv/dsv válidos (OMSetRenderTargets)
+};
+
+// Un draw indexado de la pasada principal, con lo que hay que bindear para él.
+struct DrawItem
+{
+    const D3D12_VERTEX_BUFFER_VIEW* vb = nullptr;
+    const D3D12_INDEX_BUFFER_VIEW*  ib = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS       instances = 0; // SRV de InstanceData (root param 1)
+    UINT indexCount = 0, instanceCount = 1, firstIndex = 0;
+    INT  baseVertex = 0;
+};
+
+template <class List>
+void RecordPassState(List* cl, const PassState& s)
+{
+    cl->SetGraphicsRootSignature(s.rootSig);
+    cl->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    cl->SetGraphicsRootConstantBufferView(0, s.cb);
+    cl->RSSetViewports(1, &s.viewport);
+    cl->RSSetScissorRects(1, &s.scissor);
+    cl->SetGraphicsRootShaderResourceView(1, s.instances);
+    if (s.targets) cl->OMSetRenderTargets(1, &s.rtv, FALSE, &s.dsv);
+}
+
+// Graba 'count' draws; VB, IB e instancias se setean solo cuando cambian respecto del draw anterior del rango.
+template <class List>
+void RecordDraws(List* cl, const DrawItem* items, size_t count)
+{
+    const D3D12_VERTEX_BUFFER_VIEW* vb = nullptr;
+    const D3D12_INDEX_BUFFER_VIEW* ib = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS instances = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const DrawItem& d = items[i];
+        if (d.vb != vb) { vb = d.vb; cl->IASetVertexBuffers(0, 1, vb); }
+        if (d.ib != ib) { ib = d.ib; cl->IASetIndexBuffer(ib); }
+        if (d.instances != instances) { instances = d.instances; cl->SetGraphicsRootShaderResourceView(1, instances); }
+        cl->DrawIndexedInstanced(d.indexCount, d.instanceCount, d.firstIndex, d.baseVertex, 0);
+    }
+}
+
+// Cuántas listas para 'draws' draws: al menos minPerList draws cada una (por debajo, el estado que repite cada lista
+// y el ExecuteCommandLists más largo cuestan más de lo que se gana), como mucho maxLists.
+inline UINT DrawListCount(size_t draws, UINT maxLists, UINT minPerList)
+{
+    return (UINT)(std::max)((size_t)1, (std::min)((size_t)maxLists, draws / (std::max)(1u, minPerList)));
+}
+
+// Graba items en 'lists' listas en paralelo (job system): la lista j recibe el rango contiguo j de items entre
+// open(j), que la devuelve lista para grabar (Reset + RecordPassState), y close(j, cl). Concatenadas en orden de j
+// dan la misma secuencia de draws que una sola lista. Cada lista la graba un solo hilo.
+template <class Open, class Close>
+void RecordDrawsParallel(const DrawItem* items, size_t count, UINT lists, Open open, Close close)
+{
+    ParallelFor(lists, 1, [&](UINT first, UINT last)
+    {
+        for (UINT j = first; j < last; ++j)
+        {
+            auto* cl = open(j);
+            const size_t b = count * j / lists, e = count * (j + 1) / lists;
+            RecordDraws(cl, items + b, e - b);
+            close(j, cl);
+        }
+    });
+}
+
+// Command list falsa para medir la grabación sin GPU: cada llamada se copia como un registro (opcode + argumentos) a
+// un buffer, que es lo que hace el driver con la memoria del allocator. Con keepDraws guarda además cada draw con el
+// VB/IB/instancias vigentes, para comparar la secuencia de una lista contra la de varias.
+class CommandLog
+{
+public:
+    struct Draw
+    {
+        const void* vb; const void* ib; D3D12_GPU_VIRTUAL_ADDRESS instances;
+        UINT indexCount, instanceCount, firstIndex; INT baseVertex;
+        bool operator==(const Draw& o) const
+        {
+            return vb == o.vb && ib == o.ib && instances == o.instances && indexCount == o.indexCount && instanceCount == o.instanceCount &&
+                firstIndex == o.firstIndex && baseVertex == o.baseVertex;
+        }
+    };
+
+    explicit CommandLog(bool keepDraws = false) : m_keepDraws(keepDraws) {}
+
+    void Reset() { m_words.clear(); m_draws.clear(); m_commands = 0; m_vb = m_ib = nullptr; m_instances = 0; } // conserva la memoria
+
+    void SetGraphicsRootSignature(ID3D12RootSignature* rs) { Put(1, &rs, sizeof(rs)); }
+    void IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY t) { Put(2, &t, sizeof(t)); }
+    void SetGraphicsRootConstantBufferView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS a) { Put(3, &a, sizeof(a), index); }
+    void RSSetViewports(UINT n, const D3D12_VIEWPORT* v) { Put(4, v, n * sizeof(*v)); }
+    void RSSetScissorRects(UINT n, const D3D12_RECT* r) { Put(5, r, n * sizeof(*r)); }
+    void SetGraphicsRootShaderResourceView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS a) { Put(6, &a, sizeof(a), index); m_instances = a; }
+    void OMSetRenderTargets(UINT n, const D3D12_CPU_DESCRIPTOR_HANDLE* rtv, BOOL, const D3D12_CPU_DESCRIPTOR_HANDLE* dsv)
+    {
+        Put(7, rtv, n * sizeof(*rtv));
+        Put(8, dsv, sizeof(*dsv));
+    }
+    void IASetVertexBuffers(UINT, UINT n, const D3D12_VERTEX_BUFFER_VIEW* v) { Put(9, v, n * sizeof(*v)); m_vb = v; }
+    void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* v) { Put(10, v, sizeof(*v)); m_ib = v; }
+    void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT firstIndex, INT baseVertex, UINT firstInstance)
+    {
+        const UINT args[5] = { indexCount, instanceCount, firstIndex, (UINT)baseVertex, firstInstance };
+        Put(11, args, sizeof(args));
+        if (m_keepDraws) m_draws.push_back({ m_vb, m_ib, m_instances, indexCount, instanceCount, firstIndex, baseVertex });
+    }
+
+    size_t Commands() const { return m_commands; }
+    size_t Bytes() const { return m_words.size() * sizeof(uint32_t); }
+    const std::vector<Draw>& Draws() const { return m_draws; }
+
+private:
+    void Put(uint32_t op, const void* args, size_t bytes, uint32_t index = 0)
+    {
+        const size_t words = (bytes + 3) / 4, at = m_words.size();
+        m_words.resize(at + 1 + words);
+        m_words[at] = op | index << 8 | (uint32_t)words << 16;
+        memcpy(&m_words[at + 1], args, bytes);
+        ++m_commands;
+    }
+
+    bool                    m_keepDraws;
+    std::vector<uint32_t>   m_words;
+    std::vector<Draw>       m_draws;
+    size_t                  m_commands = 0;
+    const void*             m_vb = nullptr;
+    const void*             m_ib = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS m_instances = 0;
+};
+
+// Escalado de la grabación (-benchmark-record, sin ventana ni GPU): 64 submeshes con 50000 draws de instancias
+// agrupadas de a 1..8 (como el modelo sin culling), grabados en CommandLog con 1, 2, 4... N hilos (una lista por
+// hilo, hasta MaxRecordLists - 1). La secuencia de draws de las listas concatenadas tiene que ser la de una sola.
+// Devuelve el exit code del proceso.
+int RunRecordScalingBenchmark(int runs = 5)
+{
+    const UINT drawCount = 50000, submeshes = 64;
+    std::vector<D3D12_VERTEX_BUFFER_VIEW> vbs(submeshes);
+    std::vector<D3D12_INDEX_BUFFER_VIEW> ibs(submeshes);
+    for (UINT s = 0; s < submeshes; ++s)
+    {
+        vbs[s].BufferLocation = 0x10000000ull + s * 0x100000ull; vbs[s].SizeInBytes = 0x100000; vbs[s].StrideInBytes = 32;
+        ibs[s].BufferLocation = 0x80000000ull + s * 0x40000ull; ibs[s].SizeInBytes = 0x40000; ibs[s].Format = DXGI_FORMAT_R32_UINT;
+    }
+    std::vector<DrawItem> items(drawCount);
+    uint32_t rng = 99;
+    UINT instance = 0;
+    for (UINT i = 0; i < drawCount; ++i)
+    {
+        rng = rng * 1664525u + 1013904223u;
+        const UINT s = i * submeshes / drawCount; // ordenados por submesh, como g_modelDraws
+        DrawItem& d = items[i];
+        d.vb = &vbs[s / 8]; // 8 submeshes por megabuffer
+        d.ib = &ibs[s];
+        d.instanceCount = 1 + (rng >> 8) % 8;
+        d.instances = 0x200000000ull + instance * sizeof(InstanceData);
+        instance += d.instanceCount;
+        d.indexCount = 3 * (64 + (rng >> 16) % 512);
+        d.firstIndex = (rng >> 4) % 100000;
+        d.baseVertex = (INT)(s * 1000);
+    }
+    PassState state;
+    state.rootSig = reinterpret_cast<ID3D12RootSignature*>(0x1000);
+    state.cb = 0x300000000ull;
+    state.viewport = { 0.0f, 0.0f, (float)Width, (float)Height, 0.0f, 1.0f };
+    state.scissor = { 0, 0, (LONG)Width, (LONG)Height };
+    state.rtv.ptr = 0x100; state.dsv.ptr = 0x200; state.targets = true;
+
+    // Referencia: todo en una lista
+    CommandLog reference(true);
+    RecordPassState(&reference, state);
+    RecordDraws(&reference, items.data(), items.size());
+
+    char buf[320];
+    bool same = true;
+    double base = 0.0;
+    const UINT maxThreads = (std::max)(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<CommandLog>> logs;
+    for (UINT threads = 1; ; threads = (std::min)(threads * 2, maxThreads))
+    {
+        JobSystem jobs(threads);
+        g_jobSystemOverride = &jobs;
+        const UINT lists = DrawListCount(items.size(), (std::min)(threads, MaxRecordLists - 1), MinDrawsPerList);
+        while (logs.size() < lists) logs.push_back(std::make_unique<CommandLog>(true));
+        auto open = [&](UINT j) { logs[j]->Reset(); RecordPassState(logs[j].get(), state); return logs[j].get(); };
+        auto close = [](UINT, CommandLog*) {};
+
+        double best = DBL_MAX;
+        for (int r = 0; r < runs; ++r)
+        {
+            const auto t0 = std::chrono::high_resolution_clock::now();
+            RecordDrawsParallel(items.data(), items.size(), lists, open, close);
+            best = (std::min)(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count());
+        }
+        g_jobSystemOverride = nullptr;
+        if (threads == 1) base = best;
+
+        std::vector<CommandLog::Draw> merged;
+        size_t commands = 0, bytes = 0;
+        for (UINT j = 0; j < lists; ++j)
+        {
+            merged.insert(merged.end(), logs[j]->Draws().begin(), logs[j]->Draws().end());
+            commands += logs[j]->Commands();
+            bytes += logs[j]->Bytes();
+        }
+        const bool match = merged == reference.Draws();
+        same = same && match;
+        sprintf_s(buf, "Record scaling: %3u threads | %2u lists | %7.2f ms x%.2f | %.1f M draws/s | %zu commands, %.1f MB%s\n",
+            threads, lists, best, base / best, drawCount / best / 1000.0, commands, bytes / (1024.0 * 1024.0), match ? "" : " | draw sequence MISMATCH");
+        OutputDebugStringA(buf);
+
+        if (threads == maxThreads) break;
+    }
+    sprintf_s(buf, "Record scaling: single list %zu commands, %.1f MB\n", reference.Commands(), reference.Bytes() / (1024.0 * 1024.0));
+    OutputDebugStringA(buf);
+    return same ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Globals DX12
+//--------------------------------------------------------------------------------------
+HWND                                g_hWnd = nullptr; //Handler de la ventana
+UINT                                g_frameIndex = 0; //Indice del backbuffer actual
+UINT                                g_rtvDescriptorSize = 0; //Tamaño en bytes entre descriptores RTV dentro del descriptor heap (lo da el device)
+UINT                                g_dsvDescriptorSize = 0; //Tamaño en bytes entre descriptores DSV dentro del descriptor heap (lo da el device)
+D3D12_VIEWPORT                      g_viewport = { 0.0f, 0.0f, (float)Width, (float)Height, 0.0f, 1.0f }; // Viewport de rasterización: área de la pantalla donde se dibuja
+D3D12_RECT                          g_scissorRect = { 0, 0, (LONG)Width, (LONG)Height }; //Rectángulo de scissor: recorta el dibujo a esta región
+
+// Objetos base de la plataforma DX12 (device, factory, swapchain, cola, etc.)
+
+bool                                g_forceWarp = false; // -batch-render -backend=warp: device por software aunque haya GPU (CI)
+char                                g_adapterName[128] = ""; // adaptador del device, para los logs y el JSON del batch
+ComPtr<IDXGIFactory7>               g_factory; // Factory DXGI: permite enumerar adaptadores (GPU) y crear el swap chain.
+ComPtr<ID3D12Device>                g_device; // Device de D3D12: representa la conexión lógica con la GPU. Crea recursos (buffers, textures, heaps, PSO, etc.).
+bool                                g_placedResources = true; // -committed-resources: un CreateCommittedResource por recurso, como antes
+GpuHeapAllocator                    g_gpuHeaps; // Heaps donde viven los recursos placed. Declarado antes que los recursos: se destruye después de ellos.
+ComPtr<ID3D12CommandQueue>          g_cmdQueue; // Command Queue: cola donde se envían command lists ya grabadas para que la GPU las ejecute.
+ComPtr<IDXGISwapChain3>             g_swapChain; // Swap chain: conjunto de backbuffers que se alternan entre render y presentación en pantalla.
+ComPtr<ID3D12DescriptorHeap>        g_rtvHeap; // Descriptor heap que contiene los descriptores RTV (Render Target View) de los backbuffers.
+ComPtr<ID3D12Resource>              g_renderTargets[FrameCount]; // Recursos de GPU para cada backbuffer del swap chain (las texturas donde se dibuja el frame).
+ComPtr<ID3D12CommandAllocator>      g_cmdAlloc[FrameCount]; // Command allocator por frame: administra la memoria donde se graban las commands de la command list.
+ComPtr<ID3D12GraphicsCommandList>   g_cmdList; // Command list de tipo gráfico: se graban aquí las órdenes de dibujo (set pipeline, draw, clears, etc.).
+bool                                g_parallelRecording = true; // -serial-recording: todos los draws en g_cmdList, como antes
+ComPtr<ID3D12CommandAllocator>      g_recordAlloc[FrameCount][MaxRecordLists]; // Allocator por frame y por lista de grabación en paralelo (la usa un solo hilo).
+ComPtr<ID3D12GraphicsCommandList>   g_recordLists[MaxRecordLists]; // Rangos de draws de la pasada principal y, detrás, la continuación del frame.
+ID3D12GraphicsCommandList*          g_recordingList = nullptr; // Lista donde sigue grabando el frame (g_cmdList o la continuación).
+std::vector<ID3D12CommandList*>     g_submitLists; // Listas del frame en orden de envío (un solo ExecuteCommandLists).
+PassState                           g_framePassState; // Estado de pipeline del frame, para las listas que graban draws.
+UINT64                              g_parallelFrames = 0, g_parallelLists = 0; // frames grabados en varias listas y cuántas en total
+std::vector<DrawItem>               g_mainDraws; // Draws de la pasada principal del frame.
+ResourceStateRegistry               g_resourceStates; // Estado de backbuffers/targets/depth al final de la última command list cerrada.
+ResourceStateTracker                g_cmdListStates; // Barreras de g_cmdList: inferidas del registry y emitidas en lote por pasada.
+RenderGraph                         g_frameGraph; // Pasadas del frame: se declaran y compilan en cada RecordRender.
+RgTransientPool                     g_transients; // Heap y recursos placed de los transitorios de g_frameGraph.
+D3D12QueueFence                     g_gfxQueueFence; // Fence + evento de la cola gráfica: permite saber cuándo la GPU terminó de procesar comandos.
+FrameScheduler<FrameCount>          g_frameScheduler; // Valor de fence por backbuffer: solo se espera si el slot a reutilizar sigue ocupado.
+DeferredReleaseQueue                g_retired; // PSOs/buffers reemplazados por el hot reload, hasta que la GPU termine con ellos.
+
+// Recursos de depth/stencil
+
+ComPtr<ID3D12DescriptorHeap>        g_dsvHeap; // Descriptor heap para el DSV (depth-stencil view).
+ID3D12Resource*                     g_depthTex = nullptr; // Textura de depth (Z-buffer) del frame: un transitorio de g_frameGraph (la crea g_transients).
+UINT64                              g_depthDsvGeneration = ~0ull; // g_transients.Generation() con la que se creó el DSV.
+
+// Root Signature + PSO (estado de pipeline)
+
+ComPtr<ID3D12RootSignature>         g_rootSig; // Root signature: describe qué recursos (CBVs (constant buffer view), SRVs (shader resolution view), samplers, etc.) puede ver el shader
+                                               // y cómo se van a enlazar (root parameters, descriptor tables, etc.).
+PermutationCache<ComPtr<ID3D12PipelineState>> g_pipelines; // Pipeline State Objects: estado completo del pipeline gráfico (shaders, input layout,
+                                                            // rasterizer, depth-stencil, blend, formatos RT/DS, topology, etc.), uno por PipelineKey.
+std::vector<uint8_t>                g_vsBytecode; // VS compilado una sola vez: todas las permutaciones comparten VS, solo cambia el PS.
+
+// Memoria UPLOAD por frame (constant buffers y datos dinámicos)
+ComPtr<ID3D12Resource>              g_uploadBuffer; // Buffer UPLOAD grande, mapeado de forma persistente. Una página de UploadPageSize por frame en vuelo.
+LinearUploadAllocator               g_uploadAllocator; // Reparte sub-asignaciones alineadas a 256 dentro de la página del frame actual.
+ComPtr<ID3D12CommandQueue>          g_copyQueue; // Cola de copia: lleva la geometría del ring de staging a buffers DEFAULT mientras la cola gráfica dibuja.
+D3D12QueueFence                     g_copyQueueFence; // Fence de la cola de copia: un Signal por lote de subidas.
+ComPtr<ID3D12Resource>              g_stagingBuffer; // Ring UPLOAD de StagingRingSize bytes, mapeado de forma persistente.
+D3D12CopySubmitter                  g_copySubmitter; // Graba y manda cada lote sobre g_copyQueue.
+CopyUploadBatcher                   g_uploads; // Subidas pendientes del frame: salen juntas en un lote con SubmitGeometryUploads.
+UINT64                              g_gfxCopyWait = 0; // Último lote de copia al que la cola gráfica ya tiene encolado un Wait.
+D3D12_GPU_VIRTUAL_ADDRESS           g_cbAddr = 0; // Dirección GPU del CBData escrito este frame (se bindea en RecordRender).
+
+XMMATRIX                            g_proj; // Matriz de proyección (perspectiva).
+XMMATRIX                            g_view; // Matriz de vista (cámara).
+
+XMFLOAT3 g_eyeWS; // Posición de la cámara en espacio mundo (world space). Se pasa al shader para PBR (Fresnel, view vector, etc.).
+
+
+
+//--------------------------------------------------------------------------------------
+// Parámetros de escena (material, luz, animación, selección de geometría)
+//--------------------------------------------------------------------------------------
+
+// Timing
+auto g_t0 = std::chrono::high_resolution_clock::now();
+
+// Presets de material y estado actual (para cambiar un runtime)
+static const float g_metallicPresets[] = { 0.0f, 0.1f, 0.5f, 1.0f };
+static const float g_roughnessPresets[] = { 0.08f, 0.35f, 0.6f, 0.9f };
+static const float g_aoPresets[] = { 0.0f, 0.5f, 0.8f, 1.0f };
+
+// Indices de presets
+static int   g_metallicIdx = 0;
+static int   g_roughnessIdx = 1;
+static int   g_aoIdx = 3;
+
+// Valores de presets
+static float g_metallic = g_metallicPresets[g_metallicIdx];
+static float g_roughness = g_roughnessPresets[g_roughnessIdx];
+static float g_ao = g_aoPresets[g_aoIdx];
+
+// Color base (las instancias del sweep lo copian: quien lo cambie tiene que marcar g_sweepDirty)
+static XMFLOAT3 g_baseColor = XMFLOAT3(0.95f, 0.25f, 0.20f);
+
+// Luz: parámetros base
+static XMFLOAT3 g_lightColor = XMFLOAT3(1.0f, 1.0f, 1.0f);
+static float    g_lightIntensity = 30.0f; //10 - 100 aprox
+
+// control de rotación del cubo
+static bool g_pauseRotation = false;
+static float g_rotTime = 0.0f; // tiempo acumulado para la rotación del cubo
+static std::chrono::high_resolution_clock::time_point g_prevTick; //ticker para control animación
+static float g_fixedTimestep = 0.0f; // -batch-render: segundos por frame, independientes del reloj (0 = tiempo real)
+static UINT  g_fixedFrame = 0;       // frames ya simulados con paso fijo
+
+// Buffers de geometría
+ComPtr<ID3D12Resource>              g_vb; // Vertex buffer del cubo (PackedVertex: posición cuantizada + normal octaédrica).
+ComPtr<ID3D12Resource>              g_ib; // Index buffer del cubo (definición de triángulos por índices).
+D3D12_VERTEX_BUFFER_VIEW            g_vbView = {}; // Vista del vertex buffer: GPU address + stride (tamaño entre objetos) + tamaño total.
+D3D12_INDEX_BUFFER_VIEW             g_ibView = {}; // Vista del index buffer: GPU address + formato (R16_UINT) + tamaño total.
+VertexQuantization                  g_cubeQuant; // AABB del cubo para decuantizar PackedVertex::pos en el VS.
+
+// Creamos buffers de geometría adicionales para probar una esfera
+ComPtr<ID3D12Resource> g_sphereVB;
+ComPtr<ID3D12Resource> g_sphereIB;
+D3D12_VERTEX_BUFFER_VIEW g_sphereVBView = {};
+D3D12_INDEX_BUFFER_VIEW  g_sphereIBView = {};
+VertexQuantization g_sphereQuant;
+
+// Esfera procedural: todos los niveles de subdivisión en el mismo VB/IB, uno a continuación del otro (LOD0 = el más fino).
+// Los índices son locales a cada nivel (baseVertex), así el IB puede ser de 16 bits aunque el total de vértices no entre.
+enum SphereKind { SphereIco = 0, SphereCube = 1, SphereUV = 2 };
+static const UINT SphereLodCount = 6;  // igual que ModelMaxLods: la tecla L recorre los mismos niveles
+struct SphereLod
+{
+    UINT  baseVertex;
+    UINT  firstIndex;
+    UINT  indexCount;
+    float error;      // máxima distancia de la malla a la esfera ideal, en unidades del objeto
+};
+static int g_sphereKind = SphereIco;   // -cube-sphere / -uv-sphere
+std::vector<SphereLod> g_sphereLods;
+static UINT g_sphereLod = 0;           // nivel elegido este frame (esfera sola o barrido)
+
+// Creamos buffers de geometría adicionales para probar un modelo
+// Todas las mallas del asset comparten un único VB/IB (megabuffer); cada aiMesh es un rango dentro de ellos.
+ComPtr<ID3D12Resource> g_modelVB;
+ComPtr<ID3D12Resource> g_modelIB;
+D3D12_VERTEX_BUFFER_VIEW g_modelVBView = {};
+D3D12_INDEX_BUFFER_VIEW  g_modelIBView = {};
+UINT g_modelIndexCount = 0; // total de índices de todas las mallas
+VertexQuantization g_modelQuant; // un solo AABB para todo el megabuffer (espacio local de cada malla)
+
+// Un aiMesh dentro del megabuffer. Los índices son locales a la malla: se dibujan con BaseVertexLocation.
+struct ModelSubmesh
+{
+    UINT baseVertex = 0;
+    UINT firstIndex = 0;
+    UINT indexCount = 0;
+    UINT materialId = 0; // aiMesh::mMaterialIndex
+    UINT firstMeshlet = 0; // rango en g_modelMeshlets; los meshlets cubren [firstIndex, firstIndex + indexCount)
+    UINT meshletCount = 0;
+    UINT firstLod = 0;     // rango en g_modelLods; el LOD 0 repite firstIndex/indexCount/firstMeshlet/meshletCount
+    UINT lodCount = 0;
+};
+
+static const UINT ModelMaxLods = 6; // LOD0 incluido
+
+// Un nivel de detalle de un submesh: otro rango de índices sobre los mismos vértices (mismo baseVertex), con sus meshlets.
+struct ModelLod
+{
+    UINT firstIndex = 0;
+    UINT indexCount = 0;
+    UINT firstMeshlet = 0;
+    UINT meshletCount = 0;
+    float error = 0.0f; // desvío geométrico máximo respecto de LOD0, en unidades locales de la malla
+};
+
+// Límites de un meshlet (los mismos que usa mesh shading: 64 vértices, 124 triángulos)
+static const UINT MeshletMaxVertices = 64;
+static const UINT MeshletMaxTriangles = 124;
+
+// Cluster de triángulos contiguos en el IB del modelo, con cotas en espacio local de la malla para el culling.
+struct ModelMeshlet
+{
+    XMFLOAT3 center;   float radius;     // esfera envolvente
+    XMFLOAT3 coneApex; float coneCutoff; // cono de normales; cutoff > 1 = sin cono (nunca se descarta por orientación)
+    XMFLOAT3 coneAxis;
+    UINT firstIndex = 0; // absoluto en el IB del modelo
+    UINT triangleCount = 0;
+    UINT vertexCount = 0;
+};
+
+// Jerarquía de nodos aplanada: cada referencia nodo → malla es una instancia con la transform acumulada.
+struct ModelInstance
+{
+    UINT submesh = 0;
+    XMFLOAT4X4 world; // ya transpuesta, se copia tal cual a InstanceData::world
+};
+
+// Un draw instanciado por submesh: instancias [firstInstance, firstInstance + instanceCount) de g_modelInstances.
+struct ModelDraw
+{
+    UINT submesh = 0;
+    UINT firstInstance = 0;
+    UINT instanceCount = 0;
+};
+
+std::vector<ModelSubmesh>  g_modelSubmeshes;
+std::vector<ModelInstance> g_modelInstances; // ordenadas por submesh
+std::vector<XMFLOAT4X4>    g_modelNormalWorlds; // InstanceData::normalWorld de cada instancia: se calcula al subir (no va en el cache)
+std::vector<ModelDraw>     g_modelDraws;
+std::vector<ModelMeshlet>  g_modelMeshlets;
+std::vector<ModelLod>      g_modelLods;
+std::vector<XMFLOAT4>      g_modelSubmeshBounds; // esfera de LOD0 de cada submesh (xyz centro, w radio), para elegir LOD
+std::vector<uint32_t>      g_modelIndices; // copia en CPU del IB: el culling arma con ella el IB compactado de cada frame
+D3D12_GPU_VIRTUAL_ADDRESS  g_modelInstanceAddr = 0; // InstanceData de todas las instancias del modelo (upload allocator, por frame)
+
+// Resultado de una pasada de culling (la del frame, o una pose del modo -meshlet-stats).
+struct MeshletCullStats
+{
+    UINT meshlets = 0;         // probados (meshlets × instancias)
+    UINT culledFrustum = 0;
+    UINT culledCone = 0;
+    uint64_t trianglesIn = 0;  // lo que se dibujaría sin culling
+    uint64_t trianglesOut = 0; // lo que se envía
+    double ms = 0.0;
+};
+
+// Draw del modelo con índices compactados: una instancia, rango [firstIndex, firstIndex + indexCount) del IB del frame.
+struct CulledDraw
+{
+    UINT instance = 0;
+    UINT firstIndex = 0;
+    UINT indexCount = 0;
+    INT  baseVertex = 0;
+};
+
+// Selección de LOD del modelo y de la esfera (tecla L): -1 = automático por error proyectado en pantalla, 0.. = nivel forzado.
+static int   g_lodForced = -1;
+static float g_lodPixelError = 1.0f;    // error geométrico máximo tolerado, en píxeles
+std::vector<UINT> g_instanceLods;       // LOD elegido para cada instancia este frame
+std::vector<UINT> g_drawLods;           // LOD de cada ModelDraw (el más fino de sus instancias: comparten draw instanciado)
+static uint64_t   g_lodTriangles = 0;   // triángulos de los draws con los LODs elegidos (sin culling)
+
+// Culling por meshlet del modelo (tecla C). El resultado del frame: IB compactado en el upload allocator + una draw por instancia.
+static bool g_meshletCulling = true;
+static bool g_culledThisFrame = false; // false = se dibuja el modelo entero (culling apagado o el IB no entró en la página)
+D3D12_INDEX_BUFFER_VIEW g_culledIBView = {};
+static UINT g_cullTitleFrames = 0;
+std::vector<uint32_t>   g_culledIndices; // scratch de CPU, se copia al upload allocator con el tamaño justo
+std::vector<CulledDraw> g_culledDraws;
+MeshletCullStats        g_cullStats;
+
+// Selector de geometría: 0=Cubo, 1=Esfera, 2=Modelo
+static int g_geomMode = 0;
+static const float ModelDisplayScale = 0.25f; // el modelo se dibuja achicado alrededor del origen
+
+// Estado de la carga del modelo en segundo plano. Solo lo escribe el hilo de render (PollModelLoad);
+// el hilo de carga se comunica únicamente por g_modelLoadResult.
+enum ModelLoadState { ModelLoading, ModelReady, ModelFailed };
+static int g_modelState = ModelLoading;
+
+// Geometría que realmente se dibuja: con el modelo todavía cargando (o fallido) se muestra el cubo de placeholder.
+inline int DrawnGeometry()
+{
+    return (g_geomMode == 2 && g_modelState != ModelReady) ? 0 : g_geomMode;
+}
+
+// Barrido de materiales: grilla de g_sweepDim × g_sweepDim esferas (columnas = metallic, filas = roughness)
+static bool g_sweepEnabled = false;
+static UINT g_sweepDim = 4; // 4 = grilla de presets. Potencias de 2 mayores = rampas lineales [0,1]
+static const UINT g_sweepMaxDim = 256;
+static const float SweepExtent = 1.6f; // ancho total de la grilla en mundo
+inline float SweepSphereScale(UINT dim) { return SweepExtent / float(dim) * 0.85f; } // la esfera base tiene diámetro 1
+static bool g_sweepDirty = true; // hay que regenerar g_sweepInstances (cambió la dimensión, el AO o el color base)
+
+ComPtr<ID3D12Resource> g_sweepInstances; // InstanceData de toda la grilla, en DEFAULT. Solo se regenera al cambiar la dimensión.
+UINT g_sweepInstanceCount = 0;
+
+D3D12_GPU_VIRTUAL_ADDRESS g_instanceAddr = 0; // InstanceData del draw normal (1 instancia, se escribe cada frame en el upload allocator)
+
+// Manipular fuente de luz
+static bool  g_lightPinnedFront = false; // luz fija frente a cámara
+static float g_lightFrontDist = 1.2f;  // distancia desde la cámara al origen
+
+//--------------------------------------------------------------------------------------
+// Helpers
+//--------------------------------------------------------------------------------------
+void WaitForGPU()
+{
+    //Bloquea la CPU hasta que la GPU termine todo lo que tiene pendiente en la command queue.
+    //Solo para shutdown / recrear recursos: en el loop normal se usa g_frameScheduler.
+    g_frameScheduler.WaitIdle();
+}
+
+// Último valor de fence enviado a la cola: cuando la GPU lo pasa, ningún frame ya grabado usa lo que se reemplace ahora.
+UINT64 LastSubmittedFence()
+{
+    UINT64 v = 0;
+    for (UINT i = 0; i < FrameCount; ++i) v = (std::max)(v, g_frameScheduler.SlotFenceValue(i));
+    return v;
+}
+
+// Descriptor de un buffer de 'size' bytes, layout lineal.
+D3D12_RESOURCE_DESC BufferDesc(UINT64 size)
+{
+    D3D12_RESOURCE_DESC rd = {};
+    rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+    rd.Width = size; rd.Height = 1; rd.DepthOrArraySize = 1;
+    rd.MipLevels = 1; rd.SampleDesc = { 1,0 }; rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+    return rd;
+}
+
+// Recurso en el heap de tipo 'type' vía g_gpuHeaps (placed salvo -committed-resources o que no entre en un heap).
+ComPtr<ID3D12Resource> CreateGpuResource(D3D12_HEAP_TYPE type, const D3D12_RESOURCE_DESC& desc,
+    D3D12_RESOURCE_STATES state, const D3D12_CLEAR_VALUE* clear = nullptr)
+{
+    ComPtr<ID3D12Resource> res;
+    ThrowIfFailed(g_gpuHeaps.CreateResource(type, desc, state, clear, res));
+    return res;
+}
+
+// Cola de copia + ring de staging para la geometría estática (VB/IB en DEFAULT: la GPU no los lee por PCIe cada frame).
+void CreateGeometryUploader()
+{
+    D3D12_COMMAND_QUEUE_DESC qd = {};
+    qd.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+    ThrowIfFailed(g_device->CreateCommandQueue(&qd, IID_PPV_ARGS(&g_copyQueue)));
+    g_copyQueueFence.Init(g_device.Get(), g_copyQueue.Get());
+
+    g_stagingBuffer = CreateGpuResource(D3D12_HEAP_TYPE_UPLOAD, BufferDesc(StagingRingSize), D3D12_RESOURCE_STATE_GENERIC_READ);
+    uint8_t* mapped = nullptr;
+    D3D12_RANGE rr = { 0,0 }; // la CPU nunca lee de acá
+    ThrowIfFailed(g_stagingBuffer->Map(0, &rr, reinterpret_cast<void**>(&mapped)));
+
+    g_copySubmitter.Init(g_device.Get(), g_copyQueue.Get(), &g_copyQueueFence, g_stagingBuffer.Get());
+    g_uploads.Init(mapped, StagingRingSize, &g_copyQueueFence, &g_copySubmitter);
+}
+
+// Buffer DEFAULT con 'size' bytes de 'src'. Los datos se copian al ring ahora (src se puede soltar al volver) y llegan
+// al buffer con el próximo lote de la cola de copia.
+ComPtr<ID3D12Resource> CreateDefaultBufferWithData(const void* src, UINT64 size)
+{
+    ComPtr<ID3D12Resource> res = CreateGpuResource(D3D12_HEAP_TYPE_DEFAULT, BufferDesc(size), D3D12_RESOURCE_STATE_COMMON);
+    g_uploads.Upload(res.Get(), 0, src, size);
+    return res;
+}
+
+// Una vez por frame, antes del ExecuteCommandLists de la cola gráfica: manda en un lote todo lo subido desde el frame
+// anterior y, si hubo lote nuevo, encola en la cola gráfica un Wait a su fence. El Wait es en la GPU (la CPU sigue) y
+// queda detrás de los frames ya enviados, así que la copia corre en paralelo con ellos.
+void SubmitGeometryUploads()
+{
+    const UINT64 fence = g_uploads.Flush();
+    g_uploads.Collect();
+    if (fence > g_gfxCopyWait)
+    {
+        ThrowIfFailed(g_cmdQueue->Wait(g_copyQueueFence.Fence(), fence));
+        g_gfxCopyWait = fence;
+    }
+}
+
+// Al salir: la cola de copia no puede quedar escribiendo en buffers que se están destruyendo.
+void StopGeometryUploader()
+{
+    g_uploads.WaitIdle();
+    g_copyQueueFence.Shutdown();
+
+    char buf[256];
+    sprintf_s(buf, "Geometry uploads: %.2f MB in %llu copy batches (%llu copies) | ring %llu MB, peak %.2f MB | %llu stalls\n",
+        g_uploads.Bytes() / (1024.0 * 1024.0), (unsigned long long)g_uploads.Batches(), (unsigned long long)g_uploads.Copies(),
+        (unsigned long long)(StagingRingSize >> 20), g_uploads.Ring().PeakBytes() / (1024.0 * 1024.0), (unsigned long long)g_uploads.Stalls());
+    OutputDebugStringA(buf);
+}
+
+DXGI_FORMAT ChooseBackbufferFormat() { return DXGI_FORMAT_R8G8B8A8_UNORM; } //8 bits por canal(RGB) + alpha. Color “normalizado”[0..1].
+DXGI_FORMAT ChooseDepthFormat() { return DXGI_FORMAT_D32_FLOAT; } //32 bits en float para profundidad.
+
+// Clave del PSO para el estado actual (modo de la tecla T + features + formatos). RecordRender la busca en g_pipelines.
+PipelineKey CurrentPipelineKey()
+{
+    PipelineKey k;
+    k.mode = (uint32_t)g_mode;
+    k.features = g_shaderFeatures;
+    k.rtvFormat = ChooseBackbufferFormat();
+    k.dsvFormat = ChooseDepthFormat();
+    return k;
+}
+
+void UpdateWindowTitle() //Just set title of window with current values
+{
+    static const wchar_t* modelLabels[] = { L"Model (loading...)", L"Model", L"Model (failed, cube)" };
+    const wchar_t* geom = (g_geomMode == 0) ? L"Cube" : (g_geomMode == 1) ? L"Sphere" : modelLabels[g_modelState];
+
+    // Esfera (sola o barrido): generador, LOD elegido y triángulos por esfera
+    static const wchar_t* sphereKinds[] = { L"ico", L"cube", L"uv" };
+    wchar_t sphere[96] = L"";
+    if ((g_sweepEnabled || g_geomMode == 1) && g_sphereLod < g_sphereLods.size())
+        swprintf_s(sphere, L"  |  %s LOD %s%u: %u tris", sphereKinds[g_sphereKind], (g_lodForced >= 0) ? L"" : L"auto ",
+            g_sphereLod, g_sphereLods[g_sphereLod].indexCount / 3);
+
+    const wchar_t* albedo = (g_shaderFeatures & ShaderFeatureNormalAlbedo) ? L" (normal albedo)" : L"";
+
+    wchar_t buffer[256];
+    if (g_sweepEnabled) {
+        swprintf_s(buffer, L"DX12 PBR  |  Mode: %d%s  |  Sweep %ux%u (%u instancias, 1 draw)%s  ao=%.2f",
+            g_mode, albedo, g_sweepDim, g_sweepDim, g_sweepDim * g_sweepDim, sphere, g_ao);
+    }
+    else {
+        wchar_t cull[128] = L"";
+        if (g_geomMode == 2 && g_modelState == ModelReady)
+        {
+            wchar_t lod[16];
+            if (g_lodForced >= 0) swprintf_s(lod, L"%d", g_lodForced); else swprintf_s(lod, L"auto");
+            if (g_meshletCulling)
+                swprintf_s(cull, L"  |  LOD %s  |  Cull: %llu / %llu tris", lod, (unsigned long long)g_cullStats.trianglesOut, (unsigned long long)g_cullStats.trianglesIn);
+            else
+                swprintf_s(cull, L"  |  LOD %s  |  Cull: off, %llu tris", lod, (unsigned long long)g_lodTriangles);
+        }
+        swprintf_s(buffer, L"DX12 PBR  |  Mode: %d%s  |  %s%s%s  |  metallic=%.2f  roughness=%.2f  ao=%.2f",
+            g_mode, albedo, geom, cull, sphere, g_metallic, g_roughness, g_ao);
+    }
+    SetWindowText(g_hWnd, buffer);
+}
+
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+// Fin: Includes, configuración global y tipos(Vertex, CBData, globals DX12, helpers)
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+// Inicio: Plataforma y DX12 core
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Events / Windowing
+//--------------------------------------------------------------------------------------
+
+LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) // Handle Window callbacks
+{
+    switch (msg)
+    {
+        case WM_DESTROY: PostQuitMessage(0); return 0; // Post WM_QUIT para finalizar end loop
+        case WM_KEYDOWN: //Manejar inputs de usuario.
+        {
+            if (wParam == 'T') {
+                g_mode = (g_mode + 1) % (int)ShadingModeCount; // 0..5: cambia de PSO, el PS no evalúa el modo
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'N') { // N = albedo = color debug por normal on/off (permutación NORMAL_ALBEDO)
+                g_shaderFeatures ^= ShaderFeatureNormalAlbedo;
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'M') {
+                g_metallicIdx = (g_metallicIdx + 1) % (int)(sizeof(g_metallicPresets) / sizeof(float));
+                g_metallic = g_metallicPresets[g_metallicIdx];
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'R') {
+                g_roughnessIdx = (g_roughnessIdx + 1) % (int)(sizeof(g_roughnessPresets) / sizeof(float));
+                g_roughness = g_roughnessPresets[g_roughnessIdx];
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'A') {
+                g_aoIdx = (g_aoIdx + 1) % (int)(sizeof(g_aoPresets) / sizeof(float));
+                g_ao = g_aoPresets[g_aoIdx];
+                g_sweepDirty = true; // las instancias del sweep llevan el AO horneado
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'P') {       // Pause/Resume cube rotation
+                g_pauseRotation = !g_pauseRotation;
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'G') { // alternar geometría
+                g_geomMode = (g_geomMode + 1) % 3; // 0..2
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'F') { // F = fijar/liberar luz frente a cámara
+                g_lightPinnedFront = !g_lightPinnedFront;
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'L') { // L = LOD automático → 0 → 1 → ... → último → automático
+                g_lodForced = (g_lodForced + 1 < (int)ModelMaxLods) ? g_lodForced + 1 : -1;
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'C') { // C = culling por meshlet del modelo on/off
+                g_meshletCulling = !g_meshletCulling;
+                UpdateWindowTitle();
+            }
+            else if (wParam == 'S') { // S = barrido de materiales on/off
+                g_sweepEnabled = !g_sweepEnabled;
+                UpdateWindowTitle();
+            }
+            else if (wParam == VK_ADD || wParam == VK_OEM_PLUS) { // + = grilla más grande
+                if (g_sweepDim < g_sweepMaxDim) { g_sweepDim *= 2; g_sweepDirty = true; }
+                UpdateWindowTitle();
+            }
+            else if (wParam == VK_SUBTRACT || wParam == VK_OEM_MINUS) { // - = grilla más chica (mínimo: presets)
+                if (g_sweepDim > 4) { g_sweepDim /= 2; g_sweepDirty = true; }
+                UpdateWindowTitle();
+            }
+            return 0;
+        }
+    }
+
+    return DefWindowProc(hWnd, msg, wParam, lParam); //Deja que windows maneje el mensaje
+}
+
+void CreateAppWindow(HINSTANCE hInst)
+{
+    //Obtenemos un handler a una nueva ventana de windows en g_hWnd con una Width y un Height determinados
+
+    WNDCLASS wc = {}; //Creamos tipo WNDCLASS
+    wc.lpfnWndProc = WndProc; // Funcion handler de eventos
+    wc.hInstance = hInst; // Handler a instancia
+    wc.lpszClassName = L"DX12CubeWndClass"; // Nombre de clase a crear
+    wc.hCursor = LoadCursor(nullptr, IDC_ARROW);
     RegisterClass(&wc);
 
-    RECT rc = { 0,0,(LONG)Width,(LONG)Height };
-    AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
+    RECT rc = { 0,0,(LONG)Width,(LONG)Height };
+    AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
+
+    g_hWnd = CreateWindow(wc.lpszClassName, L"DX12 Rotating Cube PBR (Press T to switch modes)",
+        WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT,
+        rc.right - rc.left, rc.bottom - rc.top,
+        nullptr, nullptr, hInst, nullptr);
+    ShowWindow(g_hWnd, SW_SHOW);
+}
+
+//--------------------------------------------------------------------------------------
+// Init DX12 core
+//--------------------------------------------------------------------------------------
+void CreateFactoryAndDevice()
+{
+    // Debug layer stuff, no funciona. Ver.
+#if _DEBUG
+    {
+        ComPtr<ID3D12Debug> dbg;
+        if (SUCCEEDED(D3D12GetDebugInterface(IID_PPV_ARGS(&dbg))))
+            dbg->EnableDebugLayer();
+    }
+#endif
+
+    UINT flags = 0;
+#if _DEBUG
+    flags |= DXGI_CREATE_FACTORY_DEBUG;
+#endif
+
+    // Crear DXGI factory para enumerar adaptadores.
+    ThrowIfFailed(CreateDXGIFactory2(flags, IID_PPV_ARGS(&g_factory)));
+
+    // Obtener Device (descarta adaptadores lógicos, solo hardware). Toma el primero. Con g_forceWarp va directo a WARP.
+    ComPtr<IDXGIAdapter1> adapter;
+    for (UINT i = 0; !g_forceWarp && g_factory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND; ++i)
+    {
+        DXGI_ADAPTER_DESC1 desc;
+        adapter->GetDesc1(&desc);
+        if (desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) continue;
+        if (SUCCEEDED(D3D12CreateDevice(adapter.Get(), D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&g_device))))
+        {
+            WideCharToMultiByte(CP_UTF8, 0, desc.Description, -1, g_adapterName, sizeof(g_adapterName), nullptr, nullptr);
+            break;
+        }
+    }
+
+    if (!g_device) {
+        // WARP fallback (si no encuentro device uso WARP (rasterizador por software acelerado por CPU)
+        ComPtr<IDXGIAdapter> warp;
+        ThrowIfFailed(g_factory->EnumWarpAdapter(IID_PPV_ARGS(&warp)));
+        ThrowIfFailed(D3D12CreateDevice(warp.Get(), D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&g_device)));
+        strcpy_s(g_adapterName, "WARP");
+    }
+    g_gpuHeaps.Init(g_device.Get(), g_placedResources);
+
+    // Command queue. Crear la cola de comandos principal
+    // Recibe command lists ya grabadas y las manda a la GPU en orden.
+
+    D3D12_COMMAND_QUEUE_DESC qd = {};
+    qd.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+    qd.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
+    ThrowIfFailed(g_device->CreateCommandQueue(&qd, IID_PPV_ARGS(&g_cmdQueue)));
+}
+
+void CreateSwapchainAndRTVs()
+{
+    // Creació de Swap chain (backbuffers) donde dibujar cada frame
+    ComPtr<IDXGISwapChain1> sc1;
+    DXGI_SWAP_CHAIN_DESC1 sd = {};
+    sd.BufferCount = FrameCount;
+    sd.Width = Width;
+    sd.Height = Height;
+    sd.Format = ChooseBackbufferFormat();
+    sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+    sd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+    sd.SampleDesc.Count = 1;
+
+    ThrowIfFailed(g_factory->CreateSwapChainForHwnd(
+        g_cmdQueue.Get(), g_hWnd, &sd, nullptr, nullptr, &sc1));
+
+    ThrowIfFailed(sc1.As(&g_swapChain));
+    g_frameIndex = g_swapChain->GetCurrentBackBufferIndex();
+
+    
+    // RTV heap Render Target View     
+    // Crear el descriptor heap RTV con FrameCount cantidad de descriptores.
+    D3D12_DESCRIPTOR_HEAP_DESC rtvDesc = {};
+    rtvDesc.NumDescriptors = FrameCount;
+    rtvDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+    rtvDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+    ThrowIfFailed(g_device->CreateDescriptorHeap(&rtvDesc, IID_PPV_ARGS(&g_rtvHeap)));
+    g_rtvDescriptorSize = g_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV); //Guardo el stride
+
+    //CD3DX12_CPU_DESCRIPTOR_HANDLE; // dummy to remind - not available; manual handle math below
+
+    // Crea cada RTV.
+    // Tambien crear un command allocator por frame buffer (Tener uno por frame permite grabar/ejecutar mientras otro está aún en uso por la GPU.)
+    D3D12_CPU_DESCRIPTOR_HANDLE rtvHandle = g_rtvHeap->GetCPUDescriptorHandleForHeapStart();
+    for (UINT i = 0; i < FrameCount; ++i)
+    {
+        ThrowIfFailed(g_swapChain->GetBuffer(i, IID_PPV_ARGS(&g_renderTargets[i])));
+        g_resourceStates.Register(g_renderTargets[i].Get(), 1, D3D12_RESOURCE_STATE_PRESENT);
+        g_device->CreateRenderTargetView(g_renderTargets[i].Get(), nullptr, rtvHandle);
+        rtvHandle.ptr += g_rtvDescriptorSize;
+        ThrowIfFailed(g_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&g_cmdAlloc[i])));
+    }
+}
+
+void CreateDepthBuffer()
+{
+    // Crea un descriptor heap de DSV con 1 descriptor
+    D3D12_DESCRIPTOR_HEAP_DESC dsvDesc = {};
+    dsvDesc.NumDescriptors = 1;
+    dsvDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
+    dsvDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+    ThrowIfFailed(g_device->CreateDescriptorHeap(&dsvDesc, IID_PPV_ARGS(&g_dsvHeap)));
+    g_dsvDescriptorSize = g_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV); //Guardo stride por si necesito más después.
+
+    // La textura de depth es un transitorio del render graph: g_transients la crea en su heap y RecordRender
+    // escribe el DSV (UpdateDepthView) cuando cambia.
+    g_transients.Init(g_device.Get(), &g_resourceStates, &g_retired);
+}
+
+// Desc de la textura de depth del frame (Z-buffer del tamaño del render, clear a 1).
+RgTextureDesc DepthTextureDesc()
+{
+    RgTextureDesc d;
+    d.width = g_renderWidth;
+    d.height = g_renderHeight;
+    d.format = ChooseDepthFormat();
+    d.flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+    d.clear.Format = ChooseDepthFormat();
+    d.clear.DepthStencil.Depth = 1.0f;
+    d.clear.DepthStencil.Stencil = 0;
+    return d;
+}
+
+// Crea el descriptor para Depth Stencil View si la textura de depth es otra que la del DSV actual.
+void UpdateDepthView(ID3D12Resource* depth)
+{
+    if (g_depthTex == depth && g_depthDsvGeneration == g_transients.Generation()) return;
+    g_depthTex = depth;
+    g_depthDsvGeneration = g_transients.Generation();
+
+    D3D12_DEPTH_STENCIL_VIEW_DESC dsv = {};
+    dsv.Format = ChooseDepthFormat();
+    dsv.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
+    dsv.Flags = D3D12_DSV_FLAG_NONE;
+    g_device->CreateDepthStencilView(depth, &dsv, g_dsvHeap->GetCPUDescriptorHandleForHeapStart());
+}
+
+void CreateCmdListAndFence()
+{
+    // Crea la command list principal(g_cmdList) usando el command allocator del frame actual.
+
+    ThrowIfFailed(g_device->CreateCommandList(
+        0, D3D12_COMMAND_LIST_TYPE_DIRECT, g_cmdAlloc[g_frameIndex].Get(), nullptr, IID_PPV_ARGS(&g_cmdList)));
+    ThrowIfFailed(g_cmdList->Close()); // Arrancamos cerrada. Se cierra inmediatamente, porque el primer uso real la va a volver a abrir con Reset.
+
+    // Listas para grabar los draws en paralelo: un allocator por frame en vuelo y por lista
+    for (UINT j = 0; j < MaxRecordLists; ++j)
+    {
+        for (UINT f = 0; f < FrameCount; ++f)
+            ThrowIfFailed(g_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&g_recordAlloc[f][j])));
+        ThrowIfFailed(g_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, g_recordAlloc[0][j].Get(), nullptr, IID_PPV_ARGS(&g_recordLists[j])));
+        ThrowIfFailed(g_recordLists[j]->Close());
+    }
+
+    // Crear fence usado para sincronización CPU/GPU en Present() y WaitForGPU().
+    g_gfxQueueFence.Init(g_device.Get(), g_cmdQueue.Get());
+    g_frameScheduler.Init(&g_gfxQueueFence);
+}
+
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+// Fin: Plataforma y DX12 core
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+// Inicio: Pipeline y recursos de escena
+//--------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Cache de bytecode de shaders (.shadercache)
+//--------------------------------------------------------------------------------------
+
+// Un solo archivo indexado para todos los shaders y permutaciones, mapeado en memoria:
+//   ShaderPackHeader | ShaderPackEntry[entryCount] ordenadas por key | blobs de bytecode alineados a 16
+// La clave de cada blob es el hash del fuente y sus includes, el entry point, el perfil, los flags y los defines:
+// si cualquiera cambia es otra clave (miss) y el blob viejo se descarta en el próximo Flush.
+static const uint32_t ShaderPackVersion = 1;
+static const uint32_t ShaderPackMagic = 0x4B504853; // "SHPK"
+static const char*    ShaderPackPath = "shaders.shadercache"; // junto a PBR.hlsl (directorio de trabajo)
+
+struct ShaderPackHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t entryCount;
+};
+
+struct ShaderPackEntry
+{
+    uint64_t key;        // ShaderKey(desc, sourceHash)
+    uint64_t fileId;     // hash del path del fuente: agrupa las entradas que invalida un cambio en ese archivo
+    uint64_t sourceHash; // fuente + includes con los que se compiló
+    uint64_t blobHash;   // HashBytes64 del bytecode, para no devolver un blob corrupto
+    uint64_t offset;
+    uint64_t size;
+};
+static_assert(sizeof(ShaderPackHeader) == 16 && sizeof(ShaderPackEntry) == 48, "Layout del .shadercache: subir ShaderPackVersion");
+
+// Qué compilar. Los defines van como strings (no D3D_SHADER_MACRO) para poder hashearlos y copiarlos entre hilos.
+struct ShaderCompileDesc
+{
+    std::string file;   // relativo al directorio de trabajo, como en D3DCompileFromFile
+    std::string entry;
+    std::string target; // perfil: vs_5_0, ps_5_0, ...
+    std::vector<std::pair<std::string, std::string>> defines;
+    UINT flags = 0;
+};
+
+// Interfaz mínima del compilador. El cache solo habla con esto, así que hits, misses e invalidación se pueden
+// ejercitar sin d3dcompiler (StubShaderCompiler) y usar la misma lógica con D3DCompileFromFile.
+struct IShaderCompiler
+{
+    virtual ~IShaderCompiler() = default;
+    virtual bool ReadSource(const std::string& path, std::string& text) = 0; // fuente o include, para la clave
+    virtual bool Compile(const ShaderCompileDesc& desc, std::vector<uint8_t>& bytecode, std::string& errors) = 0; // thread-safe
+};
+
+// Implementación real: archivos del disco + D3DCompileFromFile (d3dcompiler_47 se puede llamar desde varios hilos).
+class D3DShaderCompiler : public IShaderCompiler
+{
+public:
+    bool ReadSource(const std::string& path, std::string& text) override
+    {
+        FILE* f = nullptr;
+        if (fopen_s(&f, path.c_str(), "rb") != 0 || !f) return false;
+        text.clear();
+        char buf[4096];
+        for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;) text.append(buf, n);
+        fclose(f);
+        return true;
+    }
+
+    bool Compile(const ShaderCompileDesc& desc, std::vector<uint8_t>& bytecode, std::string& errors) override
+    {
+        std::vector<D3D_SHADER_MACRO> macros;
+        for (const auto& d : desc.defines) macros.push_back({ d.first.c_str(), d.second.c_str() });
+        macros.push_back({ nullptr, nullptr });
+
+        const std::wstring file(desc.file.begin(), desc.file.end()); // paths ASCII
+        ComPtr<ID3DBlob> blob, errBlob;
+        const HRESULT hr = D3DCompileFromFile(file.c_str(), macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE,
+            desc.entry.c_str(), desc.target.c_str(), desc.flags, 0, &blob, &errBlob);
+        if (errBlob) errors.assign((const char*)errBlob->GetBufferPointer(), errBlob->GetBufferSize());
+        if (FAILED(hr)) return false;
+
+        const uint8_t* p = static_cast<const uint8_t*>(blob->GetBufferPointer());
+        bytecode.assign(p, p + blob->GetBufferSize());
+        return true;
+    }
+};
+
+// Compilador falso para correr el cache sin d3dcompiler: los archivos viven en memoria y el "bytecode" es un texto
+// derivado del pedido y del fuente. Cuenta las compilaciones y cuántas corrieron a la vez.
+class StubShaderCompiler : public IShaderCompiler
+{
+public:
+    std::vector<std::pair<std::string, std::string>> files; // path -> contenido
+    std::atomic<uint32_t> compiles{ 0 };
+    std::atomic<uint32_t> running{ 0 };
+    std::atomic<uint32_t> peakParallel{ 0 };
+
+    bool ReadSource(const std::string& path, std::string& text) override
+    {
+        for (const auto& f : files)
+            if (f.first == path) { text = f.second; return true; }
+        return false;
+    }
+
+    bool Compile(const ShaderCompileDesc& desc, std::vector<uint8_t>& bytecode, std::string& errors) override
+    {
+        const uint32_t now = ++running;
+        for (uint32_t peak = peakParallel; now > peak && !peakParallel.compare_exchange_weak(peak, now);) {}
+        ++compiles;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // "compilar" tarda: deja ver el paralelismo
+
+        std::string source;
+        const bool ok = ReadSource(desc.file, source) && source.find("#error") == std::string::npos;
+        if (ok)
+        {
+            char buf[160];
+            sprintf_s(buf, "DXBC-stub|%s|%s|%u|%016llx", desc.entry.c_str(), desc.target.c_str(), desc.flags,
+                (unsigned long long)HashBytes64(reinterpret_cast<const uint8_t*>(source.data()), source.size()));
+            std::string text = buf;
+            for (const auto& d : desc.defines) text += "|" + d.first + "=" + d.second;
+            bytecode.assign(text.begin(), text.end());
+        }
+        else
+            errors = desc.file + ": error X1000: stub compile failed";
+        --running;
+        return ok;
+    }
+};
+
+// Hash del fuente y de todo lo que incluye con #include "..." (recursivo, relativo al archivo que incluye). Los
+// #include <...> son del sistema y no entran en la clave.
+bool HashShaderSource(IShaderCompiler& compiler, const std::string& path, uint64_t& hash, std::vector<std::string>& visited)
+{
+    if (std::find(visited.begin(), visited.end(), path) != visited.end()) return true; // include guard / ciclo
+    visited.push_back(path);
+
+    std::string text;
+    if (!compiler.ReadSource(path, text)) return false;
+    hash = (hash ^ HashBytes64(reinterpret_cast<const uint8_t*>(text.data()), text.size())) * 1099511628211ull;
+
+    const size_t slash = path.find_last_of("/\\");
+    const std::string dir = (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+    for (size_t line = 0; line < text.size();)
+    {
+        size_t end = text.find('\n', line);
+        if (end == std::string::npos) end = text.size();
+        size_t p = text.find_first_not_of(" \t", line);
+        if (p < end && text.compare(p, 8, "#include") == 0)
+        {
+            const size_t open = text.find('"', p + 8), close = (open < end) ? text.find('"', open + 1) : std::string::npos;
+            if (open < end && close < end && !HashShaderSource(compiler, dir + text.substr(open + 1, close - open - 1), hash, visited))
+                return false;
+        }
+        line = end + 1;
+    }
+    return true;
+}
+
+// Clave de un blob: fuente + entry + perfil + flags + defines (en orden).
+uint64_t ShaderKey(const ShaderCompileDesc& desc, uint64_t sourceHash)
+{
+    std::string text = desc.entry + '\n' + desc.target + '\n' + std::to_string(desc.flags) + '\n';
+    for (const auto& d : desc.defines) text += d.first + '=' + d.second + '\n';
+    return HashBytes64(reinterpret_cast<const uint8_t*>(text.data()), text.size()) ^ (sourceHash * 0x9E3779B97F4A7C15ull);
+}
+
+// Cache persistente: el .shadercache se mapea al abrir y los hits salen de ahí (búsqueda binaria por clave). Los
+// misses se compilan en paralelo (un job por pedido con ParallelFor: en un arranque en frío el VS y el PS no se esperan
+// entre sí) y quedan en memoria hasta Flush, que reescribe el pack entero descartando las entradas de fuentes que
+// cambiaron.
+class ShaderCache
+{
+public:
+    void Open(IShaderCompiler* compiler, const std::string& packPath)
+    {
+        m_compiler = compiler;
+        m_path = packPath;
+        m_pending.clear();
+        m_sourceHashes.clear();
+        MapPack();
+    }
+
+    // Bytecode de cada desc, en el mismo orden. Devuelve false si alguno no compila (errores del compilador en 'errors').
+    bool Get(const std::vector<ShaderCompileDesc>& descs, std::vector<std::vector<uint8_t>>& out, std::string& errors)
+    {
+        out.assign(descs.size(), std::vector<uint8_t>());
+        std::vector<uint64_t> keys(descs.size()), fileIds(descs.size()), sourceHashes(descs.size());
+        std::vector<size_t> misses;
+        for (size_t i = 0; i < descs.size(); ++i)
+        {
+            std::vector<std::string> visited;
+            sourceHashes[i] = 14695981039346656037ull;
+            if (!HashShaderSource(*m_compiler, descs[i].file, sourceHashes[i], visited))
+            {
+                errors += descs[i].file + ": no se pudo leer el fuente o un include\n";
+                return false;
+            }
+            fileIds[i] = HashBytes64(reinterpret_cast<const uint8_t*>(descs[i].file.data()), descs[i].file.size());
+            m_sourceHashes[fileIds[i]] = sourceHashes[i];
+            keys[i] = ShaderKey(descs[i], sourceHashes[i]);
+            if (Find(keys[i], out[i])) ++m_hits;
+            else { ++m_misses; misses.push_back(i); }
+        }
+        if (misses.empty()) return true;
+
+        std::vector<std::string> compileErrors(misses.size());
+        std::vector<char> compiled(misses.size(), 0);
+        auto compile = [&](size_t m) { compiled[m] = m_compiler->Compile(descs[misses[m]], out[misses[m]], compileErrors[m]); };
+
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        ParallelFor((UINT)misses.size(), 1, [&](UINT begin, UINT end) { for (UINT m = begin; m < end; ++m) compile(m); });
+        m_compileMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+        bool ok = true;
+        for (size_t m = 0; m < misses.size(); ++m)
+        {
+            const size_t i = misses[m];
+            errors += compileErrors[m];
+            if (!compiled[m]) { ok = false; continue; } // un fuente que no compila no se cachea
+            Pending& p = m_pending[keys[i]];
+            p.fileId = fileIds[i];
+            p.sourceHash = sourceHashes[i];
+            p.bytecode = out[i];
+        }
+        return ok;
+    }
+
+    // Reescribe el pack (entradas mapeadas todavía válidas + las compiladas en esta sesión). Las entradas de un
+    // archivo cuyo fuente actual tiene otro hash ya no se pueden pedir y se descartan.
+    bool Flush()
+    {
+        if (m_pending.empty() && !m_staleMapped) return true;
+
+        struct Item { uint64_t key, fileId, sourceHash; const uint8_t* data; size_t size; };
+        std::vector<Item> items;
+        for (const auto& p : m_pending)
+            items.push_back({ p.first, p.second.fileId, p.second.sourceHash, p.second.bytecode.data(), p.second.bytecode.size() });
+        for (uint64_t i = 0; i < m_entryCount; ++i)
+        {
+            const ShaderPackEntry& e = m_entries[i];
+            if (m_pending.count(e.key) || !BlobInPack(e)) continue;
+            auto it = m_sourceHashes.find(e.fileId);
+            if (it != m_sourceHashes.end() && it->second != e.sourceHash) { ++m_invalidated; continue; }
+            items.push_back({ e.key, e.fileId, e.sourceHash, m_pack.Data() + e.offset, (size_t)e.size });
+        }
+        std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.key < b.key; });
+
+        uint64_t offset = Align16(sizeof(ShaderPackHeader) + items.size() * sizeof(ShaderPackEntry));
+        std::vector<ShaderPackEntry> entries(items.size());
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            entries[i] = { items[i].key, items[i].fileId, items[i].sourceHash, HashBytes64(items[i].data, items[i].size), offset, items[i].size };
+            offset = Align16(offset + items[i].size);
+        }
+
+        std::vector<uint8_t> blob((size_t)offset, 0);
+        const ShaderPackHeader h = { ShaderPackMagic, ShaderPackVersion, items.size() };
+        memcpy(blob.data(), &h, sizeof(h));
+        if (!entries.empty()) memcpy(blob.data() + sizeof(h), entries.data(), entries.size() * sizeof(ShaderPackEntry));
+        for (size_t i = 0; i < items.size(); ++i)
+            if (items[i].size) memcpy(blob.data() + entries[i].offset, items[i].data, items[i].size);
+
+        m_pack.Close(); // el blob ya tiene copiado todo lo que apuntaba al pack
+        m_entries = nullptr; m_entryCount = 0;
+        const bool ok = WriteFileAtomic(m_path, blob);
+        if (ok) m_pending.clear(); // si no se pudo escribir se quedan en memoria y se reintenta en el próximo Flush
+        MapPack();
+        return ok;
+    }
+
+    uint64_t Hits() const { return m_hits; }
+    uint64_t Misses() const { return m_misses; }
+    uint64_t Invalidated() const { return m_invalidated; } // entradas descartadas por cambios en el fuente
+    uint64_t Corrupt() const { return m_corrupt; }         // blobs del pack que no pasaron el blobHash
+    uint64_t PackEntries() const { return m_entryCount; }
+    size_t   PendingEntries() const { return m_pending.size(); }
+    double   CompileMs() const { return m_compileMs; }     // tiempo de pared compilando misses
+
+private:
+    struct Pending { uint64_t fileId = 0, sourceHash = 0; std::vector<uint8_t> bytecode; };
+
+    void MapPack()
+    {
+        m_entries = nullptr; m_entryCount = 0; m_staleMapped = false;
+        if (!m_pack.Open(m_path)) return;
+
+        ShaderPackHeader h;
+        if (m_pack.Size() < sizeof(h)) { m_pack.Close(); return; }
+        memcpy(&h, m_pack.Data(), sizeof(h));
+        if (h.magic != ShaderPackMagic || h.version != ShaderPackVersion ||
+            h.entryCount > (m_pack.Size() - sizeof(h)) / sizeof(ShaderPackEntry))
+        {
+            m_pack.Close(); // versión vieja o archivo roto: se reescribe entero en el próximo Flush
+            m_staleMapped = true;
+            return;
+        }
+        m_entries = reinterpret_cast<const ShaderPackEntry*>(m_pack.Data() + sizeof(h)); // alineado: el header mide 16
+        m_entryCount = h.entryCount;
+    }
+
+    bool BlobInPack(const ShaderPackEntry& e) const { return e.offset <= m_pack.Size() && e.size <= m_pack.Size() - e.offset; }
+
+    bool Find(uint64_t key, std::vector<uint8_t>& out)
+    {
+        auto pending = m_pending.find(key);
+        if (pending != m_pending.end()) { out = pending->second.bytecode; return true; }
+
+        const ShaderPackEntry* end = m_entries + m_entryCount;
+        const ShaderPackEntry* e = std::lower_bound(m_entries, end, key, [](const ShaderPackEntry& a, uint64_t k) { return a.key < k; });
+        if (e == end || e->key != key) return false;
+        if (!BlobInPack(*e) || HashBytes64(m_pack.Data() + e->offset, (size_t)e->size) != e->blobHash)
+        {
+            ++m_corrupt;
+            m_staleMapped = true; // el Flush reescribe el pack con el blob recompilado
+            return false;
+        }
+        out.assign(m_pack.Data() + e->offset, m_pack.Data() + e->offset + e->size);
+        return true;
+    }
+
+    IShaderCompiler*        m_compiler = nullptr;
+    std::string             m_path;
+    MappedFile              m_pack;
+    const ShaderPackEntry*  m_entries = nullptr; // dentro de m_pack, ordenadas por key
+    uint64_t                m_entryCount = 0;
+    bool                    m_staleMapped = false; // hay que reescribir el pack aunque no haya entradas nuevas
+    std::unordered_map<uint64_t, Pending, PipelineKeyHash> m_pending;       // compiladas en esta sesión, sin escribir
+    std::unordered_map<uint64_t, uint64_t, PipelineKeyHash> m_sourceHashes; // fileId -> hash actual del fuente
+    uint64_t m_hits = 0, m_misses = 0, m_invalidated = 0, m_corrupt = 0;
+    double   m_compileMs = 0.0;
+};
+
+D3DShaderCompiler g_d3dShaderCompiler;
+ShaderCache       g_shaderCache; // lo abre CreateRootSigAndPSO; Flush al crear el PSO inicial y al salir
+
+// Chequeo del cache sin ventana ni d3dcompiler (-shader-cache-selftest), con StubShaderCompiler y un pack temporal:
+// arranque en frío (misses compilados en paralelo), reinicio con el pack mapeado (todo hits), flags distintos, un
+// include modificado (invalida todo lo del archivo), un blob corrupto en disco y un fuente que no compila.
+int RunShaderCacheSelfTest()
+{
+    const std::string packPath = "shadercache_selftest.shadercache";
+    DeleteFileA(packPath.c_str());
+
+    StubShaderCompiler compiler;
+    compiler.files = { { "Shaders/PBR.hlsl", "#include \"Common.hlsli\"\nfloat4 PSMain() : SV_TARGET { return 1; }\n" },
+                       { "Shaders/Common.hlsli", "static const float PI = 3.14159;\n" },
+                       { "Shaders/Broken.hlsl", "#error roto\n" } };
+
+    std::vector<ShaderCompileDesc> descs(3);
+    descs[0].file = descs[1].file = descs[2].file = "Shaders/PBR.hlsl";
+    descs[0].entry = "VSMain"; descs[0].target = "vs_5_0";
+    descs[1].entry = "PSMain"; descs[1].target = "ps_5_0"; descs[1].defines = { { "SHADING_MODE", "5" } };
+    descs[2].entry = "PSMain"; descs[2].target = "ps_5_0"; descs[2].defines = { { "SHADING_MODE", "0" } };
+
+    bool ok = true;
+    char buf[256];
+    auto check = [&](const char* step, bool pass, const ShaderCache& cache)
+    {
+        sprintf_s(buf, "Shader cache [%s]: %llu hits, %llu misses, %u compiles (peak %u in parallel), %llu invalidated, %llu corrupt, pack %llu entries | %s\n",
+            step, (unsigned long long)cache.Hits(), (unsigned long long)cache.Misses(), compiler.compiles.load(), compiler.peakParallel.load(),
+            (unsigned long long)cache.Invalidated(), (unsigned long long)cache.Corrupt(), (unsigned long long)cache.PackEntries(), pass ? "OK" : "FAIL");
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
+
+    std::vector<std::vector<uint8_t>> cold, warm, out;
+    std::string errors;
+    {
+        ShaderCache cache; // 1) frío: no hay pack, los tres se compilan a la vez
+        cache.Open(&compiler, packPath);
+        const bool got = cache.Get(descs, cold, errors);
+        check("cold", got && cache.Misses() == 3 && compiler.compiles == 3 && cache.Flush() && cache.PackEntries() == 3, cache);
+    }
+    {
+        ShaderCache cache; // 2) reinicio: todo sale del pack mapeado, idéntico a lo compilado
+        cache.Open(&compiler, packPath);
+        const bool got = cache.Get(descs, warm, errors);
+        check("warm", got && warm == cold && cache.Hits() == 3 && compiler.compiles == 3, cache);
+
+        std::vector<ShaderCompileDesc> debug = { descs[0] }; // 3) otros flags = otra clave
+        debug[0].flags = 1;
+        const bool gotDebug = cache.Get(debug, out, errors) && out[0] != cold[0];
+        check("flags", gotDebug && cache.Misses() == 1 && compiler.compiles == 4 && cache.Flush() && cache.PackEntries() == 4, cache);
+    }
+    {
+        compiler.files[1].second += "// cambio\n"; // 4) editar el include invalida todo lo compilado desde PBR.hlsl
+        ShaderCache cache;
+        cache.Open(&compiler, packPath);
+        const bool got = cache.Get(descs, out, errors);
+        const bool flushed = cache.Flush();
+        check("include edited", got && cache.Misses() == 3 && compiler.compiles == 7 && flushed && cache.Invalidated() == 4 && cache.PackEntries() == 3, cache);
+    }
+    {
+        std::vector<uint8_t> bytes; // 5) romper un byte del primer blob en disco: se detecta y se recompila
+        {
+            MappedFile f;
+            if (f.Open(packPath)) bytes.assign(f.Data(), f.Data() + f.Size());
+        }
+        ShaderPackEntry first = {};
+        if (bytes.size() >= sizeof(ShaderPackHeader) + sizeof(first))
+        {
+            memcpy(&first, bytes.data() + sizeof(ShaderPackHeader), sizeof(first));
+            if (first.size && first.offset < bytes.size()) bytes[(size_t)first.offset] ^= 0xFF;
+        }
+        const bool written = first.size && WriteFileAtomic(packPath, bytes);
+
+        ShaderCache cache;
+        cache.Open(&compiler, packPath);
+        const bool got = cache.Get(descs, out, errors);
+        check("corrupt blob", written && got && cache.Corrupt() == 1 && cache.Hits() == 2 && compiler.compiles == 8 && cache.Flush(), cache);
+
+        std::vector<ShaderCompileDesc> broken = { descs[0] }; // 6) no compila: error del compilador y nada al cache
+        broken[0].file = "Shaders/Broken.hlsl";
+        errors.clear();
+        const bool failed = !cache.Get(broken, out, errors) && errors.find("X1000") != std::string::npos;
+        check("compile error", failed && cache.PendingEntries() == 0, cache);
+    }
+
+    DeleteFileA(packPath.c_str());
+    return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Biblioteca de PSOs serializados (.psolib)
+//--------------------------------------------------------------------------------------
+
+// CreateGraphicsPipelineState compila el bytecode DXBC al ISA de la GPU en cada arranque; con una permutación por modo
+// eso se multiplica. ID3D12PipelineLibrary guarda los PSOs ya compilados por el driver y los devuelve por nombre. El
+// nombre es el hash canónico del desc (HashPipelineDesc), así que un cambio en cualquier estado o shader es otro PSO.
+// Archivo: PipelineLibraryHeader | blob de ID3D12PipelineLibrary::Serialize
+static const uint32_t PipelineLibraryVersion = 1;
+static const uint32_t PipelineLibraryMagic = 0x4C4F5350; // "PSOL"
+static const char*    PipelineLibraryPath = "pipelines.psolib";
+static const uint64_t PipelineLibraryMaxBytes = 64ull << 20; // al pasarlo se rearma solo con los PSOs de la sesión (descarta los viejos)
+static const uint32_t PipelineDescHashVersion = 1; // subir si cambia CanonicalPipelineDesc
+
+struct PipelineLibraryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t payloadSize;
+    uint64_t payloadHash; // HashBytes64 del blob: un archivo truncado no llega al driver
+    uint64_t _pad;
+};
+static_assert(sizeof(PipelineLibraryHeader) == 32, "PipelineLibraryHeader: subir PipelineLibraryVersion");
+
+// Forma canónica del desc: solo el contenido, campo por campo, nunca punteros ni padding. Los shaders entran por el
+// hash de su bytecode, la root signature por el hash de su blob serializado y los semantic names en mayúsculas (D3D
+// no distingue). Se omite lo que D3D ignora: blend de RT 1..7 sin IndependentBlendEnable, factores de blend/logic op
+// deshabilitados, stencil sin StencilEnable, depth func/write sin DepthEnable, RTVFormats más allá de NumRenderTargets
+// y CachedPSO. Dos descs que dan el mismo PSO dan los mismos bytes.
+std::vector<uint8_t> CanonicalPipelineDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& d, uint64_t rootSigHash)
+{
+    std::vector<uint8_t> c;
+    c.reserve(512);
+    auto put = [&c](uint64_t v) { for (int i = 0; i < 8; ++i) c.push_back((uint8_t)(v >> (8 * i))); }; // little endian siempre
+    auto putFloat = [&put](float f) { uint32_t u; if (f == 0.0f) f = 0.0f; memcpy(&u, &f, 4); put(u); }; // -0 == +0
+    auto putString = [&c, &put](const char* s)
+    {
+        const size_t n = s ? strlen(s) : 0;
+        put(n);
+        for (size_t i = 0; i < n; ++i) c.push_back((uint8_t)((s[i] >= 'a' && s[i] <= 'z') ? s[i] - 'a' + 'A' : s[i]));
+    };
+    auto putShader = [&put](const D3D12_SHADER_BYTECODE& b)
+    {
+        const bool has = b.pShaderBytecode && b.BytecodeLength;
+        put(has ? b.BytecodeLength : 0);
+        put(has ? HashBytes64(static_cast<const uint8_t*>(b.pShaderBytecode), b.BytecodeLength) : 0);
+    };
+
+    put(PipelineDescHashVersion);
+    put(rootSigHash);
+    putShader(d.VS); putShader(d.PS); putShader(d.DS); putShader(d.HS); putShader(d.GS);
+
+    const D3D12_STREAM_OUTPUT_DESC& so = d.StreamOutput;
+    put(so.pSODeclaration ? so.NumEntries : 0);
+    for (UINT i = 0; so.pSODeclaration && i < so.NumEntries; ++i)
+    {
+        const D3D12_SO_DECLARATION_ENTRY& e = so.pSODeclaration[i];
+        put(e.Stream); putString(e.SemanticName); put(e.SemanticIndex); put(e.StartComponent); put(e.ComponentCount); put(e.OutputSlot);
+    }
+    put(so.pBufferStrides ? so.NumStrides : 0);
+    for (UINT i = 0; so.pBufferStrides && i < so.NumStrides; ++i) put(so.pBufferStrides[i]);
+    put(so.RasterizedStream);
+
+    const D3D12_BLEND_DESC& b = d.BlendState;
+    put(b.AlphaToCoverageEnable != FALSE); put(b.IndependentBlendEnable != FALSE);
+    for (UINT i = 0; i < (b.IndependentBlendEnable ? 8u : 1u); ++i)
+    {
+        const D3D12_RENDER_TARGET_BLEND_DESC& rt = b.RenderTarget[i];
+        put(rt.BlendEnable != FALSE); put(rt.LogicOpEnable != FALSE);
+        if (rt.BlendEnable) { put(rt.SrcBlend); put(rt.DestBlend); put(rt.BlendOp); put(rt.SrcBlendAlpha); put(rt.DestBlendAlpha); put(rt.BlendOpAlpha); }
+        if (rt.LogicOpEnable) put(rt.LogicOp);
+        put(rt.RenderTargetWriteMask);
+    }
+    put(d.SampleMask);
+
+    const D3D12_RASTERIZER_DESC& r = d.RasterizerState;
+    put(r.FillMode); put(r.CullMode); put(r.FrontCounterClockwise != FALSE); put((uint32_t)r.DepthBias);
+    putFloat(r.DepthBiasClamp); putFloat(r.SlopeScaledDepthBias); put(r.DepthClipEnable != FALSE);
+    put(r.MultisampleEnable != FALSE); put(r.AntialiasedLineEnable != FALSE); put(r.ForcedSampleCount); put(r.ConservativeRaster);
+
+    const D3D12_DEPTH_STENCIL_DESC& ds = d.DepthStencilState;
+    put(ds.DepthEnable != FALSE);
+    if (ds.DepthEnable) { put(ds.DepthWriteMask); put(ds.DepthFunc); }
+    put(ds.StencilEnable != FALSE);
+    if (ds.StencilEnable)
+    {
+        put(ds.StencilReadMask); put(ds.StencilWriteMask);
+        for (const D3D12_DEPTH_STENCILOP_DESC* op : { &ds.FrontFace, &ds.BackFace })
+        { put(op->StencilFailOp); put(op->StencilDepthFailOp); put(op->StencilPassOp); put(op->StencilFunc); }
+    }
+
+    const D3D12_INPUT_LAYOUT_DESC& il = d.InputLayout;
+    put(il.pInputElementDescs ? il.NumElements : 0);
+    for (UINT i = 0; il.pInputElementDescs && i < il.NumElements; ++i)
+    {
+        const D3D12_INPUT_ELEMENT_DESC& e = il.pInputElementDescs[i];
+        putString(e.SemanticName); put(e.SemanticIndex); put(e.Format); put(e.InputSlot); put(e.AlignedByteOffset);
+        put(e.InputSlotClass); put(e.InstanceDataStepRate);
+    }
+
+    put(d.IBStripCutValue); put(d.PrimitiveTopologyType);
+    put(d.NumRenderTargets);
+    for (UINT i = 0; i < d.NumRenderTargets && i < 8; ++i) put(d.RTVFormats[i]);
+    put(d.DSVFormat); put(d.SampleDesc.Count); put(d.SampleDesc.Quality); put(d.NodeMask); put(d.Flags);
+    return c;
+}
+
+uint64_t HashPipelineDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& d, uint64_t rootSigHash)
+{
+    const std::vector<uint8_t> c = CanonicalPipelineDesc(d, rootSigHash);
+    return HashBytes64(c.data(), c.size());
+}
+
+// PSOs por hash canónico del desc. El archivo se mapea al abrir y la biblioteca del driver lee directo de ahí (por eso
+// el mapeo vive lo mismo que m_library). Si el driver o el adaptador cambiaron, CreatePipelineLibrary rechaza el blob
+// y se empieza con una biblioteca vacía. Los PSOs nuevos se agregan en memoria y Save reescribe el archivo.
+class PipelineLibrary
+{
+public:
+    void Open(ID3D12Device* device, const std::string& path, bool enabled)
+    {
+        m_path = path;
+        m_library.Reset();
+        m_file.Close();
+        if (!enabled || FAILED(device->QueryInterface(IID_PPV_ARGS(&m_device)))) return; // sin ID3D12Device1: sin biblioteca
+
+        PipelineLibraryHeader h = {};
+        const uint8_t* payload = nullptr;
+        if (m_file.Open(path) && m_file.Size() >= sizeof(h))
+        {
+            memcpy(&h, m_file.Data(), sizeof(h));
+            if (h.magic == PipelineLibraryMagic && h.version == PipelineLibraryVersion && h.payloadSize == m_file.Size() - sizeof(h) &&
+                HashBytes64(m_file.Data() + sizeof(h), (size_t)h.payloadSize) == h.payloadHash)
+                payload = m_file.Data() + sizeof(h);
+        }
+
+        if (payload && SUCCEEDED(m_device->CreatePipelineLibrary(payload, (size_t)h.payloadSize, IID_PPV_ARGS(&m_library))))
+            return;
+
+        if (m_file.Data()) // había archivo pero no sirve: otro driver/GPU, otra versión o roto
+        {
+            OutputDebugStringA("PSO library: stored library rejected (driver/adapter changed or file corrupt), starting empty\n");
+            m_dirty = true;
+        }
+        m_file.Close();
+        if (FAILED(m_device->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&m_library)))) m_library.Reset();
+    }
+
+    // PSO del desc: de la biblioteca si está, si no se crea y se guarda para el próximo arranque.
+    ComPtr<ID3D12PipelineState> LoadOrCreate(ID3D12Device* device, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, uint64_t descHash)
+    {
+        wchar_t name[32];
+        swprintf_s(name, L"pso_%016llx", (unsigned long long)descHash);
+
+        ComPtr<ID3D12PipelineState> pso;
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        if (m_library && SUCCEEDED(m_library->LoadGraphicsPipeline(name, &desc, IID_PPV_ARGS(&pso))))
+        {
+            ++m_loaded;
+            m_loadMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+            m_session.push_back({ name, pso });
+            return pso;
+        }
+
+        ThrowIfFailed(device->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pso)));
+        ++m_created;
+        m_createMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        m_session.push_back({ name, pso });
+        // Falla si el nombre ya existe con otro desc (colisión de hash): ese PSO simplemente no se cachea
+        if (m_library && SUCCEEDED(m_library->StorePipeline(name, pso.Get()))) m_dirty = true;
+        return pso;
+    }
+
+    // Reescribe el archivo si hay PSOs nuevos. La biblioteca sigue viva después, apuntando a la copia en memoria.
+    bool Save()
+    {
+        if (!m_library || !m_dirty) return true;
+
+        if (m_library->GetSerializedSize() > PipelineLibraryMaxBytes) // demasiadas variantes viejas: solo las de esta sesión
+        {
+            ComPtr<ID3D12PipelineLibrary> fresh;
+            if (FAILED(m_device->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&fresh)))) return false;
+            for (const auto& s : m_session) fresh->StorePipeline(s.name.c_str(), s.pso.Get());
+            m_library = fresh;
+        }
+
+        const size_t size = m_library->GetSerializedSize();
+        std::vector<uint8_t> blob(sizeof(PipelineLibraryHeader) + size);
+        if (FAILED(m_library->Serialize(blob.data() + sizeof(PipelineLibraryHeader), size))) return false;
+        PipelineLibraryHeader h = { PipelineLibraryMagic, PipelineLibraryVersion, size, HashBytes64(blob.data() + sizeof(h), size), 0 };
+        memcpy(blob.data(), &h, sizeof(h));
+
+        // La biblioteca lee del archivo mapeado: se recrea sobre el blob en memoria antes de soltar el mapeo y reemplazarlo.
+        ComPtr<ID3D12PipelineLibrary> reopened;
+        if (FAILED(m_device->CreatePipelineLibrary(blob.data() + sizeof(h), size, IID_PPV_ARGS(&reopened)))) return false;
+        m_library = reopened;
+        m_memory.swap(blob);
+        m_file.Close();
+
+        const bool ok = WriteFileAtomic(m_path, m_memory);
+        m_dirty = !ok;
+        return ok;
+    }
+
+    bool     Enabled() const { return m_library != nullptr; }
+    uint32_t Loaded() const { return m_loaded; }
+    uint32_t Created() const { return m_created; }
+    double   LoadMs() const { return m_loadMs; }     // LoadGraphicsPipeline de los hits
+    double   CreateMs() const { return m_createMs; } // CreateGraphicsPipelineState de los misses (o de todo, sin biblioteca)
+
+private:
+    struct SessionPso { std::wstring name; ComPtr<ID3D12PipelineState> pso; };
+
+    std::string                   m_path;
+    ComPtr<ID3D12Device1>         m_device;
+    ComPtr<ID3D12PipelineLibrary> m_library;
+    MappedFile                    m_file;   // blob leído al abrir (la biblioteca apunta acá)...
+    std::vector<uint8_t>          m_memory; // ...o, después de un Save, a esta copia
+    std::vector<SessionPso>       m_session;
+    bool     m_dirty = false;
+    uint32_t m_loaded = 0, m_created = 0;
+    double   m_loadMs = 0.0, m_createMs = 0.0;
+};
+
+PipelineLibrary g_pipelineLibrary;
+bool            g_pipelineLibraryEnabled = true; // false con -no-pso-cache (para medir el arranque sin biblioteca)
+uint64_t        g_rootSigHash = 0;                // hash del blob serializado de g_rootSig: entra en el hash de cada desc
+
+//--------------------------------------------------------------------------------------
+// RootSig + PSO
+//--------------------------------------------------------------------------------------
+// Flags de compilación de PBR.hlsl (VS y todas las permutaciones del PS).
+UINT ShaderCompileFlags()
+{
+    return
+#if _DEBUG
+        D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#else
+        0;
+#endif
+}
+
+// Pedido de compilación de un entry point de PBR.hlsl.
+ShaderCompileDesc PBRShaderDesc(const char* entry, const char* target, std::vector<std::pair<std::string, std::string>> defines = {})
+{
+    ShaderCompileDesc d;
+    d.file = "PBR.hlsl";
+    d.entry = entry;
+    d.target = target;
+    d.defines = std::move(defines);
+    d.flags = ShaderCompileFlags();
+    return d;
+}
+
+// Bytecode de varios entry points a través de g_shaderCache (los que no están se compilan en paralelo). Si alguno no
+// compila, el error del compilador va al log antes de abortar (con permutaciones un define puede romper una sola combinación).
+std::vector<std::vector<uint8_t>> CompileShaders(const std::vector<ShaderCompileDesc>& descs)
+{
+    std::vector<std::vector<uint8_t>> bytecode;
+    std::string errors;
+    const bool ok = g_shaderCache.Get(descs, bytecode, errors);
+    if (!errors.empty()) OutputDebugStringA(errors.c_str()); // warnings incluidos
+    ThrowIfFailed(ok ? S_OK : E_FAIL);
+    return bytecode;
+}
+
+// Desc del PSO de una clave. Los bytecodes tienen que seguir vivos hasta crear el PSO.
+D3D12_GRAPHICS_PIPELINE_STATE_DESC DescribePipeline(const PipelineKey& key, const std::vector<uint8_t>& vs, const std::vector<uint8_t>& ps)
+{
+    // Input layout (Describe cómo está armado el PackedVertex en memoria)
+    // El IA ya entrega los UNORM/SNORM convertidos a float: el VS solo aplica posScale/posBias y decodifica el octaedro.
+    static const D3D12_INPUT_ELEMENT_DESC il[] = {
+        { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, offsetof(PackedVertex,pos), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "NORMAL",   0, DXGI_FORMAT_R16G16_SNORM,       0, offsetof(PackedVertex,oct), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
+
+
+    // PIPELINE CONFIG:
+
+    // Rasterizer (Relleno sólido, culling de back faces, clipping de depth.)
+    D3D12_RASTERIZER_DESC rast = {};
+    rast.FillMode = D3D12_FILL_MODE_SOLID;
+    rast.CullMode = D3D12_CULL_MODE_BACK;
+    rast.FrontCounterClockwise = FALSE;
+    rast.DepthClipEnable = TRUE;
+
+    // Depth test activado, escribe el Z, pasa si es menor
+    D3D12_DEPTH_STENCIL_DESC dss = {};
+    dss.DepthEnable = TRUE;
+    dss.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
+    dss.DepthFunc = D3D12_COMPARISON_FUNC_LESS;
+    dss.StencilEnable = FALSE;
+
+    //Blend “simple”: escribe RGBA tal cual, sin blending especial
+    D3D12_BLEND_DESC blend = {};
+    blend.AlphaToCoverageEnable = FALSE;
+    blend.IndependentBlendEnable = FALSE;
+    auto& rt = blend.RenderTarget[0];
+    rt.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+
+    // Creo Pipeline State Object (PSO)
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC pso = {};
+    pso.pRootSignature = g_rootSig.Get();
+    pso.VS = { vs.data(), vs.size() };
+    pso.PS = { ps.data(), ps.size() };
+    pso.BlendState = blend;
+    pso.SampleMask = UINT_MAX;
+    pso.RasterizerState = rast;
+    pso.DepthStencilState = dss;
+    pso.InputLayout = { il, _countof(il) }; 
+    pso.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+    pso.NumRenderTargets = 1;
+    pso.RTVFormats[0] = key.rtvFormat;
+    pso.DSVFormat = key.dsvFormat;
+    pso.SampleDesc.Count = 1;
+    return pso;
+}
+
+// Builder de g_pipelines: compila el PS con los defines de la clave y carga su PSO de la biblioteca (o lo crea).
+ComPtr<ID3D12PipelineState> CreatePipelineForKey(uint64_t packedKey)
+{
+    const PipelineKey key = PipelineKey::Unpack(packedKey);
+    const std::vector<uint8_t> ps = CompileShaders({ PBRShaderDesc("PSMain", "ps_5_0", ShaderDefines(key)) })[0];
+
+    const D3D12_GRAPHICS_PIPELINE_STATE_DESC desc = DescribePipeline(key, g_vsBytecode, ps);
+    const uint64_t descHash = HashPipelineDesc(desc, g_rootSigHash);
+    const uint32_t loadedBefore = g_pipelineLibrary.Loaded();
+    ComPtr<ID3D12PipelineState> pipeline = g_pipelineLibrary.LoadOrCreate(g_device.Get(), desc, descHash);
+
+    char buf[160];
+    sprintf_s(buf, "PSO permutation 0x%016llx: mode %u, features 0x%x | desc %016llx %s\n", (unsigned long long)packedKey, key.mode,
+        key.features, (unsigned long long)descHash, g_pipelineLibrary.Loaded() > loadedBefore ? "loaded from library" : "created");
+    OutputDebugStringA(buf);
+    return pipeline;
+}
+
+// Chequeo del hash canónico de descs sin ventana ni GPU (-pso-hash-selftest). Mismo contenido en otra memoria (bytecode
+// copiado, semantic names en otro buffer y en minúsculas) y campos que D3D ignora tienen que dar el mismo hash; cada
+// cambio de estado real, uno distinto. Devuelve el exit code del proceso.
+int RunPipelineDescSelfTest()
+{
+    const char* vsText = "DXBC vertex shader";
+    const char* psText[2] = { "DXBC pixel shader, mode 5", "DXBC pixel shader, mode 0" };
+    const std::vector<uint8_t> vs(vsText, vsText + strlen(vsText));
+    const std::vector<uint8_t> vsCopy = vs;
+    const std::vector<uint8_t> ps(psText[0], psText[0] + strlen(psText[0]));
+    const std::vector<uint8_t> ps0(psText[1], psText[1] + strlen(psText[1]));
+    const uint64_t rootSig = 0x1234;
+
+    PipelineKey key;
+    key.rtvFormat = ChooseBackbufferFormat();
+    key.dsvFormat = ChooseDepthFormat();
+    const D3D12_GRAPHICS_PIPELINE_STATE_DESC base = DescribePipeline(key, vs, ps);
+    const uint64_t baseHash = HashPipelineDesc(base, rootSig);
+
+    bool ok = true;
+    int sameFailed = 0, differentFailed = 0;
+    auto same = [&](const char* what, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& d)
+    {
+        if (HashPipelineDesc(d, rootSig) == baseHash) return;
+        ++sameFailed; ok = false;
+        OutputDebugStringA((std::string("PSO desc hash: changed by ") + what + " (should be ignored)\n").c_str());
+    };
+    auto different = [&](const char* what, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& d, uint64_t rs = 0x1234)
+    {
+        if (HashPipelineDesc(d, rs) != baseHash) return;
+        ++differentFailed; ok = false;
+        OutputDebugStringA((std::string("PSO desc hash: not changed by ") + what + "\n").c_str());
+    };
+
+    // Mismo contenido, otra memoria / lo que D3D ignora
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC d = base;
+    d.VS = { vsCopy.data(), vsCopy.size() };
+    same("bytecode copy", d);
+
+    D3D12_INPUT_ELEMENT_DESC il[2];
+    memcpy(il, base.InputLayout.pInputElementDescs, sizeof(il));
+    char pos[] = "position", nrm[] = "Normal";
+    il[0].SemanticName = pos; il[1].SemanticName = nrm;
+    d = base; d.InputLayout = { il, 2 };
+    same("semantic name buffers/case", d);
+
+    d = base; d.BlendState.RenderTarget[3].BlendEnable = TRUE; d.BlendState.RenderTarget[3].RenderTargetWriteMask = 0;
+    same("RT 3 blend without IndependentBlendEnable", d);
+    d = base; d.BlendState.RenderTarget[0].SrcBlend = D3D12_BLEND_ONE; d.BlendState.RenderTarget[0].LogicOp = D3D12_LOGIC_OP_NOOP;
+    same("blend factors / logic op while disabled", d);
+    d = base; d.DepthStencilState.FrontFace.StencilFunc = D3D12_COMPARISON_FUNC_ALWAYS; d.DepthStencilState.StencilReadMask = 0x0F;
+    same("stencil state while StencilEnable = FALSE", d);
+    d = base; d.RTVFormats[1] = DXGI_FORMAT_R16G16B16A16_FLOAT;
+    same("RTVFormats beyond NumRenderTargets", d);
+    d = base; d.RasterizerState.DepthBiasClamp = -0.0f;
+    same("-0 vs +0 depth bias clamp", d);
+    d = base; d.CachedPSO = { vs.data(), vs.size() };
+    same("CachedPSO", d);
+    d = base; d.pRootSignature = reinterpret_cast<ID3D12RootSignature*>(&d); // solo cuenta rootSigHash, no el puntero
+    same("root signature pointer", d);
+
+    // Cambios reales
+    d = base; d.PS = { ps0.data(), ps0.size() }; different("pixel shader bytecode", d);
+    different("root signature contents", base, 0x4321);
+    d = base; d.RasterizerState.CullMode = D3D12_CULL_MODE_NONE; different("cull mode", d);
+    d = base; d.RasterizerState.FrontCounterClockwise = TRUE; different("front face winding", d);
+    d = base; d.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS_EQUAL; different("depth func", d);
+    d = base; d.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO; different("depth write", d);
+    d = base; d.DepthStencilState.StencilEnable = TRUE; different("stencil enable", d);
+    d = base; d.BlendState.RenderTarget[0].RenderTargetWriteMask = 0x7; different("RT 0 write mask", d);
+    d = base; d.BlendState.RenderTarget[0].BlendEnable = TRUE; different("RT 0 blend enable", d);
+    d = base; d.RTVFormats[0] = DXGI_FORMAT_B8G8R8A8_UNORM; different("RTV format", d);
+    d = base; d.DSVFormat = DXGI_FORMAT_D24_UNORM_S8_UINT; different("DSV format", d);
+    d = base; d.SampleDesc.Count = 4; different("sample count", d);
+    memcpy(il, base.InputLayout.pInputElementDescs, sizeof(il));
+    il[1].Format = DXGI_FORMAT_R16G16_FLOAT;
+    d = base; d.InputLayout = { il, 2 }; different("input element format", d);
+    d = base; d.InputLayout.NumElements = 1; different("input element count", d);
+
+    // Todas las permutaciones (con su PS) dan hashes distintos, y el hash no depende de la corrida
+    std::vector<std::vector<uint8_t>> psPerKey;
+    std::vector<uint64_t> hashes;
+    for (uint32_t features = 0; features <= ShaderFeatureAll; ++features)
+        for (uint32_t mode = 0; mode < ShadingModeCount; ++mode)
+        {
+            PipelineKey k = key;
+            k.mode = mode; k.features = features;
+            const std::string text = "DXBC ps " + std::to_string(k.Pack());
+            psPerKey.emplace_back(text.begin(), text.end());
+            hashes.push_back(HashPipelineDesc(DescribePipeline(k, vs, psPerKey.back()), rootSig));
+        }
+    std::sort(hashes.begin(), hashes.end());
+    const bool unique = std::adjacent_find(hashes.begin(), hashes.end()) == hashes.end();
+    const bool stable = CanonicalPipelineDesc(base, rootSig) == CanonicalPipelineDesc(DescribePipeline(key, vsCopy, ps), rootSig);
+    ok = ok && unique && stable;
+
+    char buf[256];
+    sprintf_s(buf, "PSO desc hash: base %016llx | %d equivalent descs changed it, %d real changes missed | %zu permutations unique %s | %s\n",
+        (unsigned long long)baseHash, sameFailed, differentFailed, hashes.size(), unique ? "yes" : "no", ok ? "OK" : "FAIL");
+    OutputDebugStringA(buf);
+    return ok ? 0 : 1;
+}
+
+void CreateRootSigAndPSO()
+{
+    // Define qué recursos ve el shader y compila el VS. Los PSOs (uno por permutación del PS) los crea
+    // CreatePipelineForKey la primera vez que RecordRender pide cada clave.
+
+    // Root parameters:
+    // 0: CBV en b0 (CBData). Lo ven todos los shaders (VS y PS)
+    // 1: SRV en t0 (StructuredBuffer<InstanceData>) como root descriptor: no hace falta descriptor heap,
+    //    se bindea directo con la dirección GPU del buffer de instancias. Solo lo lee el VS.
+    D3D12_ROOT_PARAMETER rootParams[2] = {};
+    rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+    rootParams[0].Descriptor.ShaderRegister = 0;
+    rootParams[0].Descriptor.RegisterSpace = 0;
+    rootParams[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+    rootParams[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+    rootParams[1].Descriptor.ShaderRegister = 0;
+    rootParams[1].Descriptor.RegisterSpace = 0;
+    rootParams[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX;
+
+    // Root signature flags (?)
+    D3D12_ROOT_SIGNATURE_DESC rsDesc = {};
+    rsDesc.NumParameters = _countof(rootParams);
+    rsDesc.pParameters = rootParams;
+    rsDesc.NumStaticSamplers = 0;
+    rsDesc.pStaticSamplers = nullptr;
+    rsDesc.Flags =
+        D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT |
+        D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
+        D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
+        D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS;
+
+    // Crear Root signature
+    ComPtr<ID3DBlob> sigBlob, errBlob;
+    ThrowIfFailed(D3D12SerializeRootSignature(&rsDesc, D3D_ROOT_SIGNATURE_VERSION_1, &sigBlob, &errBlob));
+    ThrowIfFailed(g_device->CreateRootSignature(0, sigBlob->GetBufferPointer(), sigBlob->GetBufferSize(),
+        IID_PPV_ARGS(&g_rootSig)));
+    g_rootSigHash = HashBytes64(static_cast<const uint8_t*>(sigBlob->GetBufferPointer()), sigBlob->GetBufferSize());
+
+    // Bytecode de PBR.hlsl desde el cache en disco. En frío el VS (el mismo para todas las permutaciones) y el PS
+    // inicial se compilan a la vez; CreatePipelineForKey encuentra el PS ya en el cache.
+    g_shaderCache.Open(&g_d3dShaderCompiler, ShaderPackPath);
+    g_vsBytecode = CompileShaders({ PBRShaderDesc("VSMain", "vs_5_0"),
+        PBRShaderDesc("PSMain", "ps_5_0", ShaderDefines(CurrentPipelineKey())) })[0];
+
+    g_pipelineLibrary.Open(g_device.Get(), PipelineLibraryPath, g_pipelineLibraryEnabled);
+    g_pipelines.SetBuilder(CreatePipelineForKey);
+    g_pipelines.Get(CurrentPipelineKey().Pack()); // el PSO inicial se crea acá, no en el primer frame
+    g_shaderCache.Flush();
+    g_pipelineLibrary.Save();
+
+    char buf[192];
+    sprintf_s(buf, "Shader cache: %llu hits | %llu misses (%.2f ms compiling) | %llu entries in %s\n",
+        (unsigned long long)g_shaderCache.Hits(), (unsigned long long)g_shaderCache.Misses(), g_shaderCache.CompileMs(),
+        (unsigned long long)g_shaderCache.PackEntries(), ShaderPackPath);
+    OutputDebugStringA(buf);
+    // Arranque con y sin biblioteca: comparar esta línea entre una corrida normal y una con -no-pso-cache
+    sprintf_s(buf, "PSO library (%s): %u loaded in %.2f ms | %u created in %.2f ms\n",
+        g_pipelineLibrary.Enabled() ? PipelineLibraryPath : "off", g_pipelineLibrary.Loaded(), g_pipelineLibrary.LoadMs(),
+        g_pipelineLibrary.Created(), g_pipelineLibrary.CreateMs());
+    OutputDebugStringA(buf);
+}
+
+//--------------------------------------------------------------------------------------
+// Geometry (cube) + CB
+//--------------------------------------------------------------------------------------
+// Cubo unitario centrado en CPU. Lo sube CreateCubeGeometry y lo dibuja el rasterizador por software.
+void BuildCubeMesh(std::vector<Vertex>& verts, std::vector<uint32_t>& inds)
+{
+    const float s = 0.5f;
+
+    // 24 vértices (4 por cara) con normal plana por cara
+    const Vertex v[] = {
+        // Frente (z+), n=(0,0,1)
+        {{-s,-s, s},{0,0,1}}, {{ s,-s, s},{0,0,1}},
+        {{ s, s, s},{0,0,1}}, {{-s, s, s},{0,0,1}},
+        // Atrás (z-), n=(0,0,-1)
+        {{-s,-s,-s},{0,0,-1}}, {{-s, s,-s},{0,0,-1}},
+        {{ s, s,-s},{0,0,-1}}, {{ s,-s,-s},{0,0,-1}},
+        // Izquierda (x-), n=(-1,0,0)
+        {{-s,-s,-s},{-1,0,0}}, {{-s,-s, s},{-1,0,0}},
+        {{-s, s, s},{-1,0,0}}, {{-s, s,-s},{-1,0,0}},
+        // Derecha (x+), n=(1,0,0)
+        {{ s,-s, s},{1,0,0}}, {{ s,-s,-s},{1,0,0}},
+        {{ s, s,-s},{1,0,0}}, {{ s, s, s},{1,0,0}},
+        // Arriba (y+), n=(0,1,0)
+        {{-s, s, s},{0,1,0}}, {{ s, s, s},{0,1,0}},
+        {{ s, s,-s},{0,1,0}}, {{-s, s,-s},{0,1,0}},
+        // Abajo (y-), n=(0,-1,0)
+        {{-s,-s,-s},{0,-1,0}}, {{ s,-s,-s},{0,-1,0}},
+        {{ s,-s, s},{0,-1,0}}, {{-s,-s, s},{0,-1,0}},
+    };
+
+    const uint16_t i[] = {
+        // 6 caras * 2 triángulos
+        0,1,2, 0,2,3,       // frente
+        4,5,6, 4,6,7,       // atrás
+        8,9,10, 8,10,11,    // izquierda
+        12,13,14, 12,14,15, // derecha
+        16,17,18, 16,18,19, // arriba
+        20,21,22, 20,22,23  // abajo
+    };
+
+    verts.assign(v, v + _countof(v));
+    inds.assign(i, i + _countof(i));
+}
+
+void CreateCubeGeometry()
+{
+    // Crea el vertex buffer y el index buffer del cubo.
+    std::vector<Vertex> v;
+    std::vector<uint32_t> inds;
+    BuildCubeMesh(v, inds);
+
+    // Empaquetar a 12 bytes por vértice (el VB que sube es el de PackedVertex)
+    const UINT vertexCount = (UINT)v.size();
+    g_cubeQuant = ComputeVertexQuantization(v.data(), vertexCount);
+    std::vector<PackedVertex> packed;
+    PackVertices(v.data(), vertexCount, g_cubeQuant, packed);
+    VerifyPackedVertices("cube", v.data(), packed.data(), vertexCount, g_cubeQuant);
+
+    const std::vector<uint16_t> i(inds.begin(), inds.end()); // 6 caras * 2 triángulos
+
+    const UINT vbSize = vertexCount * sizeof(PackedVertex);
+    const UINT ibSize = (UINT)(i.size() * sizeof(uint16_t));
+
+    // VB en heap DEFAULT (memoria de la GPU). Los vértices pasan por el ring de staging
+    // y la cola de copia los lleva al buffer antes del primer frame que lo dibuja.
+    {
+        g_vb = CreateDefaultBufferWithData(packed.data(), vbSize);
+
+        g_vbView.BufferLocation = g_vb->GetGPUVirtualAddress();
+        g_vbView.StrideInBytes = sizeof(PackedVertex);
+        g_vbView.SizeInBytes = vbSize;
+    }
+
+    // IB (DEFAULT)
+    {
+        //Similar para el index buffer
+        g_ib = CreateDefaultBufferWithData(i.data(), ibSize);
+
+        g_ibView.BufferLocation = g_ib->GetGPUVirtualAddress();
+        g_ibView.Format = DXGI_FORMAT_R16_UINT;
+        g_ibView.SizeInBytes = ibSize;
+    }
+
+}
+
+//--------------------------------------------------------------------------------------
+// Upload buffer por frame (CB + datos dinámicos)
+//--------------------------------------------------------------------------------------
+void CreateFrameUploadBuffer()
+{
+    // Un solo buffer UPLOAD con una página por frame en vuelo. Queda mapeado toda la vida de la app
+    // y g_uploadAllocator reparte sub-asignaciones alineadas a 256 bytes dentro de cada página.
+    const UINT64 totalSize = UploadPageSize * FrameCount;
+
+    g_uploadBuffer = CreateGpuResource(D3D12_HEAP_TYPE_UPLOAD, BufferDesc(totalSize), D3D12_RESOURCE_STATE_GENERIC_READ);
+
+    uint8_t* mapped = nullptr;
+    D3D12_RANGE rr = { 0,0 }; // la CPU nunca lee de acá
+    ThrowIfFailed(g_uploadBuffer->Map(0, &rr, reinterpret_cast<void**>(&mapped)));
+
+    g_uploadAllocator.Init(mapped, g_uploadBuffer->GetGPUVirtualAddress(), UploadPageSize, FrameCount);
+    g_uploadAllocator.BeginFrame(g_frameIndex, g_gfxQueueFence.GetCompletedValue());
+}
+
+//--------------------------------------------------------------------------------------
+// Geometry (sphere)
+//--------------------------------------------------------------------------------------
+
+// Tres generadores con la misma salida: vértices sobre la esfera de radio 'radius', índices de 32 bits y triángulos
+// de frente en sentido horario vistos desde afuera (cross(p1 - p0, p2 - p0) apunta hacia afuera).
+//  - UV: el original. Costura duplicada, triángulos degenerados en los polos y densidad que se amontona en ellos.
+//  - Icosfera: cada cara del icosaedro se parte en freq² triángulos y se proyecta a la esfera.
+//  - Cube-sphere: cada cara del cubo es una grilla n × n con el mapeo casi equiárea cubo → esfera.
+// Icosfera y cube-sphere se generan por filas de cada cara (ParallelFor sobre el job system cuando hay trabajo) con una clave canónica
+// por punto; los puntos compartidos entre caras se sueldan por esa clave, así no quedan costuras ni duplicados.
+
+static const uint64_t SphereUniqueKey = ~0ull; // punto interior de una cara: no se comparte, no entra al ordenamiento
+
+// Suelda los puntos generados por cara: keys[i] identifica el punto i en toda la esfera (dos caras que comparten
+// un punto generan la misma clave). Solo se ordenan los puntos de borde; cada punto queda en el orden de su primera
+// aparición (las caras siguen contiguas en el VB) y 'inds' pasa de índices locales a índices del VB compactado.
+void WeldSphereVertices(const std::vector<uint64_t>& keys, std::vector<Vertex>& verts, std::vector<uint32_t>& inds)
+{
+    std::vector<std::pair<uint64_t, uint32_t>> sorted;
+    std::vector<uint32_t> remap(keys.size());
+    for (uint32_t i = 0; i < (uint32_t)keys.size(); ++i)
+    {
+        remap[i] = i;
+        if (keys[i] != SphereUniqueKey) sorted.push_back({ keys[i], i });
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    for (size_t i = 0; i < sorted.size(); )
+    {
+        size_t j = i;
+        for (; j < sorted.size() && sorted[j].first == sorted[i].first; ++j) remap[sorted[j].second] = sorted[i].second; // el de menor índice representa al grupo
+        i = j;
+    }
+
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < (uint32_t)remap.size(); ++i)
+    {
+        if (remap[i] == i) { verts[unique] = verts[i]; remap[i] = unique++; }
+        else remap[i] = remap[remap[i]]; // el representante es anterior: ya tiene su índice final
+    }
+    verts.resize(unique);
+    for (uint32_t& idx : inds) idx = remap[idx];
+}
+
+void BuildUVSphere(float radius, int stacks, int slices, std::vector<Vertex>& verts, std::vector<uint32_t>& inds)
+{
+    verts.clear(); inds.clear();
+    verts.reserve((stacks + 1) * (slices + 1));
+    inds.reserve(stacks * slices * 6);
+
+    for (int y = 0; y <= stacks; ++y)
+    {
+        float v = float(y) / stacks;           // [0,1]
+        float phi = v * XM_PI;                 // [0,π]
+        float sinPhi = sinf(phi), cosPhi = cosf(phi);
+
+        for (int x = 0; x <= slices; ++x)
+        {
+            float u = float(x) / slices;       // [0,1]
+            float theta = u * XM_2PI;          // [0,2π]
+            float sinTheta = sinf(theta), cosTheta = cosf(theta);
+
+            XMFLOAT3 n = XMFLOAT3(cosTheta * sinPhi, cosPhi, sinTheta * sinPhi);
+            XMFLOAT3 p = XMFLOAT3(n.x * radius, n.y * radius, n.z * radius);
+
+            verts.push_back({ p, n });
+        }
+    }
+
+    int stride = slices + 1;
+    for (int y = 0; y < stacks; ++y)
+    {
+        for (int x = 0; x < slices; ++x)
+        {
+            uint32_t i0 = y * stride + x;
+            uint32_t i1 = i0 + 1;
+            uint32_t i2 = i0 + stride;
+            uint32_t i3 = i2 + 1;
+
+            // Dos triángulos por quad
+            inds.push_back(i0);
+            inds.push_back(i1);
+            inds.push_back(i2);
+
+            inds.push_back(i1);
+            inds.push_back(i3);
+            inds.push_back(i2);
+        }
+    }
+}
+
+// Icosfera de frecuencia 'freq': 20·freq² triángulos, 10·freq² + 2 vértices. La cara (A, B, C) se recorre por filas
+// i = 0..freq desde A; el punto (i, j) tiene pesos baricéntricos enteros (freq - i, i - j, j).
+void BuildIcosphere(float radius, UINT freq, std::vector<Vertex>& verts, std::vector<uint32_t>& inds)
+{
+    const float t = (1.0f + sqrtf(5.0f)) * 0.5f;
+    const XMFLOAT3 corners[12] = {
+        { -1,  t,  0 }, {  1,  t,  0 }, { -1, -t,  0 }, {  1, -t,  0 },
+        {  0, -1,  t }, {  0,  1,  t }, {  0, -1, -t }, {  0,  1, -t },
+        {  t,  0, -1 }, {  t,  0,  1 }, { -t,  0, -1 }, { -t,  0,  1 } };
+    UINT faces[20][3] = {
+        { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+        { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+        { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+        { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 } };
+    for (UINT (&f)[3] : faces) // misma orientación que el resto de la app, sin depender del orden de la tabla
+    {
+        const XMVECTOR a = XMLoadFloat3(&corners[f[0]]);
+        const XMVECTOR n = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&corners[f[1]]), a), XMVectorSubtract(XMLoadFloat3(&corners[f[2]]), a));
+        if (XMVectorGetX(XMVector3Dot(n, a)) < 0.0f) std::swap(f[1], f[2]);
+    }
+
+    const UINT faceVerts = (freq + 1) * (freq + 2) / 2;
+    const UINT faceTris = freq * freq;
+    std::vector<uint64_t> keys((size_t)20 * faceVerts);
+    verts.resize(keys.size());
+    inds.resize((size_t)20 * faceTris * 3);
+
+    // Clave canónica: esquina = su índice; arista = (esquinas ordenadas, peso de la menor); interior = única.
+    auto pointKey = [](const UINT c[3], const UINT w[3]) -> uint64_t
+    {
+        UINT id[3], wt[3], k = 0;
+        for (int e = 0; e < 3; ++e) if (w[e]) { id[k] = c[e]; wt[k] = w[e]; ++k; }
+        if (k == 1) return id[0];
+        if (k == 2) return (1ull << 62) | ((uint64_t)(std::min)(id[0], id[1]) << 48) | ((uint64_t)(std::max)(id[0], id[1]) << 40) | (id[0] < id[1] ? wt[0] : wt[1]);
+        return SphereUniqueKey;
+    };
+
+    ParallelFor(20 * (freq + 1), 64, [&](UINT begin, UINT end)
+    {
+        for (UINT row = begin; row < end; ++row)
+        {
+            const UINT f = row / (freq + 1), i = row % (freq + 1);
+            const XMVECTOR A = XMLoadFloat3(&corners[faces[f][0]]);
+            const XMVECTOR B = XMLoadFloat3(&corners[faces[f][1]]);
+            const XMVECTOR C = XMLoadFloat3(&corners[faces[f][2]]);
+            const size_t rowBase = (size_t)f * faceVerts + i * (i + 1) / 2;
+
+            for (UINT j = 0; j <= i; ++j)
+            {
+                const UINT w[3] = { freq - i, i - j, j };
+                const XMVECTOR p = XMVectorAdd(XMVectorAdd(XMVectorScale(A, (float)w[0]), XMVectorScale(B, (float)w[1])), XMVectorScale(C, (float)w[2]));
+                const XMVECTOR n = XMVector3Normalize(p);
+                Vertex& v = verts[rowBase + j];
+                XMStoreFloat3(&v.normal, n);
+                XMStoreFloat3(&v.pos, XMVectorScale(n, radius));
+                keys[rowBase + j] = pointKey(faces[f], w);
+            }
+
+            if (i == freq) continue;
+            // Fila de triángulos i: 2i + 1 triángulos entre la fila i y la i + 1 (misma orientación que A, B, C)
+            const uint32_t top = (uint32_t)rowBase, bottom = (uint32_t)(rowBase + i + 1);
+            uint32_t* out = &inds[((size_t)f * faceTris + (size_t)i * i) * 3];
+            for (UINT j = 0; j <= i; ++j)
+            {
+                *out++ = top + j; *out++ = bottom + j; *out++ = bottom + j + 1;
+                if (j < i) { *out++ = top + j; *out++ = bottom + j + 1; *out++ = top + j + 1; }
+            }
+        }
+    });
+
+    WeldSphereVertices(keys, verts, inds);
+}
+
+// Cube-sphere: 12·n² triángulos, 6·n² + 2 vértices. El punto de la grilla es un punto entero (i, j, k) de [0, n]³ sobre
+// la superficie del cubo: en el borde de la cara esa terna es la clave. Cada quad se corta por la diagonal más corta ya sobre la esfera.
+void BuildCubeSphere(float radius, UINT n, std::vector<Vertex>& verts, std::vector<uint32_t>& inds)
+{
+    const UINT side = n + 1;
+    const UINT faceVerts = side * side;
+    std::vector<uint64_t> keys((size_t)6 * faceVerts);
+    verts.resize(keys.size());
+    inds.resize((size_t)6 * n * n * 6);
+
+    // Cara = (eje a, signo). Los ejes de la grilla b = a+1, c = a+2 cumplen e_b × e_c = e_a: hacia afuera en la cara positiva.
+    ParallelFor(6 * side, 64, [&](UINT begin, UINT end)
+    {
+        for (UINT row = begin; row < end; ++row)
+        {
+            const UINT face = row / side, v = row % side;
+            const UINT a = face >> 1, b = (a + 1) % 3, c = (a + 2) % 3;
+            for (UINT u = 0; u <= n; ++u)
+            {
+                UINT lattice[3];
+                lattice[a] = (face & 1) ? 0 : n;
+                lattice[b] = u;
+                lattice[c] = v;
+
+                float q[3];
+                for (int e = 0; e < 3; ++e) q[e] = 2.0f * lattice[e] / n - 1.0f;
+                const float xx = q[0] * q[0], yy = q[1] * q[1], zz = q[2] * q[2];
+                const XMVECTOR s = XMVector3Normalize(XMVectorSet(
+                    q[0] * sqrtf((std::max)(0.0f, 1.0f - yy * 0.5f - zz * 0.5f + yy * zz / 3.0f)),
+                    q[1] * sqrtf((std::max)(0.0f, 1.0f - zz * 0.5f - xx * 0.5f + zz * xx / 3.0f)),
+                    q[2] * sqrtf((std::max)(0.0f, 1.0f - xx * 0.5f - yy * 0.5f + xx * yy / 3.0f)), 0.0f));
+
+                const size_t idx = (size_t)face * faceVerts + (size_t)v * side + u;
+                XMStoreFloat3(&verts[idx].normal, s);
+                XMStoreFloat3(&verts[idx].pos, XMVectorScale(s, radius));
+                keys[idx] = (u == 0 || u == n || v == 0 || v == n) ? ((uint64_t)lattice[0] * side + lattice[1]) * side + lattice[2] : SphereUniqueKey;
+            }
+        }
+    });
+
+    ParallelFor(6 * n, 64, [&](UINT begin, UINT end)
+    {
+        for (UINT row = begin; row < end; ++row)
+        {
+            const UINT face = row / n, v = row % n;
+            const bool flip = (face & 1) != 0; // cara negativa: e_b × e_c apunta hacia adentro
+            uint32_t* out = &inds[((size_t)face * n * n + (size_t)v * n) * 6];
+            for (UINT u = 0; u < n; ++u)
+            {
+                const uint32_t q00 = face * faceVerts + v * side + u, q10 = q00 + 1, q01 = q00 + side, q11 = q01 + 1;
+                const float d0 = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(XMLoadFloat3(&verts[q10].pos), XMLoadFloat3(&verts[q01].pos))));
+                const float d1 = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(XMLoadFloat3(&verts[q00].pos), XMLoadFloat3(&verts[q11].pos))));
+                const uint32_t tris[6] = { q00, q10, d0 <= d1 ? q01 : q11, d0 <= d1 ? q10 : q00, q11, q01 };
+                for (int t = 0; t < 6; t += 3)
+                {
+                    *out++ = tris[t];
+                    *out++ = flip ? tris[t + 2] : tris[t + 1];
+                    *out++ = flip ? tris[t + 1] : tris[t + 2];
+                }
+            }
+        }
+    });
+
+    WeldSphereVertices(keys, verts, inds);
+}
+
+// Parámetro de teselación del nivel 'lod' (0 = el más fino): frecuencia de la icosfera (20·f² triángulos), lado
+// de la grilla de la cube-sphere (12·n²) o stacks = slices de la UV (2·s²; el nivel 1 es la 32 × 32 original).
+UINT SphereLodParam(int kind, UINT lod)
+{
+    return (kind == SphereUV) ? (std::max)(2u, 64u >> lod) : (std::max)(1u, 32u >> lod);
+}
+
+void BuildSphere(int kind, float radius, UINT param, std::vector<Vertex>& verts, std::vector<uint32_t>& inds)
+{
+    if (kind == SphereIco) BuildIcosphere(radius, param, verts, inds);
+    else if (kind == SphereCube) BuildCubeSphere(radius, param, verts, inds);
+    else BuildUVSphere(radius, (int)param, (int)param, verts, inds);
+}
+
+// Calidad de una malla de esfera (para -benchmark-sphere y el error de cada LOD).
+struct SphereMeshStats
+{
+    size_t triangles = 0;
+    size_t vertices = 0;
+    size_t degenerate = 0;      // área ~0 (los polos de la UV)
+    size_t duplicates = 0;      // vértices en la misma posición que otro (costura y polos de la UV)
+    float minQuality = 1.0f;    // 4√3·área / (a² + b² + c²) de los no degenerados: 1 = equilátero, 0 = aguja
+    float avgQuality = 0.0f;
+    float areaRatio = 0.0f;     // área máxima / mínima de los no degenerados: 1 = todos iguales
+    float error = 0.0f;         // máxima distancia de un triángulo a la esfera (radio - distancia de su plano al centro)
+};
+
+SphereMeshStats AnalyzeSphereMesh(const std::vector<Vertex>& verts, const std::vector<uint32_t>& inds, float radius, bool countDuplicates = true)
+{
+    SphereMeshStats s;
+    s.triangles = inds.size() / 3;
+    s.vertices = verts.size();
+
+    double qualitySum = 0.0;
+    float minArea = FLT_MAX, maxArea = 0.0f;
+    for (size_t t = 0; t + 2 < inds.size(); t += 3)
+    {
+        const XMVECTOR p0 = XMLoadFloat3(&verts[inds[t]].pos);
+        const XMVECTOR p1 = XMLoadFloat3(&verts[inds[t + 1]].pos);
+        const XMVECTOR p2 = XMLoadFloat3(&verts[inds[t + 2]].pos);
+        const XMVECTOR cross = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+        const float area = 0.5f * XMVectorGetX(XMVector3Length(cross));
+        if (area <= 1e-10f * radius * radius) { ++s.degenerate; continue; }
+
+        const float edges = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(p1, p0))) + XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(p2, p1))) +
+            XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(p0, p2)));
+        const float quality = 4.0f * sqrtf(3.0f) * area / edges;
+        s.minQuality = (std::min)(s.minQuality, quality);
+        qualitySum += quality;
+        minArea = (std::min)(minArea, area);
+        maxArea = (std::max)(maxArea, area);
+
+        const float planeDist = fabsf(XMVectorGetX(XMVector3Dot(XMVector3Normalize(cross), p0)));
+        s.error = (std::max)(s.error, radius - planeDist);
+    }
+    const size_t valid = s.triangles - s.degenerate;
+    if (valid) { s.avgQuality = (float)(qualitySum / valid); s.areaRatio = maxArea / minArea; }
+    else s.minQuality = 0.0f;
+
+    if (countDuplicates)
+    {
+        std::vector<XMFLOAT3> pos(verts.size());
+        for (size_t i = 0; i < verts.size(); ++i) pos[i] = verts[i].pos;
+        auto same = [](const XMFLOAT3& a, const XMFLOAT3& b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+        std::sort(pos.begin(), pos.end(), [](const XMFLOAT3& a, const XMFLOAT3& b)
+            { return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.z < b.z; });
+        for (size_t i = 1; i < pos.size(); ++i) if (same(pos[i], pos[i - 1])) ++s.duplicates;
+    }
+    return s;
+}
+
+// Genera la cadena de LODs de la esfera y la sube a un único VB/IB en DEFAULT (como el cubo, por el ring de staging).
+// El IB es de 16 bits si todos los niveles tienen a lo sumo 65536 vértices (los índices son locales al nivel); si no,
+// de 32 bits.
+void CreateSphereGeometry(float radius = 0.5f, int kind = SphereIco)
+{
+    std::vector<Vertex> verts;
+    std::vector<uint32_t> inds;
+    size_t maxLevelVerts = 0;
+    g_sphereLods.clear();
+
+    char buf[160];
+    for (UINT lod = 0; lod < SphereLodCount; ++lod)
+    {
+        std::vector<Vertex> levelVerts;
+        std::vector<uint32_t> levelInds;
+        BuildSphere(kind, radius, SphereLodParam(kind, lod), levelVerts, levelInds);
+
+        SphereLod l;
+        l.baseVertex = (UINT)verts.size();
+        l.firstIndex = (UINT)inds.size();
+        l.indexCount = (UINT)levelInds.size();
+        l.error = AnalyzeSphereMesh(levelVerts, levelInds, radius, false).error;
+        g_sphereLods.push_back(l);
+
+        sprintf_s(buf, "Sphere LOD %u: %zu tris, %zu verts, error %.5f\n", lod, levelInds.size() / 3, levelVerts.size(), l.error);
+        OutputDebugStringA(buf);
+
+        maxLevelVerts = (std::max)(maxLevelVerts, levelVerts.size());
+        verts.insert(verts.end(), levelVerts.begin(), levelVerts.end());
+        inds.insert(inds.end(), levelInds.begin(), levelInds.end());
+    }
+
+    const bool index16 = maxLevelVerts <= 65536;
+    std::vector<uint16_t> inds16;
+    if (index16) inds16.assign(inds.begin(), inds.end());
+
+    // Empaquetar a PackedVertex
+    g_sphereQuant = ComputeVertexQuantization(verts.data(), verts.size());
+    std::vector<PackedVertex> packed;
+    PackVertices(verts.data(), verts.size(), g_sphereQuant, packed);
+    VerifyPackedVertices("sphere", verts.data(), packed.data(), verts.size(), g_sphereQuant);
+
+    // Subir a GPU: buffers DEFAULT cargados por el ring de staging y la cola de copia (CreateDefaultBufferWithData)
+    const UINT vbSize = (UINT)(packed.size() * sizeof(PackedVertex));
+    const UINT ibSize = index16 ? (UINT)(inds16.size() * sizeof(uint16_t)) : (UINT)(inds.size() * sizeof(uint32_t));
+
+    // VB
+    {
+        g_sphereVB = CreateDefaultBufferWithData(packed.data(), vbSize);
+
+        g_sphereVBView.BufferLocation = g_sphereVB->GetGPUVirtualAddress();
+        g_sphereVBView.StrideInBytes = sizeof(PackedVertex);
+        g_sphereVBView.SizeInBytes = vbSize;
+    }
+
+    // IB
+    {
+        g_sphereIB = CreateDefaultBufferWithData(index16 ? (const void*)inds16.data() : (const void*)inds.data(), ibSize);
+
+        g_sphereIBView.BufferLocation = g_sphereIB->GetGPUVirtualAddress();
+        g_sphereIBView.Format = index16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+        g_sphereIBView.SizeInBytes = ibSize;
+    }
+}
+
+// LOD de una esfera de escala 'scale' cuyo borde más cercano está a 'dist' de la cámara: el nivel más grueso cuyo error
+// proyectado no supera g_lodPixelError píxeles (o el forzado con la tecla L). Mismo criterio que SelectModelLods.
+UINT SelectSphereLod(float scale, float dist, CXMMATRIX proj)
+{
+    if (g_sphereLods.empty()) return 0;
+    const UINT last = (UINT)g_sphereLods.size() - 1;
+    if (g_lodForced >= 0) return (std::min)((UINT)g_lodForced, last);
+
+    const float pixelsPerUnit = XMVectorGetY(proj.r[1]) * g_renderHeight * 0.5f;
+    dist = (std::max)(dist, 1e-3f);
+    for (UINT l = last; l > 0; --l)
+        if (g_sphereLods[l].error * scale * pixelsPerUnit / dist <= g_lodPixelError) return l;
+    return 0;
+}
+
+// Benchmark de generación de esferas (-benchmark-sphere, sin ventana ni GPU): UV (la función original) contra icosfera
+// y cube-sphere con aproximadamente la misma cantidad de triángulos. Tiempo = mejor de 'runs' (incluye soldadura);
+// calidad según AnalyzeSphereMesh. Devuelve el exit code del proceso.
+int RunSphereBenchmark(int runs = 3)
+{
+    static const char* kindNames[] = { "ico ", "cube", "uv  " };
+    static const double targets[] = { 2048.0, 32768.0, 1048576.0 };
+    const float radius = 0.5f;
+
+    char buf[320];
+    sprintf_s(buf, "Sphere benchmark: best of %d runs, %u hardware threads\n", runs, (std::max)(1u, std::thread::hardware_concurrency()));
+    OutputDebugStringA(buf);
+
+    std::vector<Vertex> verts;
+    std::vector<uint32_t> inds;
+    for (double target : targets)
+    {
+        for (int kind : { (int)SphereUV, (int)SphereIco, (int)SphereCube })
+        {
+            const double trisPerUnit = (kind == SphereUV) ? 2.0 : (kind == SphereIco) ? 20.0 : 12.0;
+            const UINT param = (std::max)(2u, (UINT)(sqrt(target / trisPerUnit) + 0.5));
+
+            double bestMs = DBL_MAX;
+            for (int r = 0; r < runs; ++r)
+            {
+                auto t0 = std::chrono::high_resolution_clock::now();
+                BuildSphere(kind, radius, param, verts, inds);
+                bestMs = (std::min)(bestMs, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count());
+            }
+
+            const SphereMeshStats st = AnalyzeSphereMesh(verts, inds, radius);
+            sprintf_s(buf, "Sphere %s %4u: %8zu tris %8zu verts (%s%s) | gen %8.2f ms | degenerate %5zu | duplicates %5zu | "
+                "quality min %.3f avg %.3f | area max/min %6.2f | error %.6f\n",
+                kindNames[kind], param, st.triangles, st.vertices, st.vertices <= 65536 ? "R16" : "R32",
+                (kind == SphereUV && st.vertices > 65536) ? ", uint16 original desbordaba" : "",
+                bestMs, st.degenerate, st.duplicates, st.minQuality, st.avgQuality, st.areaRatio, st.error);
+            OutputDebugStringA(buf);
+        }
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Barrido de materiales (instancias)
+//--------------------------------------------------------------------------------------
+
+// Arma la grilla dim × dim de instancias frente a la cámara: columnas = metallic, filas = roughness.
+// dim == 4 usa exactamente los presets de las teclas M/R; dims mayores usan rampas lineales.
+void BuildMaterialSweep(UINT dim, XMFLOAT3 right, XMFLOAT3 up, std::vector<InstanceData>& out)
+{
+    const UINT presetCount = (UINT)(sizeof(g_metallicPresets) / sizeof(float));
+    const bool usePresets = (dim == presetCount);
+
+    const float spacing = SweepExtent / float(dim);
+    const float scale = SweepSphereScale(dim);
+    const float origin = -0.5f * SweepExtent + 0.5f * spacing;
+
+    out.resize((size_t)dim * dim);
+    ParallelFor(dim, (std::max)(1u, 4096u / dim), [&](UINT rowBegin, UINT rowEnd) // por filas; grillas chicas en este hilo
+    {
+        for (UINT row = rowBegin; row < rowEnd; ++row)
+        {
+            for (UINT col = 0; col < dim; ++col)
+            {
+                const float t = (dim > 1) ? float(col) / float(dim - 1) : 0.0f;
+                const float r = (dim > 1) ? float(row) / float(dim - 1) : 0.0f;
+
+                const float x = origin + col * spacing;
+                const float y = -(origin + row * spacing); // roughness crece hacia abajo
+
+                XMMATRIX m = XMMatrixScaling(scale, scale, scale) *
+                    XMMatrixTranslation(right.x * x + up.x * y, right.y * x + up.y * y, right.z * x + up.z * y);
+
+                InstanceData& inst = out[(size_t)row * dim + col];
+                SetInstanceTransform(inst, m);
+                inst.baseColor = g_baseColor;
+                inst.metallic = usePresets ? g_metallicPresets[col] : t;
+                inst.roughness = usePresets ? g_roughnessPresets[row] : (0.05f + 0.95f * r); // GGX con roughness 0 es un delta: lo evitamos
+                inst.ao = g_ao;
+                inst._pad = XMFLOAT2(0, 0);
+            }
+        }
+    });
+}
+
+void UpdateMaterialSweep()
+{
+    // Regenera el buffer estático de instancias solo si cambió la dimensión de la grilla, el AO o el color base.
+    // Mientras no cambien, el costo de CPU por frame del barrido es constante (un draw, cero escrituras).
+    if (!g_sweepEnabled || !g_sweepDirty) return;
+    g_sweepDirty = false;
+
+    // Ejes de la cámara en mundo (filas de la inversa de view) para que la grilla mire a la cámara
+    XMMATRIX invView = XMMatrixInverse(nullptr, g_view);
+    XMFLOAT3 right, up;
+    XMStoreFloat3(&right, invView.r[0]);
+    XMStoreFloat3(&up, invView.r[1]);
+
+    std::vector<InstanceData> instances;
+    BuildMaterialSweep(g_sweepDim, right, up, instances);
+    g_sweepInstanceCount = (UINT)instances.size();
+
+    const UINT64 size = instances.size() * sizeof(InstanceData);
+
+    // El buffer anterior lo pueden estar leyendo frames en vuelo: se suelta cuando la GPU los termina. El nuevo va a
+    // DEFAULT por la cola de copia, como la geometría (la grilla se dibuja todos los frames y cambia muy de vez en cuando).
+    g_retired.Retire(g_sweepInstances, LastSubmittedFence());
+    g_sweepInstances = CreateDefaultBufferWithData(instances.data(), size);
+}
+
+//--------------------------------------------------------------------------------------
+// BRDF de referencia en CPU (port de PSMain de PBR.hlsl)
+//--------------------------------------------------------------------------------------
+
+// Misma cuenta que PSMain, en el mismo orden de operaciones, para validar cambios del shader sin GPU y para sombrear
+// en CPU (bakes, rasterizador por software). Hay dos versiones que tienen que coincidir:
+//  - escalar: un punto por vez, es la referencia (se lee al lado del HLSL línea por línea);
+//  - SIMD: lotes SoA de a 4 puntos por XMVECTOR (SSE/NEON según compile DirectXMath).
+// Diferencias conocidas con la GPU: normalize es v / |v| (la GPU usa rsqrt) y pow(x, 1/2.2) es exp2(log2(x) / 2.2),
+// como lo compila fxc. pow(x, 5) con exponente literal fxc lo expande a productos, y acá también.
+// Sin MultiplyAdd a propósito: con FMA (/arch:AVX2) el redondeo cambiaría solo en la versión SIMD.
+
+// Lote SoA de puntos de sombreado: lo que PSMain recibe interpolado. Las normales no hace falta que estén normalizadas.
+struct ShadingBatch
+{
+    std::vector<float> px, py, pz;              // posWS
+    std::vector<float> nx, ny, nz;              // nrmWS
+    std::vector<float> r, g, b;                 // baseColor
+    std::vector<float> metallic, roughness, ao;
+
+    size_t Size() const { return px.size(); }
+    void Resize(size_t n)
+    {
+        for (std::vector<float>* v : { &px, &py, &pz, &nx, &ny, &nz, &r, &g, &b, &metallic, &roughness, &ao }) v->resize(n);
+    }
+};
+
+// Color final por punto (con gamma y saturate, como el SV_TARGET de PSMain).
+struct ShadedBatch
+{
+    std::vector<float> r, g, b;
+
+    void Resize(size_t n) { r.resize(n); g.resize(n); b.resize(n); }
+};
+
+// Un punto. Solo lee del CB lo que lee PSMain: mode, ambient, viewPos, lightPos, lightIntensity, lightColor.
+XMFLOAT3 ShadePointScalar(const CBData& cb, const XMFLOAT3& posWS, const XMFLOAT3& nrmWS, const XMFLOAT3& baseColor,
+    float metallic, float roughness, float ao)
+{
+    const float nLen = sqrtf(nrmWS.x * nrmWS.x + nrmWS.y * nrmWS.y + nrmWS.z * nrmWS.z);
+    const float N[3] = { nrmWS.x / nLen, nrmWS.y / nLen, nrmWS.z / nLen };
+
+    float V[3] = { cb.viewPos.x - posWS.x, cb.viewPos.y - posWS.y, cb.viewPos.z - posWS.z };
+    const float vLen = sqrtf(V[0] * V[0] + V[1] * V[1] + V[2] * V[2]);
+    for (float& c : V) c = c / vLen;
+
+    // Luz puntual física
+    const float Lvec[3] = { cb.lightPos.x - posWS.x, cb.lightPos.y - posWS.y, cb.lightPos.z - posWS.z };
+    const float dist2 = (std::max)(1e-6f, Lvec[0] * Lvec[0] + Lvec[1] * Lvec[1] + Lvec[2] * Lvec[2]); // r^2
+    const float dist = sqrtf(dist2);
+    const float L[3] = { Lvec[0] / dist, Lvec[1] / dist, Lvec[2] / dist };
+
+    float H[3] = { V[0] + L[0], V[1] + L[1], V[2] + L[2] };
+    const float hLen = sqrtf(H[0] * H[0] + H[1] * H[1] + H[2] * H[2]);
+    for (float& c : H) c = c / hLen;
+
+    // max(0, x) y no max(x, 0): así un NaN da 0, igual que maxps de SSE y que la GPU
+    const float NdotL = (std::max)(0.0f, N[0] * L[0] + N[1] * L[1] + N[2] * L[2]);
+    const float NdotV = (std::max)(0.0f, N[0] * V[0] + N[1] * V[1] + N[2] * V[2]);
+    const float NdotH = (std::max)(0.0f, N[0] * H[0] + N[1] * H[1] + N[2] * H[2]);
+    const float VoH = (std::max)(0.0f, V[0] * H[0] + V[1] * H[1] + V[2] * H[2]);
+
+    // Cook-Torrance: DistributionGGX, GeometrySmith (Schlick-GGX) y la parte escalar de FresnelSchlick
+    const float a = roughness * roughness;
+    const float a2 = a * a;
+    const float denomD = (NdotH * NdotH) * (a2 - 1.0f) + 1.0f;
+    const float D = a2 / (3.14159f * denomD * denomD + 1e-5f);
+
+    const float rk = roughness + 1.0f;
+    const float k = (rk * rk) / 8.0f;
+    const float G = (NdotV / (NdotV * (1.0f - k) + k)) * (NdotL / (NdotL * (1.0f - k) + k));
+
+    const float f = 1.0f - VoH;
+    const float f2 = f * f;
+    const float f5 = f2 * f2 * f;
+
+    const float denom = 4.0f * NdotV * NdotL + 1e-4f;
+    const float radianceScale = cb.lightIntensity / dist2; // <- 1/r^2
+
+    const float base[3] = { baseColor.x, baseColor.y, baseColor.z };
+    const float lightColor[3] = { cb.lightColor.x, cb.lightColor.y, cb.lightColor.z };
+    float color[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        const float F0 = 0.04f + metallic * (base[c] - 0.04f); // lerp(0.04, baseColor, metallic)
+        const float F = F0 + (1.0f - F0) * f5;
+        const float specular = (D * G * F) / denom;
+        const float kD = (1.0f - F) * (1.0f - metallic);
+        const float diffuse = kD * base[c] / 3.14159f;
+        const float radiance = lightColor[c] * radianceScale;
+        const float Lo = (diffuse + specular) * radiance * NdotL;
+
+        switch (cb.mode)
+        {
+        case 0:  color[c] = base[c]; break;                                  // Unlit
+        case 1:  color[c] = base[c] * cb.ambient; break;                     // Ambient (placeholder)
+        case 2:  color[c] = base[c] * radiance * NdotL; break;               // Difuso Lambert only
+        case 3:  color[c] = specular * radiance * NdotL; break;              // Especular PBR only
+        case 4:  color[c] = Lo; break;                                       // Direct PBR
+        default: color[c] = 0.03f * base[c] * ao + Lo; break;                // PBR completo básico
+        }
+
+        const float gamma = exp2f(log2f(color[c]) * (1.0f / 2.2f));
+        color[c] = gamma > 0.0f ? (gamma < 1.0f ? gamma : 1.0f) : 0.0f; // saturate (NaN → 0)
+    }
+    return XMFLOAT3(color[0], color[1], color[2]);
+}
+
+void ShadeBatchScalar(const CBData& cb, const ShadingBatch& in, ShadedBatch& out)
+{
+    out.Resize(in.Size());
+    for (size_t i = 0; i < in.Size(); ++i)
+    {
+        const XMFLOAT3 c = ShadePointScalar(cb, XMFLOAT3(in.px[i], in.py[i], in.pz[i]), XMFLOAT3(in.nx[i], in.ny[i], in.nz[i]),
+            XMFLOAT3(in.r[i], in.g[i], in.b[i]), in.metallic[i], in.roughness[i], in.ao[i]);
+        out.r[i] = c.x; out.g[i] = c.y; out.b[i] = c.z;
+    }
+}
+
+// Versión SIMD: cada XMVECTOR lleva la misma magnitud de 4 puntos distintos. El mode es uniforme (viene del CB).
+void ShadeBatchSIMD(const CBData& cb, const ShadingBatch& in, ShadedBatch& out)
+{
+    const size_t n = in.Size();
+    out.Resize(n);
+
+    const XMVECTOR zero = XMVectorZero();
+    const XMVECTOR one = XMVectorReplicate(1.0f);
+    const XMVECTOR pi = XMVectorReplicate(3.14159f);
+    const XMVECTOR viewPos[3] = { XMVectorReplicate(cb.viewPos.x), XMVectorReplicate(cb.viewPos.y), XMVectorReplicate(cb.viewPos.z) };
+    const XMVECTOR lightPos[3] = { XMVectorReplicate(cb.lightPos.x), XMVectorReplicate(cb.lightPos.y), XMVectorReplicate(cb.lightPos.z) };
+    const XMVECTOR lightColor[3] = { XMVectorReplicate(cb.lightColor.x), XMVectorReplicate(cb.lightColor.y), XMVectorReplicate(cb.lightColor.z) };
+    const XMVECTOR lightIntensity = XMVectorReplicate(cb.lightIntensity);
+    const XMVECTOR ambient = XMVectorReplicate(cb.ambient);
+    const XMVECTOR invGamma = XMVectorReplicate(1.0f / 2.2f);
+
+    auto dot3 = [](const XMVECTOR a[3], const XMVECTOR b[3])
+    {
+        return XMVectorAdd(XMVectorAdd(XMVectorMultiply(a[0], b[0]), XMVectorMultiply(a[1], b[1])), XMVectorMultiply(a[2], b[2]));
+    };
+    auto normalize3 = [&dot3](XMVECTOR v[3])
+    {
+        const XMVECTOR len = XMVectorSqrt(dot3(v, v));
+        for (int c = 0; c < 3; ++c) v[c] = XMVectorDivide(v[c], len);
+    };
+
+    for (size_t i = 0; i < n; i += 4)
+    {
+        // La cola (< 4 puntos) pasa por un buffer con ceros: los carriles sobrantes se calculan y se descartan
+        const size_t lanes = (std::min)((size_t)4, n - i);
+        auto load = [i, lanes](const std::vector<float>& src)
+        {
+            XMFLOAT4 tmp(0, 0, 0, 0);
+            memcpy(&tmp, &src[i], lanes * sizeof(float));
+            return XMLoadFloat4(&tmp);
+        };
+        auto store = [i, lanes](std::vector<float>& dst, FXMVECTOR v)
+        {
+            XMFLOAT4 tmp;
+            XMStoreFloat4(&tmp, v);
+            memcpy(&dst[i], &tmp, lanes * sizeof(float));
+        };
+
+        const XMVECTOR pos[3] = { load(in.px), load(in.py), load(in.pz) };
+        XMVECTOR N[3] = { load(in.nx), load(in.ny), load(in.nz) };
+        const XMVECTOR base[3] = { load(in.r), load(in.g), load(in.b) };
+        const XMVECTOR metallic = load(in.metallic);
+        const XMVECTOR roughness = load(in.roughness);
+        normalize3(N);
+
+        XMVECTOR V[3], L[3], H[3];
+        for (int c = 0; c < 3; ++c) V[c] = XMVectorSubtract(viewPos[c], pos[c]);
+        normalize3(V);
+
+        for (int c = 0; c < 3; ++c) L[c] = XMVectorSubtract(lightPos[c], pos[c]);
+        const XMVECTOR dist2 = XMVectorMax(dot3(L, L), XMVectorReplicate(1e-6f));
+        const XMVECTOR dist = XMVectorSqrt(dist2);
+        for (int c = 0; c < 3; ++c) L[c] = XMVectorDivide(L[c], dist);
+
+        for (int c = 0; c < 3; ++c) H[c] = XMVectorAdd(V[c], L[c]);
+        normalize3(H);
+
+        const XMVECTOR NdotL = XMVectorMax(dot3(N, L), zero);
+        const XMVECTOR NdotV = XMVectorMax(dot3(N, V), zero);
+        const XMVECTOR NdotH = XMVectorMax(dot3(N, H), zero);
+        const XMVECTOR VoH = XMVectorMax(dot3(V, H), zero);
+
+        const XMVECTOR a = XMVectorMultiply(roughness, roughness);
+        const XMVECTOR a2 = XMVectorMultiply(a, a);
+        const XMVECTOR denomD = XMVectorAdd(XMVectorMultiply(XMVectorMultiply(NdotH, NdotH), XMVectorSubtract(a2, one)), one);
+        const XMVECTOR D = XMVectorDivide(a2, XMVectorAdd(XMVectorMultiply(XMVectorMultiply(pi, denomD), denomD), XMVectorReplicate(1e-5f)));
+
+        const XMVECTOR rk = XMVectorAdd(roughness, one);
+        const XMVECTOR k = XMVectorDivide(XMVectorMultiply(rk, rk), XMVectorReplicate(8.0f));
+        const XMVECTOR oneMinusK = XMVectorSubtract(one, k);
+        const XMVECTOR G = XMVectorMultiply(
+            XMVectorDivide(NdotV, XMVectorAdd(XMVectorMultiply(NdotV, oneMinusK), k)),
+            XMVectorDivide(NdotL, XMVectorAdd(XMVectorMultiply(NdotL, oneMinusK), k)));
+
+        const XMVECTOR f = XMVectorSubtract(one, VoH);
+        const XMVECTOR f2 = XMVectorMultiply(f, f);
+        const XMVECTOR f5 = XMVectorMultiply(XMVectorMultiply(f2, f2), f);
+
+        const XMVECTOR denom = XMVectorAdd(XMVectorMultiply(XMVectorMultiply(XMVectorReplicate(4.0f), NdotV), NdotL), XMVectorReplicate(1e-4f));
+        const XMVECTOR radianceScale = XMVectorDivide(lightIntensity, dist2);
+        const XMVECTOR DG = XMVectorMultiply(D, G);
+        const XMVECTOR oneMinusMetallic = XMVectorSubtract(one, metallic);
+
+        XMVECTOR color[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            const XMVECTOR F0 = XMVectorAdd(XMVectorReplicate(0.04f), XMVectorMultiply(metallic, XMVectorSubtract(base[c], XMVectorReplicate(0.04f))));
+            const XMVECTOR F = XMVectorAdd(F0, XMVectorMultiply(XMVectorSubtract(one, F0), f5));
+            const XMVECTOR specular = XMVectorDivide(XMVectorMultiply(DG, F), denom);
+            const XMVECTOR kD = XMVectorMultiply(XMVectorSubtract(one, F), oneMinusMetallic);
+            const XMVECTOR diffuse = XMVectorDivide(XMVectorMultiply(kD, base[c]), pi);
+            const XMVECTOR radiance = XMVectorMultiply(lightColor[c], radianceScale);
+            const XMVECTOR Lo = XMVectorMultiply(XMVectorMultiply(XMVectorAdd(diffuse, specular), radiance), NdotL);
+
+            switch (cb.mode)
+            {
+            case 0:  color[c] = base[c]; break;
+            case 1:  color[c] = XMVectorMultiply(base[c], ambient); break;
+            case 2:  color[c] = XMVectorMultiply(XMVectorMultiply(base[c], radiance), NdotL); break;
+            case 3:  color[c] = XMVectorMultiply(XMVectorMultiply(specular, radiance), NdotL); break;
+            case 4:  color[c] = Lo; break;
+            default: color[c] = XMVectorAdd(XMVectorMultiply(XMVectorMultiply(XMVectorReplicate(0.03f), base[c]), load(in.ao)), Lo); break;
+            }
+
+            color[c] = XMVectorSaturate(XMVectorExp2(XMVectorMultiply(XMVectorLog2(color[c]), invGamma)));
+        }
+
+        store(out.r, color[0]);
+        store(out.g, color[1]);
+        store(out.b, color[2]);
+    }
+}
+
+// Distancia en ulps entre dos floats (0 = idénticos; dos NaN cuentan como iguales).
+uint32_t FloatUlpDistance(float a, float b)
+{
+    if (a != a || b != b) return (a != a && b != b) ? 0 : UINT32_MAX;
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(float));
+    memcpy(&ib, &b, sizeof(float));
+    if (ia < 0) ia = INT32_MIN - ia; // orden monótono: negativos por debajo de +0
+    if (ib < 0) ib = INT32_MIN - ib;
+    const int64_t d = (int64_t)ia - (int64_t)ib;
+    return (uint32_t)(std::min)((int64_t)UINT32_MAX, d < 0 ? -d : d);
+}
+
+// Chequeo escalar vs. SIMD y throughput de las dos (-brdf-selftest, sin ventana ni GPU): puntos pseudoaleatorios
+// reproducibles (posiciones alrededor del origen, normales sin normalizar, cualquier material) con la cámara y la luz
+// de la app, los 6 modos. Falla si algún canal difiere en más de 'maxUlps' (log2/exp2 de DirectXMath son polinomios,
+// no los de la CRT). Devuelve el exit code del proceso.
+int RunBrdfSelfTest(size_t count = 1 << 18, uint32_t maxUlps = 16)
+{
+    ShadingBatch in;
+    in.Resize(count);
+    uint32_t seed = 12345u;
+    auto rnd = [&seed](float lo, float hi) // LCG: mismos puntos en todas las corridas y plataformas
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return lo + (hi - lo) * float(seed >> 8) * (1.0f / 16777216.0f);
+    };
+    for (size_t i = 0; i < count; ++i)
+    {
+        in.px[i] = rnd(-1, 1); in.py[i] = rnd(-1, 1); in.pz[i] = rnd(-1, 1);
+        in.nx[i] = rnd(-2, 2); in.ny[i] = rnd(-2, 2); in.nz[i] = rnd(-2, 2);
+        in.r[i] = rnd(0, 1); in.g[i] = rnd(0, 1); in.b[i] = rnd(0, 1);
+        in.metallic[i] = rnd(0, 1); in.roughness[i] = rnd(0.05f, 1); in.ao[i] = rnd(0, 1);
+    }
+
+    CBData cb = {};
+    cb.ambient = 0.15f;
+    cb.viewPos = XMFLOAT3(1.5f, 1.2f, -2.0f); // eye de InitCamera
+    cb.lightPos = XMFLOAT3(1.2f, 1.0f, 0.0f); // órbita de UpdateCB en t = 0
+    cb.lightIntensity = g_lightIntensity;
+    cb.lightColor = g_lightColor;
+
+    ShadedBatch scalar, simd;
+    bool ok = true;
+    char buf[256];
+    for (int mode = 0; mode < 6; ++mode)
+    {
+        cb.mode = mode;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        ShadeBatchScalar(cb, in, scalar);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        ShadeBatchSIMD(cb, in, simd);
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        uint32_t worst = 0;
+        size_t differing = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const uint32_t d = (std::max)({ FloatUlpDistance(scalar.r[i], simd.r[i]), FloatUlpDistance(scalar.g[i], simd.g[i]),
+                FloatUlpDistance(scalar.b[i], simd.b[i]) });
+            worst = (std::max)(worst, d);
+            if (d) ++differing;
+        }
+        ok = ok && worst <= maxUlps;
+
+        const double scalarMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        const double simdMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        sprintf_s(buf, "BRDF mode %d: %zu points | max %u ulp, %zu differ | scalar %.2f ms (%.1f Mpts/s) | SIMD %.2f ms (%.1f Mpts/s, x%.2f) | %s\n",
+            mode, count, worst, differing, scalarMs, count / (scalarMs * 1000.0), simdMs, count / (simdMs * 1000.0),
+            scalarMs / (std::max)(simdMs, 1e-6), worst <= maxUlps ? "OK" : "FAIL");
+        OutputDebugStringA(buf);
+    }
+    return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Optimización de mallas (CPU): vertex cache, overdraw y vertex fetch
+//--------------------------------------------------------------------------------------
+
+// Tamaño del post-transform vertex cache que modelamos (FIFO). 16 es un valor típico/conservador.
+static const UINT VertexCacheSize = 16;
+
+// Estadísticas de una malla para comparar antes/después de optimizar.
+struct MeshOptStats
+{
+    float acmr = 0.0f;     // Average Cache Miss Ratio: vértices transformados por triángulo (ideal ~0.5, peor caso 3).
+    float atvr = 0.0f;     // Average Transformed Vertex Ratio: vértices transformados / vértices únicos (ideal 1).
+    float overdraw = 0.0f; // Pixeles sombreados / pixeles cubiertos, promedio sobre 6 vistas ortográficas.
+};
+
+// Simula un cache FIFO de 'cacheSize' entradas y cuenta cuántos vértices hay que transformar.
+void AnalyzeVertexCache(const std::vector<uint32_t>& inds, size_t vertexCount, UINT cacheSize, MeshOptStats& stats)
+{
+    std::vector<uint32_t> timestamps(vertexCount, 0);
+    std::vector<uint8_t> used(vertexCount, 0);
+    uint32_t timestamp = cacheSize + 1; // todo vértice arranca "fuera" del cache
+    size_t misses = 0, unique = 0;
+
+    for (uint32_t v : inds)
+    {
+        if (timestamp - timestamps[v] > cacheSize) { // miss: entra al cache (FIFO: no se refresca en los hits)
+            timestamps[v] = timestamp++;
+            ++misses;
+        }
+        if (!used[v]) { used[v] = 1; ++unique; }
+    }
+
+    const size_t triCount = inds.size() / 3;
+    stats.acmr = triCount ? float(misses) / float(triCount) : 0.0f;
+    stats.atvr = unique ? float(misses) / float(unique) : 0.0f;
+}
+
+// Overdraw: rasteriza la malla en orden de submit desde las 6 direcciones de los ejes (ortográfica,
+// back-face culling como el PSO, depth test LESS) y compara fragmentos que pasaron el depth test
+// contra pixeles finalmente cubiertos. Con early-Z, eso es lo que termina pagando el pixel shader.
+void AnalyzeOverdraw(const std::vector<Vertex>& verts, const std::vector<uint32_t>& inds, MeshOptStats& stats)
+{
+    const int Res = 256;
+    if (verts.empty() || inds.empty()) { stats.overdraw = 0.0f; return; }
+
+    XMFLOAT3 mn = verts[0].pos, mx = verts[0].pos;
+    for (const Vertex& v : verts) {
+        mn.x = (std::min)(mn.x, v.pos.x); mn.y = (std::min)(mn.y, v.pos.y); mn.z = (std::min)(mn.z, v.pos.z);
+        mx.x = (std::max)(mx.x, v.pos.x); mx.y = (std::max)(mx.y, v.pos.y); mx.z = (std::max)(mx.z, v.pos.z);
+    }
+    const float ext = (std::max)((std::max)(mx.x - mn.x, mx.y - mn.y), (std::max)(mx.z - mn.z, 1e-6f));
+
+    std::vector<float> depth(Res * Res);
+    UINT64 shaded = 0, covered = 0;
+
+    for (int view = 0; view < 6; ++view)
+    {
+        // axis = eje de la vista, sign = hacia dónde mira la cámara. (u, w) = los otros dos ejes en pantalla.
+        const int axis = view >> 1;
+        const float sign = (view & 1) ? -1.0f : 1.0f;
+        const int ua = (axis + 1) % 3, wa = (axis + 2) % 3;
+
+        std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+        for (size_t t = 0; t + 2 < inds.size(); t += 3)
+        {
+            const XMFLOAT3* p[3] = { &verts[inds[t]].pos, &verts[inds[t + 1]].pos, &verts[inds[t + 2]].pos };
+            float c[3][3]; // (x pantalla, y pantalla, profundidad)
+            for (int k = 0; k < 3; ++k) {
+                const float q[3] = { (p[k]->x - mn.x) / ext, (p[k]->y - mn.y) / ext, (p[k]->z - mn.z) / ext };
+                c[k][0] = q[ua] * (Res - 1);
+                c[k][1] = q[wa] * (Res - 1);
+                c[k][2] = sign * q[axis];
+            }
+
+            // Normal geométrica (cross(v1-v0, v2-v0) apunta hacia afuera con el winding del PSO).
+            // La cámara mira en +sign sobre 'axis': el triángulo es front-facing si la normal apunta en contra.
+            const float e1[3] = { p[1]->x - p[0]->x, p[1]->y - p[0]->y, p[1]->z - p[0]->z };
+            const float e2[3] = { p[2]->x - p[0]->x, p[2]->y - p[0]->y, p[2]->z - p[0]->z };
+            const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            if (n[axis] * sign >= 0.0f) continue;
+
+            const float area = (c[1][0] - c[0][0]) * (c[2][1] - c[0][1]) - (c[1][1] - c[0][1]) * (c[2][0] - c[0][0]);
+            if (fabsf(area) < 1e-12f) continue;
+            const float invArea = 1.0f / area;
+
+            const int x0 = (std::max)(0, (int)floorf((std::min)((std::min)(c[0][0], c[1][0]), c[2][0])));
+            const int x1 = (std::min)(Res - 1, (int)ceilf((std::max)((std::max)(c[0][0], c[1][0]), c[2][0])));
+            const int y0 = (std::max)(0, (int)floorf((std::min)((std::min)(c[0][1], c[1][1]), c[2][1])));
+            const int y1 = (std::min)(Res - 1, (int)ceilf((std::max)((std::max)(c[0][1], c[1][1]), c[2][1])));
+
+            for (int y = y0; y <= y1; ++y)
+            {
+                for (int x = x0; x <= x1; ++x)
+                {
+                    const float px = x + 0.5f, py = y + 0.5f;
+                    // Baricéntricas normalizadas por el área con signo: valen igual para cualquier winding en pantalla.
+                    const float b0 = ((c[1][0] - px) * (c[2][1] - py) - (c[1][1] - py) * (c[2][0] - px)) * invArea;
+                    const float b1 = ((c[2][0] - px) * (c[0][1] - py) - (c[2][1] - py) * (c[0][0] - px)) * invArea;
+                    const float b2 = 1.0f - b0 - b1;
+                    if (b0 < 0.0f || b1 < 0.0f || b2 < 0.0f) continue;
+
+                    const float z = b0 * c[0][2] + b1 * c[1][2] + b2 * c[2][2];
+                    float& d = depth[y * Res + x];
+                    if (z < d) {
+                        if (d == FLT_MAX) ++covered;
+                        d = z;
+                        ++shaded;
+                    }
+                }
+            }
+        }
+    }
+
+    stats.overdraw = covered ? float(shaded) / float(covered) : 0.0f;
+}
+
+// Reordena triángulos para el post-transform cache con Tipsify (Sander, Nehab, Barczak 2007):
+// se "abanica" alrededor de un vértice y se salta al vecino que siga en cache después de emitir su abanico.
+void OptimizeVertexCacheTipsify(const std::vector<uint32_t>& inds, size_t vertexCount, UINT cacheSize, std::vector<uint32_t>& out)
+{
+    const size_t triCount = inds.size() / 3;
+    out.clear();
+    out.reserve(triCount * 3);
+    if (triCount == 0) return;
+
+    // Adyacencia vértice → triángulos (CSR: offsets + lista)
+    std::vector<uint32_t> liveCount(vertexCount, 0);
+    for (uint32_t v : inds) ++liveCount[v];
+
+    std::vector<uint32_t> adjOffset(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v) adjOffset[v + 1] = adjOffset[v] + liveCount[v];
+    std::vector<uint32_t> adj(inds.size());
+    {
+        std::vector<uint32_t> fill(adjOffset.begin(), adjOffset.end() - 1);
+        for (size_t t = 0; t < triCount; ++t)
+            for (int k = 0; k < 3; ++k) adj[fill[inds[t * 3 + k]]++] = (uint32_t)t;
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<uint8_t> emitted(triCount, 0);
+    std::vector<uint32_t> deadEnd;     // pila de vértices recientes para retomar cuando no hay candidatos
+    std::vector<uint32_t> candidates;  // 1-anillo del vértice abanicado
+    deadEnd.reserve(inds.size());
+
+    uint32_t timestamp = cacheSize + 1;
+    size_t cursor = 0;                 // para barrer vértices en orden cuando la pila se vacía
+    int64_t fan = 0;
+
+    while (fan >= 0)
+    {
+        candidates.clear();
+        for (uint32_t a = adjOffset[fan]; a < adjOffset[fan + 1]; ++a)
+        {
+            const uint32_t t = adj[a];
+            if (emitted[t]) continue;
+            for (int k = 0; k < 3; ++k) {
+                const uint32_t v = inds[t * 3 + k];
+                out.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --liveCount[v];
+                if (timestamp - cacheTime[v] > cacheSize) cacheTime[v] = timestamp++;
+            }
+            emitted[t] = 1;
+        }
+
+        // Próximo abanico: el candidato con triángulos vivos que siga en cache después de emitirlos (el más viejo gana)
+        int64_t best = -1;
+        int bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (liveCount[v] == 0) continue;
+            int priority = 0;
+            if (timestamp - cacheTime[v] + 2 * liveCount[v] <= cacheSize) priority = int(timestamp - cacheTime[v]);
+            if (priority > bestPriority) { bestPriority = priority; best = v; }
+        }
+
+        if (best < 0) // dead-end: primero vértices recientes, después barrido lineal
+        {
+            while (!deadEnd.empty() && best < 0) {
+                const uint32_t d = deadEnd.back(); deadEnd.pop_back();
+                if (liveCount[d] > 0) best = d;
+            }
+            while (best < 0 && cursor < vertexCount) {
+                if (liveCount[cursor] > 0) best = (int64_t)cursor;
+                ++cursor;
+            }
+        }
+        fan = best;
+    }
+}
+
+// Reordenamiento por overdraw (el paso 2 de Tipsify, como en meshoptimizer): se corta la lista ya optimizada
+// para cache en clusters, y los clusters se ordenan para dibujar primero los que más tapan (caras hacia afuera,
+// lejos del centro). threshold > 1 permite cortar clusters más chicos a cambio de empeorar un poco el ACMR.
+void OptimizeOverdraw(const std::vector<Vertex>& verts, std::vector<uint32_t>& inds, UINT cacheSize, float threshold = 1.05f)
+{
+    const size_t triCount = inds.size() / 3;
+    if (triCount < 2) return;
+
+    std::vector<uint32_t> cacheTime(verts.size(), 0);
+    uint32_t timestamp = cacheSize + 1;
+    auto triMisses = [&](size_t t) {
+        UINT m = 0;
+        for (int k = 0; k < 3; ++k) {
+            const uint32_t v = inds[t * 3 + k];
+            if (timestamp - cacheTime[v] > cacheSize) { cacheTime[v] = timestamp++; ++m; }
+        }
+        return m;
+    };
+
+    // 1) Bordes duros: triángulos con 3 misses (el cache quedó "limpio", cortar ahí no cuesta nada)
+    std::vector<size_t> hard;
+    for (size_t t = 0; t < triCount; ++t)
+        if (triMisses(t) == 3) hard.push_back(t);
+    if (hard.empty() || hard[0] != 0) hard.insert(hard.begin(), 0);
+
+    // 2) Bordes blandos: dentro de cada cluster duro se corta cuando el ACMR acumulado ya está por debajo
+    //    del ACMR del cluster * threshold (empezar de nuevo ahí cuesta poco)
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h < hard.size(); ++h)
+    {
+        const size_t start = hard[h];
+        const size_t end = (h + 1 < hard.size()) ? hard[h + 1] : triCount;
+
+        timestamp += cacheSize + 1;
+        UINT clusterMisses = 0;
+        for (size_t t = start; t < end; ++t) clusterMisses += triMisses(t);
+        const float clusterThreshold = threshold * float(clusterMisses) / float(end - start);
+
+        clusters.push_back(start);
+        timestamp += cacheSize + 1;
+        UINT runMisses = 0, runTris = 0;
+        for (size_t t = start; t < end; ++t)
+        {
+            runMisses += triMisses(t);
+            ++runTris;
+            if (float(runMisses) / float(runTris) <= clusterThreshold && t + 1 < end) {
+                clusters.push_back(t + 1);
+                timestamp += cacheSize + 1;
+                runMisses = 0; runTris = 0;
+            }
+        }
+    }
+
+    // 3) Clave de orden: qué tanto mira hacia afuera el cluster, dot(centroide - centro de la malla, normal)
+    XMVECTOR meshCenter = XMVectorZero();
+    float meshArea = 0.0f;
+    std::vector<XMFLOAT4> triData(triCount); // xyz = centroide, w = área
+    std::vector<XMFLOAT3> triNormal(triCount); // normal sin normalizar (largo = 2*área)
+    for (size_t t = 0; t < triCount; ++t)
+    {
+        XMVECTOR a = XMLoadFloat3(&verts[inds[t * 3 + 0]].pos);
+        XMVECTOR b = XMLoadFloat3(&verts[inds[t * 3 + 1]].pos);
+        XMVECTOR c = XMLoadFloat3(&verts[inds[t * 3 + 2]].pos);
+        XMVECTOR n = XMVector3Cross(XMVectorSubtract(b, a), XMVectorSubtract(c, a));
+        const float area = 0.5f * XMVectorGetX(XMVector3Length(n));
+        XMVECTOR centroid = XMVectorScale(XMVectorAdd(XMVectorAdd(a, b), c), 1.0f / 3.0f);
+        XMStoreFloat4(&triData[t], XMVectorSetW(centroid, area));
+        XMStoreFloat3(&triNormal[t], n);
+        meshCenter = XMVectorAdd(meshCenter, XMVectorScale(centroid, area));
+        meshArea += area;
+    }
+    if (meshArea > 0.0f) meshCenter = XMVectorScale(meshCenter, 1.0f / meshArea);
+
+    struct ClusterKey { float key; size_t start, end; };
+    std::vector<ClusterKey> keys(clusters.size());
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        const size_t start = clusters[c];
+        const size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : triCount;
+        XMVECTOR center = XMVectorZero(), normal = XMVectorZero();
+        float area = 0.0f;
+        for (size_t t = start; t < end; ++t) {
+            center = XMVectorAdd(center, XMVectorScale(XMLoadFloat4(&triData[t]), triData[t].w));
+            normal = XMVectorAdd(normal, XMLoadFloat3(&triNormal[t]));
+            area += triData[t].w;
+        }
+        if (area > 0.0f) center = XMVectorScale(center, 1.0f / area);
+        const float nLen = XMVectorGetX(XMVector3Length(normal));
+        const float key = (nLen > 0.0f)
+            ? XMVectorGetX(XMVector3Dot(XMVectorSubtract(center, meshCenter), normal)) / nLen : 0.0f;
+        keys[c] = { key, start, end };
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [](const ClusterKey& a, const ClusterKey& b) { return a.key > b.key; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(inds.size());
+    for (const ClusterKey& k : keys)
+        sorted.insert(sorted.end(), inds.begin() + k.start * 3, inds.begin() + k.end * 3);
+    inds.swap(sorted);
+}
+
+// Reordena los vértices en orden de primer uso para que las lecturas del vertex buffer sean secuenciales.
+// Los vértices que ningún triángulo usa se descartan.
+void OptimizeVertexFetch(std::vector<Vertex>& verts, std::vector<uint32_t>& inds)
+{
+    std::vector<uint32_t> remap(verts.size(), UINT32_MAX);
+    std::vector<Vertex> ordered;
+    ordered.reserve(verts.size());
+
+    for (uint32_t& idx : inds)
+    {
+        if (remap[idx] == UINT32_MAX) {
+            remap[idx] = (uint32_t)ordered.size();
+            ordered.push_back(verts[idx]);
+        }
+        idx = remap[idx];
+    }
+    verts.swap(ordered);
+}
+
+// Pipeline completo: cache → overdraw → fetch. Devuelve estadísticas antes/después para el log.
+void OptimizeMeshForGPU(std::vector<Vertex>& verts, std::vector<uint32_t>& inds, MeshOptStats& before, MeshOptStats& after)
+{
+    AnalyzeVertexCache(inds, verts.size(), VertexCacheSize, before);
+    AnalyzeOverdraw(verts, inds, before);
+
+    std::vector<uint32_t> reordered;
+    OptimizeVertexCacheTipsify(inds, verts.size(), VertexCacheSize, reordered);
+    inds.swap(reordered);
+    OptimizeOverdraw(verts, inds, VertexCacheSize);
+    OptimizeVertexFetch(verts, inds);
+
+    AnalyzeVertexCache(inds, verts.size(), VertexCacheSize, after);
+    AnalyzeOverdraw(verts, inds, after);
+}
+
+// Vértices y caras en paralelo (job system). Las caras van en bloques fijos: primero se cuentan los triángulos de cada
+// bloque y después cada uno escribe desde su offset, así el resultado no depende de cuántos hilos haya.
+void ExtractMeshCPU(
+    const aiMesh* mesh,
+    std::vector<Vertex>& outVerts,
+    std::vector<uint32_t>& outIndices)
+{
+    const bool hasNormals = mesh->HasNormals();
+
+    outVerts.resize(mesh->mNumVertices);
+    ParallelFor(mesh->mNumVertices, 16384, [&](UINT begin, UINT end)
+    {
+        for (UINT v = begin; v < end; ++v)
+        {
+            const aiVector3D& p = mesh->mVertices[v];
+            XMFLOAT3 pos = XMFLOAT3(p.x, p.y, p.z);
+
+            XMFLOAT3 nrm = XMFLOAT3(0, 1, 0);
+            if (hasNormals)
+            {
+                const aiVector3D& n = mesh->mNormals[v];
+                nrm = XMFLOAT3(n.x, n.y, n.z);
+            }
+
+            outVerts[v] = Vertex{ pos, nrm };
+        }
+    });
+
+    // Solo triángulos: las caras de líneas/puntos se saltean
+    const UINT faceBlock = 16384;
+    const UINT blocks = (mesh->mNumFaces + faceBlock - 1) / faceBlock;
+    std::vector<size_t> triBase((size_t)blocks + 1, 0);
+    ParallelFor(blocks, 1, [&](UINT begin, UINT end)
+    {
+        for (UINT b = begin; b < end; ++b)
+        {
+            size_t tris = 0;
+            for (UINT f = b * faceBlock, last = (std::min)(f + faceBlock, mesh->mNumFaces); f < last; ++f)
+                tris += mesh->mFaces[f].mNumIndices == 3;
+            triBase[b + 1] = tris;
+        }
+    });
+    for (UINT b = 0; b < blocks; ++b) triBase[b + 1] += triBase[b];
+
+    outIndices.resize(triBase[blocks] * 3);
+    ParallelFor(blocks, 1, [&](UINT begin, UINT end)
+    {
+        for (UINT b = begin; b < end; ++b)
+        {
+            uint32_t* dst = outIndices.data() + triBase[b] * 3;
+            for (UINT f = b * faceBlock, last = (std::min)(f + faceBlock, mesh->mNumFaces); f < last; ++f)
+            {
+                const aiFace& face = mesh->mFaces[f];
+                if (face.mNumIndices != 3) continue;
+
+                *dst++ = (uint32_t)face.mIndices[0];
+                *dst++ = (uint32_t)face.mIndices[1];
+                *dst++ = (uint32_t)face.mIndices[2];
+            }
+        }
+    });
+}
+
+// aiMatrix4x4 es row-major con vectores columna (traslación en a4, b4, c4); XMMATRIX usa vectores fila → transpuesta.
+inline XMMATRIX AiToXM(const aiMatrix4x4& m)
+{
+    return XMMATRIX(
+        m.a1, m.b1, m.c1, m.d1,
+        m.a2, m.b2, m.c2, m.d2,
+        m.a3, m.b3, m.c3, m.d3,
+        m.a4, m.b4, m.c4, m.d4);
+}
+
+// Recorre el árbol de nodos acumulando transforms y emite una instancia por cada malla que referencia cada nodo.
+// Las mallas sin triángulos (solo líneas/puntos) no generan instancias.
+void FlattenNodeHierarchy(const aiNode* node, FXMMATRIX parent, const std::vector<ModelSubmesh>& submeshes, std::vector<ModelInstance>& out)
+{
+    const XMMATRIX world = AiToXM(node->mTransformation) * parent;
+
+    for (unsigned int m = 0; m < node->mNumMeshes; ++m)
+    {
+        const UINT submesh = node->mMeshes[m];
+        if (submesh >= submeshes.size() || submeshes[submesh].indexCount == 0) continue;
+
+        ModelInstance inst;
+        inst.submesh = submesh;
+        XMStoreFloat4x4(&inst.world, XMMatrixTranspose(world));
+        out.push_back(inst);
+    }
+
+    for (unsigned int c = 0; c < node->mNumChildren; ++c)
+        FlattenNodeHierarchy(node->mChildren[c], world, submeshes, out);
+}
+
+// Ordena las instancias por submesh y arma un draw por cada grupo.
+void BuildModelDraws(std::vector<ModelInstance>& instances, std::vector<ModelDraw>& draws)
+{
+    std::stable_sort(instances.begin(), instances.end(),
+        [](const ModelInstance& a, const ModelInstance& b) { return a.submesh < b.submesh; });
+
+    draws.clear();
+    for (UINT i = 0; i < (UINT)instances.size(); ++i)
+    {
+        if (draws.empty() || draws.back().submesh != instances[i].submesh)
+            draws.push_back(ModelDraw{ instances[i].submesh, i, 0 });
+        ++draws.back().instanceCount;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Cache binario de mallas (.meshcache)
+//--------------------------------------------------------------------------------------
+
+// Flags de import de Assimp. Forman parte de la clave del cache: si cambian, el cache se regenera.
+static const unsigned int ModelImportFlags =
+    aiProcess_Triangulate |
+    aiProcess_FlipUVs |
+    aiProcess_GenSmoothNormals |
+    aiProcess_JoinIdenticalVertices;
+
+// Subir cuando cambie el layout del archivo, PackedVertex/ModelSubmesh/ModelInstance o el resultado del optimizer.
+static const uint32_t MeshCacheVersion = 4;
+static const uint32_t MeshCacheMagic = 0x4843534D; // "MSCH"
+
+enum MeshImporter : uint32_t { MeshImporterAssimp = 0, MeshImporterObjFastPath = 1 };
+static bool g_objFastPath = true; // false con -no-fast-obj: los .obj también pasan por Assimp
+
+// Resultado del import en CPU, ya en el formato final de GPU (lo mismo que se hornea al cache).
+struct ModelCPU
+{
+    VertexQuantization         quant;
+    std::vector<PackedVertex>  verts;
+    std::vector<uint32_t>      inds;
+    std::vector<ModelSubmesh>  submeshes;
+    std::vector<ModelInstance> instances; // ya ordenadas por submesh
+    std::vector<ModelMeshlet>  meshlets;  // rangos de cada submesh en ModelSubmesh::firstMeshlet/meshletCount
+    std::vector<ModelLod>      lods;      // rangos de cada submesh en ModelSubmesh::firstLod/lodCount
+};
+
+// Vista sin copias de un modelo listo para subir: apunta a un ModelCPU o directamente al .meshcache mapeado.
+struct ModelGeometryView
+{
+    VertexQuantization   quant;
+    const PackedVertex*  verts = nullptr;      size_t vertexCount = 0;
+    const uint32_t*      inds = nullptr;       size_t indexCount = 0;
+    const ModelSubmesh*  submeshes = nullptr;  size_t submeshCount = 0;
+    const ModelInstance* instances = nullptr;  size_t instanceCount = 0;
+    const ModelMeshlet*  meshlets = nullptr;   size_t meshletCount = 0;
+    const ModelLod*      lods = nullptr;       size_t lodCount = 0;
+};
+
+// Cabecera del archivo. Después vienen las secciones en el orden de los offsets, cada una alineada a 16 bytes.
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;   // hash del contenido del archivo fuente (.obj, .fbx, ...)
+    uint64_t sourceSize;
+    uint32_t importFlags;  // ModelImportFlags con las que se horneó
+    uint32_t importer;     // MeshImporter pedido (el fast path OBJ y Assimp no dan exactamente los mismos vértices)
+    uint32_t vertexStride; // sizeof(PackedVertex)
+    uint64_t vertexCount, indexCount, submeshCount, instanceCount, meshletCount, lodCount;
+    uint64_t vertexOffset, indexOffset, submeshOffset, instanceOffset, meshletOffset, lodOffset;
+    VertexQuantization quant;
+    uint32_t _pad[3];
+};
+static_assert(sizeof(MeshCacheHeader) % 16 == 0, "MeshCacheHeader tiene que mantener alineadas las secciones");
+static_assert(sizeof(ModelSubmesh) == 32 && sizeof(ModelInstance) == 68 && sizeof(ModelMeshlet) == 56 && sizeof(ModelLod) == 20,
+    "Layout del .meshcache: subir MeshCacheVersion");
+
+std::string MeshCachePath(const std::string& sourcePath) { return sourcePath + ".meshcache"; }
+
+ModelGeometryView ViewOf(const ModelCPU& m)
+{
+    ModelGeometryView v;
+    v.quant = m.quant;
+    v.verts = m.verts.data();         v.vertexCount = m.verts.size();
+    v.inds = m.inds.data();           v.indexCount = m.inds.size();
+    v.submeshes = m.submeshes.data(); v.submeshCount = m.submeshes.size();
+    v.instances = m.instances.data(); v.instanceCount = m.instances.size();
+    v.meshlets = m.meshlets.data();   v.meshletCount = m.meshlets.size();
+    v.lods = m.lods.data();           v.lodCount = m.lods.size();
+    return v;
+}
+
+// Valida la cabecera contra el fuente actual y arma la vista apuntando dentro del archivo mapeado (cero parseo).
+// Los rangos de submeshes/instancias se chequean para que un cache corrupto no termine en lecturas fuera del VB/IB.
+bool OpenMeshCache(const MappedFile& file, uint64_t sourceHash, uint64_t sourceSize, uint32_t importer, ModelGeometryView& out)
+{
+    if (file.Size() < sizeof(MeshCacheHeader)) return false;
+
+    MeshCacheHeader h;
+    memcpy(&h, file.Data(), sizeof(h));
+    if (h.magic != MeshCacheMagic || h.version != MeshCacheVersion) return false;
+    if (h.sourceHash != sourceHash || h.sourceSize != sourceSize || h.importFlags != ModelImportFlags || h.importer != importer) return false;
+    if (h.vertexStride != sizeof(PackedVertex)) return false;
+
+    auto inFile = [&](uint64_t offset, uint64_t count, uint64_t stride)
+    {
+        return offset % 16 == 0 && offset <= file.Size() && count <= (file.Size() - offset) / stride;
+    };
+    if (!inFile(h.vertexOffset, h.vertexCount, sizeof(PackedVertex)) ||
+        !inFile(h.indexOffset, h.indexCount, sizeof(uint32_t)) ||
+        !inFile(h.submeshOffset, h.submeshCount, sizeof(ModelSubmesh)) ||
+        !inFile(h.instanceOffset, h.instanceCount, sizeof(ModelInstance)) ||
+        !inFile(h.meshletOffset, h.meshletCount, sizeof(ModelMeshlet)) ||
+        !inFile(h.lodOffset, h.lodCount, sizeof(ModelLod)))
+        return false;
+
+    out.quant = h.quant;
+    out.verts = reinterpret_cast<const PackedVertex*>(file.Data() + h.vertexOffset);
+    out.inds = reinterpret_cast<const uint32_t*>(file.Data() + h.indexOffset);
+    out.submeshes = reinterpret_cast<const ModelSubmesh*>(file.Data() + h.submeshOffset);
+    out.instances = reinterpret_cast<const ModelInstance*>(file.Data() + h.instanceOffset);
+    out.meshlets = reinterpret_cast<const ModelMeshlet*>(file.Data() + h.meshletOffset);
+    out.lods = reinterpret_cast<const ModelLod*>(file.Data() + h.lodOffset);
+    out.vertexCount = (size_t)h.vertexCount;
+    out.indexCount = (size_t)h.indexCount;
+    out.submeshCount = (size_t)h.submeshCount;
+    out.instanceCount = (size_t)h.instanceCount;
+    out.meshletCount = (size_t)h.meshletCount;
+    out.lodCount = (size_t)h.lodCount;
+
+    for (size_t i = 0; i < out.submeshCount; ++i)
+    {
+        const ModelSubmesh& sm = out.submeshes[i];
+        if ((uint64_t)sm.firstIndex + sm.indexCount > out.indexCount || sm.baseVertex > out.vertexCount) return false;
+        if ((uint64_t)sm.firstMeshlet + sm.meshletCount > out.meshletCount) return false;
+        if (sm.lodCount == 0 || (uint64_t)sm.firstLod + sm.lodCount > out.lodCount) return false;
+    }
+    for (size_t i = 0; i < out.lodCount; ++i)
+    {
+        const ModelLod& lod = out.lods[i];
+        if ((uint64_t)lod.firstIndex + lod.indexCount > out.indexCount || (uint64_t)lod.firstMeshlet + lod.meshletCount > out.meshletCount) return false;
+    }
+    for (size_t i = 0; i < out.meshletCount; ++i)
+        if ((uint64_t)out.meshlets[i].firstIndex + out.meshlets[i].triangleCount * 3ull > out.indexCount) return false;
+    for (size_t i = 0; i < out.instanceCount; ++i)
+        if (out.instances[i].submesh >= out.submeshCount) return false;
+
+    return true;
+}
+
+// Escribe el cache completo de una vez (WriteFileAtomic): si el proceso muere a mitad de camino no queda un cache a medias.
+bool WriteMeshCache(const std::string& path, uint64_t sourceHash, uint64_t sourceSize, uint32_t importer, const ModelCPU& m)
+{
+    MeshCacheHeader h = {};
+    h.magic = MeshCacheMagic;
+    h.version = MeshCacheVersion;
+    h.sourceHash = sourceHash;
+    h.sourceSize = sourceSize;
+    h.importFlags = ModelImportFlags;
+    h.importer = importer;
+    h.vertexStride = sizeof(PackedVertex);
+    h.vertexCount = m.verts.size();
+    h.indexCount = m.inds.size();
+    h.submeshCount = m.submeshes.size();
+    h.instanceCount = m.instances.size();
+    h.meshletCount = m.meshlets.size();
+    h.lodCount = m.lods.size();
+    h.quant = m.quant;
+
+    h.vertexOffset = sizeof(MeshCacheHeader);
+    h.indexOffset = Align16(h.vertexOffset + h.vertexCount * sizeof(PackedVertex));
+    h.submeshOffset = Align16(h.indexOffset + h.indexCount * sizeof(uint32_t));
+    h.instanceOffset = Align16(h.submeshOffset + h.submeshCount * sizeof(ModelSubmesh));
+    h.meshletOffset = Align16(h.instanceOffset + h.instanceCount * sizeof(ModelInstance));
+    h.lodOffset = Align16(h.meshletOffset + h.meshletCount * sizeof(ModelMeshlet));
+    const uint64_t fileSize = h.lodOffset + h.lodCount * sizeof(ModelLod);
+
+    std::vector<uint8_t> blob((size_t)fileSize, 0);
+    memcpy(blob.data(), &h, sizeof(h));
+    if (!m.verts.empty()) memcpy(blob.data() + h.vertexOffset, m.verts.data(), m.verts.size() * sizeof(PackedVertex));
+    if (!m.inds.empty()) memcpy(blob.data() + h.indexOffset, m.inds.data(), m.inds.size() * sizeof(uint32_t));
+    if (!m.submeshes.empty()) memcpy(blob.data() + h.submeshOffset, m.submeshes.data(), m.submeshes.size() * sizeof(ModelSubmesh));
+    if (!m.instances.empty()) memcpy(blob.data() + h.instanceOffset, m.instances.data(), m.instances.size() * sizeof(ModelInstance));
+    if (!m.meshlets.empty()) memcpy(blob.data() + h.meshletOffset, m.meshlets.data(), m.meshlets.size() * sizeof(ModelMeshlet));
+    if (!m.lods.empty()) memcpy(blob.data() + h.lodOffset, m.lods.data(), m.lods.size() * sizeof(ModelLod));
+
+    return WriteFileAtomic(path, blob);
+}
+
+//--------------------------------------------------------------------------------------
+// Meshlets: clusters con esfera envolvente y cono de normales, culling por cluster en CPU
+//--------------------------------------------------------------------------------------
+
+// Peso del desvío de normal frente a la cantidad de vértices nuevos al elegir el próximo triángulo.
+// Más alto = conos más cerrados (más backface culling) a cambio de meshlets algo menos llenos.
+static const float MeshletConeWeight = 0.5f;
+
+// Esfera (centro del AABB + distancia máxima) y cono de normales del meshlet, como en meshoptimizer:
+// eje = promedio de normales de cara, cutoff = sin del ángulo del cono, ápice = punto del eje detrás de todos los planos.
+// Un meshlet entero es backface si dot(normalize(apex - eye), axis) >= cutoff.
+void ComputeMeshletBounds(const std::vector<Vertex>& verts, const uint32_t* inds, UINT triCount, const XMFLOAT3* triNormals, ModelMeshlet& m)
+{
+    XMVECTOR mn = XMVectorReplicate(FLT_MAX), mx = XMVectorReplicate(-FLT_MAX);
+    for (UINT i = 0; i < triCount * 3; ++i)
+    {
+        const XMVECTOR p = XMLoadFloat3(&verts[inds[i]].pos);
+        mn = XMVectorMin(mn, p); mx = XMVectorMax(mx, p);
+    }
+    const XMVECTOR center = XMVectorScale(XMVectorAdd(mn, mx), 0.5f);
+    float radius = 0.0f;
+    for (UINT i = 0; i < triCount * 3; ++i)
+        radius = (std::max)(radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&verts[inds[i]].pos), center))));
+    XMStoreFloat3(&m.center, center);
+    m.radius = radius;
+
+    XMVECTOR axis = XMVectorZero();
+    UINT valid = 0;
+    for (UINT t = 0; t < triCount; ++t)
+    {
+        const XMVECTOR n = XMLoadFloat3(&triNormals[t]);
+        if (XMVectorGetX(XMVector3LengthSq(n)) == 0.0f) continue; // degenerado: no aporta orientación
+        axis = XMVectorAdd(axis, n);
+        ++valid;
+    }
+
+    m.coneAxis = XMFLOAT3(0, 0, 1);
+    m.coneApex = m.center;
+    m.coneCutoff = 2.0f; // sin cono: ningún punto de vista lo descarta
+    if (valid == 0 || XMVectorGetX(XMVector3LengthSq(axis)) < 1e-12f) return;
+    axis = XMVector3Normalize(axis);
+
+    float minDot = 1.0f;
+    for (UINT t = 0; t < triCount; ++t)
+    {
+        const XMVECTOR n = XMLoadFloat3(&triNormals[t]);
+        if (XMVectorGetX(XMVector3LengthSq(n)) == 0.0f) continue;
+        minDot = (std::min)(minDot, XMVectorGetX(XMVector3Dot(axis, n)));
+    }
+    if (minDot <= 0.1f) return; // cono de más de ~84°: casi nunca se puede descartar entero
+
+    float maxT = 0.0f;
+    for (UINT t = 0; t < triCount; ++t)
+    {
+        const XMVECTOR n = XMLoadFloat3(&triNormals[t]);
+        if (XMVectorGetX(XMVector3LengthSq(n)) == 0.0f) continue;
+        // punto center - t*axis sobre el plano del triángulo: dot(center - corner, n) = t * dot(axis, n)
+        const float dc = XMVectorGetX(XMVector3Dot(XMVectorSubtract(center, XMLoadFloat3(&verts[inds[t * 3]].pos)), n));
+        const float dn = XMVectorGetX(XMVector3Dot(axis, n));
+        maxT = (std::max)(maxT, dc / dn);
+    }
+
+    XMStoreFloat3(&m.coneAxis, axis);
+    XMStoreFloat3(&m.coneApex, XMVectorSubtract(center, XMVectorScale(axis, maxT)));
+    m.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+// Parte una malla (ya optimizada) en meshlets de ≤ MeshletMaxVertices vértices y ≤ MeshletMaxTriangles triángulos.
+// Greedy por adyacencia: arranca en el próximo triángulo libre en el orden del optimizer y agrega el vecino que
+// menos vértices nuevos suma y más se alinea con la normal media del cluster. Reordena 'inds' para que cada
+// meshlet sea un rango contiguo; 'indexBase' es el offset de la malla en el IB del modelo.
+void BuildMeshlets(const std::vector<Vertex>& verts, std::vector<uint32_t>& inds, UINT indexBase, std::vector<ModelMeshlet>& out)
+{
+    const UINT triCount = (UINT)(inds.size() / 3);
+    if (triCount == 0) return;
+
+    // Normal de cara (winding horario = frente, igual que el rasterizer con FrontCounterClockwise = FALSE)
+    std::vector<XMFLOAT3> triNormals(triCount);
+    for (UINT t = 0; t < triCount; ++t)
+    {
+        const XMVECTOR p0 = XMLoadFloat3(&verts[inds[t * 3 + 0]].pos);
+        const XMVECTOR p1 = XMLoadFloat3(&verts[inds[t * 3 + 1]].pos);
+        const XMVECTOR p2 = XMLoadFloat3(&verts[inds[t * 3 + 2]].pos);
+        const XMVECTOR n = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+        const float len = XMVectorGetX(XMVector3Length(n));
+        XMStoreFloat3(&triNormals[t], len > 1e-20f ? XMVectorScale(n, 1.0f / len) : XMVectorZero());
+    }
+
+    // Adyacencia vértice → triángulos (CSR)
+    std::vector<uint32_t> adjOffset(verts.size() + 1, 0), adjTris(inds.size());
+    for (uint32_t v : inds) ++adjOffset[v + 1];
+    for (size_t v = 0; v < verts.size(); ++v) adjOffset[v + 1] += adjOffset[v];
+    {
+        std::vector<uint32_t> fill(adjOffset.begin(), adjOffset.end() - 1);
+        for (UINT t = 0; t < triCount; ++t)
+            for (int k = 0; k < 3; ++k) adjTris[fill[inds[t * 3 + k]]++] = t;
+    }
+
+    std::vector<uint8_t> emitted(triCount, 0);
+    std::vector<uint32_t> vertexMeshlet(verts.size(), UINT32_MAX); // último meshlet que usó el vértice
+    std::vector<uint32_t> reordered;
+    std::vector<XMFLOAT3> reorderedNormals;
+    reordered.reserve(inds.size());
+    reorderedNormals.reserve(triCount);
+    std::vector<uint32_t> meshletVerts;
+    meshletVerts.reserve(MeshletMaxVertices);
+
+    UINT seed = 0;
+    for (uint32_t id = (uint32_t)out.size();; ++id)
+    {
+        while (seed < triCount && emitted[seed]) ++seed;
+        if (seed == triCount) break;
+
+        const UINT first = (UINT)reordered.size();
+        UINT tris = 0;
+        XMVECTOR normalSum = XMVectorZero();
+        meshletVerts.clear();
+
+        auto newVertices = [&](UINT t)
+        {
+            UINT n = 0;
+            for (int k = 0; k < 3; ++k) n += (vertexMeshlet[inds[t * 3 + k]] != id);
+            return n;
+        };
+        auto add = [&](UINT t)
+        {
+            emitted[t] = 1;
+            for (int k = 0; k < 3; ++k)
+            {
+                const uint32_t v = inds[t * 3 + k];
+                if (vertexMeshlet[v] != id) { vertexMeshlet[v] = id; meshletVerts.push_back(v); }
+                reordered.push_back(v);
+            }
+            reorderedNormals.push_back(triNormals[t]);
+            normalSum = XMVectorAdd(normalSum, XMLoadFloat3(&triNormals[t]));
+            ++tris;
+        };
+
+        add(seed);
+        while (tris < MeshletMaxTriangles)
+        {
+            const XMVECTOR avg = XMVector3Normalize(normalSum); // cero si todo lo agregado es degenerado
+            UINT best = UINT32_MAX;
+            float bestScore = FLT_MAX;
+            for (uint32_t v : meshletVerts)
+            {
+                for (uint32_t a = adjOffset[v]; a < adjOffset[v + 1]; ++a)
+                {
+                    const UINT t = adjTris[a];
+                    if (emitted[t]) continue;
+                    const UINT extra = newVertices(t);
+                    if (meshletVerts.size() + extra > MeshletMaxVertices) continue;
+
+                    const float score = float(extra) + MeshletConeWeight * (1.0f - XMVectorGetX(XMVector3Dot(XMLoadFloat3(&triNormals[t]), avg)));
+                    if (score < bestScore) { bestScore = score; best = t; }
+                }
+            }
+            if (best == UINT32_MAX) break; // sin vecinos que entren: se cierra el meshlet
+            add(best);
+        }
+
+        ModelMeshlet m = {};
+        ComputeMeshletBounds(verts, reordered.data() + first, tris, reorderedNormals.data() + first / 3, m);
+        m.firstIndex = indexBase + first;
+        m.triangleCount = tris;
+        m.vertexCount = (UINT)meshletVerts.size();
+        out.push_back(m);
+    }
+
+    inds.swap(reordered);
+}
+
+// Planos del frustum (normalizados, hacia adentro) a partir de viewProj con vectores fila: Gribb-Hartmann sobre
+// las columnas de la matriz. Near es z >= 0 (convención D3D).
+void ExtractFrustumPlanes(FXMMATRIX viewProj, XMVECTOR planes[6])
+{
+    const XMMATRIX c = XMMatrixTranspose(viewProj); // filas de c = columnas de viewProj
+    planes[0] = XMVectorAdd(c.r[3], c.r[0]);      // left
+    planes[1] = XMVectorSubtract(c.r[3], c.r[0]); // right
+    planes[2] = XMVectorAdd(c.r[3], c.r[1]);      // bottom
+    planes[3] = XMVectorSubtract(c.r[3], c.r[1]); // top
+    planes[4] = c.r[2];                           // near
+    planes[5] = XMVectorSubtract(c.r[3], c.r[2]); // far
+    for (int i = 0; i < 6; ++i) planes[i] = XMPlaneNormalize(planes[i]);
+}
+
+// Culling por cluster: cada meshlet de cada instancia contra el frustum (esfera) y la cámara (cono de normales).
+// Se trabaja en el espacio local de la instancia: los planos y el ojo se llevan una vez por instancia en vez de
+// transformar cada meshlet. Asume worlds de rotación + escala uniforme (igual que el VS para las normales).
+// Los índices que sobreviven van a 'outIndices', agrupados en una CulledDraw por instancia. 'instanceLods' puede ser
+// nullptr (todo en LOD0); si no, se recorren los meshlets del LOD elegido para cada instancia.
+void CullModelMeshlets(const ModelGeometryView& model, const UINT* instanceLods, FXMMATRIX objectWorld, CXMMATRIX viewProj, const XMFLOAT3& eyeWS,
+    std::vector<uint32_t>& outIndices, std::vector<CulledDraw>& draws, MeshletCullStats& stats)
+{
+    auto t0 = std::chrono::high_resolution_clock::now();
+    stats = MeshletCullStats{};
+    outIndices.clear();
+    draws.clear();
+
+    XMVECTOR planesWS[6];
+    ExtractFrustumPlanes(viewProj, planesWS);
+
+    for (UINT i = 0; i < (UINT)model.instanceCount; ++i)
+    {
+        const ModelInstance& inst = model.instances[i];
+        const ModelSubmesh& sm = model.submeshes[inst.submesh];
+        const XMMATRIX world = XMMatrixMultiply(XMMatrixTranspose(XMLoadFloat4x4(&inst.world)), objectWorld);
+
+        // plano local = world · plano (con vectores fila: plano * worldᵀ). La distancia que da es la de mundo.
+        XMVECTOR planes[6];
+        const XMMATRIX worldT = XMMatrixTranspose(world);
+        for (int p = 0; p < 6; ++p) planes[p] = XMVector4Transform(planesWS[p], worldT);
+
+        const float scale = sqrtf((std::max)({ XMVectorGetX(XMVector3LengthSq(world.r[0])),
+            XMVectorGetX(XMVector3LengthSq(world.r[1])), XMVectorGetX(XMVector3LengthSq(world.r[2])) }));
+        XMVECTOR det;
+        const XMMATRIX invWorld = XMMatrixInverse(&det, world);
+        const XMVECTOR eye = XMVector3TransformCoord(XMLoadFloat3(&eyeWS), invWorld);
+        const bool coneUsable = XMVectorGetX(det) > 0.0f; // un espejo invierte el winding: el cono ya no dice qué es backface
+
+        CulledDraw d;
+        d.instance = i;
+        d.firstIndex = (UINT)outIndices.size();
+        d.baseVertex = (INT)sm.baseVertex;
+
+        UINT firstMeshlet = sm.firstMeshlet, meshletCount = sm.meshletCount;
+        if (instanceLods)
+        {
+            const ModelLod& lod = model.lods[sm.firstLod + instanceLods[i]];
+            firstMeshlet = lod.firstMeshlet;
+            meshletCount = lod.meshletCount;
+        }
+
+        for (UINT m = firstMeshlet; m < firstMeshlet + meshletCount; ++m)
+        {
+            const ModelMeshlet& ml = model.meshlets[m];
+            ++stats.meshlets;
+            stats.trianglesIn += ml.triangleCount;
+
+            const XMVECTOR center = XMLoadFloat3(&ml.center);
+            const float radius = ml.radius * scale;
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; ++p)
+                outside = XMVectorGetX(XMPlaneDotCoord(planes[p], center)) < -radius;
+            if (outside) { ++stats.culledFrustum; continue; }
+
+            if (coneUsable && ml.coneCutoff <= 1.0f)
+            {
+                const XMVECTOR toApex = XMVector3Normalize(XMVectorSubtract(XMLoadFloat3(&ml.coneApex), eye));
+                if (XMVectorGetX(XMVector3Dot(toApex, XMLoadFloat3(&ml.coneAxis))) >= ml.coneCutoff) { ++stats.culledCone; continue; }
+            }
+
+            outIndices.insert(outIndices.end(), model.inds + ml.firstIndex, model.inds + ml.firstIndex + ml.triangleCount * 3);
+            stats.trianglesOut += ml.triangleCount;
+        }
+
+        d.indexCount = (UINT)outIndices.size() - d.firstIndex;
+        if (d.indexCount) draws.push_back(d);
+    }
+
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Simplificación por cuádricas de error (cadena de LODs)
+//--------------------------------------------------------------------------------------
+
+// Niveles (hasta ModelMaxLods): LOD0 = malla completa, cada nivel siguiente apunta a la mitad de triángulos del anterior.
+static const float LodTargetRatio = 0.5f;
+static const float LodMinReduction = 0.9f;     // si un nivel no baja al menos a este ratio del anterior, se corta la cadena
+static const float LodMaxRelativeError = 0.05f; // error máximo aceptado, relativo a la diagonal del AABB de la malla
+static const double LodBoundaryWeight = 10.0;   // peso de los planos que preservan bordes abiertos
+
+// Cuádrica de Garland-Heckbert: suma de distancias al cuadrado a un conjunto de planos (matriz simétrica 4×4).
+struct Quadric
+{
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+    void AddPlane(double a, double b, double c, double d, double w)
+    {
+        a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+        b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+        c2 += w * c * c; cd += w * c * d;
+        d2 += w * d * d;
+    }
+    void Add(const Quadric& q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+        bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+    }
+    double Eval(const XMFLOAT3& p) const
+    {
+        const double x = p.x, y = p.y, z = p.z;
+        return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+             + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+             + c2 * z * z + 2 * cd * z + d2;
+    }
+};
+
+// Simplifica por colapso de aristas sobre vértices existentes: el resultado son solo índices nuevos sobre el mismo VB,
+// así todos los LODs comparten vértices. Los vértices con la misma posición (costuras de normales) se colapsan juntos
+// y cada esquina toma la variante del destino con la normal más parecida. Para en 'targetIndexCount' o cuando el próximo
+// colapso supera 'maxError'. Devuelve el error geométrico (raíz de la cuádrica del peor colapso hecho, en unidades de la malla).
+float SimplifyMesh(const std::vector<Vertex>& verts, const std::vector<uint32_t>& inds, size_t targetIndexCount, float maxError, std::vector<uint32_t>& out)
+{
+    const UINT triCount = (UINT)(inds.size() / 3);
+    out = inds;
+    if (triCount == 0 || targetIndexCount >= inds.size()) return 0.0f;
+
+    // 1. Grupos por posición exacta (ordenando: sin hash de floats)
+    std::vector<uint32_t> order(verts.size());
+    for (uint32_t i = 0; i < (uint32_t)order.size(); ++i) order[i] = i;
+    auto posLess = [&](uint32_t a, uint32_t b)
+    {
+        const XMFLOAT3& p = verts[a].pos; const XMFLOAT3& q = verts[b].pos;
+        return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+    };
+    std::sort(order.begin(), order.end(), posLess);
+
+    std::vector<uint32_t> group(verts.size()), groupStart;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (i == 0 || posLess(order[i - 1], order[i])) groupStart.push_back((uint32_t)i);
+        group[order[i]] = (uint32_t)groupStart.size() - 1;
+    }
+    const uint32_t groupCount = (uint32_t)groupStart.size();
+    groupStart.push_back((uint32_t)order.size()); // variantes del grupo g: order[groupStart[g] .. groupStart[g+1])
+    auto groupPos = [&](uint32_t g) -> const XMFLOAT3& { return verts[order[groupStart[g]]].pos; };
+
+    // 2. Cuádricas de cara + bordes abiertos (aristas con un solo triángulo)
+    std::vector<Quadric> quadrics(groupCount);
+    std::vector<uint8_t> live(triCount, 1);
+    std::vector<std::pair<uint64_t, uint32_t>> edges; // (arista de grupos ordenada, triángulo)
+    edges.reserve(inds.size());
+    UINT liveTris = 0;
+    for (UINT t = 0; t < triCount; ++t)
+    {
+        const uint32_t g[3] = { group[inds[t * 3]], group[inds[t * 3 + 1]], group[inds[t * 3 + 2]] };
+        if (g[0] == g[1] || g[1] == g[2] || g[0] == g[2]) { live[t] = 0; continue; }
+
+        const XMVECTOR p0 = XMLoadFloat3(&groupPos(g[0]));
+        const XMVECTOR n = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&groupPos(g[1])), p0), XMVectorSubtract(XMLoadFloat3(&groupPos(g[2])), p0));
+        if (XMVectorGetX(XMVector3LengthSq(n)) > 0.0f)
+        {
+            XMFLOAT3 nn; XMStoreFloat3(&nn, XMVector3Normalize(n));
+            const double d = -(double(nn.x) * groupPos(g[0]).x + double(nn.y) * groupPos(g[0]).y + double(nn.z) * groupPos(g[0]).z);
+            for (int k = 0; k < 3; ++k) quadrics[g[k]].AddPlane(nn.x, nn.y, nn.z, d, 1.0);
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            const uint32_t a = (std::min)(g[k], g[(k + 1) % 3]), b = (std::max)(g[k], g[(k + 1) % 3]);
+            edges.push_back({ ((uint64_t)a << 32) | b, t });
+        }
+        ++liveTris;
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < edges.size();)
+    {
+        size_t j = i;
+        while (j < edges.size() && edges[j].first == edges[i].first) ++j;
+        if (j - i == 1) // borde: plano que contiene la arista y es perpendicular a la cara
+        {
+            const uint32_t a = (uint32_t)(edges[i].first >> 32), b = (uint32_t)edges[i].first, t = edges[i].second;
+            const XMVECTOR pa = XMLoadFloat3(&groupPos(a)), pb = XMLoadFloat3(&groupPos(b));
+            const XMVECTOR p0 = XMLoadFloat3(&groupPos(group[inds[t * 3]]));
+            const XMVECTOR fn = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&groupPos(group[inds[t * 3 + 1]])), p0),
+                                               XMVectorSubtract(XMLoadFloat3(&groupPos(group[inds[t * 3 + 2]])), p0));
+            const XMVECTOR en = XMVector3Cross(XMVectorSubtract(pb, pa), fn);
+            if (XMVectorGetX(XMVector3LengthSq(en)) > 0.0f)
+            {
+                XMFLOAT3 nn; XMStoreFloat3(&nn, XMVector3Normalize(en));
+                const double d = -(double(nn.x) * groupPos(a).x + double(nn.y) * groupPos(a).y + double(nn.z) * groupPos(a).z);
+                quadrics[a].AddPlane(nn.x, nn.y, nn.z, d, LodBoundaryWeight);
+                quadrics[b].AddPlane(nn.x, nn.y, nn.z, d, LodBoundaryWeight);
+            }
+        }
+        i = j;
+    }
+
+    // 3. Adyacencia grupo → triángulos y triángulos en espacio de grupos
+    std::vector<std::vector<uint32_t>> groupTris(groupCount);
+    std::vector<uint32_t> triGroups(inds.size());
+    for (UINT t = 0; t < triCount; ++t)
+    {
+        for (int k = 0; k < 3; ++k) triGroups[t * 3 + k] = group[inds[t * 3 + k]];
+        if (live[t]) for (int k = 0; k < 3; ++k) groupTris[triGroups[t * 3 + k]].push_back(t);
+    }
+
+    // 4. Cola de colapsos (min-heap) con invalidación perezosa por versión de cada grupo
+    struct Collapse { double cost; uint32_t from, to, stampFrom, stampTo; };
+    auto heapLess = [](const Collapse& a, const Collapse& b) { return a.cost > b.cost; };
+    std::vector<Collapse> heap;
+    std::vector<uint32_t> stamp(groupCount, 0);
+    std::vector<uint8_t> dead(groupCount, 0);
+
+    auto pushEdge = [&](uint32_t a, uint32_t b)
+    {
+        Quadric q = quadrics[a]; q.Add(quadrics[b]);
+        const double ab = q.Eval(groupPos(b)), ba = q.Eval(groupPos(a)); // a→b se queda con la posición de b
+        Collapse c = ab <= ba ? Collapse{ ab, a, b, stamp[a], stamp[b] } : Collapse{ ba, b, a, stamp[b], stamp[a] };
+        heap.push_back(c);
+        std::push_heap(heap.begin(), heap.end(), heapLess);
+    };
+    for (size_t i = 0; i < edges.size(); ++i)
+        if (i == 0 || edges[i].first != edges[i - 1].first)
+            pushEdge((uint32_t)(edges[i].first >> 32), (uint32_t)edges[i].first);
+
+    const UINT targetTris = (UINT)(targetIndexCount / 3);
+    const double maxCost = double(maxError) * maxError;
+    double worst = 0.0;
+    std::vector<uint32_t> neighbors;
+
+    while (liveTris > targetTris && !heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), heapLess);
+        const Collapse c = heap.back();
+        heap.pop_back();
+        if (dead[c.from] || dead[c.to] || stamp[c.from] != c.stampFrom || stamp[c.to] != c.stampTo) continue;
+        if (c.cost > maxCost) break; // el heap está ordenado: ningún colapso restante entra en el error pedido
+
+        // Rechazar si algún triángulo que sobrevive se da vuelta o se pliega demasiado al mover 'from' a 'to'
+        bool valid = true;
+        const XMVECTOR target = XMLoadFloat3(&groupPos(c.to));
+        for (uint32_t t : groupTris[c.from])
+        {
+            if (!live[t]) continue;
+            const uint32_t* g = &triGroups[t * 3];
+            if (g[0] == c.to || g[1] == c.to || g[2] == c.to) continue; // desaparece con el colapso
+
+            XMVECTOR p[3], q[3];
+            for (int k = 0; k < 3; ++k) { p[k] = XMLoadFloat3(&groupPos(g[k])); q[k] = g[k] == c.from ? target : p[k]; }
+            const XMVECTOR n0 = XMVector3Cross(XMVectorSubtract(p[1], p[0]), XMVectorSubtract(p[2], p[0]));
+            const XMVECTOR n1 = XMVector3Cross(XMVectorSubtract(q[1], q[0]), XMVectorSubtract(q[2], q[0]));
+            const float dot = XMVectorGetX(XMVector3Dot(n0, n1));
+            if (dot <= 0.25f * XMVectorGetX(XMVector3Length(n0)) * XMVectorGetX(XMVector3Length(n1))) { valid = false; break; }
+        }
+        if (!valid) continue;
+
+        // Aplicar: los triángulos con la arista mueren, el resto pasa a 'to' con la variante de normal más cercana
+        dead[c.from] = 1;
+        quadrics[c.to].Add(quadrics[c.from]);
+        worst = (std::max)(worst, c.cost);
+        for (uint32_t t : groupTris[c.from])
+        {
+            if (!live[t]) continue;
+            uint32_t* g = &triGroups[t * 3];
+            if (g[0] == c.to || g[1] == c.to || g[2] == c.to) { live[t] = 0; --liveTris; continue; }
+
+            for (int k = 0; k < 3; ++k)
+            {
+                if (g[k] != c.from) continue;
+                g[k] = c.to;
+                const XMVECTOR n = XMLoadFloat3(&verts[out[t * 3 + k]].normal);
+                uint32_t best = order[groupStart[c.to]];
+                float bestDot = -FLT_MAX;
+                for (uint32_t w = groupStart[c.to]; w < groupStart[c.to + 1]; ++w)
+                {
+                    const float d = XMVectorGetX(XMVector3Dot(n, XMLoadFloat3(&verts[order[w]].normal)));
+                    if (d > bestDot) { bestDot = d; best = order[w]; }
+                }
+                out[t * 3 + k] = best;
+            }
+            groupTris[c.to].push_back(t);
+        }
+        groupTris[c.from].clear();
+        groupTris[c.from].shrink_to_fit();
+
+        // Compactar la lista de 'to' y volver a encolar sus aristas con la cuádrica nueva
+        ++stamp[c.to];
+        std::vector<uint32_t>& adj = groupTris[c.to];
+        adj.erase(std::remove_if(adj.begin(), adj.end(), [&](uint32_t t) { return !live[t]; }), adj.end());
+        neighbors.clear();
+        for (uint32_t t : adj)
+            for (int k = 0; k < 3; ++k)
+                if (triGroups[t * 3 + k] != c.to) neighbors.push_back(triGroups[t * 3 + k]);
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+        for (uint32_t n : neighbors) pushEdge(c.to, n);
+    }
+
+    // 5. Compactar: solo los triángulos vivos, en el orden original (después se reordenan para el vertex cache)
+    size_t w = 0;
+    for (UINT t = 0; t < triCount; ++t)
+    {
+        if (!live[t]) continue;
+        for (int k = 0; k < 3; ++k) out[w++] = out[t * 3 + k];
+    }
+    out.resize(w);
+    return (float)sqrt((std::max)(worst, 0.0)); // la cuádrica puede dar apenas negativa por redondeo
+}
+
+// Cadena de LODs de una malla: LOD0 es 'inds' tal cual; cada nivel simplifica el anterior a LodTargetRatio de sus
+// triángulos y se reordena para el vertex cache. El error de cada nivel se acumula (cota conservadora respecto de LOD0).
+void BuildLodChain(const std::vector<Vertex>& verts, const std::vector<uint32_t>& inds, std::vector<std::vector<uint32_t>>& levels, std::vector<float>& errors)
+{
+    levels.assign(1, inds);
+    errors.assign(1, 0.0f);
+    if (inds.empty()) return;
+
+    XMVECTOR mn = XMVectorReplicate(FLT_MAX), mx = XMVectorReplicate(-FLT_MAX);
+    for (uint32_t i : inds) { const XMVECTOR p = XMLoadFloat3(&verts[i].pos); mn = XMVectorMin(mn, p); mx = XMVectorMax(mx, p); }
+    const float maxError = LodMaxRelativeError * XMVectorGetX(XMVector3Length(XMVectorSubtract(mx, mn)));
+
+    while (levels.size() < ModelMaxLods)
+    {
+        const std::vector<uint32_t>& prev = levels.back();
+        const size_t target = (size_t)(prev.size() / 3 * LodTargetRatio) * 3;
+        if (target < 3 * 4) break; // menos de 4 triángulos: no vale la pena
+
+        const float budget = maxError - errors.back();
+        if (budget <= 0.0f) break;
+
+        std::vector<uint32_t> simplified;
+        const float err = SimplifyMesh(verts, prev, target, budget, simplified);
+        if (simplified.empty() || simplified.size() > prev.size() * LodMinReduction) break;
+
+        std::vector<uint32_t> reordered;
+        OptimizeVertexCacheTipsify(simplified, verts.size(), VertexCacheSize, reordered);
+        levels.push_back(std::move(reordered));
+        errors.push_back(errors.back() + err);
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Parser OBJ nativo (fast path multihilo)
+//--------------------------------------------------------------------------------------
+
+// Malla en formato de trabajo CPU, antes de optimizar y empaquetar. Es lo que sale de ExtractMeshCPU o del parser OBJ.
+struct MeshCPU
+{
+    std::vector<Vertex>   verts;
+    std::vector<uint32_t> inds;
+    UINT materialId = 0;
+};
+
+// Lo que parsea un hilo en su rango de líneas. Los índices positivos del OBJ quedan en base 0 y absolutos;
+// los negativos (relativos al último v/vn leído) se guardan relativos al inicio del chunk y se corrigen al unir.
+struct ObjChunk
+{
+    enum : int32_t { NoNormal = INT32_MIN };
+    enum : uint8_t { PosRelative = 1, NrmRelative = 2 };
+
+    std::vector<XMFLOAT3> positions;
+    std::vector<XMFLOAT3> normals;
+    std::vector<int32_t>  cornerPos;
+    std::vector<int32_t>  cornerNrm;   // NoNormal si la esquina no trae vn
+    std::vector<uint8_t>  cornerFlags; // PosRelative / NrmRelative
+    std::vector<uint32_t> faceSizes;   // esquinas por cara (polígonos de n lados, se triangulan en abanico)
+    std::vector<std::pair<uint32_t, std::string>> materialSwitches; // (primera cara del chunk afectada, nombre de usemtl)
+    bool ok = true;
+};
+
+struct ObjParseStats
+{
+    size_t bytes = 0, positions = 0, normals = 0, faces = 0, triangles = 0, vertices = 0;
+    UINT threads = 0;
+    double parseMs = 0.0, buildMs = 0.0;
+};
+
+inline bool ObjIsBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+inline const char* ObjSkipBlanks(const char* c) { while (ObjIsBlank(*c)) ++c; return c; }
+
+// fast_atof de Assimp (el mismo que usa su importer de OBJ, así los floats salen bit a bit iguales).
+inline const char* ObjParseFloat3(const char* c, XMFLOAT3& out)
+{
+    c = Assimp::fast_atoreal_move<float>(ObjSkipBlanks(c), out.x, false);
+    c = Assimp::fast_atoreal_move<float>(ObjSkipBlanks(c), out.y, false);
+    c = Assimp::fast_atoreal_move<float>(ObjSkipBlanks(c), out.z, false);
+    return c;
+}
+
+// Parsea una línea terminada en '\n' o '\0' (nunca lee más allá de eso).
+void ParseObjLine(const char* c, ObjChunk& ch)
+{
+    c = ObjSkipBlanks(c);
+
+    if (c[0] == 'v' && ObjIsBlank(c[1]))
+    {
+        XMFLOAT3 p;
+        ObjParseFloat3(c + 1, p);
+        ch.positions.push_back(p);
+    }
+    else if (c[0] == 'v' && c[1] == 'n' && ObjIsBlank(c[2]))
+    {
+        XMFLOAT3 n;
+        ObjParseFloat3(c + 2, n);
+        ch.normals.push_back(n);
+    }
+    else if (c[0] == 'f' && ObjIsBlank(c[1]))
+    {
+        ++c;
+        uint32_t corners = 0;
+        for (;;)
+        {
+            c = ObjSkipBlanks(c);
+            if (!(*c == '-' || (*c >= '0' && *c <= '9'))) break;
+
+            const int v = Assimp::strtol10(c, &c);
+            int vn = 0;
+            if (*c == '/')
+            {
+                ++c;
+                if (*c != '/') Assimp::strtol10(c, &c); // vt: no lo usamos
+                if (*c == '/') { ++c; vn = Assimp::strtol10(c, &c); }
+            }
+            if (v == 0) { ch.ok = false; return; }
+
+            uint8_t flags = 0;
+            ch.cornerPos.push_back(v > 0 ? v - 1 : (int32_t)ch.positions.size() + v);
+            if (v < 0) flags |= ObjChunk::PosRelative;
+
+            if (vn == 0) ch.cornerNrm.push_back(ObjChunk::NoNormal);
+            else
+            {
+                ch.cornerNrm.push_back(vn > 0 ? vn - 1 : (int32_t)ch.normals.size() + vn);
+                if (vn < 0) flags |= ObjChunk::NrmRelative;
+            }
+            ch.cornerFlags.push_back(flags);
+            ++corners;
+        }
+        ch.faceSizes.push_back(corners);
+    }
+    else if (strncmp(c, "usemtl", 6) == 0 && ObjIsBlank(c[6]))
+    {
+        const char* b = ObjSkipBlanks(c + 6);
+        const char* e = b;
+        while (*e && *e != '\n') ++e;
+        while (e > b && ObjIsBlank(e[-1])) --e;
+        ch.materialSwitches.emplace_back((uint32_t)ch.faceSizes.size(), std::string(b, e));
+    }
+    // vt, o, g, s, mtllib, comentarios: se ignoran
+}
+
+void ParseObjChunk(const char* begin, const char* end, const char* fileEnd, ObjChunk& ch)
+{
+    try
+    {
+        for (const char* line = begin; line < end;)
+        {
+            const char* nl = static_cast<const char*>(memchr(line, '\n', (size_t)(end - line)));
+            if (nl)
+            {
+                ParseObjLine(line, ch);
+                line = nl + 1;
+            }
+            else
+            {
+                // Última línea del archivo sin '\n': se copia para tener un terminador (el mapeo no lo tiene)
+                const std::string last(line, fileEnd);
+                ParseObjLine(last.c_str(), ch);
+                break;
+            }
+        }
+    }
+    catch (const std::exception&) // fast_atof tira DeadlyImportError con números inválidos
+    {
+        ch.ok = false;
+    }
+}
+
+// Tabla hash de direccionamiento abierto para soldar vértices: clave (posición, normal) → índice de vértice.
+class VertexWeldMap
+{
+public:
+    explicit VertexWeldMap(size_t expected = 1024) { Rehash(RoundUp(expected * 2)); }
+
+    // Devuelve el índice existente o inserta 'next' y deja inserted = true.
+    uint32_t FindOrInsert(uint64_t key, uint32_t next, bool& inserted)
+    {
+        if ((m_count + 1) * 2 > m_keys.size()) Rehash(m_keys.size() * 2);
+
+        size_t i = Hash(key) & (m_keys.size() - 1);
+        for (;;)
+        {
+            if (m_keys[i] == Empty)
+            {
+                m_keys[i] = key; m_vals[i] = next; ++m_count;
+                inserted = true;
+                return next;
+            }
+            if (m_keys[i] == key) { inserted = false; return m_vals[i]; }
+            i = (i + 1) & (m_keys.size() - 1);
+        }
+    }
+
+private:
+    static const uint64_t Empty = ~0ull;
+    static size_t RoundUp(size_t v) { size_t p = 64; while (p < v) p <<= 1; return p; }
+    static size_t Hash(uint64_t k) { k ^= k >> 33; k *= 0xff51afd7ed558ccdull; k ^= k >> 33; return (size_t)k; }
+
+    void Rehash(size_t capacity)
+    {
+        std::vector<uint64_t> keys(capacity, Empty);
+        std::vector<uint32_t> vals(capacity);
+        for (size_t i = 0; i < m_keys.size(); ++i)
+        {
+            if (m_keys[i] == Empty) continue;
+            size_t j = Hash(m_keys[i]) & (capacity - 1);
+            while (keys[j] != Empty) j = (j + 1) & (capacity - 1);
+            keys[j] = m_keys[i]; vals[j] = m_vals[i];
+        }
+        m_keys.swap(keys);
+        m_vals.swap(vals);
+    }
+
+    std::vector<uint64_t> m_keys;
+    std::vector<uint32_t> m_vals;
+    size_t m_count = 0;
+};
+
+// Parser de OBJ sobre el archivo ya mapeado, con los cortes de chunk ya elegidos (cuts[0] = inicio, cuts.back() = fin,
+// cada corte justo después de un '\n'). Los chunks se parsean en paralelo; después se resuelven los índices, se
+// triangula en abanico, se sueldan vértices (posición + normal) y se generan normales suaves (ponderadas por área)
+// para las esquinas sin vn. Sale una malla por usemtl. Devuelve false ante cualquier cosa que no entienda.
+bool ParseObjChunks(const uint8_t* data, size_t size, const std::vector<const char*>& cuts, std::vector<MeshCPU>& out, ObjParseStats& stats)
+{
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    const char* fileEnd = reinterpret_cast<const char*>(data) + size;
+    const UINT threads = (UINT)cuts.size() - 1;
+
+    std::vector<ObjChunk> chunks(threads);
+    ParallelFor(threads, 1, [&](UINT begin, UINT end)
+    {
+        for (UINT t = begin; t < end; ++t) ParseObjChunk(cuts[t], cuts[t + 1], fileEnd, chunks[t]);
+    });
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    // Unir posiciones/normales y calcular la base de cada chunk para los índices relativos
+    std::vector<XMFLOAT3> positions, normals;
+    std::vector<size_t> posBase(threads), nrmBase(threads);
+    for (UINT t = 0; t < threads; ++t)
+    {
+        if (!chunks[t].ok) return false;
+        posBase[t] = positions.size();
+        nrmBase[t] = normals.size();
+        positions.insert(positions.end(), chunks[t].positions.begin(), chunks[t].positions.end());
+        normals.insert(normals.end(), chunks[t].normals.begin(), chunks[t].normals.end());
+    }
+
+    // Materiales en orden de primera aparición; las caras anteriores al primer usemtl van al material 0
+    std::vector<std::string> materialNames(1, std::string());
+    std::vector<VertexWeldMap> weld(1);
+    out.assign(1, MeshCPU{});
+
+    std::vector<std::vector<uint8_t>> generatedPerMesh(1); // 1 si el vértice lleva normal generada (sin vn)
+
+    UINT mat = 0;
+    auto useMaterial = [&](const std::string& name)
+    {
+        auto it = std::find(materialNames.begin(), materialNames.end(), name);
+        mat = (UINT)(it - materialNames.begin());
+        if (it == materialNames.end())
+        {
+            materialNames.push_back(name);
+            weld.emplace_back();
+            out.emplace_back();
+            out.back().materialId = mat;
+            generatedPerMesh.emplace_back();
+        }
+    };
+
+    std::vector<uint32_t> faceVerts;
+    for (UINT t = 0; t < threads; ++t)
+    {
+        const ObjChunk& ch = chunks[t];
+        size_t corner = 0, nextSwitch = 0;
+        for (uint32_t f = 0; f < (uint32_t)ch.faceSizes.size(); ++f)
+        {
+            while (nextSwitch < ch.materialSwitches.size() && ch.materialSwitches[nextSwitch].first == f)
+                useMaterial(ch.materialSwitches[nextSwitch++].second);
+
+            MeshCPU& mesh = out[mat];
+            std::vector<uint8_t>& gen = generatedPerMesh[mat];
+            faceVerts.clear();
+            for (uint32_t k = 0; k < ch.faceSizes[f]; ++k, ++corner)
+            {
+                int64_t p = ch.cornerPos[corner];
+                int64_t n = ch.cornerNrm[corner];
+                if (ch.cornerFlags[corner] & ObjChunk::PosRelative) p += (int64_t)posBase[t];
+                if (n != ObjChunk::NoNormal && (ch.cornerFlags[corner] & ObjChunk::NrmRelative)) n += (int64_t)nrmBase[t];
+                if (p < 0 || p >= (int64_t)positions.size()) return false;
+                if (n != ObjChunk::NoNormal && (n < 0 || n >= (int64_t)normals.size())) return false;
+
+                const uint64_t key = ((uint64_t)p << 32) | (n == ObjChunk::NoNormal ? 0xffffffffull : (uint64_t)n);
+                bool inserted = false;
+                const uint32_t idx = weld[mat].FindOrInsert(key, (uint32_t)mesh.verts.size(), inserted);
+                if (inserted)
+                {
+                    const bool hasNormal = (n != ObjChunk::NoNormal);
+                    mesh.verts.push_back(Vertex{ positions[(size_t)p], hasNormal ? normals[(size_t)n] : XMFLOAT3(0, 0, 0) });
+                    gen.push_back(hasNormal ? 0 : 1);
+                }
+                faceVerts.push_back(idx);
+            }
+
+            for (size_t k = 1; k + 1 < faceVerts.size(); ++k)
+            {
+                mesh.inds.push_back(faceVerts[0]);
+                mesh.inds.push_back(faceVerts[k]);
+                mesh.inds.push_back(faceVerts[k + 1]);
+            }
+        }
+        // usemtl después de la última cara del chunk: no se aplicó dentro del bucle y vale para el chunk siguiente
+        while (nextSwitch < ch.materialSwitches.size())
+            useMaterial(ch.materialSwitches[nextSwitch++].second);
+        stats.faces += ch.faceSizes.size();
+    }
+
+    // Normales suaves para los vértices sin vn: suma de normales de cara sin normalizar (= ponderadas por área)
+    for (size_t m = 0; m < out.size(); ++m)
+    {
+        MeshCPU& mesh = out[m];
+        const std::vector<uint8_t>& gen = generatedPerMesh[m];
+        if (std::find(gen.begin(), gen.end(), (uint8_t)1) == gen.end()) continue;
+
+        for (size_t i = 0; i + 2 < mesh.inds.size(); i += 3)
+        {
+            const uint32_t a = mesh.inds[i], b = mesh.inds[i + 1], c = mesh.inds[i + 2];
+            XMVECTOR pa = XMLoadFloat3(&mesh.verts[a].pos);
+            XMVECTOR fn = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&mesh.verts[b].pos), pa), XMVectorSubtract(XMLoadFloat3(&mesh.verts[c].pos), pa));
+            for (uint32_t v : { a, b, c })
+            {
+                if (!gen[v]) continue;
+                XMStoreFloat3(&mesh.verts[v].normal, XMVectorAdd(XMLoadFloat3(&mesh.verts[v].normal), fn));
+            }
+        }
+        for (size_t v = 0; v < mesh.verts.size(); ++v)
+        {
+            if (!gen[v]) continue;
+            XMVECTOR n = XMLoadFloat3(&mesh.verts[v].normal);
+            XMStoreFloat3(&mesh.verts[v].normal, XMVectorGetX(XMVector3Length(n)) > 0.0f ? XMVector3Normalize(n) : XMVectorSet(0, 1, 0, 0));
+        }
+    }
+
+    // El material 0 solo existe si hubo caras antes del primer usemtl
+    if (out[0].inds.empty()) out.erase(out.begin());
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    stats.bytes = size;
+    stats.threads = threads;
+    stats.positions = positions.size();
+    stats.normals = normals.size();
+    for (const MeshCPU& m : out) { stats.triangles += m.inds.size() / 3; stats.vertices += m.verts.size(); }
+    stats.parseMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    stats.buildMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    return !out.empty();
+}
+
+// Parser de OBJ: parte el archivo en 'threads' rangos alineados a línea (chunks de al menos 1 MB) y los parsea con
+// ParseObjChunks. Devuelve false ante cualquier cosa que no entienda: el llamador cae a Assimp.
+bool ParseObj(const uint8_t* data, size_t size, std::vector<MeshCPU>& out, ObjParseStats& stats, UINT threads = 0)
+{
+    const char* file = reinterpret_cast<const char*>(data);
+    const char* fileEnd = file + size;
+
+    if (threads == 0) threads = Jobs().ThreadCount();
+    threads = (UINT)(std::min)((size_t)threads, (std::max)((size_t)1, size / (1 << 20)));
+
+    // Cortes de chunk: cada uno arranca justo después de un '\n'
+    std::vector<const char*> cuts(threads + 1, fileEnd);
+    cuts[0] = file;
+    for (UINT t = 1; t < threads; ++t)
+    {
+        const char* c = (std::max)(file + size * t / threads, cuts[t - 1]);
+        const char* nl = static_cast<const char*>(memchr(c, '\n', (size_t)(fileEnd - c)));
+        cuts[t] = nl ? nl + 1 : fileEnd;
+    }
+    return ParseObjChunks(data, size, cuts, out, stats);
+}
+
+//--------------------------------------------------------------------------------------
+// Import de modelos (Assimp / OBJ nativo → ModelCPU)
+//--------------------------------------------------------------------------------------
+
+// Optimiza cada malla, las concatena en el megabuffer del modelo y empaqueta a PackedVertex.
+// Común a los dos importers; las instancias las arma cada uno. Devuelve false si no hay triángulos.
+bool BuildModelCPU(std::vector<MeshCPU>& meshes, ModelCPU& out)
+{
+    std::vector<Vertex> verts;
+    out.inds.clear();
+    out.meshlets.clear();
+    out.lods.clear();
+    out.submeshes.assign(meshes.size(), ModelSubmesh{});
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    MeshOptStats before, after; // promedios ponderados por triángulo (ACMR, overdraw) y por vértice (ATVR)
+    size_t optTris = 0, optVerts = 0;
+    double lodMs = 0.0;
+    std::vector<std::vector<uint32_t>> levels;
+    std::vector<float> levelErrors;
+
+    for (size_t m = 0; m < meshes.size(); ++m)
+    {
+        std::vector<Vertex>& meshVerts = meshes[m].verts;
+        std::vector<uint32_t>& meshInds = meshes[m].inds;
+
+        // Reordenar índices/vértices para el vertex cache, el overdraw y el fetch secuencial
+        if (!meshInds.empty())
+        {
+            MeshOptStats b, a;
+            OptimizeMeshForGPU(meshVerts, meshInds, b, a);
+
+            const float tris = float(meshInds.size() / 3), nv = float(meshVerts.size());
+            before.acmr += b.acmr * tris; after.acmr += a.acmr * tris;
+            before.overdraw += b.overdraw * tris; after.overdraw += a.overdraw * tris;
+            before.atvr += b.atvr * nv; after.atvr += a.atvr * nv;
+            optTris += meshInds.size() / 3;
+            optVerts += meshVerts.size();
+        }
+        else
+        {
+            meshVerts.clear(); // sin triángulos: no aporta nada al megabuffer
+        }
+
+        // Cadena de LODs sobre los vértices ya ordenados: cada nivel es solo otro rango de índices
+        auto tl = std::chrono::high_resolution_clock::now();
+        BuildLodChain(meshVerts, meshInds, levels, levelErrors);
+        lodMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tl).count();
+
+        ModelSubmesh& sm = out.submeshes[m];
+        sm.baseVertex = (UINT)verts.size();
+        sm.materialId = meshes[m].materialId;
+        sm.firstLod = (UINT)out.lods.size();
+        sm.lodCount = (UINT)levels.size();
+
+        for (size_t l = 0; l < levels.size(); ++l)
+        {
+            ModelLod lod;
+            lod.firstIndex = (UINT)out.inds.size();
+            lod.indexCount = (UINT)levels[l].size();
+            lod.error = levelErrors[l];
+
+            // Clusters para el culling: reordena los triángulos del nivel (los vértices no se tocan)
+            lod.firstMeshlet = (UINT)out.meshlets.size();
+            BuildMeshlets(meshVerts, levels[l], lod.firstIndex, out.meshlets);
+            lod.meshletCount = (UINT)out.meshlets.size() - lod.firstMeshlet;
+
+            out.inds.insert(out.inds.end(), levels[l].begin(), levels[l].end());
+            out.lods.push_back(lod);
+        }
+
+        const ModelLod& lod0 = out.lods[sm.firstLod];
+        sm.firstIndex = lod0.firstIndex;
+        sm.indexCount = lod0.indexCount;
+        sm.firstMeshlet = lod0.firstMeshlet;
+        sm.meshletCount = lod0.meshletCount;
+
+        verts.insert(verts.end(), meshVerts.begin(), meshVerts.end());
+    }
+
+    {
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0).count() - (float)lodMs;
+        const float invT = optTris ? 1.0f / float(optTris) : 0.0f, invV = optVerts ? 1.0f / float(optVerts) : 0.0f;
+
+        char buf[256];
+        sprintf_s(buf, "Mesh optimizer (cache %u): %zu meshes | tris %zu | ACMR %.3f -> %.3f | ATVR %.3f -> %.3f | overdraw %.3f -> %.3f | %.1f ms\n",
+            VertexCacheSize, meshes.size(), optTris, before.acmr * invT, after.acmr * invT, before.atvr * invV, after.atvr * invV,
+            before.overdraw * invT, after.overdraw * invT, ms);
+        OutputDebugStringA(buf);
+    }
+
+    if (out.inds.empty())
+    {
+        OutputDebugStringA("Model has no triangles\n");
+        return false;
+    }
+
+    {
+        size_t mlVerts = 0, mlTris = 0, noCone = 0;
+        for (const ModelMeshlet& ml : out.meshlets)
+        {
+            mlVerts += ml.vertexCount;
+            mlTris += ml.triangleCount;
+            noCone += ml.coneCutoff > 1.0f;
+        }
+        const float n = float(out.meshlets.size());
+        char buf[256];
+        sprintf_s(buf, "Meshlets (max %u verts / %u tris, all LODs): %zu | avg %.1f verts, %.1f tris | without a usable cone: %.1f%%\n",
+            MeshletMaxVertices, MeshletMaxTriangles, out.meshlets.size(), mlVerts / n, mlTris / n, 100.0f * noCone / n);
+        OutputDebugStringA(buf);
+    }
+
+    // LODs: triángulos totales y peor error por nivel (una malla con menos niveles aporta el más grueso que tiene)
+    {
+        XMVECTOR mn = XMVectorReplicate(FLT_MAX), mx = XMVectorReplicate(-FLT_MAX);
+        for (const Vertex& v : verts) { const XMVECTOR p = XMLoadFloat3(&v.pos); mn = XMVectorMin(mn, p); mx = XMVectorMax(mx, p); }
+        const float diag = (std::max)(XMVectorGetX(XMVector3Length(XMVectorSubtract(mx, mn))), 1e-20f);
+
+        UINT maxLods = 0;
+        for (const ModelSubmesh& sm : out.submeshes) maxLods = (std::max)(maxLods, sm.lodCount);
+
+        char buf[256];
+        sprintf_s(buf, "LOD chain: %u levels | simplifier %.1f ms\n", maxLods, lodMs);
+        OutputDebugStringA(buf);
+        for (UINT l = 0; l < maxLods; ++l)
+        {
+            size_t tris = 0;
+            float err = 0.0f;
+            for (const ModelSubmesh& sm : out.submeshes)
+            {
+                if (sm.lodCount == 0) continue;
+                const ModelLod& lod = out.lods[sm.firstLod + (std::min)(l, sm.lodCount - 1)];
+                tris += lod.indexCount / 3;
+                err = (std::max)(err, lod.error);
+            }
+            sprintf_s(buf, "  LOD %u: tris %zu (%.1f%%) | max error %.5f (%.3f%% of the model size)\n",
+                l, tris, 100.0 * tris / (std::max)(optTris, (size_t)1), err, 100.0f * err / diag);
+            OutputDebugStringA(buf);
+        }
+    }
+
+    // Empaquetar a PackedVertex (después del optimizer: el orden de vértices ya es el definitivo)
+    out.quant = ComputeVertexQuantization(verts.data(), verts.size());
+    PackVertices(verts.data(), verts.size(), out.quant, out.verts);
+    VerifyPackedVertices("model", verts.data(), out.verts.data(), verts.size(), out.quant);
+    return true;
+}
+
+// Camino frío genérico: Assimp + optimizer + empaquetado. Deja el modelo en el formato final de GPU.
+bool ImportModelAssimp(const std::string& fileName, ModelCPU& out)
+{
+    Assimp::Importer importer;
+
+    const aiScene* scene = importer.ReadFile(fileName, ModelImportFlags);
+
+    if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode || scene->mNumMeshes == 0)
+    {
+        OutputDebugStringA("Assimp load failed:\n");
+        OutputDebugStringA(importer.GetErrorString());
+        OutputDebugStringA("\n");
+        return false;
+    }
+
+    // Todas las mallas al megabuffer: cada una se optimiza por separado y se agrega al final del VB/IB compartido
+    std::vector<MeshCPU> meshes(scene->mNumMeshes);
+    ParallelFor(scene->mNumMeshes, 1, [&](UINT begin, UINT end) // una malla por job; las grandes se parten adentro
+    {
+        for (UINT m = begin; m < end; ++m)
+        {
+            ExtractMeshCPU(scene->mMeshes[m], meshes[m].verts, meshes[m].inds);
+            meshes[m].materialId = scene->mMeshes[m]->mMaterialIndex;
+        }
+    });
+
+    if (!BuildModelCPU(meshes, out)) return false;
+
+    // Jerarquía de nodos → lista plana de instancias, ordenada por submesh
+    out.instances.clear();
+    FlattenNodeHierarchy(scene->mRootNode, XMMatrixIdentity(), out.submeshes, out.instances);
+    std::vector<ModelDraw> draws;
+    BuildModelDraws(out.instances, draws);
+    return true;
+}
+
+// Camino frío para .obj: parser nativo sobre el archivo ya mapeado. Un OBJ no tiene jerarquía:
+// una instancia identidad por submesh (una por usemtl).
+bool ImportModelObj(const MappedFile& source, ModelCPU& out)
+{
+    std::vector<MeshCPU> meshes;
+    ObjParseStats st;
+    if (!ParseObj(source.Data(), source.Size(), meshes, st))
+    {
+        OutputDebugStringA("OBJ fast path failed, falling back to Assimp\n");
+        return false;
+    }
+
+    char buf[256];
+    sprintf_s(buf, "OBJ fast path: %.1f MB | %u threads | parse %.1f ms (%.0f MB/s) | weld %.1f ms | %zu meshes | verts %zu | tris %zu\n",
+        st.bytes / (1024.0 * 1024.0), st.threads, st.parseMs, st.bytes / (1024.0 * 1024.0) / (st.parseMs / 1000.0), st.buildMs,
+        meshes.size(), st.vertices, st.triangles);
+    OutputDebugStringA(buf);
+
+    if (!BuildModelCPU(meshes, out)) return false;
+
+    out.instances.clear();
+    for (UINT m = 0; m < (UINT)out.submeshes.size(); ++m)
+    {
+        if (out.submeshes[m].indexCount == 0) continue;
+        ModelInstance inst;
+        inst.submesh = m;
+        XMStoreFloat4x4(&inst.world, XMMatrixIdentity());
+        out.instances.push_back(inst);
+    }
+    return true;
+}
+
+inline bool IsObjPath(const std::string& path)
+{
+    return path.size() > 4 && _stricmp(path.c_str() + path.size() - 4, ".obj") == 0;
+}
+
+// Import con cache: si el .meshcache existe y coincide con el fuente (hash, tamaño, flags, versión) se usa mapeado
+// tal cual; si no, se importa con Assimp y se hornea uno nuevo. 'cacheFile' y 'imported' tienen que vivir mientras se use 'out'.
+bool LoadModelCPU(const std::string& fileName, MappedFile& cacheFile, ModelCPU& imported, ModelGeometryView& out, bool& warm)
+{
+    warm = false;
+
+    MappedFile source;
+    if (!source.Open(fileName))
+    {
+        OutputDebugStringA(("Model source not found: " + fileName + "\n").c_str());
+        return false;
+    }
+    const uint64_t sourceSize = source.Size();
+    const uint64_t sourceHash = HashBytes64(source.Data(), source.Size());
+    const uint32_t importer = (g_objFastPath && IsObjPath(fileName)) ? MeshImporterObjFastPath : MeshImporterAssimp;
+
+    const std::string cachePath = MeshCachePath(fileName);
+    if (cacheFile.Open(cachePath))
+    {
+        if (OpenMeshCache(cacheFile, sourceHash, sourceSize, importer, out))
+        {
+            warm = true;
+            return true;
+        }
+        cacheFile.Close(); // desactualizado o corrupto: se regenera (y no se puede reemplazar mientras esté mapeado)
+        OutputDebugStringA("Mesh cache stale, rebuilding\n");
+    }
+
+    // El fuente sigue mapeado: el parser OBJ trabaja directo sobre el mapeo
+    const bool ok = (importer == MeshImporterObjFastPath && ImportModelObj(source, imported)) || ImportModelAssimp(fileName, imported);
+    source.Close();
+    if (!ok) return false;
+
+    if (!WriteMeshCache(cachePath, sourceHash, sourceSize, importer, imported))
+        OutputDebugStringA(("Mesh cache write failed: " + cachePath + "\n").c_str());
+
+    out = ViewOf(imported);
+    return true;
+}
+
+// Benchmark de arranque frío vs. caliente (solo CPU: la subida a GPU es idéntica en los dos caminos).
+// Se corre con el argumento -benchmark-meshcache; borra el cache para que la primera pasada sea realmente fría.
+void BenchmarkModelCache(const std::string& fileName, int warmRuns = 10)
+{
+    DeleteFileA(MeshCachePath(fileName).c_str());
+
+    double coldMs = 0.0, warmMinMs = 1e30, warmSumMs = 0.0;
+    for (int run = 0; run <= warmRuns; ++run)
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        MappedFile cacheFile;
+        ModelCPU imported;
+        ModelGeometryView view;
+        bool warm = false;
+        if (!LoadModelCPU(fileName, cacheFile, imported, view, warm)) return;
+
+        // Tocar todo el VB/IB como lo haría el memcpy de la subida (sin esto el mapeo caliente no lee nada)
+        uint64_t touch = HashBytes64(reinterpret_cast<const uint8_t*>(view.verts), view.vertexCount * sizeof(PackedVertex)) ^
+            HashBytes64(reinterpret_cast<const uint8_t*>(view.inds), view.indexCount * sizeof(uint32_t));
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+        (void)touch;
+
+        if (run == 0)
+        {
+            coldMs = ms;
+        }
+        else if (!warm)
+        {
+            OutputDebugStringA("Mesh cache benchmark: warm run missed the cache (write failed?)\n");
+            return;
+        }
+        else
+        {
+            warmMinMs = (std::min)(warmMinMs, ms);
+            warmSumMs += ms;
+        }
+    }
+
+    char buf[256];
+    sprintf_s(buf, "Mesh cache benchmark [%s]: cold %.2f ms | warm min %.2f ms avg %.2f ms (%d runs) | speedup %.1fx\n",
+        fileName.c_str(), coldMs, warmMinMs, warmSumMs / warmRuns, warmRuns, coldMs / warmMinMs);
+    OutputDebugStringA(buf);
+}
+
+// Resultado de comparar las mallas de dos importers del mismo archivo.
+struct MeshCompareResult
+{
+    size_t trisA = 0, trisB = 0, vertsA = 0, vertsB = 0;
+    size_t matched = 0;           // triángulos con las mismas 3 posiciones (bit a bit) y el mismo winding
+    float maxNormalErrDeg = 0.0f; // entre esquinas de triángulos emparejados
+};
+
+// Triángulos comparables sin importar el orden de la malla ni por qué esquina arranca: se rota para que
+// la posición lexicográficamente menor quede primera (mantiene el winding) y se ordena la lista.
+struct CanonTri { float p[9]; float n[9]; };
+
+void CanonicalTriangles(const std::vector<MeshCPU>& meshes, std::vector<CanonTri>& out)
+{
+    out.clear();
+    for (const MeshCPU& m : meshes)
+    {
+        for (size_t i = 0; i + 2 < m.inds.size(); i += 3)
+        {
+            const Vertex* v[3] = { &m.verts[m.inds[i]], &m.verts[m.inds[i + 1]], &m.verts[m.inds[i + 2]] };
+            int first = 0;
+            for (int k = 1; k < 3; ++k)
+            {
+                const float* a = &v[k]->pos.x; const float* b = &v[first]->pos.x;
+                if (std::lexicographical_compare(a, a + 3, b, b + 3)) first = k;
+            }
+
+            CanonTri t;
+            for (int k = 0; k < 3; ++k)
+            {
+                const Vertex* s = v[(first + k) % 3];
+                memcpy(&t.p[k * 3], &s->pos, sizeof(XMFLOAT3));
+                memcpy(&t.n[k * 3], &s->normal, sizeof(XMFLOAT3));
+            }
+            out.push_back(t);
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const CanonTri& a, const CanonTri& b) { return std::lexicographical_compare(a.p, a.p + 9, b.p, b.p + 9); });
+}
+
+MeshCompareResult CompareMeshSets(const std::vector<MeshCPU>& a, const std::vector<MeshCPU>& b)
+{
+    MeshCompareResult r;
+    for (const MeshCPU& m : a) r.vertsA += m.verts.size();
+    for (const MeshCPU& m : b) r.vertsB += m.verts.size();
+
+    std::vector<CanonTri> ta, tb;
+    CanonicalTriangles(a, ta);
+    CanonicalTriangles(b, tb);
+    r.trisA = ta.size();
+    r.trisB = tb.size();
+
+    auto less = [](const CanonTri& x, const CanonTri& y) { return std::lexicographical_compare(x.p, x.p + 9, y.p, y.p + 9); };
+    for (size_t i = 0, j = 0; i < ta.size() && j < tb.size();)
+    {
+        if (less(ta[i], tb[j])) { ++i; continue; }
+        if (less(tb[j], ta[i])) { ++j; continue; }
+
+        ++r.matched;
+        for (int k = 0; k < 3; ++k)
+        {
+            const XMVECTOR na = XMVector3Normalize(XMVectorSet(ta[i].n[k * 3], ta[i].n[k * 3 + 1], ta[i].n[k * 3 + 2], 0));
+            const XMVECTOR nb = XMVector3Normalize(XMVectorSet(tb[j].n[k * 3], tb[j].n[k * 3 + 1], tb[j].n[k * 3 + 2], 0));
+            const float ang = atan2f(XMVectorGetX(XMVector3Length(XMVector3Cross(na, nb))), XMVectorGetX(XMVector3Dot(na, nb)));
+            r.maxNormalErrDeg = (std::max)(r.maxNormalErrDeg, XMConvertToDegrees(ang));
+        }
+        ++i; ++j;
+    }
+    return r;
+}
+
+// OBJ sintético para medir throughput: grilla ondulada de dim × dim con vn, quads, un usemtl cada 64 filas
+// y las filas impares con índices negativos (relativos), que es lo que más estresa los cortes de chunk.
+bool WriteSyntheticObj(const std::string& path, UINT dim)
+{
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+
+    std::string buf;
+    bool ok = true;
+    auto flush = [&](bool force)
+    {
+        if (!ok || (!force && buf.size() < (4u << 20))) return;
+        DWORD written = 0;
+        ok = WriteFile(f, buf.data(), (DWORD)buf.size(), &written, nullptr) && written == buf.size();
+        buf.clear();
+    };
+
+    char line[160];
+    for (UINT r = 0; r < dim && ok; ++r)
+    {
+        for (UINT c = 0; c < dim; ++c)
+        {
+            const float x = float(c) / dim, z = float(r) / dim;
+            const float y = 0.05f * sinf(x * 40.0f) * cosf(z * 40.0f);
+            const float dx = 2.0f * cosf(x * 40.0f) * cosf(z * 40.0f), dz = -2.0f * sinf(x * 40.0f) * sinf(z * 40.0f);
+            const float il = 1.0f / sqrtf(dx * dx + 1.0f + dz * dz);
+            buf.append(line, (size_t)snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvn %.6f %.6f %.6f\n", x, y, z, -dx * il, il, -dz * il));
+        }
+        if (r == 0) continue;
+
+        if (r % 64 == 1)
+            buf.append(line, (size_t)snprintf(line, sizeof(line), "usemtl synthetic_%u\n", (r / 64) % 4));
+
+        for (UINT c = 0; c + 1 < dim; ++c)
+        {
+            if (r & 1)
+            {
+                // relativo: -1 es el último v leído (fin de la fila r)
+                const int a = -(int)(2 * dim - c), b = a + 1, d = -(int)(dim - c), e = d + 1;
+                buf.append(line, (size_t)snprintf(line, sizeof(line), "f %d//%d %d//%d %d//%d %d//%d\n", a, a, d, d, e, e, b, b));
+            }
+            else
+            {
+                const UINT a = (r - 1) * dim + c + 1, b = a + 1, d = r * dim + c + 1, e = d + 1;
+                buf.append(line, (size_t)snprintf(line, sizeof(line), "f %u//%u %u//%u %u//%u %u//%u\n", a, a, d, d, e, e, b, b));
+            }
+        }
+        flush(false);
+    }
+    flush(true);
+    CloseHandle(f);
+    return ok;
+}
+
+// Chequeo de los cortes de chunk del parser OBJ sin ventana ni GPU (-obj-selftest): un OBJ chico con usemtl, índices
+// relativos y caras sin vn se parsea en un solo chunk y partido en cada borde de línea (incluido justo después de cada
+// usemtl) y con una línea por chunk; las mallas tienen que salir idénticas. Devuelve el exit code del proceso.
+int RunObjParserSelfTest()
+{
+    const char* text =
+        "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvn 0 0 1\n"
+        "f 1//1 2//1 3//1\n"
+        "usemtl red\n"
+        "f 1//1 3//1 4//1\n"
+        "v 0 0 1\nv 1 0 1\n"
+        "f -2 -1 2\n"
+        "usemtl blue\n"
+        "v 1 1 1\nv 0 1 1\n"
+        "f 5 6 7 8\n"
+        "f -4//1 -3//1 3//1\n"
+        "usemtl red\n"
+        "f 2//1 3//1 6//1\n";
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(text);
+    const size_t size = strlen(text);
+    const char* fileEnd = text + size;
+
+    std::vector<const char*> lineStarts;
+    for (const char* c = text; c < fileEnd; ++c)
+        if (c > text && c[-1] == '\n') lineStarts.push_back(c);
+
+    bool ok = true;
+    char buf[256];
+    auto report = [&](const char* step, bool pass, const char* detail)
+    {
+        ok &= pass;
+        sprintf_s(buf, "OBJ parser [%s]: %s%s%s\n", step, pass ? "OK" : "FAIL", detail[0] ? " " : "", detail);
+        OutputDebugStringA(buf);
+    };
+
+    // Referencia: un solo chunk. Material 0 (sin usemtl) 1 triángulo, red 3, blue 3 (el quad en abanico + 1)
+    std::vector<MeshCPU> ref;
+    ObjParseStats refStats;
+    const bool refOk = ParseObjChunks(data, size, { text, fileEnd }, ref, refStats);
+    const bool refShape = refOk && ref.size() == 3 && ref[0].inds.size() == 3 && ref[1].inds.size() == 9 && ref[2].inds.size() == 9 &&
+        ref[1].materialId == 1 && ref[2].materialId == 2;
+    report("single chunk", refShape, "");
+    if (!refShape) return 1;
+
+    auto same = [&](const std::vector<MeshCPU>& m)
+    {
+        if (m.size() != ref.size()) return false;
+        for (size_t i = 0; i < m.size(); ++i)
+        {
+            if (m[i].materialId != ref[i].materialId || m[i].inds != ref[i].inds || m[i].verts.size() != ref[i].verts.size()) return false;
+            if (memcmp(m[i].verts.data(), ref[i].verts.data(), m[i].verts.size() * sizeof(Vertex)) != 0) return false;
+        }
+        return true;
+    };
+
+    // Un corte en cada borde de línea
+    int failed = 0;
+    std::string failedAt;
+    for (size_t i = 0; i < lineStarts.size(); ++i)
+    {
+        std::vector<MeshCPU> m;
+        ObjParseStats st;
+        if (ParseObjChunks(data, size, { text, lineStarts[i], fileEnd }, m, st) && same(m)) continue;
+        ++failed;
+        failedAt += " | after \"" + std::string(i ? lineStarts[i - 1] : text, lineStarts[i] - 1) + "\"";
+    }
+    sprintf_s(buf, "%d of %zu cuts differ", failed, lineStarts.size());
+    report("one cut per line boundary", failed == 0, (std::string(buf) + failedAt).c_str());
+
+    // El caso del review: el chunk termina justo después de usemtl y la cara siguiente es del chunk de al lado
+    const char* afterBlue = strstr(text, "usemtl blue\n") + strlen("usemtl blue\n");
+    std::vector<MeshCPU> split;
+    ObjParseStats splitStats;
+    report("cut right after usemtl", ParseObjChunks(data, size, { text, afterBlue, fileEnd }, split, splitStats) && same(split), "");
+
+    // Una línea por chunk
+    std::vector<const char*> every(1, text);
+    every.insert(every.end(), lineStarts.begin(), lineStarts.end());
+    every.push_back(fileEnd);
+    std::vector<MeshCPU> lines;
+    ObjParseStats linesStats;
+    report("one line per chunk", ParseObjChunks(data, size, every, lines, linesStats) && same(lines), "");
+
+    OutputDebugStringA(ok ? "OBJ parser self-test: OK\n" : "OBJ parser self-test: FAIL\n");
+    return ok ? 0 : 1;
+}
+
+// Throughput y correctitud del parser OBJ nativo contra Assimp sobre el mismo archivo.
+void BenchmarkObjFile(const std::string& fileName)
+{
+    MappedFile source;
+    if (!source.Open(fileName)) return;
+    const double mb = source.Size() / (1024.0 * 1024.0);
+
+    std::vector<MeshCPU> fast;
+    ObjParseStats st1, stN;
+    ParseObj(source.Data(), source.Size(), fast, st1, 1); // escalado: un hilo vs. todos
+    if (!ParseObj(source.Data(), source.Size(), fast, stN))
+    {
+        OutputDebugStringA(("OBJ benchmark: fast path failed on " + fileName + "\n").c_str());
+        return;
+    }
+    source.Close();
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    std::vector<MeshCPU> ref;
+    {
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(fileName, ModelImportFlags);
+        if (scene && scene->mRootNode)
+        {
+            ref.resize(scene->mNumMeshes);
+            ParallelFor(scene->mNumMeshes, 1, [&](UINT begin, UINT end)
+            {
+                for (UINT m = begin; m < end; ++m) ExtractMeshCPU(scene->mMeshes[m], ref[m].verts, ref[m].inds);
+            });
+        }
+    }
+    const double assimpMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+    const double fast1Ms = st1.parseMs + st1.buildMs, fastNMs = stN.parseMs + stN.buildMs;
+    char buf[512];
+    sprintf_s(buf, "OBJ benchmark [%s] %.1f MB: fast 1 thread %.1f ms (%.0f MB/s) | fast %u threads %.1f ms (%.0f MB/s, parse %.0f MB/s) | Assimp %.1f ms (%.0f MB/s) | %.1fx\n",
+        fileName.c_str(), mb, fast1Ms, mb / (fast1Ms / 1000.0), stN.threads, fastNMs, mb / (fastNMs / 1000.0), mb / (stN.parseMs / 1000.0),
+        assimpMs, mb / (assimpMs / 1000.0), assimpMs / fastNMs);
+    OutputDebugStringA(buf);
+
+    if (ref.empty())
+    {
+        OutputDebugStringA("OBJ benchmark: Assimp failed, no reference to compare against\n");
+        return;
+    }
+
+    // Los quads/triángulos tienen que coincidir 1:1. Los n-gonos > 4 pueden diferir (Assimp usa ear clipping, acá abanico)
+    // y Assimp separa vértices por UV, así que el conteo de vértices puede ser mayor del lado de Assimp.
+    const MeshCompareResult cmp = CompareMeshSets(fast, ref);
+    sprintf_s(buf, "OBJ compare vs Assimp: tris %zu / %zu | matched %zu (%.2f%%) | verts %zu / %zu | max normal err %.3f deg%s\n",
+        cmp.trisA, cmp.trisB, cmp.matched, cmp.trisB ? 100.0 * cmp.matched / cmp.trisB : 0.0, cmp.vertsA, cmp.vertsB, cmp.maxNormalErrDeg,
+        (cmp.matched == cmp.trisA && cmp.matched == cmp.trisB) ? "" : " | MISMATCH");
+    OutputDebugStringA(buf);
+}
+
+// Se corre con -benchmark-obj: el modelo de la escena y un OBJ sintético de ~300 MB (se borra al terminar).
+void BenchmarkObjParser(const std::string& modelPath)
+{
+    BenchmarkObjFile(modelPath);
+
+    const std::string synthetic = modelPath.substr(0, modelPath.find_last_of("/\\") + 1) + "_obj_benchmark.obj";
+    if (!WriteSyntheticObj(synthetic, 1600))
+    {
+        OutputDebugStringA("OBJ benchmark: could not write the synthetic file\n");
+        return;
+    }
+    BenchmarkObjFile(synthetic);
+    DeleteFileA(synthetic.c_str());
+}
+
+// Benchmark del simplificador en CPU (-benchmark-simplify): mismas mallas que el import en frío (parser OBJ o Assimp,
+// ya optimizadas), cadena completa de LODs 'runs' veces. Reporta throughput sobre los triángulos de entrada.
+void BenchmarkSimplifier(const std::string& fileName, int runs = 3)
+{
+    std::vector<MeshCPU> meshes;
+    MappedFile source;
+    ObjParseStats st;
+    if (!(IsObjPath(fileName) && source.Open(fileName) && ParseObj(source.Data(), source.Size(), meshes, st)))
+    {
+        meshes.clear();
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(fileName, ModelImportFlags);
+        if (!scene || !scene->mRootNode) { OutputDebugStringA("Simplifier benchmark: model load failed\n"); return; }
+        meshes.resize(scene->mNumMeshes);
+        ParallelFor(scene->mNumMeshes, 1, [&](UINT begin, UINT end)
+        {
+            for (UINT m = begin; m < end; ++m) ExtractMeshCPU(scene->mMeshes[m], meshes[m].verts, meshes[m].inds);
+        });
+    }
+    source.Close();
+
+    size_t inputTris = 0;
+    for (MeshCPU& m : meshes)
+    {
+        if (m.inds.empty()) continue;
+        MeshOptStats b, a;
+        OptimizeMeshForGPU(m.verts, m.inds, b, a);
+        inputTris += m.inds.size() / 3;
+    }
+
+    std::vector<size_t> levelTris(ModelMaxLods, 0);
+    std::vector<std::vector<uint32_t>> levels;
+    std::vector<float> errors;
+    double bestMs = DBL_MAX;
+    for (int r = 0; r < runs; ++r)
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        std::fill(levelTris.begin(), levelTris.end(), 0);
+        for (const MeshCPU& m : meshes)
+        {
+            BuildLodChain(m.verts, m.inds, levels, errors);
+            for (size_t l = 0; l < ModelMaxLods; ++l) levelTris[l] += levels[(std::min)(l, levels.size() - 1)].size() / 3;
+        }
+        bestMs = (std::min)(bestMs, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count());
+    }
+
+    char buf[256];
+    sprintf_s(buf, "Simplifier benchmark: %zu meshes | %zu input tris | LOD chain best of %d: %.1f ms (%.2f M input tris/s) | tris per level:",
+        meshes.size(), inputTris, runs, bestMs, inputTris / (bestMs * 1000.0));
+    std::string line = buf;
+    for (size_t l = 0; l < ModelMaxLods; ++l) line += " " + std::to_string(levelTris[l]);
+    OutputDebugStringA((line + "\n").c_str());
+}
+
+// VB e IB del modelo que se está subiendo: reemplazan a g_modelVB/g_modelIB en PublishModelGeometry.
+ComPtr<ID3D12Resource> g_modelNextVB;
+ComPtr<ID3D12Resource> g_modelNextIB;
+
+// Crea el VB/IB nuevos (DEFAULT) y encola sus datos en g_uploads. No copia nada: 'm' tiene que seguir vivo hasta que
+// Pump termine de pasarlo al ring, de a un ring por frame (PollModelLoad).
+void BeginModelUpload(const ModelGeometryView& m)
+{
+    const UINT vbSize = (UINT)(m.vertexCount * sizeof(PackedVertex));
+    g_modelNextVB = CreateGpuResource(D3D12_HEAP_TYPE_DEFAULT, BufferDesc(vbSize), D3D12_RESOURCE_STATE_COMMON);
+    g_uploads.Enqueue(g_modelNextVB.Get(), 0, m.verts, vbSize);
+
+    const UINT ibSize = (UINT)(m.indexCount * sizeof(uint32_t));
+    g_modelNextIB = CreateGpuResource(D3D12_HEAP_TYPE_DEFAULT, BufferDesc(ibSize), D3D12_RESOURCE_STATE_COMMON);
+    g_uploads.Enqueue(g_modelNextIB.Get(), 0, m.inds, ibSize);
+}
+
+// Con la copia del VB/IB ya enviada a la cola de copia: los pone en uso y arma las tablas de draws del modelo.
+void PublishModelGeometry(const ModelGeometryView& m)
+{
+    g_modelVB = std::move(g_modelNextVB);
+    g_modelIB = std::move(g_modelNextIB);
+
+    g_modelQuant = m.quant;
+    g_modelIndexCount = (UINT)m.indexCount;
+    g_modelSubmeshes.assign(m.submeshes, m.submeshes + m.submeshCount);
+    g_modelInstances.assign(m.instances, m.instances + m.instanceCount);
+    g_modelNormalWorlds.resize(g_modelInstances.size());
+    for (size_t i = 0; i < g_modelInstances.size(); ++i) g_modelNormalWorlds[i] = NormalWorldFromStored(g_modelInstances[i].world);
+    BuildModelDraws(g_modelInstances, g_modelDraws); // ya vienen ordenadas: solo agrupa
+    g_modelMeshlets.assign(m.meshlets, m.meshlets + m.meshletCount);
+    g_modelLods.assign(m.lods, m.lods + m.lodCount);
+    g_modelIndices.assign(m.inds, m.inds + m.indexCount);
+
+    // Esfera de cada submesh (envuelve las de sus meshlets de LOD0) para medir el tamaño proyectado
+    g_modelSubmeshBounds.assign(m.submeshCount, XMFLOAT4(0, 0, 0, 0));
+    for (size_t i = 0; i < m.submeshCount; ++i)
+    {
+        const ModelSubmesh& sm = m.submeshes[i];
+        if (sm.meshletCount == 0) continue;
+        XMVECTOR mn = XMVectorReplicate(FLT_MAX), mx = XMVectorReplicate(-FLT_MAX);
+        for (UINT k = sm.firstMeshlet; k < sm.firstMeshlet + sm.meshletCount; ++k)
+        {
+            const XMVECTOR c = XMLoadFloat3(&m.meshlets[k].center), r = XMVectorReplicate(m.meshlets[k].radius);
+            mn = XMVectorMin(mn, XMVectorSubtract(c, r)); mx = XMVectorMax(mx, XMVectorAdd(c, r));
+        }
+        const XMVECTOR center = XMVectorScale(XMVectorAdd(mn, mx), 0.5f);
+        float radius = 0.0f;
+        for (UINT k = sm.firstMeshlet; k < sm.firstMeshlet + sm.meshletCount; ++k)
+            radius = (std::max)(radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&m.meshlets[k].center), center))) + m.meshlets[k].radius);
+        XMStoreFloat4(&g_modelSubmeshBounds[i], XMVectorSetW(center, radius));
+    }
+
+    // --- VB (DEFAULT, por la cola de copia) ---
+    {
+        const UINT vbSize = (UINT)(m.vertexCount * sizeof(PackedVertex));
+        g_modelVBView.BufferLocation = g_modelVB->GetGPUVirtualAddress();
+        g_modelVBView.StrideInBytes = sizeof(PackedVertex);
+        g_modelVBView.SizeInBytes = vbSize;
+    }
+
+    // --- IB (DEFAULT, por la cola de copia) 32-bit ---
+    {
+        const UINT ibSize = (UINT)(m.indexCount * sizeof(uint32_t));
+        g_modelIBView.BufferLocation = g_modelIB->GetGPUVirtualAddress();
+        g_modelIBView.Format = DXGI_FORMAT_R32_UINT;
+        g_modelIBView.SizeInBytes = ibSize;
+    }
+
+    char buf[256];
+    sprintf_s(buf, "Model GPU upload OK. Verts: %zu | Indices: %zu | Submeshes: %zu | Instances: %zu | Draws: %zu\n",
+        m.vertexCount, m.indexCount, g_modelSubmeshes.size(), g_modelInstances.size(), g_modelDraws.size());
+    OutputDebugStringA(buf);
+}
+
+// Vista de lo que ya está subido (copias en CPU de las tablas y del IB), para el culling por frame.
+ModelGeometryView ModelRuntimeView()
+{
+    ModelGeometryView v;
+    v.quant = g_modelQuant;
+    v.inds = g_modelIndices.data();           v.indexCount = g_modelIndices.size();
+    v.submeshes = g_modelSubmeshes.data();    v.submeshCount = g_modelSubmeshes.size();
+    v.instances = g_modelInstances.data();    v.instanceCount = g_modelInstances.size();
+    v.meshlets = g_modelMeshlets.data();      v.meshletCount = g_modelMeshlets.size();
+    v.lods = g_modelLods.data();              v.lodCount = g_modelLods.size();
+    return v; // sin vértices: el culling solo usa cotas e índices
+}
+
+// LOD de cada instancia: el más grueso cuyo error geométrico, proyectado con g_proj a la distancia del submesh, no
+// supera g_lodPixelError píxeles. La distancia se mide al borde de la esfera (conservador con la cámara cerca o adentro).
+// Cada ModelDraw usa el LOD más fino de sus instancias, porque comparten un único draw instanciado.
+void SelectModelLods(FXMMATRIX objectWorld, CXMMATRIX proj, const XMFLOAT3& eyeWS)
+{
+    const float pixelsPerUnit = XMVectorGetY(proj.r[1]) * g_renderHeight * 0.5f; // píxeles que ocupa 1 unidad a distancia 1
+    const XMVECTOR eye = XMLoadFloat3(&eyeWS);
+
+    g_instanceLods.resize(g_modelInstances.size());
+    for (size_t i = 0; i < g_modelInstances.size(); ++i)
+    {
+        const ModelSubmesh& sm = g_modelSubmeshes[g_modelInstances[i].submesh];
+        UINT lod = 0;
+        if (g_lodForced >= 0)
+        {
+            lod = (std::min)((UINT)g_lodForced, sm.lodCount - 1);
+        }
+        else
+        {
+            const XMMATRIX world = XMMatrixMultiply(XMMatrixTranspose(XMLoadFloat4x4(&g_modelInstances[i].world)), objectWorld);
+            const float scale = sqrtf((std::max)({ XMVectorGetX(XMVector3LengthSq(world.r[0])),
+                XMVectorGetX(XMVector3LengthSq(world.r[1])), XMVectorGetX(XMVector3LengthSq(world.r[2])) }));
+            const XMFLOAT4& b = g_modelSubmeshBounds[g_modelInstances[i].submesh];
+            const XMVECTOR center = XMVector3TransformCoord(XMVectorSet(b.x, b.y, b.z, 1.0f), world);
+            const float dist = (std::max)(XMVectorGetX(XMVector3Length(XMVectorSubtract(center, eye))) - b.w * scale, 1e-3f);
+
+            for (UINT l = sm.lodCount - 1; l > 0; --l)
+            {
+                if (g_modelLods[sm.firstLod + l].error * scale * pixelsPerUnit / dist <= g_lodPixelError) { lod = l; break; }
+            }
+        }
+        g_instanceLods[i] = lod;
+    }
+
+    g_lodTriangles = 0;
+    g_drawLods.resize(g_modelDraws.size());
+    for (size_t d = 0; d < g_modelDraws.size(); ++d)
+    {
+        const ModelDraw& draw = g_modelDraws[d];
+        UINT lod = UINT32_MAX;
+        for (UINT i = draw.firstInstance; i < draw.firstInstance + draw.instanceCount; ++i) lod = (std::min)(lod, g_instanceLods[i]);
+        g_drawLods[d] = lod;
+        g_lodTriangles += (uint64_t)g_modelLods[g_modelSubmeshes[draw.submesh].firstLod + lod].indexCount / 3 * draw.instanceCount;
+    }
+}
+
+// Carga asincrónica del modelo: el hilo de carga hace todo lo de CPU (mapear, importar o abrir el cache, hornear)
+// y publica el resultado completo con un único store atómico. El hilo de render lo levanta con exchange entre
+// frames, sube la geometría de a un ring por frame (PumpModelUpload) y recién ahí habilita el modo 2. Ningún global
+// del modelo se toca desde el otro hilo.
+struct ModelLoadResult
+{
+    bool ok = false;
+    bool warm = false;
+    double loadMs = 0.0;
+    MappedFile cacheFile; // tiene que vivir mientras 'view' apunte al cache mapeado
+    ModelCPU imported;
+    ModelGeometryView view;
+};
+
+static std::thread g_modelLoader;
+static std::atomic<ModelLoadResult*> g_modelLoadResult{ nullptr };
+static UINT g_framesWhileLoading = 0;
+static bool g_modelReloading = false; // re-import por hot reload: el modelo anterior se sigue dibujando hasta que llega el nuevo
+
+// Carga ya tomada cuyo VB/IB todavía pasa por el ring de staging: un modelo de más de un ring tarda varios frames y el
+// hilo de render no espera a la cola de copia. Se publica cuando la fence del último bloque ya se envió.
+static ModelLoadResult* g_modelUpload = nullptr;
+static bool   g_modelUploadStaged = false; // todo pasó al ring; falta que se envíe el lote con g_modelUploadFence
+static UINT64 g_modelUploadFence = 0;
+static UINT   g_modelUploadFrames = 0;
+static double g_modelUploadMs = 0.0;       // tiempo del hilo de render en Pump + publicar, sumado entre frames
+
+// Benchmarks de CPU pedidos por línea de comandos. Corren en el hilo de carga antes de cargar: tampoco demoran el primer frame.
+struct ModelBenchmarks
+{
+    bool obj = false;       // -benchmark-obj
+    bool meshCache = false; // -benchmark-meshcache
+    bool simplify = false;  // -benchmark-simplify
+};
+
+void StartModelLoad(const std::string& fileName, ModelBenchmarks benchmarks, bool reload = false)
+{
+    if (g_modelLoader.joinable()) g_modelLoader.join(); // la carga anterior ya publicó su resultado (PollModelLoad lo tomó)
+    g_modelReloading = reload;
+    if (!reload) g_modelState = ModelLoading;
+    g_modelLoader = std::thread([fileName, benchmarks]()
+    {
+        if (benchmarks.obj) BenchmarkObjParser(fileName);
+        if (benchmarks.simplify) BenchmarkSimplifier(fileName);
+        if (benchmarks.meshCache) BenchmarkModelCache(fileName); // deja el cache horneado: la carga de abajo ya es caliente
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        ModelLoadResult* r = new ModelLoadResult();
+        try
+        {
+            r->ok = LoadModelCPU(fileName, r->cacheFile, r->imported, r->view, r->warm);
+        }
+        catch (const std::exception& e)
+        {
+            OutputDebugStringA(("Model load failed: " + std::string(e.what()) + "\n").c_str());
+            r->ok = false;
+        }
+        r->loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+        g_modelLoadResult.store(r, std::memory_order_release); // todo lo escrito en *r queda visible para quien lo tome
+    });
+}
+
+// Un paso por frame de la subida del modelo tomado: pasa a lo sumo un ring al lote y, cuando ya se envió la copia del
+// último bloque, lo publica (ModelReady, VB/IB y tablas). Los frames que se dibujen desde ahí tienen en la cola
+// gráfica el Wait a esa fence.
+void PumpModelUpload()
+{
+    auto t0 = std::chrono::high_resolution_clock::now();
+    ModelLoadResult* r = g_modelUpload;
+    ++g_modelUploadFrames;
+    if (!g_modelUploadStaged) g_modelUploadStaged = g_uploads.Pump(StagingRingSize, g_modelUploadFence);
+    const bool publish = g_modelUploadStaged && g_uploads.LastSubmitted() >= g_modelUploadFence;
+    if (publish)
+    {
+        if (g_modelReloading) // los frames en vuelo todavía leen el VB/IB anterior: se sueltan cuando la GPU los termina
+        {
+            const UINT64 fence = LastSubmittedFence();
+            g_retired.Retire(g_modelVB, fence);
+            g_retired.Retire(g_modelIB, fence);
+        }
+        PublishModelGeometry(r->view);
+        g_modelState = ModelReady;
+    }
+    g_modelUploadMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+    if (!publish) return;
+
+    char buf[256];
+    sprintf_s(buf, "Model %s (%s): %.2f ms on the loader thread + %.2f ms upload over %u frames | %u frames drawn while loading\n",
+        g_modelReloading ? "hot reload" : "load", r->warm ? "warm, mesh cache" : "cold, import + bake", r->loadMs,
+        g_modelUploadMs, g_modelUploadFrames, g_framesWhileLoading);
+    OutputDebugStringA(buf);
+
+    delete r; // cierra el mapeo del cache; la geometría ya pasó entera por el ring de staging
+    g_modelUpload = nullptr;
+    g_modelReloading = false;
+    UpdateWindowTitle();
+}
+
+// Se llama una vez por frame desde el loop, antes de UpdateCB. Barato mientras no haya nada publicado.
+void PollModelLoad()
+{
+    if (g_modelState != ModelLoading && !g_modelReloading) return;
+    if (g_modelUpload)
+    {
+        if (!g_modelReloading) ++g_framesWhileLoading;
+        PumpModelUpload();
+        return;
+    }
+
+    ModelLoadResult* r = g_modelLoadResult.exchange(nullptr, std::memory_order_acquire);
+    if (!r)
+    {
+        if (!g_modelReloading) ++g_framesWhileLoading;
+        return;
+    }
+
+    if (r->ok) // buffers nuevos: ningún frame en vuelo los referencia todavía
+    {
+        BeginModelUpload(r->view);
+        g_modelUpload = r;
+        g_modelUploadStaged = false;
+        g_modelUploadFrames = 0;
+        g_modelUploadMs = 0.0;
+        PumpModelUpload();
+        return;
+    }
 
-    g_hWnd = CreateWindow(wc.lpszClassName, L"DX12 Rotating Cube PBR (Press T to switch modes)",
-        WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT,
-        rc.right - rc.left, rc.bottom - rc.top,
-        nullptr, nullptr, hInst, nullptr);
-    ShowWindow(g_hWnd, SW_SHOW);
+    char buf[256];
+    if (g_modelReloading)
+    {
+        sprintf_s(buf, "Model hot reload failed after %.2f ms, keeping the previous model\n", r->loadMs);
+    }
+    else
+    {
+        g_modelState = ModelFailed;
+        sprintf_s(buf, "Model load failed after %.2f ms, keeping the placeholder cube\n", r->loadMs);
+    }
+    OutputDebugStringA(buf);
+
+    delete r;
+    g_modelReloading = false;
+    UpdateWindowTitle();
+}
+
+// Al salir: si la carga sigue en curso hay que esperarla (el hilo no se puede abandonar con los globals destruyéndose).
+void StopModelLoad()
+{
+    if (g_modelLoader.joinable()) g_modelLoader.join();
+    delete g_modelLoadResult.exchange(nullptr, std::memory_order_acquire);
+    g_uploads.DropQueued(); // solo el modelo encola: lo que falte pasar al ring apunta a g_modelUpload
+    delete g_modelUpload;
+    g_modelUpload = nullptr;
+}
+
+// Escalado del job system (-benchmark-jobs, sin ventana ni GPU): el mismo trabajo con 1, 2, 4... N hilos. Icosfera de
+// ~1M triángulos (BuildSphere), ExtractMeshCPU sobre esa esfera pasada a aiMesh, transforms de 1M instancias como
+// los de UpdateCB y 200k jobs vacíos (costo del scheduler). Tiempo = mejor de 'runs'. Devuelve el exit code del proceso.
+int RunJobScalingBenchmark(int runs = 3)
+{
+    std::vector<Vertex> sphereVerts;
+    std::vector<uint32_t> sphereInds;
+    BuildSphere(SphereIco, 0.5f, 229, sphereVerts, sphereInds);
+
+    aiMesh mesh; // libera sus arrays al destruirse
+    mesh.mNumVertices = (unsigned int)sphereVerts.size();
+    mesh.mVertices = new aiVector3D[mesh.mNumVertices];
+    mesh.mNormals = new aiVector3D[mesh.mNumVertices];
+    for (unsigned int v = 0; v < mesh.mNumVertices; ++v)
+    {
+        mesh.mVertices[v] = aiVector3D(sphereVerts[v].pos.x, sphereVerts[v].pos.y, sphereVerts[v].pos.z);
+        mesh.mNormals[v] = aiVector3D(sphereVerts[v].normal.x, sphereVerts[v].normal.y, sphereVerts[v].normal.z);
+    }
+    mesh.mNumFaces = (unsigned int)(sphereInds.size() / 3);
+    mesh.mFaces = new aiFace[mesh.mNumFaces];
+    for (unsigned int f = 0; f < mesh.mNumFaces; ++f)
+    {
+        mesh.mFaces[f].mNumIndices = 3;
+        mesh.mFaces[f].mIndices = new unsigned int[3]{ sphereInds[f * 3], sphereInds[f * 3 + 1], sphereInds[f * 3 + 2] };
+    }
+
+    const UINT instanceCount = 1u << 20, tinyJobs = 200000;
+    std::vector<InstanceData> instances(instanceCount);
+    auto updateTransforms = [&instances](float t)
+    {
+        ParallelFor((UINT)instances.size(), 4096, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; ++i)
+            {
+                const XMMATRIX m = XMMatrixRotationY(t + i * 0.001f) * XMMatrixTranslation((float)(i & 1023), 0.0f, (float)(i >> 10));
+                SetInstanceTransform(instances[i], m);
+                instances[i].metallic = (i & 7) / 7.0f;
+            }
+        });
+    };
+
+    char buf[320];
+    const UINT maxThreads = (std::max)(1u, std::thread::hardware_concurrency());
+    double base[4] = {};
+    std::vector<Vertex> verts;
+    std::vector<uint32_t> inds;
+    for (UINT threads = 1; ; threads = (std::min)(threads * 2, maxThreads))
+    {
+        JobSystem jobs(threads);
+        g_jobSystemOverride = &jobs; // ParallelFor del código portado usa este sistema mientras dure la medición
+
+        double best[4] = { DBL_MAX, DBL_MAX, DBL_MAX, DBL_MAX };
+        for (int r = 0; r < runs; ++r)
+        {
+            auto t0 = std::chrono::high_resolution_clock::now();
+            BuildSphere(SphereIco, 0.5f, 229, verts, inds);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            ExtractMeshCPU(&mesh, verts, inds);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            updateTransforms((float)r);
+            auto t3 = std::chrono::high_resolution_clock::now();
+            JobCounter done;
+            for (UINT i = 0; i < tinyJobs; ++i) jobs.Run([]() {}, &done);
+            jobs.Wait(done);
+            auto t4 = std::chrono::high_resolution_clock::now();
+
+            const double ms[4] = { std::chrono::duration<double, std::milli>(t1 - t0).count(), std::chrono::duration<double, std::milli>(t2 - t1).count(),
+                std::chrono::duration<double, std::milli>(t3 - t2).count(), std::chrono::duration<double, std::milli>(t4 - t3).count() };
+            for (int k = 0; k < 4; ++k) best[k] = (std::min)(best[k], ms[k]);
+        }
+        g_jobSystemOverride = nullptr;
+        if (threads == 1) std::copy(best, best + 4, base);
+
+        sprintf_s(buf, "Job scaling: %3u threads | sphere %7.2f ms x%.2f | extract %7.2f ms x%.2f | transforms %7.2f ms x%.2f | "
+            "empty jobs %.2f M/s | stolen %llu\n",
+            threads, best[0], base[0] / best[0], best[1], base[1] / best[1], best[2], base[2] / best[2],
+            tinyJobs / best[3] / 1000.0, (unsigned long long)jobs.Steals());
+        OutputDebugStringA(buf);
+
+        if (threads == maxThreads) break;
+    }
+
+    const bool same = verts.size() == sphereVerts.size() && inds == sphereInds;
+    OutputDebugStringA(same ? "Job scaling: ExtractMeshCPU output matches the source mesh\n" : "Job scaling: ExtractMeshCPU output MISMATCH\n");
+    return same ? 0 : 1;
 }
 
 //--------------------------------------------------------------------------------------
-// Init DX12 core
+// Hot reload (PBR.hlsl y modelo): file watcher + debounce + rebuild en segundo plano
 //--------------------------------------------------------------------------------------
-void CreateFactoryAndDevice()
+
+static const double HotReloadQuietMs = 150.0; // un archivo se procesa recién cuando deja de cambiar por este tiempo
+static const DWORD  HotReloadPollMs = 50;     // cada cuánto mira el hilo del watcher (y el intervalo del watcher por polling)
+
+// Interfaz mínima de un watcher de directorio. El hot reload solo habla con esto, así que la lógica se ejercita igual
+// con ReadDirectoryChangesW o con el watcher por polling (fallback y tests).
+struct IFileWatcher
 {
-    // Debug layer stuff, no funciona. Ver.
-#if _DEBUG
+    virtual ~IFileWatcher() = default;
+    // Agrega a 'changed' los nombres (relativos al directorio) creados o modificados; espera como mucho timeoutMs.
+    virtual void WaitForChanges(std::vector<std::string>& changed, DWORD timeoutMs) = 0;
+};
+
+// Implementación real: ReadDirectoryChangesW asincrónico (OVERLAPPED + evento), siempre con un pedido pendiente para
+// no perder eventos entre llamadas.
+class Win32DirectoryWatcher : public IFileWatcher
+{
+public:
+    ~Win32DirectoryWatcher() override { Close(); }
+
+    bool Open(const std::string& dir)
     {
-        ComPtr<ID3D12Debug> dbg;
-        if (SUCCEEDED(D3D12GetDebugInterface(IID_PPV_ARGS(&dbg))))
-            dbg->EnableDebugLayer();
+        m_dir = CreateFileA(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (m_dir == INVALID_HANDLE_VALUE) return false;
+        m_overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (!m_overlapped.hEvent || !Issue()) { Close(); return false; }
+        return true;
     }
-#endif
 
-    UINT flags = 0;
-#if _DEBUG
-    flags |= DXGI_CREATE_FACTORY_DEBUG;
-#endif
+    void WaitForChanges(std::vector<std::string>& changed, DWORD timeoutMs) override
+    {
+        if (WaitForSingleObject(m_overlapped.hEvent, timeoutMs) != WAIT_OBJECT_0) return;
 
-    // Crear DXGI factory para enumerar adaptadores.
-    ThrowIfFailed(CreateDXGIFactory2(flags, IID_PPV_ARGS(&g_factory)));
+        DWORD bytes = 0;
+        if (GetOverlappedResult(m_dir, &m_overlapped, &bytes, FALSE) && bytes > 0)
+        {
+            for (DWORD offset = 0;;)
+            {
+                const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(reinterpret_cast<const uint8_t*>(m_buffer) + offset);
+                // Borrados y el nombre viejo de un rename no se recargan; los editores que guardan con rename avisan con el nuevo
+                if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+                {
+                    char name[MAX_PATH * 3];
+                    const int n = WideCharToMultiByte(CP_UTF8, 0, info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)), name, sizeof(name), nullptr, nullptr);
+                    if (n > 0) changed.emplace_back(name, (size_t)n);
+                }
+                if (!info->NextEntryOffset) break;
+                offset += info->NextEntryOffset;
+            }
+        }
+        ResetEvent(m_overlapped.hEvent);
+        Issue(); // bytes == 0: se desbordó el buffer y se perdieron eventos; se sigue con el próximo lote
+    }
 
-    // Obtener Device (descarta adaptadores lógicos, solo hardware). Toma el primero.
-    ComPtr<IDXGIAdapter1> adapter;
-    for (UINT i = 0; g_factory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND; ++i)
+private:
+    bool Issue()
     {
-        DXGI_ADAPTER_DESC1 desc;
-        adapter->GetDesc1(&desc);
-        if (desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) continue;
-        if (SUCCEEDED(D3D12CreateDevice(adapter.Get(), D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&g_device))))
-            break;
+        return ReadDirectoryChangesW(m_dir, m_buffer, sizeof(m_buffer), FALSE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE, nullptr, &m_overlapped, nullptr) != FALSE;
     }
 
-    if (!g_device) {
-        // WARP fallback (si no encuentro device uso WARP (rasterizador por software acelerado por CPU)
-        ComPtr<IDXGIAdapter> warp;
-        ThrowIfFailed(g_factory->EnumWarpAdapter(IID_PPV_ARGS(&warp)));
-        ThrowIfFailed(D3D12CreateDevice(warp.Get(), D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&g_device)));
+    void Close()
+    {
+        if (m_dir != INVALID_HANDLE_VALUE)
+        {
+            DWORD bytes = 0;
+            CancelIoEx(m_dir, &m_overlapped);
+            GetOverlappedResult(m_dir, &m_overlapped, &bytes, TRUE); // el kernel deja de escribir en m_buffer
+            CloseHandle(m_dir);
+        }
+        if (m_overlapped.hEvent) CloseHandle(m_overlapped.hEvent);
+        m_dir = INVALID_HANDLE_VALUE;
+        m_overlapped = OVERLAPPED();
     }
 
-    // Command queue. Crear la cola de comandos principal
-    // Recibe command lists ya grabadas y las manda a la GPU en orden.
+    HANDLE     m_dir = INVALID_HANDLE_VALUE;
+    OVERLAPPED m_overlapped = {};
+    DWORD      m_buffer[16 * 1024]; // alineado a DWORD, como pide ReadDirectoryChangesW
+};
 
-    D3D12_COMMAND_QUEUE_DESC qd = {};
-    qd.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
-    qd.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
-    ThrowIfFailed(g_device->CreateCommandQueue(&qd, IID_PPV_ARGS(&g_cmdQueue)));
+// Fallback portable: lista el directorio cada timeoutMs y compara tamaño y fecha de escritura de cada archivo.
+class PollingDirectoryWatcher : public IFileWatcher
+{
+public:
+    bool Open(const std::string& dir)
+    {
+        m_dir = dir;
+        Scan(m_files);
+        return true;
+    }
+
+    void WaitForChanges(std::vector<std::string>& changed, DWORD timeoutMs) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+        std::vector<FileStamp> now;
+        Scan(now);
+        for (const FileStamp& f : now)
+        {
+            auto old = std::find_if(m_files.begin(), m_files.end(), [&f](const FileStamp& o) { return o.name == f.name; });
+            if (old == m_files.end() || old->size != f.size || old->writeTime != f.writeTime) changed.push_back(f.name);
+        }
+        m_files.swap(now);
+    }
+
+private:
+    struct FileStamp { std::string name; uint64_t size; uint64_t writeTime; };
+
+    void Scan(std::vector<FileStamp>& out) const
+    {
+        out.clear();
+        WIN32_FIND_DATAA fd;
+        HANDLE h = FindFirstFileA((m_dir + "/*").c_str(), &fd);
+        if (h == INVALID_HANDLE_VALUE) return;
+        do
+        {
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            out.push_back({ fd.cFileName, ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow,
+                ((uint64_t)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime });
+        } while (FindNextFileA(h, &fd));
+        FindClose(h);
+    }
+
+    std::string            m_dir;
+    std::vector<FileStamp> m_files;
+};
+
+// ReadDirectoryChangesW si el directorio lo permite (no anda en algunos shares de red), si no polling.
+std::unique_ptr<IFileWatcher> CreateFileWatcher(const std::string& dir, bool forcePolling = false)
+{
+    if (!forcePolling)
+    {
+        std::unique_ptr<Win32DirectoryWatcher> w(new Win32DirectoryWatcher());
+        if (w->Open(dir)) return std::move(w);
+    }
+    std::unique_ptr<PollingDirectoryWatcher> p(new PollingDirectoryWatcher());
+    p->Open(dir);
+    return std::move(p);
 }
 
-void CreateSwapchainAndRTVs()
+// Los editores guardan en varios pasos (truncar, escribir, renombrar) y cada uno genera eventos. Un archivo queda
+// listo cuando pasa quietMs sin eventos nuevos; el reloj lo pasa quien llama, así que se prueba sin esperar.
+class ChangeDebouncer
 {
-    // Creació de Swap chain (backbuffers) donde dibujar cada frame
-    ComPtr<IDXGISwapChain1> sc1;
-    DXGI_SWAP_CHAIN_DESC1 sd = {};
-    sd.BufferCount = FrameCount;
-    sd.Width = Width;
-    sd.Height = Height;
-    sd.Format = ChooseBackbufferFormat();
-    sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-    sd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-    sd.SampleDesc.Count = 1;
+public:
+    explicit ChangeDebouncer(double quietMs) : m_quietMs(quietMs) {}
 
-    ThrowIfFailed(g_factory->CreateSwapChainForHwnd(
-        g_cmdQueue.Get(), g_hWnd, &sd, nullptr, nullptr, &sc1));
+    void Add(const std::string& path, double nowMs)
+    {
+        for (auto& p : m_pending)
+            if (p.first == path) { p.second = nowMs; return; }
+        m_pending.push_back({ path, nowMs });
+    }
 
-    ThrowIfFailed(sc1.As(&g_swapChain));
-    g_frameIndex = g_swapChain->GetCurrentBackBufferIndex();
+    // Pasa a 'ready' (sin repetir) los archivos que no cambiaron en los últimos quietMs.
+    void TakeReady(double nowMs, std::vector<std::string>& ready)
+    {
+        for (size_t i = 0; i < m_pending.size();)
+        {
+            if (nowMs - m_pending[i].second >= m_quietMs)
+            {
+                ready.push_back(m_pending[i].first);
+                m_pending.erase(m_pending.begin() + i);
+            }
+            else ++i;
+        }
+    }
 
-    
-    // RTV heap Render Target View     
-    // Crear el descriptor heap RTV con FrameCount cantidad de descriptores.
-    D3D12_DESCRIPTOR_HEAP_DESC rtvDesc = {};
-    rtvDesc.NumDescriptors = FrameCount;
-    rtvDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
-    rtvDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
-    ThrowIfFailed(g_device->CreateDescriptorHeap(&rtvDesc, IID_PPV_ARGS(&g_rtvHeap)));
-    g_rtvDescriptorSize = g_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV); //Guardo el stride
+    bool Empty() const { return m_pending.empty(); }
 
-    //CD3DX12_CPU_DESCRIPTOR_HANDLE; // dummy to remind - not available; manual handle math below
+private:
+    double m_quietMs;
+    std::vector<std::pair<std::string, double>> m_pending; // path, último evento
+};
 
-    // Crea cada RTV.
-    // Tambien crear un command allocator por frame buffer (Tener uno por frame permite grabar/ejecutar mientras otro está aún en uso por la GPU.)
-    D3D12_CPU_DESCRIPTOR_HANDLE rtvHandle = g_rtvHeap->GetCPUDescriptorHandleForHeapStart();
-    for (UINT i = 0; i < FrameCount; ++i)
+inline std::string ToLowerAscii(std::string s)
+{
+    for (char& c : s) if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    return s;
+}
+
+// Servicio de hot reload: un hilo vigila el directorio de los shaders y el del modelo, filtra lo que importa
+// (.hlsl/.hlsli; el modelo y su .mtl), aplica el debounce y solo levanta flags. El hilo de render los consume entre
+// frames y lanza el trabajo pesado en segundo plano (PollHotReload): ni el watcher ni el rebuild bloquean un frame.
+// Los archivos que escribe la propia app (.shadercache, .psolib, .meshcache y sus .tmp) no coinciden con el filtro.
+class HotReloader
+{
+public:
+    ~HotReloader() { Stop(); }
+
+    void Start(const std::string& shaderDir, const std::string& modelPath, bool forcePolling = false)
     {
-        ThrowIfFailed(g_swapChain->GetBuffer(i, IID_PPV_ARGS(&g_renderTargets[i])));
-        g_device->CreateRenderTargetView(g_renderTargets[i].Get(), nullptr, rtvHandle);
-        rtvHandle.ptr += g_rtvDescriptorSize;
-        ThrowIfFailed(g_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&g_cmdAlloc[i])));
+        Stop();
+        const size_t slash = modelPath.find_last_of("/\\");
+        m_modelDir = (slash == std::string::npos) ? "." : modelPath.substr(0, slash);
+        m_modelName = ToLowerAscii(slash == std::string::npos ? modelPath : modelPath.substr(slash + 1));
+        const size_t dot = m_modelName.find_last_of('.');
+        m_materialName = m_modelName.substr(0, dot) + ".mtl";
+        m_shaderDir = shaderDir;
+
+        m_watches.clear();
+        m_watches.push_back({ shaderDir, CreateFileWatcher(shaderDir, forcePolling) });
+        if (m_modelDir != shaderDir) m_watches.push_back({ m_modelDir, CreateFileWatcher(m_modelDir, forcePolling) });
+
+        m_stop = false;
+        m_thread = std::thread([this]() { Run(); });
+    }
+
+    void Stop()
+    {
+        m_stop = true;
+        if (m_thread.joinable()) m_thread.join();
+        m_watches.clear();
+    }
+
+    bool TakeShaderChange() { return m_shaderChanged.exchange(false); }
+    bool TakeModelChange() { return m_modelChanged.exchange(false); }
+    uint64_t RawEvents() const { return m_rawEvents; } // eventos de archivos relevantes antes del debounce
+
+private:
+    struct DirWatch { std::string dir; std::unique_ptr<IFileWatcher> watcher; };
+    enum Kind { KindIgnored, KindShader, KindModel };
+
+    Kind Classify(const std::string& dir, const std::string& fileName) const
+    {
+        const std::string name = ToLowerAscii(fileName);
+        const size_t dot = name.find_last_of('.');
+        const std::string ext = (dot == std::string::npos) ? "" : name.substr(dot);
+        if (dir == m_shaderDir && (ext == ".hlsl" || ext == ".hlsli")) return KindShader;
+        if (dir == m_modelDir && (name == m_modelName || name == m_materialName)) return KindModel;
+        return KindIgnored;
+    }
+
+    void Run()
+    {
+        ChangeDebouncer debouncer(HotReloadQuietMs);
+        std::vector<std::string> changed, ready;
+        const auto t0 = std::chrono::steady_clock::now();
+        while (!m_stop)
+        {
+            for (DirWatch& w : m_watches)
+            {
+                changed.clear();
+                w.watcher->WaitForChanges(changed, HotReloadPollMs / (DWORD)m_watches.size());
+                const double now = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                for (const std::string& name : changed)
+                {
+                    const Kind kind = Classify(w.dir, name);
+                    if (kind == KindIgnored) continue;
+                    ++m_rawEvents;
+                    debouncer.Add((kind == KindShader ? "s:" : "m:") + name, now);
+                }
+            }
+
+            ready.clear();
+            debouncer.TakeReady(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count(), ready);
+            for (const std::string& r : ready)
+            {
+                OutputDebugStringA(("Hot reload: " + r.substr(2) + " changed\n").c_str());
+                (r[0] == 's' ? m_shaderChanged : m_modelChanged) = true;
+            }
+        }
+    }
+
+    std::string m_shaderDir, m_modelDir, m_modelName, m_materialName; // nombres en minúsculas (NTFS no distingue)
+    std::vector<DirWatch> m_watches;
+    std::thread m_thread;
+    std::atomic<bool> m_stop{ false };
+    std::atomic<bool> m_shaderChanged{ false };
+    std::atomic<bool> m_modelChanged{ false };
+    std::atomic<uint64_t> m_rawEvents{ 0 };
+};
+
+// Rebuild de shaders en segundo plano: compila el VS y el PS de cada permutación ya construida (en paralelo, sin pasar
+// por g_shaderCache, que es del hilo de render) y crea sus PSOs (el device es free-threaded). Se publica todo junto con
+// un único store atómico, como la carga del modelo; si algo no compila no se publica nada y sigue lo de antes.
+struct ShaderRebuildResult
+{
+    std::vector<uint8_t> vs;
+    std::vector<uint64_t> keys;
+    std::vector<ComPtr<ID3D12PipelineState>> pipelines; // uno por clave
+    double ms = 0.0;
+};
+
+static std::thread g_shaderRebuilder;
+static std::atomic<ShaderRebuildResult*> g_shaderRebuildResult{ nullptr };
+static bool g_shaderRebuilding = false;
+HotReloader g_hotReload;
+std::string g_hotReloadModelPath;
+
+void StartShaderRebuild(std::vector<uint64_t> keys)
+{
+    if (g_shaderRebuilder.joinable()) g_shaderRebuilder.join(); // ya publicó (o falló): termina enseguida
+    g_shaderRebuilding = true;
+    g_shaderRebuilder = std::thread([keys]()
+    {
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        std::vector<ShaderCompileDesc> descs = { PBRShaderDesc("VSMain", "vs_5_0") };
+        for (uint64_t k : keys) descs.push_back(PBRShaderDesc("PSMain", "ps_5_0", ShaderDefines(PipelineKey::Unpack(k))));
+
+        std::vector<std::vector<uint8_t>> bytecode(descs.size());
+        std::vector<std::string> errors(descs.size());
+        std::vector<char> compiled(descs.size(), 0);
+        ParallelFor((UINT)descs.size(), 1, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; ++i) compiled[i] = g_d3dShaderCompiler.Compile(descs[i], bytecode[i], errors[i]);
+        });
+
+        ShaderRebuildResult* r = new ShaderRebuildResult();
+        bool ok = true;
+        for (size_t i = 0; i < descs.size(); ++i)
+        {
+            if (!errors[i].empty()) OutputDebugStringA(errors[i].c_str());
+            ok = ok && compiled[i];
+        }
+        for (size_t i = 0; ok && i < keys.size(); ++i)
+        {
+            const D3D12_GRAPHICS_PIPELINE_STATE_DESC desc = DescribePipeline(PipelineKey::Unpack(keys[i]), bytecode[0], bytecode[i + 1]);
+            ComPtr<ID3D12PipelineState> pso;
+            ok = SUCCEEDED(g_device->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pso)));
+            r->pipelines.push_back(pso);
+        }
+        r->ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        if (ok)
+        {
+            r->vs = std::move(bytecode[0]);
+            r->keys = keys;
+        }
+        else
+        {
+            OutputDebugStringA("Hot reload: PBR.hlsl has errors, keeping the current pipelines\n");
+            r->pipelines.clear(); // resultado vacío: avisa que terminó sin cambiar nada
+        }
+        g_shaderRebuildResult.store(r, std::memory_order_release);
+    });
+}
+
+// Una vez por frame, después de PollModelLoad: aplica lo que terminó y lanza lo que el watcher pidió. No espera nada.
+void PollHotReload()
+{
+    if (ShaderRebuildResult* r = g_shaderRebuildResult.exchange(nullptr, std::memory_order_acquire))
+    {
+        g_shaderRebuilding = false;
+        if (!r->keys.empty())
+        {
+            // Los frames ya grabados siguen usando los PSOs viejos: se sueltan cuando la GPU pasa la última fence enviada
+            const UINT64 fence = LastSubmittedFence();
+            g_vsBytecode.swap(r->vs);
+            for (size_t i = 0; i < r->keys.size(); ++i) g_retired.Retire(g_pipelines.Replace(r->keys[i], r->pipelines[i]), fence);
+            for (uint64_t k : g_pipelines.Keys()) // permutaciones creadas durante el rebuild: se reconstruyen al usarlas
+                if (std::find(r->keys.begin(), r->keys.end(), k) == r->keys.end()) g_retired.Retire(g_pipelines.Erase(k), fence);
+
+            char buf[128];
+            sprintf_s(buf, "Hot reload: %zu PSOs rebuilt in %.2f ms on a background thread\n", r->keys.size(), r->ms);
+            OutputDebugStringA(buf);
+        }
+        delete r;
     }
+
+    // Un cambio que llega durante un rebuild o una carga queda pendiente hasta que termine
+    if (!g_shaderRebuilding && g_hotReload.TakeShaderChange()) StartShaderRebuild(g_pipelines.Keys());
+    if (g_modelState != ModelLoading && !g_modelReloading && g_hotReload.TakeModelChange())
+        StartModelLoad(g_hotReloadModelPath, ModelBenchmarks(), true);
+
+    g_retired.Collect(g_gfxQueueFence.GetCompletedValue());
 }
 
-void CreateDepthBuffer()
+// Al salir: los hilos de rebuild y del watcher no se pueden abandonar con los globals destruyéndose.
+void StopHotReload()
 {
-    // Crea un descriptor heap de DSV con 1 descriptor
-    D3D12_DESCRIPTOR_HEAP_DESC dsvDesc = {};
-    dsvDesc.NumDescriptors = 1;
-    dsvDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
-    dsvDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
-    ThrowIfFailed(g_device->CreateDescriptorHeap(&dsvDesc, IID_PPV_ARGS(&g_dsvHeap)));
-    g_dsvDescriptorSize = g_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV); //Guardo stride por si necesito más después.
+    g_hotReload.Stop();
+    if (g_shaderRebuilder.joinable()) g_shaderRebuilder.join();
+    delete g_shaderRebuildResult.exchange(nullptr, std::memory_order_acquire);
+}
 
-    // Depth texture. Describo una textura 2D para depth
-    D3D12_RESOURCE_DESC tex = {};
-    tex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-    tex.Alignment = 0;
-    tex.Width = Width;
-    tex.Height = Height;
-    tex.DepthOrArraySize = 1;
-    tex.MipLevels = 1;
-    tex.Format = ChooseDepthFormat();
-    tex.SampleDesc = { 1, 0 };
-    tex.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
-    tex.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+// Chequeo del watcher y del debounce sin ventana ni GPU (-hot-reload-selftest), en un directorio temporal: el
+// debounce con un reloj falso; los dos watchers (el de la plataforma y el de polling) ven archivos nuevos y
+// modificados y no reportan los que no se tocaron; y el HotReloader levanta el flag correcto por tipo de archivo,
+// uno solo para varias escrituras seguidas, e ignora los caches que escribe la app. Devuelve el exit code del proceso.
+int RunHotReloadSelfTest()
+{
+    bool ok = true;
+    char buf[256];
+    auto report = [&](const char* step, bool pass)
+    {
+        sprintf_s(buf, "Hot reload [%s]: %s\n", step, pass ? "OK" : "FAIL");
+        OutputDebugStringA(buf);
+        ok = ok && pass;
+    };
 
-    //Determino Clear value por defecto
-    D3D12_CLEAR_VALUE clear = {};
-    clear.Format = ChooseDepthFormat();
-    clear.DepthStencil.Depth = 1.0f;
-    clear.DepthStencil.Stencil = 0;
-
-    //Crea la textura de depth en DEFAULT memory (rápida para GPU).
-    D3D12_HEAP_PROPERTIES hp = {};
-    hp.Type = D3D12_HEAP_TYPE_DEFAULT;
-    ThrowIfFailed(g_device->CreateCommittedResource(
-        &hp, D3D12_HEAP_FLAG_NONE, &tex,
-        D3D12_RESOURCE_STATE_DEPTH_WRITE, &clear,
-        IID_PPV_ARGS(&g_depthTex)));
-
-    // Crea un descriptor para Depth Stencil View (RTV)
-    D3D12_DEPTH_STENCIL_VIEW_DESC dsv = {};
-    dsv.Format = ChooseDepthFormat();
-    dsv.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
-    dsv.Flags = D3D12_DSV_FLAG_NONE;
-    g_device->CreateDepthStencilView(g_depthTex.Get(), &dsv, g_dsvHeap->GetCPUDescriptorHandleForHeapStart());
+    // 1) Debounce con reloj falso: ráfaga de a.hlsl en 0/30/60 ms, b.hlsl en 50 ms, quiet 100 ms
+    {
+        ChangeDebouncer d(100.0);
+        std::vector<std::string> ready;
+        d.Add("a.hlsl", 0); d.Add("a.hlsl", 30); d.Add("b.hlsl", 50); d.Add("a.hlsl", 60);
+        d.TakeReady(140, ready);
+        const bool none = ready.empty();
+        d.TakeReady(150, ready);
+        const bool onlyB = ready.size() == 1 && ready[0] == "b.hlsl";
+        ready.clear();
+        d.TakeReady(160, ready);
+        const bool thenA = ready.size() == 1 && ready[0] == "a.hlsl" && d.Empty();
+        report("debounce", none && onlyB && thenA);
+    }
+
+    char tmp[MAX_PATH] = "";
+    GetTempPathA(MAX_PATH, tmp);
+    const std::string dir = std::string(tmp) + "dx12pbr_hotreload_" + std::to_string(GetCurrentProcessId());
+    CreateDirectoryA(dir.c_str(), nullptr);
+    auto write = [&dir](const char* name, const char* text)
+    {
+        FILE* f = nullptr;
+        if (fopen_s(&f, (dir + "/" + name).c_str(), "wb") != 0 || !f) return false;
+        fputs(text, f);
+        fclose(f);
+        return true;
+    };
+    // Espera hasta 2 s a que el watcher reporte 'name'; devuelve todo lo que reportó
+    auto waitFor = [](IFileWatcher& w, const char* name, std::vector<std::string>& seen)
+    {
+        for (int i = 0; i < 40; ++i)
+        {
+            w.WaitForChanges(seen, 50);
+            if (std::find(seen.begin(), seen.end(), name) != seen.end()) return true;
+        }
+        return false;
+    };
+
+    // 2) Los dos watchers: archivo nuevo, archivo modificado, archivo sin tocar
+    write("untouched.hlsl", "// nada\n");
+    write("edited.hlsl", "// v1\n");
+    for (int polling = 0; polling < 2; ++polling)
+    {
+        std::unique_ptr<IFileWatcher> w = CreateFileWatcher(dir, polling != 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // fecha de escritura distinta a la del scan inicial
+        std::vector<std::string> seen;
+        write(polling ? "new_p.hlsl" : "new_w.hlsl", "// nuevo\n");
+        const bool created = waitFor(*w, polling ? "new_p.hlsl" : "new_w.hlsl", seen);
+        write("edited.hlsl", polling ? "// v3, más largo\n" : "// v2, largo\n");
+        const bool edited = waitFor(*w, "edited.hlsl", seen);
+        const bool quiet = std::find(seen.begin(), seen.end(), "untouched.hlsl") == seen.end();
+        report(polling ? "polling watcher" : "platform watcher", created && edited && quiet);
+    }
+
+    // 3) HotReloader: varias escrituras seguidas = un flag; shader vs modelo; los caches de la app no cuentan
+    {
+        HotReloader reloader;
+        reloader.Start(dir, dir + "/Ship.obj");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        write("cache.shadercache", "x"); write("Ship.obj.meshcache", "x"); write("pipelines.psolib", "x");
+        for (int i = 0; i < 3; ++i) { write("edited.hlsl", i == 1 ? "// ráfaga, más larga\n" : "// ráfaga\n"); std::this_thread::sleep_for(std::chrono::milliseconds(20)); }
+        bool shader = false;
+        for (int i = 0; i < 40 && !shader; ++i) { std::this_thread::sleep_for(std::chrono::milliseconds(50)); shader = reloader.TakeShaderChange(); }
+        std::this_thread::sleep_for(std::chrono::milliseconds(400)); // si el debounce fallara, acá llegaría un segundo flag
+        const bool once = !reloader.TakeShaderChange();
+        const bool noModel = !reloader.TakeModelChange();
+
+        write("Ship.mtl", "newmtl a\n");
+        bool model = false;
+        for (int i = 0; i < 40 && !model; ++i) { std::this_thread::sleep_for(std::chrono::milliseconds(50)); model = reloader.TakeModelChange(); }
+        const bool noShader = !reloader.TakeShaderChange();
+        reloader.Stop();
+        sprintf_s(buf, "Hot reload [reloader]: %llu relevant raw events\n", (unsigned long long)reloader.RawEvents());
+        OutputDebugStringA(buf);
+        report("reloader", shader && once && noModel && model && noShader);
+    }
+
+    for (const char* name : { "untouched.hlsl", "edited.hlsl", "new_w.hlsl", "new_p.hlsl", "cache.shadercache", "Ship.obj.meshcache", "pipelines.psolib", "Ship.mtl" })
+        DeleteFileA((dir + "/" + name).c_str());
+    RemoveDirectoryA(dir.c_str());
+    return ok ? 0 : 1;
 }
 
-void CreateCmdListAndFence()
+//--------------------------------------------------------------------------------------
+// Init de matrices de cámara
+//--------------------------------------------------------------------------------------
+void InitCamera()
 {
-    // Crea la command list principal(g_cmdList) usando el command allocator del frame actual.
+    // Configura view / projection y guarda la posición de la cámara.
 
-    ThrowIfFailed(g_device->CreateCommandList(
-        0, D3D12_COMMAND_LIST_TYPE_DIRECT, g_cmdAlloc[g_frameIndex].Get(), nullptr, IID_PPV_ARGS(&g_cmdList)));
-    ThrowIfFailed(g_cmdList->Close()); // Arrancamos cerrada. Se cierra inmediatamente, porque el primer uso real la va a volver a abrir con Reset.
+    XMVECTOR eye = XMVectorSet(1.5f, 1.2f, -2.0f, 0.0f);
+    XMVECTOR at = XMVectorSet(0, 0, 0, 0);
+    XMVECTOR up = XMVectorSet(0, 1, 0, 0);
+
+    g_view = XMMatrixLookAtLH(eye, at, up);
+    g_proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(60.f), float(g_renderWidth) / float(g_renderHeight), 0.1f, 100.0f);
 
-    // Crear fence usado para sincronización CPU/GPU en Present() y WaitForGPU().
-    ThrowIfFailed(g_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&g_fence))); 
-    g_fenceValue = 0;
-    g_fenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr); //evento de Win32 asociado a la fence
+    XMStoreFloat3(&g_eyeWS, eye); // para PBR, vector V en shader.
 }
 
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
-// Fin: Plataforma y DX12 core
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
+// Estadísticas de culling reproducibles sin ventana ni device (-meshlet-stats): carga el modelo por el mismo camino
+// que la app (cache u import), lo pone en la pose de UpdateCB con la rotación en cero y recorre una órbita fija de
+// cámaras alrededor del eye de InitCamera. Misma entrada → mismos números. Devuelve el exit code del proceso.
+int RunHeadlessMeshletStats(const std::string& fileName, UINT poses = 16)
+{
+    MappedFile cacheFile;
+    ModelCPU imported;
+    ModelGeometryView model;
+    bool warm = false;
+    if (!LoadModelCPU(fileName, cacheFile, imported, model, warm)) return 1;
 
-//--------------------------------------------------------------------------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------------------------------------------------------------------------
+    InitCamera();
+    const XMMATRIX objectWorld = XMMatrixScaling(ModelDisplayScale, ModelDisplayScale, ModelDisplayScale);
+    const XMVECTOR eye0 = XMLoadFloat3(&g_eyeWS);
 
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
-// Inicio: Pipeline y recursos de escena
-//--------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------
+    std::vector<uint32_t> indices;
+    std::vector<CulledDraw> draws;
+    uint64_t totalIn = 0, totalOut = 0;
+    char buf[256];
+    for (UINT i = 0; i < poses; ++i)
+    {
+        const XMVECTOR eye = XMVector3Transform(eye0, XMMatrixRotationY(XM_2PI * i / poses));
+        const XMMATRIX view = XMMatrixLookAtLH(eye, XMVectorZero(), XMVectorSet(0, 1, 0, 0));
+        XMFLOAT3 eyeWS;
+        XMStoreFloat3(&eyeWS, eye);
+
+        MeshletCullStats st;
+        CullModelMeshlets(model, nullptr, objectWorld, view * g_proj, eyeWS, indices, draws, st);
+        totalIn += st.trianglesIn;
+        totalOut += st.trianglesOut;
+
+        sprintf_s(buf, "Meshlet cull pose %2u (%5.1f deg): meshlets %u | frustum %u | cone %u | tris %llu -> %llu (%.1f%%) | %.3f ms\n",
+            i, 360.0f * i / poses, st.meshlets, st.culledFrustum, st.culledCone, (unsigned long long)st.trianglesIn,
+            (unsigned long long)st.trianglesOut, st.trianglesIn ? 100.0 * st.trianglesOut / st.trianglesIn : 0.0, st.ms);
+        OutputDebugStringA(buf);
+    }
+
+    sprintf_s(buf, "Meshlet cull total over %u poses: tris %llu -> %llu (%.1f%% submitted)\n", poses,
+        (unsigned long long)totalIn, (unsigned long long)totalOut, totalIn ? 100.0 * totalOut / totalIn : 0.0);
+    OutputDebugStringA(buf);
+    return 0;
+}
 
 //--------------------------------------------------------------------------------------
-// RootSig + PSO
+// Escena del frame (compartido por UpdateCB y el rasterizador por software)
 //--------------------------------------------------------------------------------------
-void CreateRootSigAndPSO()
+
+// Matriz de mundo del objeto: usa rotTime (g_rotTime, no seconds) para la rotación.
+XMMATRIX SceneWorldMatrix(int geom, float rotTime, bool sweep)
 {
-    // Define qué recursos ve el shader y crea el pipeline gráfico completo.
+    if (sweep) // la grilla queda quieta frente a la cámara (cada esfera rotando sobre sí misma se vería igual)
+    {
+        return XMMatrixIdentity();
+    }
 
-    // Root parameter: 1 CBV (b0)
-    // Root signature con un solo parámetro: un CBV en b0 (CBData)
-    // Lo ven todos los shaders (VS y PS)
-    D3D12_ROOT_PARAMETER rootParams[1] = {};
-    rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
-    rootParams[0].Descriptor.ShaderRegister = 0;
-    rootParams[0].Descriptor.RegisterSpace = 0;
-    rootParams[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+    XMMATRIX mWorld =
+        XMMatrixRotationX(rotTime * 0.7f) *
+        XMMatrixRotationY(rotTime * 1.1f);
 
-    // Root signature flags (?)
-    D3D12_ROOT_SIGNATURE_DESC rsDesc = {};
-    rsDesc.NumParameters = 1;
-    rsDesc.pParameters = rootParams;
-    rsDesc.NumStaticSamplers = 0;
-    rsDesc.pStaticSamplers = nullptr;
-    rsDesc.Flags =
-        D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT |
-        D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
-        D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
-        D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS;
+    if (geom == 2) // modelo
+    {
+        mWorld = XMMatrixScaling(ModelDisplayScale, ModelDisplayScale, ModelDisplayScale) * mWorld;
+    }
+    return mWorld;
+}
 
-    // Crear Root signature
-    ComPtr<ID3DBlob> sigBlob, errBlob;
-    ThrowIfFailed(D3D12SerializeRootSignature(&rsDesc, D3D_ROOT_SIGNATURE_VERSION_1, &sigBlob, &errBlob));
-    ThrowIfFailed(g_device->CreateRootSignature(0, sigBlob->GetBufferPointer(), sigBlob->GetBufferSize(),
-        IID_PPV_ARGS(&g_rootSig)));
+// CBData del frame: matrices, cámara, luz (órbita según 'seconds' o fija frente a la cámara) y modo desde los globals.
+CBData BuildFrameCB(FXMMATRIX mWorld, CXMMATRIX viewProj, float seconds, const VertexQuantization& quant)
+{
+    // luz direccional fija en mundo (arriba-derecha-atrás)
+    XMVECTOR L = XMVector3Normalize(XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f));
 
-    // Compilar shaders desde archivo PBR.hlsl
-    UINT compileFlags =
-#if _DEBUG
-        D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
-#else
-        0;
-#endif
-    ComPtr<ID3DBlob> vs, ps;
+    // Poblar CBData
+    CBData cb;
+    cb.viewProj = XMMatrixTranspose(viewProj);
+    cb.world = XMMatrixTranspose(mWorld); // transpuesta igual que viewProj (el cbuffer de HLSL es column-major)
+    XMStoreFloat3(&cb.lightDir, L);
+    cb.ambient = 0.15f;      // ambiente base
+    cb.mode = g_mode;     // desde el toggle
 
-    ThrowIfFailed(D3DCompileFromFile(
-        L"PBR.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE,
-        "VSMain", "vs_5_0", compileFlags, 0, &vs, &errBlob));
+    cb.viewPos = g_eyeWS;     
+    cb.shininess = 64.0f;     // pruebitas: 32-128
+    cb.specIntensity = 0.6f;  // k_s
 
-    ThrowIfFailed(D3DCompileFromFile(
-        L"PBR.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE,
-        "PSMain", "ps_5_0", compileFlags, 0, &ps, &errBlob));
+    XMFLOAT3 lightPosWS;
+    if (g_lightPinnedFront) {
+        // vector forward de la cámara hacia el origen (0,0,0)
+        XMVECTOR eyeV = XMLoadFloat3(&g_eyeWS);
+        XMVECTOR toOrigin = XMVector3Normalize(XMVectorSubtract(XMVectorZero(), eyeV));
+        XMVECTOR posV = XMVectorAdd(eyeV, XMVectorScale(toOrigin, g_lightFrontDist));
+        XMStoreFloat3(&lightPosWS, posV);
+    }
+    else {
+        // órbita simple en XZ
+        float radius = 1.2f;                // 1.2 para que pase bien por delante
+        float angle = seconds;             // velocidad 1 rad/s
+        lightPosWS = XMFLOAT3(cosf(angle) * radius, 1.0f, sinf(angle) * radius);
+    }
 
-    // Input layout (Describe cómo está armado el Vertex en memoria)
-    D3D12_INPUT_ELEMENT_DESC il[] = {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex,pos),    D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "COLOR",    0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex,color),  D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex,normal), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    };
+    // Colocar en el CB
+    cb.lightPos = lightPosWS;
+    cb.lightIntensity = g_lightIntensity;
+    cb.lightColor = g_lightColor;
 
+    cb.posScale = quant.scale;
+    cb.posBias = quant.bias;
+    cb._pad5 = cb._pad6 = 0.0f;
+    return cb;
+}
 
-    // PIPELINE CONFIG:
+//--------------------------------------------------------------------------------------
+// Rasterizador por software (headless)
+//--------------------------------------------------------------------------------------
 
-    // Rasterizer (Relleno sólido, culling de back faces, clipping de depth.)
-    D3D12_RASTERIZER_DESC rast = {};
-    rast.FillMode = D3D12_FILL_MODE_SOLID;
-    rast.CullMode = D3D12_CULL_MODE_BACK;
-    rast.FrontCounterClockwise = FALSE;
-    rast.DepthClipEnable = TRUE;
+// Dibuja las mismas escenas sin GPU. Consume los mismos PackedVertex, índices, InstanceData y CBData que el pipeline
+// de DX12. El VS es el de VSMain en CPU y el PS es PSMain a través de ShadeBatchSIMD. Replica el estado del PSO de
+// CreateRootSigAndPSO: cull back con FrontCounterClockwise = FALSE (frente = horario en pantalla), depth clip,
+// depth D32 con LESS y target RGBA8 UNORM.
+// Tres fases, cada una repartida entre 'threads' hilos:
+//  1. vértices: IA + VSMain para cada (draw, instancia);
+//  2. triángulos: clipping (near + guard band), culling, setup en punto fijo con 8 bits de subpixel y binning a tiles.
+//     Cada hilo toma un rango contiguo de triángulos y tiene sus propios bins: no hay locks y el orden de submit se mantiene;
+//  3. tiles, repartidos dinámicamente: depth test contra un visibility buffer del tile y después un solo sombreado por
+//     pixel visible, en lotes SoA. Con LESS el color final es el mismo que sombreando cada fragmento que pasa.
+
+static const UINT  SwTileSize = 64;
+static const int   SwSubpixelBits = 8;   // como D3D
+static const float SwGuardBand = 16.0f;  // |x|, |y| <= 16·w en clip space: las coordenadas en 24.8 quedan muy lejos de desbordar
+
+// Draw en CPU: lo mismo que DrawIndexedInstanced sobre un VB/IB ya cargados.
+struct SoftwareDraw
+{
+    const PackedVertex* verts = nullptr;
+    const uint32_t*     inds = nullptr;
+    UINT indexCount = 0;
+    UINT firstIndex = 0;
+    INT  baseVertex = 0;
+    const InstanceData* instances = nullptr;
+    UINT instanceCount = 0;
+};
 
-    // Depth test activado, escribe el Z, pasa si es menor
-    D3D12_DEPTH_STENCIL_DESC dss = {};
-    dss.DepthEnable = TRUE;
-    dss.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
-    dss.DepthFunc = D3D12_COMPARISON_FUNC_LESS;
-    dss.StencilEnable = FALSE;
+struct SoftwareTarget
+{
+    UINT width = 0, height = 0;
+    std::vector<uint32_t> color; // RGBA8 UNORM, fila 0 arriba (como el backbuffer)
+    std::vector<float>    depth; // D32
 
-    //Blend “simple”: escribe RGBA tal cual, sin blending especial
-    D3D12_BLEND_DESC blend = {};
-    blend.AlphaToCoverageEnable = FALSE;
-    blend.IndependentBlendEnable = FALSE;
-    auto& rt = blend.RenderTarget[0];
-    rt.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+    void Resize(UINT w, UINT h) { width = w; height = h; color.resize((size_t)w * h); depth.resize((size_t)w * h); }
+};
 
-    // Creo Pipeline State Object (PSO)
-    D3D12_GRAPHICS_PIPELINE_STATE_DESC pso = {};
-    pso.pRootSignature = g_rootSig.Get();
-    pso.VS = { vs->GetBufferPointer(), vs->GetBufferSize() };
-    pso.PS = { ps->GetBufferPointer(), ps->GetBufferSize() };
-    pso.BlendState = blend;
-    pso.SampleMask = UINT_MAX;
-    pso.RasterizerState = rast;
-    pso.DepthStencilState = dss;
-    pso.InputLayout = { il, _countof(il) }; 
-    pso.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
-    pso.NumRenderTargets = 1;
-    pso.RTVFormats[0] = ChooseBackbufferFormat();
-    pso.DSVFormat = ChooseDepthFormat();
-    pso.SampleDesc.Count = 1;
-    ThrowIfFailed(g_device->CreateGraphicsPipelineState(&pso, IID_PPV_ARGS(&g_pso)));
+struct SoftwareRasterStats
+{
+    UINT   threads = 0;
+    size_t vertices = 0;     // transformados (por instancia)
+    size_t triangles = 0;    // de entrada (por instancia)
+    size_t culled = 0;       // fuera del frustum, de espaldas, de área cero o sin pixels
+    size_t clipped = 0;      // cortados contra el near o la guard band
+    size_t binned = 0;       // entradas en los bins (un triángulo cuenta una vez por tile)
+    size_t pixelsShaded = 0;
+    double vertexMs = 0.0, setupMs = 0.0, rasterMs = 0.0, totalMs = 0.0;
+};
+
+// Corre fn(worker) para cada worker de [0, threads) en el job system y espera a todos. Los workers no se esperan
+// entre sí (cada uno usa su índice o toma trabajo de un contador atómico), así que varios pueden caer en un mismo hilo.
+template <class Fn>
+void RunWorkers(UINT threads, Fn&& fn)
+{
+    ParallelFor(threads, 1, [&fn](UINT begin, UINT end) { for (UINT w = begin; w < end; ++w) fn(w); });
 }
 
-//--------------------------------------------------------------------------------------
-// Geometry (cube) + CB
-//--------------------------------------------------------------------------------------
-void CreateCubeGeometryAndCB()
+class SoftwareRasterizer
 {
-    // Crea el vertex buffer, index buffer del cubo y el constant buffer mapeado.
+public:
+    // threads = 0: uno por núcleo. El target tiene que venir con el tamaño del viewport (Resize).
+    void Render(const CBData& cb, const std::vector<SoftwareDraw>& draws, SoftwareTarget& target, UINT threads, SoftwareRasterStats& stats)
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        if (threads == 0) threads = Jobs().ThreadCount();
+        stats = SoftwareRasterStats();
+        stats.threads = threads;
+
+        m_width = target.width;
+        m_height = target.height;
+        m_tilesX = (m_width + SwTileSize - 1) / SwTileSize;
+        m_tilesY = (m_height + SwTileSize - 1) / SwTileSize;
+
+        // Un job por (draw, instancia): rango de vértices que tocan sus índices y dónde queda su salida del VS
+        m_jobs.clear();
+        size_t vertexTotal = 0, triangleTotal = 0;
+        for (const SoftwareDraw& d : draws)
+        {
+            if (d.indexCount < 3 || d.instanceCount == 0) continue;
+            uint32_t lo = UINT32_MAX, hi = 0;
+            for (UINT i = 0; i < d.indexCount; ++i) { lo = (std::min)(lo, d.inds[d.firstIndex + i]); hi = (std::max)(hi, d.inds[d.firstIndex + i]); }
+            for (UINT inst = 0; inst < d.instanceCount; ++inst)
+            {
+                Job j;
+                j.draw = &d;
+                j.instance = &d.instances[inst];
+                j.firstVertex = lo;
+                j.vertexCount = hi - lo + 1;
+                j.vertexOffset = vertexTotal;
+                j.firstTriangle = triangleTotal;
+                vertexTotal += j.vertexCount;
+                triangleTotal += d.indexCount / 3;
+                m_jobs.push_back(j);
+            }
+        }
+        stats.vertices = vertexTotal;
+        stats.triangles = triangleTotal;
 
-    // Cubo unitario centrado
-    const float s = 0.5f;
+        // Matrices en la convención de CPU (el CB las guarda transpuestas para HLSL)
+        const XMMATRIX world = XMMatrixTranspose(cb.world);
+        const XMMATRIX viewProj = XMMatrixTranspose(cb.viewProj);
 
-    // 24 vértices (4 por cara) con normal plana por cara
-    Vertex v[] = {
-        // Frente (z+), n=(0,0,1)
-        {{-s,-s, s},{1,0,0},{0,0,1}}, {{ s,-s, s},{0,1,0},{0,0,1}},
-        {{ s, s, s},{0,0,1},{0,0,1}}, {{-s, s, s},{1,1,0},{0,0,1}},
-        // Atrás (z-), n=(0,0,-1)
-        {{-s,-s,-s},{1,0,1},{0,0,-1}}, {{-s, s,-s},{0,1,1},{0,0,-1}},
-        {{ s, s,-s},{1,1,1},{0,0,-1}}, {{ s,-s,-s},{0,0,0},{0,0,-1}},
-        // Izquierda (x-), n=(-1,0,0)
-        {{-s,-s,-s},{1,0,1},{-1,0,0}}, {{-s,-s, s},{1,0,0},{-1,0,0}},
-        {{-s, s, s},{1,1,0},{-1,0,0}}, {{-s, s,-s},{0,1,1},{-1,0,0}},
-        // Derecha (x+), n=(1,0,0)
-        {{ s,-s, s},{0,1,0},{1,0,0}}, {{ s,-s,-s},{0,0,0},{1,0,0}},
-        {{ s, s,-s},{1,1,1},{1,0,0}}, {{ s, s, s},{0,0,1},{1,0,0}},
-        // Arriba (y+), n=(0,1,0)
-        {{-s, s, s},{1,1,0},{0,1,0}}, {{ s, s, s},{0,0,1},{0,1,0}},
-        {{ s, s,-s},{1,1,1},{0,1,0}}, {{-s, s,-s},{0,1,1},{0,1,0}},
-        // Abajo (y-), n=(0,-1,0)
-        {{-s,-s,-s},{1,0,1},{0,-1,0}}, {{ s,-s,-s},{0,0,0},{0,-1,0}},
-        {{ s,-s, s},{0,1,0},{0,-1,0}}, {{-s,-s, s},{1,0,0},{0,-1,0}},
-    };
+        // 1. Vértices
+        auto t1 = std::chrono::high_resolution_clock::now();
+        m_vertices.resize(vertexTotal);
+        RunWorkers(threads, [&](UINT w)
+        {
+            const size_t begin = vertexTotal * w / threads, end = vertexTotal * (w + 1) / threads;
+            size_t job = FindJob(begin, true);
+            for (size_t v = begin; v < end; ++v)
+            {
+                while (v >= m_jobs[job].vertexOffset + m_jobs[job].vertexCount) ++job;
+                const Job& j = m_jobs[job];
+                const XMMATRIX objectToWorld = XMMatrixMultiply(XMMatrixTranspose(XMLoadFloat4x4(&j.instance->world)), world);
+                // Normales como el VS: matriz de normales de la instancia y después el 3x3 de la world del CB (rotación
+                // + escala uniforme, así que no necesita la suya)
+                const XMMATRIX normalToWorld = XMMatrixMultiply(XMMatrixTranspose(XMLoadFloat4x4(&j.instance->normalWorld)), world);
+                ShadeVertex(j.draw->verts[(size_t)((INT)(j.firstVertex + (v - j.vertexOffset)) + j.draw->baseVertex)], cb, objectToWorld, normalToWorld, viewProj, m_vertices[v]);
+            }
+        });
 
-    uint16_t i[] = {
-        // 6 caras * 2 triángulos
-        0,1,2, 0,2,3,       // frente
-        4,5,6, 4,6,7,       // atrás
-        8,9,10, 8,10,11,    // izquierda
-        12,13,14, 12,14,15, // derecha
-        16,17,18, 16,18,19, // arriba
-        20,21,22, 20,22,23  // abajo
+        // 2. Triángulos → bins
+        auto t2 = std::chrono::high_resolution_clock::now();
+        const UINT tileCount = m_tilesX * m_tilesY;
+        m_chunks.resize(threads);
+        RunWorkers(threads, [&](UINT w)
+        {
+            Chunk& c = m_chunks[w];
+            c.tris.clear();
+            c.clipVerts.clear();
+            c.bins.resize(tileCount);
+            for (std::vector<uint32_t>& b : c.bins) b.clear();
+            c.culled = c.clipped = c.binned = 0;
+
+            const size_t begin = triangleTotal * w / threads, end = triangleTotal * (w + 1) / threads;
+            size_t job = FindJob(begin, false);
+            for (size_t t = begin; t < end; ++t)
+            {
+                while (t >= m_jobs[job].firstTriangle + m_jobs[job].draw->indexCount / 3) ++job;
+                const Job& j = m_jobs[job];
+                const uint32_t* idx = j.draw->inds + j.draw->firstIndex + (t - j.firstTriangle) * 3;
+                const SwVertex* v[3];
+                for (int k = 0; k < 3; ++k) v[k] = &m_vertices[j.vertexOffset + (idx[k] - j.firstVertex)];
+                AssembleTriangle(v, j.instance, c);
+            }
+        });
+        for (const Chunk& c : m_chunks) { stats.culled += c.culled; stats.clipped += c.clipped; stats.binned += c.binned; }
+
+        // 3. Tiles
+        auto t3 = std::chrono::high_resolution_clock::now();
+        std::atomic<UINT> nextTile(0);
+        std::vector<size_t> shaded(threads, 0);
+        RunWorkers(threads, [&](UINT w)
+        {
+            TileScratch scratch;
+            for (UINT tile = nextTile++; tile < tileCount; tile = nextTile++)
+                shaded[w] += RasterTile(tile, cb, target, scratch);
+        });
+        for (size_t s : shaded) stats.pixelsShaded += s;
+
+        auto t4 = std::chrono::high_resolution_clock::now();
+        stats.vertexMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        stats.setupMs = std::chrono::duration<double, std::milli>(t3 - t2).count();
+        stats.rasterMs = std::chrono::duration<double, std::milli>(t4 - t3).count();
+        stats.totalMs = std::chrono::duration<double, std::milli>(t4 - t0).count();
+    }
+
+private:
+    // Salida de VSMain para un vértice
+    struct SwVertex
+    {
+        XMFLOAT4 clip;
+        XMFLOAT3 posWS;
+        XMFLOAT3 nrmWS;
     };
 
-    const UINT vbSize = sizeof(v);
-    const UINT ibSize = sizeof(i);
+    // Triángulo listo para rasterizar
+    struct SwTriangle
+    {
+        const SwVertex* v[3];
+        const InstanceData* instance;
+        int64_t x[3], y[3];            // pantalla en punto fijo (SwSubpixelBits)
+        float invW[3];
+        float zA, zB, zC;              // z = zA·px + zB·py + zC, con (px, py) en pixels
+        float lA[2], lB[2], lC[2];     // baricéntricas en pantalla de los vértices 1 y 2 (la del 0 es 1 - l1 - l2)
+        int minX, minY, maxX, maxY;    // bbox en pixels recortada a la pantalla, inclusive
+    };
 
-    // VB (upload para simplificar lo hago aca)
-    // Reserva un buffer en heap UPLOAD(memoria accesible por CPU).
-    // Lo mapea, copia los vértices, lo desmapea.
+    struct Job
     {
-        D3D12_HEAP_PROPERTIES hp = {}; hp.Type = D3D12_HEAP_TYPE_UPLOAD;
-        D3D12_RESOURCE_DESC rd = {};
-        rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        rd.Width = vbSize; rd.Height = 1; rd.DepthOrArraySize = 1;
-        rd.MipLevels = 1; rd.SampleDesc = { 1,0 }; rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        const SoftwareDraw* draw;
+        const InstanceData* instance;
+        uint32_t firstVertex, vertexCount;
+        size_t vertexOffset, firstTriangle;
+    };
 
-        ThrowIfFailed(g_device->CreateCommittedResource(&hp, D3D12_HEAP_FLAG_NONE, &rd,
-            D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&g_vb)));
+    struct Chunk
+    {
+        std::vector<SwTriangle> tris;
+        std::deque<SwVertex> clipVerts;          // vértices nuevos del clipping (deque: las direcciones no se mueven)
+        std::vector<std::vector<uint32_t>> bins; // por tile: índices en 'tris', en orden de submit
+        size_t culled = 0, clipped = 0, binned = 0;
+    };
 
-        void* data = nullptr;
-        D3D12_RANGE rr = { 0,0 };
-        ThrowIfFailed(g_vb->Map(0, &rr, &data));
-        memcpy(data, v, vbSize);
-        g_vb->Unmap(0, nullptr);
+    struct TileScratch
+    {
+        std::vector<const SwTriangle*> vis = std::vector<const SwTriangle*>(SwTileSize * SwTileSize);
+        std::vector<uint32_t> pixels;            // pixels visibles del tile, en el orden del lote
+        ShadingBatch batch;
+        ShadedBatch shaded;
+    };
 
-        g_vbView.BufferLocation = g_vb->GetGPUVirtualAddress();
-        g_vbView.StrideInBytes = sizeof(Vertex);
-        g_vbView.SizeInBytes = vbSize;
+    // Primer job que contiene el vértice/triángulo 'first' (los offsets son crecientes)
+    size_t FindJob(size_t first, bool vertices) const
+    {
+        size_t lo = 0, hi = m_jobs.size();
+        while (hi - lo > 1)
+        {
+            const size_t mid = (lo + hi) / 2;
+            ((vertices ? m_jobs[mid].vertexOffset : m_jobs[mid].firstTriangle) <= first ? lo : hi) = mid;
+        }
+        return lo;
     }
 
-    // IB (upload)
+    // IA + VSMain: decuantizar, instancia → world → viewProj. La normal va a mundo con la parte 3x3 (worlds = rotación + escala uniforme).
+    static void ShadeVertex(const PackedVertex& p, const CBData& cb, FXMMATRIX objectToWorld, CXMMATRIX normalToWorld, CXMMATRIX viewProj, SwVertex& out)
     {
-        //Similar para el index buffer
-        D3D12_HEAP_PROPERTIES hp = {}; hp.Type = D3D12_HEAP_TYPE_UPLOAD;
-        D3D12_RESOURCE_DESC rd = {};
-        rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        rd.Width = ibSize; rd.Height = 1; rd.DepthOrArraySize = 1;
-        rd.MipLevels = 1; rd.SampleDesc = { 1,0 }; rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-
-        ThrowIfFailed(g_device->CreateCommittedResource(&hp, D3D12_HEAP_FLAG_NONE, &rd,
-            D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&g_ib)));
+        VertexQuantization q;
+        q.scale = cb.posScale;
+        q.bias = cb.posBias;
+        const Vertex v = UnpackVertex(p, q);
+
+        const XMVECTOR pWS = XMVector3Transform(XMLoadFloat3(&v.pos), objectToWorld);
+        XMStoreFloat4(&out.clip, XMVector4Transform(XMVectorSetW(pWS, 1.0f), viewProj));
+        XMStoreFloat3(&out.posWS, pWS);
+        XMStoreFloat3(&out.nrmWS, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&v.normal), normalToWorld)));
+    }
 
-        void* data = nullptr;
-        D3D12_RANGE rr = { 0,0 };
-        ThrowIfFailed(g_ib->Map(0, &rr, &data));
-        memcpy(data, i, ibSize);
-        g_ib->Unmap(0, nullptr);
+    static SwVertex LerpVertex(const SwVertex& a, const SwVertex& b, float t)
+    {
+        auto lerp = [t](float x, float y) { return x + (y - x) * t; };
+        SwVertex o;
+        o.clip = XMFLOAT4(lerp(a.clip.x, b.clip.x), lerp(a.clip.y, b.clip.y), lerp(a.clip.z, b.clip.z), lerp(a.clip.w, b.clip.w));
+        o.posWS = XMFLOAT3(lerp(a.posWS.x, b.posWS.x), lerp(a.posWS.y, b.posWS.y), lerp(a.posWS.z, b.posWS.z));
+        o.nrmWS = XMFLOAT3(lerp(a.nrmWS.x, b.nrmWS.x), lerp(a.nrmWS.y, b.nrmWS.y), lerp(a.nrmWS.z, b.nrmWS.z));
+        return o;
+    }
 
-        g_ibView.BufferLocation = g_ib->GetGPUVirtualAddress();
-        g_ibView.Format = DXGI_FORMAT_R16_UINT;
-        g_ibView.SizeInBytes = ibSize;
+    // Distancia con signo a los planos de clip que se cortan de verdad: near (z >= 0) y la guard band en x/y.
+    // El resto del frustum (far, bordes de pantalla) lo resuelven el depth test y el recorte del bbox.
+    static float ClipDistance(const XMFLOAT4& c, int plane)
+    {
+        switch (plane)
+        {
+        case 0:  return c.z;
+        case 1:  return SwGuardBand * c.w - c.x;
+        case 2:  return SwGuardBand * c.w + c.x;
+        case 3:  return SwGuardBand * c.w - c.y;
+        default: return SwGuardBand * c.w + c.y;
+        }
     }
 
-    // Constant Buffer (mapeado persistente, g_cbMapped)
+    void AssembleTriangle(const SwVertex* const v[3], const InstanceData* instance, Chunk& c) const
     {
-        UINT cbSize = Align256(sizeof(CBData));
-        D3D12_HEAP_PROPERTIES hp = {}; hp.Type = D3D12_HEAP_TYPE_UPLOAD;
-        D3D12_RESOURCE_DESC rd = {};
-        rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        rd.Width = cbSize; rd.Height = 1; rd.DepthOrArraySize = 1;
-        rd.MipLevels = 1; rd.SampleDesc = { 1,0 }; rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        // Rechazo trivial: los tres del lado de afuera de un mismo plano del frustum
+        const XMFLOAT4& a = v[0]->clip; const XMFLOAT4& b = v[1]->clip; const XMFLOAT4& d = v[2]->clip;
+        if ((a.x > a.w && b.x > b.w && d.x > d.w) || (a.x < -a.w && b.x < -b.w && d.x < -d.w) ||
+            (a.y > a.w && b.y > b.w && d.y > d.w) || (a.y < -a.w && b.y < -b.w && d.y < -d.w) ||
+            (a.z < 0.0f && b.z < 0.0f && d.z < 0.0f) || (a.z > a.w && b.z > b.w && d.z > d.w))
+        {
+            ++c.culled;
+            return;
+        }
 
-        ThrowIfFailed(g_device->CreateCommittedResource(&hp, D3D12_HEAP_FLAG_NONE, &rd,
-            D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&g_cb)));
+        bool inside = true;
+        for (int p = 0; p < 5 && inside; ++p)
+            inside = ClipDistance(a, p) >= 0.0f && ClipDistance(b, p) >= 0.0f && ClipDistance(d, p) >= 0.0f;
+        if (inside)
+        {
+            SetupTriangle(v, instance, c);
+            return;
+        }
 
-        D3D12_RANGE rr = { 0,0 };
-        ThrowIfFailed(g_cb->Map(0, &rr, reinterpret_cast<void**>(&g_cbMapped)));
-    }
-}
+        // Sutherland-Hodgman: a lo sumo 3 + 5 vértices; el polígono resultante se abanica desde el primero
+        ++c.clipped;
+        SwVertex poly[2][9];
+        int count = 3;
+        for (int k = 0; k < 3; ++k) poly[0][k] = *v[k];
+        int cur = 0;
+        for (int p = 0; p < 5 && count > 0; ++p)
+        {
+            int outCount = 0;
+            for (int k = 0; k < count; ++k)
+            {
+                const SwVertex& s = poly[cur][k];
+                const SwVertex& e = poly[cur][(k + 1) % count];
+                const float ds = ClipDistance(s.clip, p), de = ClipDistance(e.clip, p);
+                if (ds >= 0.0f) poly[cur ^ 1][outCount++] = s;
+                if ((ds >= 0.0f) != (de >= 0.0f)) poly[cur ^ 1][outCount++] = LerpVertex(s, e, ds / (ds - de));
+            }
+            count = outCount;
+            cur ^= 1;
+        }
+        if (count < 3) { ++c.culled; return; }
 
-//--------------------------------------------------------------------------------------
-// Geometry (sphere)
-//--------------------------------------------------------------------------------------
+        c.clipVerts.push_back(poly[cur][0]);
+        const SwVertex* first = &c.clipVerts.back();
+        for (int k = 1; k + 1 < count; ++k)
+        {
+            c.clipVerts.push_back(poly[cur][k]);
+            const SwVertex* p1 = &c.clipVerts.back();
+            c.clipVerts.push_back(poly[cur][k + 1]);
+            const SwVertex* tri[3] = { first, p1, &c.clipVerts.back() };
+            SetupTriangle(tri, instance, c);
+        }
+    }
 
-void CreateSphereGeometry(float radius = 0.5f, int stacks = 32, int slices = 32)
-{
-    // Opcional para visualizar una esfera en lugar de un cubo.
+    void SetupTriangle(const SwVertex* const v[3], const InstanceData* instance, Chunk& c) const
+    {
+        SwTriangle t;
+        float px[3], py[3], z[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            // Viewport: NDC → pixels (y hacia abajo), z queda en [0, 1]
+            t.v[k] = v[k];
+            t.invW[k] = 1.0f / v[k]->clip.w;
+            px[k] = (v[k]->clip.x * t.invW[k] + 1.0f) * 0.5f * m_width;
+            py[k] = (1.0f - v[k]->clip.y * t.invW[k]) * 0.5f * m_height;
+            z[k] = v[k]->clip.z * t.invW[k];
+            t.x[k] = (int64_t)llroundf(px[k] * (1 << SwSubpixelBits));
+            t.y[k] = (int64_t)llroundf(py[k] * (1 << SwSubpixelBits));
+        }
 
-    std::vector<Vertex> verts;
-    std::vector<uint16_t> inds;
-    verts.reserve((stacks + 1) * (slices + 1));
-    inds.reserve(stacks * slices * 6);
+        // Área con signo en pantalla: > 0 = horario = frente (FrontCounterClockwise = FALSE). El resto es back-face o degenerado.
+        const int64_t area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+        if (area <= 0) { ++c.culled; return; }
+
+        t.minX = (int)(std::max)((int64_t)0, (std::min)({ t.x[0], t.x[1], t.x[2] }) >> SwSubpixelBits);
+        t.minY = (int)(std::max)((int64_t)0, (std::min)({ t.y[0], t.y[1], t.y[2] }) >> SwSubpixelBits);
+        t.maxX = (int)(std::min)((int64_t)m_width - 1, (std::max)({ t.x[0], t.x[1], t.x[2] }) >> SwSubpixelBits);
+        t.maxY = (int)(std::min)((int64_t)m_height - 1, (std::max)({ t.y[0], t.y[1], t.y[2] }) >> SwSubpixelBits);
+        if (t.minX > t.maxX || t.minY > t.maxY) { ++c.culled; return; }
+
+        // Planos de baricéntricas y de profundidad en pixels (float), a partir de los vértices ya snapeados
+        const float scale = 1.0f / (1 << SwSubpixelBits);
+        const float sx[3] = { t.x[0] * scale, t.x[1] * scale, t.x[2] * scale };
+        const float sy[3] = { t.y[0] * scale, t.y[1] * scale, t.y[2] * scale };
+        const float invArea = 1.0f / ((sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]));
+        for (int k = 0; k < 2; ++k)
+        {
+            // l1 es la función de arista 2→0 y l2 la de 0→1, normalizadas por el área
+            const int a = (k == 0) ? 2 : 0, b = (k == 0) ? 0 : 1;
+            t.lA[k] = -(sy[b] - sy[a]) * invArea;
+            t.lB[k] = (sx[b] - sx[a]) * invArea;
+            t.lC[k] = ((sy[b] - sy[a]) * sx[a] - (sx[b] - sx[a]) * sy[a]) * invArea;
+        }
+        const float dz1 = z[1] - z[0], dz2 = z[2] - z[0];
+        t.zA = t.lA[0] * dz1 + t.lA[1] * dz2;
+        t.zB = t.lB[0] * dz1 + t.lB[1] * dz2;
+        t.zC = z[0] + t.lC[0] * dz1 + t.lC[1] * dz2;
+        t.instance = instance;
+
+        const uint32_t index = (uint32_t)c.tris.size();
+        c.tris.push_back(t);
+        for (int ty = t.minY / (int)SwTileSize; ty <= t.maxY / (int)SwTileSize; ++ty)
+            for (int tx = t.minX / (int)SwTileSize; tx <= t.maxX / (int)SwTileSize; ++tx)
+            {
+                c.bins[ty * m_tilesX + tx].push_back(index);
+                ++c.binned;
+            }
+    }
 
-    for (int y = 0; y <= stacks; ++y)
+    // Rasteriza y sombrea un tile. Devuelve los pixels sombreados.
+    size_t RasterTile(UINT tile, const CBData& cb, SoftwareTarget& target, TileScratch& s) const
     {
-        float v = float(y) / stacks;           // [0,1]
-        float phi = v * XM_PI;                 // [0,π]
-        float sinPhi = sinf(phi), cosPhi = cosf(phi);
+        const int x0 = (int)((tile % m_tilesX) * SwTileSize), y0 = (int)((tile / m_tilesX) * SwTileSize);
+        const int x1 = (std::min)(x0 + (int)SwTileSize, (int)m_width) - 1, y1 = (std::min)(y0 + (int)SwTileSize, (int)m_height) - 1;
 
-        for (int x = 0; x <= slices; ++x)
+        for (int y = y0; y <= y1; ++y)
+            std::fill_n(&target.depth[(size_t)y * m_width + x0], x1 - x0 + 1, 1.0f);
+        std::fill(s.vis.begin(), s.vis.end(), nullptr);
+
+        // Depth test de todos los triángulos del tile, en orden de submit (chunk 0, 1, ... y dentro de cada uno en orden)
+        const int64_t half = 1 << (SwSubpixelBits - 1), one = 1 << SwSubpixelBits;
+        for (const Chunk& c : m_chunks)
         {
-            float u = float(x) / slices;       // [0,1]
-            float theta = u * XM_2PI;          // [0,2π]
-            float sinTheta = sinf(theta), cosTheta = cosf(theta);
+            for (uint32_t index : c.bins[tile])
+            {
+                const SwTriangle& t = c.tris[index];
+                const int bx0 = (std::max)(t.minX, x0), by0 = (std::max)(t.minY, y0);
+                const int bx1 = (std::min)(t.maxX, x1), by1 = (std::min)(t.maxY, y1);
+                if (bx0 > bx1 || by0 > by1) continue;
+
+                // Funciones de arista en punto fijo sobre el centro del pixel. Regla top-left: las aristas que no son
+                // top ni left no incluyen los pixels que caen justo encima (sesgo -1).
+                int64_t e[3], stepX[3], stepY[3];
+                const int64_t cx = (int64_t)bx0 * one + half, cy = (int64_t)by0 * one + half;
+                for (int k = 0; k < 3; ++k)
+                {
+                    const int a = (k + 1) % 3, b = (k + 2) % 3; // arista opuesta al vértice k
+                    const int64_t dx = t.x[b] - t.x[a], dy = t.y[b] - t.y[a];
+                    const bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+                    e[k] = dx * (cy - t.y[a]) - dy * (cx - t.x[a]) - (topLeft ? 0 : 1);
+                    stepX[k] = -dy * one;
+                    stepY[k] = dx * one;
+                }
+
+                for (int y = by0; y <= by1; ++y)
+                {
+                    int64_t w0 = e[0], w1 = e[1], w2 = e[2];
+                    float* depthRow = &target.depth[(size_t)y * m_width];
+                    const SwTriangle** visRow = &s.vis[(size_t)(y - y0) * SwTileSize]; // fila del tile: se indexa con x - x0
+                    const float zRow = t.zB * (y + 0.5f) + t.zC;
+                    for (int x = bx0; x <= bx1; ++x)
+                    {
+                        if ((w0 | w1 | w2) >= 0)
+                        {
+                            const float z = t.zA * (x + 0.5f) + zRow;
+                            if (z < depthRow[x]) { depthRow[x] = z; visRow[x - x0] = &t; }
+                        }
+                        w0 += stepX[0]; w1 += stepX[1]; w2 += stepX[2];
+                    }
+                    for (int k = 0; k < 3; ++k) e[k] += stepY[k];
+                }
+            }
+        }
 
-            XMFLOAT3 n = XMFLOAT3(cosTheta * sinPhi, cosPhi, sinTheta * sinPhi);
-            XMFLOAT3 p = XMFLOAT3(n.x * radius, n.y * radius, n.z * radius);
+        // Sombreado de los pixels visibles: interpolación con corrección de perspectiva y PSMain en lotes
+        s.pixels.clear();
+        s.batch.Resize(0);
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = x0; x <= x1; ++x)
+            {
+                const SwTriangle* t = s.vis[(size_t)(y - y0) * SwTileSize + (x - x0)];
+                if (!t)
+                {
+                    target.color[(size_t)y * m_width + x] = 0xFF291A12; // clearColor de RecordRender (0.07, 0.1, 0.16, 1)
+                    continue;
+                }
+
+                const float fx = x + 0.5f, fy = y + 0.5f;
+                const float l1 = t->lA[0] * fx + t->lB[0] * fy + t->lC[0];
+                const float l2 = t->lA[1] * fx + t->lB[1] * fy + t->lC[1];
+                const float w[3] = { (1.0f - l1 - l2) * t->invW[0], l1 * t->invW[1], l2 * t->invW[2] };
+                const float inv = 1.0f / (w[0] + w[1] + w[2]);
+
+                XMFLOAT3 pos(0, 0, 0), nrm(0, 0, 0);
+                for (int k = 0; k < 3; ++k)
+                {
+                    const float b = w[k] * inv;
+                    pos.x += t->v[k]->posWS.x * b; pos.y += t->v[k]->posWS.y * b; pos.z += t->v[k]->posWS.z * b;
+                    nrm.x += t->v[k]->nrmWS.x * b; nrm.y += t->v[k]->nrmWS.y * b; nrm.z += t->v[k]->nrmWS.z * b;
+                }
+
+                ShadingBatch& in = s.batch;
+                in.px.push_back(pos.x); in.py.push_back(pos.y); in.pz.push_back(pos.z);
+                in.nx.push_back(nrm.x); in.ny.push_back(nrm.y); in.nz.push_back(nrm.z);
+                in.r.push_back(t->instance->baseColor.x); in.g.push_back(t->instance->baseColor.y); in.b.push_back(t->instance->baseColor.z);
+                in.metallic.push_back(t->instance->metallic); in.roughness.push_back(t->instance->roughness); in.ao.push_back(t->instance->ao);
+                s.pixels.push_back((uint32_t)(y * m_width + x));
+            }
+        }
+
+        ShadeBatchSIMD(cb, s.batch, s.shaded);
+        for (size_t i = 0; i < s.pixels.size(); ++i)
+        {
+            // Conversión a UNORM8 como el RTV: round(saturate(c) · 255). El PS ya devuelve saturate.
+            const uint32_t r = (uint32_t)(s.shaded.r[i] * 255.0f + 0.5f);
+            const uint32_t g = (uint32_t)(s.shaded.g[i] * 255.0f + 0.5f);
+            const uint32_t b = (uint32_t)(s.shaded.b[i] * 255.0f + 0.5f);
+            target.color[s.pixels[i]] = r | (g << 8) | (b << 16) | 0xFF000000u;
+        }
+        return s.pixels.size();
+    }
 
-            // color simple por normal (debug)
-            XMFLOAT3 c = XMFLOAT3(0.5f * (n.x + 1.0f), 0.5f * (n.y + 1.0f), 0.5f * (n.z + 1.0f));
+    UINT m_width = 0, m_height = 0;
+    UINT m_tilesX = 0, m_tilesY = 0;
+    std::vector<Job>      m_jobs;
+    std::vector<SwVertex> m_vertices;
+    std::vector<Chunk>    m_chunks;   // uno por hilo de la fase 2
+};
 
-            verts.push_back({ p, c, n });
+// TGA sin comprimir de 32 bits (BGRA, origen arriba a la izquierda). Lo abre cualquier visor sin dependencias.
+bool WriteTga(const std::string& path, UINT width, UINT height, const uint32_t* rgba)
+{
+    FILE* f = nullptr;
+    if (fopen_s(&f, path.c_str(), "wb") != 0 || !f) return false;
+
+    uint8_t header[18] = {};
+    header[2] = 2; // true color sin comprimir
+    header[12] = (uint8_t)(width & 0xFF); header[13] = (uint8_t)(width >> 8);
+    header[14] = (uint8_t)(height & 0xFF); header[15] = (uint8_t)(height >> 8);
+    header[16] = 32;
+    header[17] = 0x28; // 8 bits de alpha + origen arriba
+    fwrite(header, 1, sizeof(header), f);
+
+    std::vector<uint8_t> row((size_t)width * 4);
+    for (UINT y = 0; y < height; ++y)
+    {
+        for (UINT x = 0; x < width; ++x)
+        {
+            const uint32_t c = rgba[(size_t)y * width + x];
+            row[x * 4 + 0] = (uint8_t)(c >> 16); row[x * 4 + 1] = (uint8_t)(c >> 8);
+            row[x * 4 + 2] = (uint8_t)c;         row[x * 4 + 3] = (uint8_t)(c >> 24);
         }
+        fwrite(row.data(), 1, row.size(), f);
     }
+    fclose(f);
+    return true;
+}
 
-    int stride = slices + 1;
-    for (int y = 0; y < stacks; ++y)
+// PNG RGB de 8 bits con deflate sin compresión (bloques "stored"): sin dependencias y exacto pixel a pixel, que es lo
+// que importa para comparar renders de regresión. El alpha del target siempre es 1 y no se guarda.
+bool WritePng(const std::string& path, UINT width, UINT height, const uint32_t* rgba)
+{
+    if (width == 0 || height == 0) return false;
+
+    static const std::vector<uint32_t> crcTable = []()
     {
-        for (int x = 0; x < slices; ++x)
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; ++n)
         {
-            uint32_t i0 = y * stride + x;
-            uint32_t i1 = i0 + 1;
-            uint32_t i2 = i0 + stride;
-            uint32_t i3 = i2 + 1;
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    auto crc = [](uint32_t c, const uint8_t* p, size_t n) { for (size_t i = 0; i < n; ++i) c = crcTable[(c ^ p[i]) & 0xFF] ^ (c >> 8); return c; };
+    auto put32 = [](std::vector<uint8_t>& v, uint32_t x) { v.push_back((uint8_t)(x >> 24)); v.push_back((uint8_t)(x >> 16)); v.push_back((uint8_t)(x >> 8)); v.push_back((uint8_t)x); };
+
+    // Filas con filtro 0 (None) y RGB
+    const size_t rowBytes = (size_t)width * 3 + 1;
+    std::vector<uint8_t> raw(rowBytes * height);
+    for (UINT y = 0; y < height; ++y)
+    {
+        uint8_t* row = &raw[y * rowBytes];
+        row[0] = 0;
+        for (UINT x = 0; x < width; ++x)
+        {
+            const uint32_t c = rgba[(size_t)y * width + x];
+            row[1 + x * 3 + 0] = (uint8_t)c; row[1 + x * 3 + 1] = (uint8_t)(c >> 8); row[1 + x * 3 + 2] = (uint8_t)(c >> 16);
+        }
+    }
+
+    // Stream zlib: cabecera, bloques stored de hasta 65535 bytes y adler32
+    std::vector<uint8_t> idat = { 'I', 'D', 'A', 'T', 0x78, 0x01 };
+    idat.reserve(raw.size() + raw.size() / 65535 * 5 + 32);
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0; pos < raw.size(); )
+    {
+        const size_t n = (std::min)(raw.size() - pos, (size_t)65535);
+        idat.push_back(pos + n == raw.size() ? 1 : 0); // BFINAL
+        idat.push_back((uint8_t)n); idat.push_back((uint8_t)(n >> 8));
+        idat.push_back((uint8_t)~n); idat.push_back((uint8_t)(~n >> 8));
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + n);
+        for (size_t i = pos; i < pos + n; ++i) { a = (a + raw[i]) % 65521; b = (b + a) % 65521; }
+        pos += n;
+    }
+    put32(idat, (b << 16) | a);
+
+    std::vector<uint8_t> ihdr = { 'I', 'H', 'D', 'R' };
+    put32(ihdr, width); put32(ihdr, height);
+    ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); // 8 bits, RGB, deflate, filtros estándar, sin interlace
+
+    FILE* f = nullptr;
+    if (fopen_s(&f, path.c_str(), "wb") != 0 || !f) return false;
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, sizeof(signature), f);
+    static const uint8_t iendType[4] = { 'I', 'E', 'N', 'D' };
+    std::vector<uint8_t> iend(iendType, iendType + 4);
+    for (const std::vector<uint8_t>* chunk : { &ihdr, &idat, &iend })
+    {
+        std::vector<uint8_t> framing;
+        put32(framing, (uint32_t)(chunk->size() - 4)); // el tipo no cuenta en el largo
+        fwrite(framing.data(), 1, 4, f);
+        fwrite(chunk->data(), 1, chunk->size(), f);
+        framing.clear();
+        put32(framing, crc(0xFFFFFFFFu, chunk->data(), chunk->size()) ^ 0xFFFFFFFFu); // el CRC sí cubre el tipo
+        fwrite(framing.data(), 1, 4, f);
+    }
+    const bool ok = ferror(f) == 0;
+    fclose(f);
+    return ok;
+}
+
+// Escena para el rasterizador por software: VB/IB en CPU con el mismo empaquetado que en GPU, las instancias con el
+// material de los presets (como UpdateCB) y las draws que las recorren. No se copia ni se mueve: las draws apuntan
+// a sus propios vectores y, para el modelo, al cache mapeado.
+struct SoftwareScene
+{
+    const char* name = "";
+    int  geom = 0;       // como g_geomMode: 0 = cubo, 1 = esfera, 2 = modelo
+    bool sweep = false;  // grilla de esferas de BuildMaterialSweep (g_sweepDim)
+    VertexQuantization quant;
+    std::vector<PackedVertex> verts;
+    std::vector<uint32_t> inds;
+    std::vector<InstanceData> instances;
+    std::vector<SoftwareDraw> draws;
+    MappedFile cacheFile;
+    ModelCPU imported;
+};
 
-            // Dos triángulos por quad
-            inds.push_back((uint16_t)i0);
-            inds.push_back((uint16_t)i1);
-            inds.push_back((uint16_t)i2);
+// Arma la escena de 'geom' (con sweep, la grilla de esferas). Cubo y esfera usan la malla base (LOD0); el modelo, el
+// LOD0 de cada submesh con una draw por instancia. La vista de InitCamera tiene que estar lista para el barrido.
+bool BuildSoftwareScene(int geom, bool sweep, const std::string& modelPath, SoftwareScene& sc)
+{
+    InstanceData material;
+    SetInstanceTransform(material, XMMatrixIdentity());
+    material.baseColor = g_baseColor;
+    material.metallic = g_metallic;
+    material.roughness = g_roughness;
+    material.ao = g_ao;
+    material._pad = XMFLOAT2(0, 0);
+
+    sc.geom = sweep ? 1 : geom;
+    sc.sweep = sweep;
+    sc.name = sweep ? "sweep" : (geom == 0) ? "cube" : (geom == 1) ? "sphere" : "model";
+    sc.draws.clear();
+
+    if (sc.geom != 2)
+    {
+        std::vector<Vertex> verts;
+        if (sc.geom == 0) BuildCubeMesh(verts, sc.inds);
+        else BuildSphere(g_sphereKind, 0.5f, SphereLodParam(g_sphereKind, 0), verts, sc.inds);
+        sc.quant = ComputeVertexQuantization(verts.data(), verts.size());
+        PackVertices(verts.data(), verts.size(), sc.quant, sc.verts);
 
-            inds.push_back((uint16_t)i1);
-            inds.push_back((uint16_t)i3);
-            inds.push_back((uint16_t)i2);
+        if (sweep)
+        {
+            // Misma grilla que UpdateMaterialSweep: mirando a la cámara
+            const XMMATRIX invView = XMMatrixInverse(nullptr, g_view);
+            XMFLOAT3 right, up;
+            XMStoreFloat3(&right, invView.r[0]);
+            XMStoreFloat3(&up, invView.r[1]);
+            BuildMaterialSweep(g_sweepDim, right, up, sc.instances);
+        }
+        else
+        {
+            sc.instances.assign(1, material);
         }
-    }
 
-    g_sphereIndexCount = (UINT)inds.size();
+        SoftwareDraw d;
+        d.verts = sc.verts.data();
+        d.inds = sc.inds.data();
+        d.indexCount = (UINT)sc.inds.size();
+        d.instances = sc.instances.data();
+        d.instanceCount = (UINT)sc.instances.size();
+        sc.draws.push_back(d);
+        return true;
+    }
 
-    // Subir a GPU (UPLOAD como el cubo)
-    const UINT vbSize = (UINT)(verts.size() * sizeof(Vertex));
-    const UINT ibSize = (UINT)(inds.size() * sizeof(uint16_t));
+    ModelGeometryView model;
+    bool warm = false;
+    if (!LoadModelCPU(modelPath, sc.cacheFile, sc.imported, model, warm)) return false;
 
-    // VB
+    sc.quant = model.quant;
+    sc.instances.resize(model.instanceCount);
+    for (size_t i = 0; i < model.instanceCount; ++i)
+    {
+        sc.instances[i] = material;
+        sc.instances[i].world = model.instances[i].world;
+        sc.instances[i].normalWorld = NormalWorldFromStored(model.instances[i].world);
+    }
+    for (size_t i = 0; i < model.instanceCount; ++i)
     {
-        D3D12_HEAP_PROPERTIES hp = {}; hp.Type = D3D12_HEAP_TYPE_UPLOAD;
-        D3D12_RESOURCE_DESC rd = {};
-        rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        rd.Width = vbSize; rd.Height = 1; rd.DepthOrArraySize = 1;
-        rd.MipLevels = 1; rd.SampleDesc = { 1,0 }; rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        const ModelSubmesh& sm = model.submeshes[model.instances[i].submesh];
+        SoftwareDraw d;
+        d.verts = model.verts;
+        d.inds = model.inds;
+        d.indexCount = sm.indexCount;
+        d.firstIndex = sm.firstIndex;
+        d.baseVertex = (INT)sm.baseVertex;
+        d.instances = &sc.instances[i];
+        d.instanceCount = 1;
+        sc.draws.push_back(d);
+    }
+    return true;
+}
 
-        ThrowIfFailed(g_device->CreateCommittedResource(&hp, D3D12_HEAP_FLAG_NONE, &rd,
-            D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&g_sphereVB)));
+// CBData del frame 'frame' de una escena a pasos fijos de 'timestep' segundos: lo mismo que UpdateCB con g_fixedTimestep.
+CBData SoftwareSceneCB(const SoftwareScene& sc, UINT frame, float timestep)
+{
+    const float t = frame * timestep;
+    return BuildFrameCB(SceneWorldMatrix(sc.geom, t, sc.sweep), g_view * g_proj, t, sc.quant);
+}
 
-        void* data = nullptr; D3D12_RANGE rr = { 0,0 };
-        ThrowIfFailed(g_sphereVB->Map(0, &rr, &data));
-        memcpy(data, verts.data(), vbSize);
-        g_sphereVB->Unmap(0, nullptr);
+// Render por software sin ventana ni device (-software-render): cubo, esfera (LOD0) y modelo a Width × Height con la
+// cámara de InitCamera y la rotación de la app a 60 fps. 'frames' frames por escena con todos los núcleos; el último
+// se guarda como software_<escena>.tga. Después mide el escalado con la cantidad de hilos sobre el modelo.
+// Devuelve el exit code del proceso.
+int RunSoftwareRender(const std::string& modelPath, UINT frames = 30)
+{
+    InitCamera();
 
-        g_sphereVBView.BufferLocation = g_sphereVB->GetGPUVirtualAddress();
-        g_sphereVBView.StrideInBytes = sizeof(Vertex);
-        g_sphereVBView.SizeInBytes = vbSize;
+    std::deque<SoftwareScene> scenes; // deque: las escenas no se mueven al agregar
+    for (int geom = 0; geom < 3; ++geom)
+    {
+        scenes.emplace_back();
+        if (!BuildSoftwareScene(geom, false, modelPath, scenes.back()))
+        {
+            OutputDebugStringA("Software render: model load failed, rendering cube and sphere only\n");
+            scenes.pop_back();
+        }
     }
 
-    // IB
-    {
-        D3D12_HEAP_PROPERTIES hp = {}; hp.Type = D3D12_HEAP_TYPE_UPLOAD;
-        D3D12_RESOURCE_DESC rd = {};
-        rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        rd.Width = ibSize; rd.Height = 1; rd.DepthOrArraySize = 1;
-        rd.MipLevels = 1; rd.SampleDesc = { 1,0 }; rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+    SoftwareRasterizer raster;
+    SoftwareTarget target;
+    target.Resize(Width, Height);
+    char buf[320];
 
-        ThrowIfFailed(g_device->CreateCommittedResource(&hp, D3D12_HEAP_FLAG_NONE, &rd,
-            D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&g_sphereIB)));
+    auto renderFrames = [&](const SoftwareScene& sc, UINT threads, UINT count, SoftwareRasterStats& last)
+    {
+        double total = 0.0;
+        for (UINT f = 0; f < count; ++f)
+        {
+            raster.Render(SoftwareSceneCB(sc, f, 1.0f / 60.0f), sc.draws, target, threads, last);
+            total += last.totalMs;
+        }
+        return total / count;
+    };
 
-        void* data = nullptr; D3D12_RANGE rr = { 0,0 };
-        ThrowIfFailed(g_sphereIB->Map(0, &rr, &data));
-        memcpy(data, inds.data(), ibSize);
-        g_sphereIB->Unmap(0, nullptr);
+    for (const SoftwareScene& sc : scenes)
+    {
+        SoftwareRasterStats st;
+        const double avgMs = renderFrames(sc, 0, frames, st);
+        sprintf_s(buf, "Software render %-6s %ux%u: %.2f ms/frame (%.1f fps) over %u frames, %u threads | last: tris %zu, culled %zu, clipped %zu, "
+            "bin entries %zu, shaded px %zu | vs %.2f, setup %.2f, raster %.2f ms\n",
+            sc.name, Width, Height, avgMs, 1000.0 / avgMs, frames, st.threads, st.triangles, st.culled, st.clipped, st.binned,
+            st.pixelsShaded, st.vertexMs, st.setupMs, st.rasterMs);
+        OutputDebugStringA(buf);
+
+        const std::string file = std::string("software_") + sc.name + ".tga";
+        if (!WriteTga(file, target.width, target.height, target.color.data()))
+            OutputDebugStringA(("Software render: could not write " + file + "\n").c_str());
+    }
 
-        g_sphereIBView.BufferLocation = g_sphereIB->GetGPUVirtualAddress();
-        g_sphereIBView.Format = DXGI_FORMAT_R16_UINT;
-        g_sphereIBView.SizeInBytes = ibSize;
+    // Escalado con hilos sobre la escena más pesada (la última: el modelo si cargó)
+    const SoftwareScene& heavy = scenes.back();
+    const UINT maxThreads = Jobs().ThreadCount(); // los workers del rasterizador corren en el job system
+    double baseMs = 0.0;
+    for (UINT threads = 1; ; threads = (std::min)(threads * 2, maxThreads))
+    {
+        SoftwareRasterStats st;
+        const double ms = renderFrames(heavy, threads, (std::max)(1u, frames / 3), st);
+        if (threads == 1) baseMs = ms;
+        sprintf_s(buf, "Software render scaling (%s): %3u threads %8.2f ms/frame | speedup x%.2f | efficiency %.0f%%\n",
+            heavy.name, threads, ms, baseMs / ms, 100.0 * baseMs / ms / threads);
+        OutputDebugStringA(buf);
+        if (threads == maxThreads) break;
     }
+    return 0;
 }
 
-void ExtractMeshCPU(
-    const aiMesh* mesh,
-    std::vector<Vertex>& outVerts,
-    std::vector<uint32_t>& outIndices)
-{
-    outVerts.clear();
-    outIndices.clear();
-
-    outVerts.reserve(mesh->mNumVertices);
-    outIndices.reserve(mesh->mNumFaces * 3);
+//--------------------------------------------------------------------------------------
+// Render offscreen (batch)
+//--------------------------------------------------------------------------------------
 
-    const bool hasNormals = mesh->HasNormals();
+// -batch-render: sin ventana ni swap chain. Los "backbuffers" son texturas RGBA8 propias con el mismo formato, así
+// que RecordRender graba exactamente lo mismo que en pantalla. Cada frame además copia el color a un buffer READBACK de
+// su slot y marca dos timestamps (inicio y fin de la lista). El slot se lee recién cuando se vuelve a usar, así la GPU
+// dibuja el frame N+1 mientras la CPU escribe el PNG del N.
 
-    for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
-    {
-        const aiVector3D& p = mesh->mVertices[v];
-        XMFLOAT3 pos = XMFLOAT3(p.x, p.y, p.z);
+// Opciones de -batch-render (cada una es "-clave=valor" en la línea de comandos).
+struct BatchOptions
+{
+    std::string model;          // -model=       (por defecto el modelo de la app)
+    std::string outDir = "batch"; // -out=
+    std::string backend = "d3d12"; // -backend=d3d12 | warp (device por software) | software (rasterizador en CPU, sin device)
+    int  geom = 2;              // -geom=cube | sphere | model
+    UINT sweepDim = 0;          // -sweep=N: grilla de N × N esferas (0 = sin barrido)
+    UINT width = Width, height = Height; // -size=WxH
+    UINT frames = 120;          // -frames=
+    float fps = 60.0f;          // -fps=: paso fijo de 1 / fps segundos
+    int  metallicIdx = -1, roughnessIdx = -1, aoIdx = -1; // -material=m,r,a (índices de preset; -1 = el de la app)
+    int  mode = -1;             // -mode=0..5 (-1 = g_mode)
+};
 
-        XMFLOAT3 nrm = XMFLOAT3(0, 1, 0);
-        if (hasNormals)
-        {
-            const aiVector3D& n = mesh->mNormals[v];
-            nrm = XMFLOAT3(n.x, n.y, n.z);
-        }
+// Tiempos de un frame del batch, en ms. gpuMs < 0 = sin medición (rasterizador por software).
+struct BatchFrameTiming
+{
+    UINT   frame = 0;
+    float  time = 0.0f;  // segundos de animación
+    double cpuMs = 0.0;  // UpdateCB + RecordRender + Execute (software: el render entero)
+    double gpuMs = -1.0; // entre los timestamps del principio y el final de la command list
+    double waitMs = 0.0; // bloqueado esperando que la GPU libere el slot
+    double writeMs = 0.0; // readback + PNG
+};
 
-        // color debug por normal transformo [-1, 1]  →  [0, 1]
-        XMFLOAT3 col = XMFLOAT3(
-            0.5f * (nrm.x + 1.0f),
-            0.5f * (nrm.y + 1.0f),
-            0.5f * (nrm.z + 1.0f)
-        );
+struct BatchTargets
+{
+    bool active = false;
+    ComPtr<ID3D12QueryHeap> timestamps;     // 2 por slot: inicio y fin
+    ComPtr<ID3D12Resource>  timestampReadback;
+    ComPtr<ID3D12Resource>  readback[FrameCount];
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {}; // layout de una fila de la textura dentro del READBACK
+    UINT64 timestampFrequency = 1;
+    UINT   slotFrame[FrameCount];           // frame que se dibujó en cada slot, UINT32_MAX = vacío
+};
+static BatchTargets g_batch;
 
-        outVerts.push_back(Vertex{ pos, col, nrm });
-    }
+// Valor de "-clave=valor" en la línea de comandos: hasta el próximo espacio, o entre comillas si empieza con ".
+// Las rutas se pasan a char tal cual (ASCII), como el resto de la app que abre archivos con las APIs A.
+bool CmdLineOption(const wchar_t* cmdLine, const wchar_t* key, std::string& value)
+{
+    const wchar_t* p = cmdLine ? wcsstr(cmdLine, key) : nullptr;
+    if (!p) return false;
+    p += wcslen(key);
+    const wchar_t end = (*p == L'"') ? L'"' : L' ';
+    if (end == L'"') ++p;
+    value.clear();
+    for (; *p && *p != end; ++p) value.push_back((char)*p);
+    return true;
+}
 
-    for (unsigned int f = 0; f < mesh->mNumFaces; ++f)
-    {
-        const aiFace& face = mesh->mFaces[f];
-        if (face.mNumIndices != 3) continue;
+// Parsea las opciones del batch. Devuelve false (y lo loguea) si alguna es inválida. Los números se leen con signo: un
+// negativo pasado a UINT daría un -frames o un -sweep enorme en vez de un error. -1 en -material y -mode es el valor
+// por defecto ("el de la app"), así que si vienen en la línea de comandos tienen que estar en rango.
+bool ParseBatchOptions(const wchar_t* cmdLine, const std::string& defaultModel, BatchOptions& o)
+{
+    std::string v;
+    int sweep = (int)o.sweepDim, frames = (int)o.frames;
+    o.model = defaultModel;
+    if (CmdLineOption(cmdLine, L"-model=", v)) o.model = v;
+    if (CmdLineOption(cmdLine, L"-out=", v)) o.outDir = v;
+    if (CmdLineOption(cmdLine, L"-backend=", v)) o.backend = v;
+    if (CmdLineOption(cmdLine, L"-geom=", v)) o.geom = (v == "cube") ? 0 : (v == "sphere") ? 1 : (v == "model") ? 2 : -1;
+    if (CmdLineOption(cmdLine, L"-sweep=", v)) sweep = atoi(v.c_str());
+    if (CmdLineOption(cmdLine, L"-size=", v) && sscanf_s(v.c_str(), "%ux%u", &o.width, &o.height) != 2) o.width = 0;
+    if (CmdLineOption(cmdLine, L"-frames=", v)) frames = atoi(v.c_str());
+    if (CmdLineOption(cmdLine, L"-fps=", v)) o.fps = (float)atof(v.c_str());
+    const bool material = CmdLineOption(cmdLine, L"-material=", v);
+    if (material && sscanf_s(v.c_str(), "%d,%d,%d", &o.metallicIdx, &o.roughnessIdx, &o.aoIdx) != 3) o.metallicIdx = -1;
+    const bool mode = CmdLineOption(cmdLine, L"-mode=", v);
+    if (mode) o.mode = atoi(v.c_str());
+
+    const int presets = (int)(sizeof(g_metallicPresets) / sizeof(float));
+    auto preset = [presets](int i) { return i >= 0 && i < presets; };
+    const char* error = nullptr;
+    if (o.geom < 0) error = "-geom must be cube, sphere or model";
+    else if (o.backend != "d3d12" && o.backend != "warp" && o.backend != "software") error = "-backend must be d3d12, warp or software";
+    else if (o.width == 0 || o.height == 0 || o.width > 16384 || o.height > 16384) error = "-size must be WxH, up to 16384x16384";
+    else if (frames <= 0 || frames > 1000000) error = "-frames must be 1..1000000";
+    else if (!(o.fps > 0.0f)) error = "-fps must be positive";
+    else if (sweep < 0 || sweep > (int)g_sweepMaxDim) error = "-sweep must be 0 up to the maximum grid";
+    else if (material && !(preset(o.metallicIdx) && preset(o.roughnessIdx) && preset(o.aoIdx))) error = "-material must be three preset indices m,r,a in 0..3";
+    else if (mode && (o.mode < 0 || o.mode > 5)) error = "-mode must be 0..5";
+    if (error) OutputDebugStringA((std::string("Batch render: ") + error + "\n").c_str());
+    o.sweepDim = (UINT)(std::max)(sweep, 0);
+    o.frames = (UINT)(std::max)(frames, 0);
+    return error == nullptr;
+}
 
-        outIndices.push_back((uint32_t)face.mIndices[0]);
-        outIndices.push_back((uint32_t)face.mIndices[1]);
-        outIndices.push_back((uint32_t)face.mIndices[2]);
-    }
+// Aplica las opciones a los globals que leen UpdateCB / InitCamera / BuildSoftwareScene.
+void ApplyBatchOptions(const BatchOptions& o)
+{
+    g_renderWidth = o.width;
+    g_renderHeight = o.height;
+    g_viewport = { 0.0f, 0.0f, (float)o.width, (float)o.height, 0.0f, 1.0f };
+    g_scissorRect = { 0, 0, (LONG)o.width, (LONG)o.height };
+
+    g_geomMode = o.geom;
+    g_sweepEnabled = o.sweepDim > 0;
+    if (g_sweepEnabled) { g_sweepDim = o.sweepDim; g_sweepDirty = true; }
+    if (o.metallicIdx >= 0) { g_metallicIdx = o.metallicIdx; g_metallic = g_metallicPresets[g_metallicIdx]; }
+    if (o.roughnessIdx >= 0) { g_roughnessIdx = o.roughnessIdx; g_roughness = g_roughnessPresets[g_roughnessIdx]; }
+    if (o.aoIdx >= 0) { g_aoIdx = o.aoIdx; g_ao = g_aoPresets[g_aoIdx]; g_sweepDirty = true; }
+    if (o.mode >= 0) g_mode = o.mode;
+    g_fixedTimestep = 1.0f / o.fps;
+    g_fixedFrame = 0;
 }
 
-void CreateCustomModelGeometry(const std::string& fileName)
+// Reemplazo de CreateSwapchainAndRTVs para el batch: texturas RGBA8 en DEFAULT como backbuffers (en estado PRESENT =
+// COMMON, igual que los del swap chain), sus RTVs y allocators, más los buffers de readback y los timestamps.
+void CreateOffscreenTargets()
 {
-    Assimp::Importer importer;
+    D3D12_DESCRIPTOR_HEAP_DESC rtvDesc = {};
+    rtvDesc.NumDescriptors = FrameCount;
+    rtvDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+    rtvDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+    ThrowIfFailed(g_device->CreateDescriptorHeap(&rtvDesc, IID_PPV_ARGS(&g_rtvHeap)));
+    g_rtvDescriptorSize = g_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+
+    D3D12_RESOURCE_DESC tex = {};
+    tex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+    tex.Width = g_renderWidth;
+    tex.Height = g_renderHeight;
+    tex.DepthOrArraySize = 1;
+    tex.MipLevels = 1;
+    tex.Format = ChooseBackbufferFormat();
+    tex.SampleDesc = { 1, 0 };
+    tex.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+    tex.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
 
-    const unsigned int flags =
-        aiProcess_Triangulate |
-        aiProcess_FlipUVs |
-        aiProcess_GenSmoothNormals |
-        aiProcess_JoinIdenticalVertices;
+    D3D12_CLEAR_VALUE clear = {};
+    clear.Format = ChooseBackbufferFormat();
+    clear.Color[0] = 0.07f; clear.Color[1] = 0.1f; clear.Color[2] = 0.16f; clear.Color[3] = 1.0f; // clearColor de RecordRender
 
-    const aiScene* scene = importer.ReadFile(fileName, flags);
+    // Una fila de la textura en el READBACK va alineada a D3D12_TEXTURE_DATA_PITCH_ALIGNMENT (256 bytes)
+    UINT64 readbackSize = 0;
+    g_device->GetCopyableFootprints(&tex, 0, 1, 0, &g_batch.footprint, nullptr, nullptr, &readbackSize);
 
-    if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode || scene->mNumMeshes == 0)
+    D3D12_CPU_DESCRIPTOR_HANDLE rtvHandle = g_rtvHeap->GetCPUDescriptorHandleForHeapStart();
+    for (UINT i = 0; i < FrameCount; ++i)
     {
-        OutputDebugStringA("Assimp load failed:\n");
-        OutputDebugStringA(importer.GetErrorString());
-        OutputDebugStringA("\n");
-        return;
+        g_renderTargets[i] = CreateGpuResource(D3D12_HEAP_TYPE_DEFAULT, tex, D3D12_RESOURCE_STATE_PRESENT, &clear);
+        g_resourceStates.Register(g_renderTargets[i].Get(), 1, D3D12_RESOURCE_STATE_PRESENT);
+        g_device->CreateRenderTargetView(g_renderTargets[i].Get(), nullptr, rtvHandle);
+        rtvHandle.ptr += g_rtvDescriptorSize;
+        ThrowIfFailed(g_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&g_cmdAlloc[i])));
+
+        g_batch.readback[i] = CreateGpuResource(D3D12_HEAP_TYPE_READBACK, BufferDesc(readbackSize), D3D12_RESOURCE_STATE_COPY_DEST);
+        g_resourceStates.Register(g_batch.readback[i].Get(), 1, D3D12_RESOURCE_STATE_COPY_DEST); // un READBACK nunca sale de COPY_DEST
+        g_batch.slotFrame[i] = UINT32_MAX;
     }
 
-    const aiMesh* mesh = scene->mMeshes[0];
+    D3D12_QUERY_HEAP_DESC qh = {};
+    qh.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    qh.Count = FrameCount * 2;
+    ThrowIfFailed(g_device->CreateQueryHeap(&qh, IID_PPV_ARGS(&g_batch.timestamps)));
+    g_batch.timestampReadback = CreateGpuResource(D3D12_HEAP_TYPE_READBACK, BufferDesc(FrameCount * 2 * sizeof(UINT64)),
+        D3D12_RESOURCE_STATE_COPY_DEST);
+    ThrowIfFailed(g_cmdQueue->GetTimestampFrequency(&g_batch.timestampFrequency));
 
-    std::vector<Vertex> verts;
-    std::vector<uint32_t> inds;
+    g_frameIndex = 0;
+    g_batch.active = true;
+}
 
-    ExtractMeshCPU(mesh, verts, inds);
+// Pasada "readback" del grafo: copia del color al READBACK del slot, timestamp de fin y resolve de los dos timestamps
+// del slot. El grafo ya dejó la textura en COPY_SOURCE y de ahí la pasa directo a PRESENT.
+void RecordBatchReadback(ID3D12GraphicsCommandList* cl, ID3D12Resource* rt)
+{
+    D3D12_TEXTURE_COPY_LOCATION src = {};
+    src.pResource = rt;
+    src.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+    src.SubresourceIndex = 0;
+    D3D12_TEXTURE_COPY_LOCATION dst = {};
+    dst.pResource = g_batch.readback[g_frameIndex].Get();
+    dst.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+    dst.PlacedFootprint = g_batch.footprint;
+    cl->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+
+    cl->EndQuery(g_batch.timestamps.Get(), D3D12_QUERY_TYPE_TIMESTAMP, g_frameIndex * 2 + 1);
+    cl->ResolveQueryData(g_batch.timestamps.Get(), D3D12_QUERY_TYPE_TIMESTAMP, g_frameIndex * 2, 2,
+        g_batch.timestampReadback.Get(), g_frameIndex * 2 * sizeof(UINT64));
+}
 
-    g_modelIndexCount = (UINT)inds.size();
+// Lee el frame que quedó en 'slot' (la GPU ya lo terminó): tiempo de GPU y PNG. No hace nada si el slot está vacío.
+void ResolveBatchSlot(UINT slot, const std::string& outDir, std::vector<BatchFrameTiming>& timings, std::vector<uint32_t>& pixels)
+{
+    const UINT frame = g_batch.slotFrame[slot];
+    if (frame == UINT32_MAX) return;
+    g_batch.slotFrame[slot] = UINT32_MAX;
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    D3D12_RANGE tsRange = { slot * 2 * sizeof(UINT64), (slot * 2 + 2) * sizeof(UINT64) };
+    UINT64* ts = nullptr;
+    ThrowIfFailed(g_batch.timestampReadback->Map(0, &tsRange, reinterpret_cast<void**>(&ts)));
+    timings[frame].gpuMs = double(ts[slot * 2 + 1] - ts[slot * 2]) * 1000.0 / double(g_batch.timestampFrequency);
+    D3D12_RANGE noWrite = { 0, 0 };
+    g_batch.timestampReadback->Unmap(0, &noWrite);
+
+    const D3D12_SUBRESOURCE_FOOTPRINT& fp = g_batch.footprint.Footprint;
+    D3D12_RANGE range = { 0, (SIZE_T)fp.RowPitch * fp.Height };
+    uint8_t* data = nullptr;
+    ThrowIfFailed(g_batch.readback[slot]->Map(0, &range, reinterpret_cast<void**>(&data)));
+    pixels.resize((size_t)fp.Width * fp.Height);
+    for (UINT y = 0; y < fp.Height; ++y)
+        memcpy(&pixels[(size_t)y * fp.Width], data + (size_t)y * fp.RowPitch, fp.Width * sizeof(uint32_t)); // RGBA8: R en el byte bajo
+    g_batch.readback[slot]->Unmap(0, &noWrite);
+
+    char name[64];
+    sprintf_s(name, "/frame_%04u.png", frame);
+    if (!WritePng(outDir + name, fp.Width, fp.Height, pixels.data()))
+        OutputDebugStringA(("Batch render: could not write " + outDir + name + "\n").c_str());
+    timings[frame].writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
 
-    // --- VB (UPLOAD) ---
+// timings.json del batch: la configuración, un resumen y una entrada por frame.
+bool WriteBatchTimings(const BatchOptions& o, const char* device, const std::vector<BatchFrameTiming>& timings, double totalMs)
+{
+    auto escape = [](const std::string& s)
     {
-        const UINT vbSize = (UINT)(verts.size() * sizeof(Vertex));
-
-        D3D12_HEAP_PROPERTIES hp = {};
-        hp.Type = D3D12_HEAP_TYPE_UPLOAD;
-
-        D3D12_RESOURCE_DESC rd = {};
-        rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        rd.Width = vbSize;
-        rd.Height = 1;
-        rd.DepthOrArraySize = 1;
-        rd.MipLevels = 1;
-        rd.SampleDesc = { 1, 0 };
-        rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-
-        ThrowIfFailed(g_device->CreateCommittedResource(
-            &hp, D3D12_HEAP_FLAG_NONE, &rd,
-            D3D12_RESOURCE_STATE_GENERIC_READ,
-            nullptr, IID_PPV_ARGS(&g_modelVB)));
-
-        void* data = nullptr;
-        D3D12_RANGE rr = { 0, 0 };
-        ThrowIfFailed(g_modelVB->Map(0, &rr, &data));
-        memcpy(data, verts.data(), vbSize);
-        g_modelVB->Unmap(0, nullptr);
+        std::string r;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\') r.push_back('\\');
+            if ((unsigned char)c >= 0x20) r.push_back(c);
+        }
+        return r;
+    };
+    auto stats = [&](double BatchFrameTiming::* field, double& avg, double& mx)
+    {
+        avg = 0.0; mx = 0.0;
+        for (const BatchFrameTiming& t : timings) { avg += t.*field; mx = (std::max)(mx, t.*field); }
+        avg /= timings.size();
+    };
 
-        g_modelVBView.BufferLocation = g_modelVB->GetGPUVirtualAddress();
-        g_modelVBView.StrideInBytes = sizeof(Vertex);
-        g_modelVBView.SizeInBytes = vbSize;
+    FILE* f = nullptr;
+    const std::string path = o.outDir + "/timings.json";
+    if (fopen_s(&f, path.c_str(), "wb") != 0 || !f) return false;
+
+    static const char* geomNames[] = { "cube", "sphere", "model" };
+    fprintf(f, "{\n");
+    fprintf(f, "  \"backend\": \"%s\",\n  \"device\": \"%s\",\n", o.backend.c_str(), escape(device).c_str());
+    fprintf(f, "  \"width\": %u,\n  \"height\": %u,\n  \"geometry\": \"%s\",\n  \"model\": \"%s\",\n  \"sweep\": %u,\n",
+        o.width, o.height, geomNames[o.geom], escape(o.model).c_str(), o.sweepDim);
+    fprintf(f, "  \"material\": { \"metallic\": %g, \"roughness\": %g, \"ao\": %g },\n  \"mode\": %d,\n", g_metallic, g_roughness, g_ao, g_mode);
+    fprintf(f, "  \"frames\": %u,\n  \"timestep\": %.9g,\n  \"totalMs\": %.3f,\n", o.frames, 1.0 / o.fps, totalMs);
+
+    double avg, mx;
+    fprintf(f, "  \"summary\": {");
+    stats(&BatchFrameTiming::cpuMs, avg, mx);
+    fprintf(f, " \"cpuMsAvg\": %.4f, \"cpuMsMax\": %.4f,", avg, mx);
+    if (o.backend != "software")
+    {
+        stats(&BatchFrameTiming::gpuMs, avg, mx);
+        fprintf(f, " \"gpuMsAvg\": %.4f, \"gpuMsMax\": %.4f,", avg, mx);
     }
+    stats(&BatchFrameTiming::writeMs, avg, mx);
+    fprintf(f, " \"writeMsAvg\": %.4f },\n", avg);
 
-    // --- IB (UPLOAD) 32-bit ---
+    fprintf(f, "  \"perFrame\": [\n");
+    for (size_t i = 0; i < timings.size(); ++i)
     {
-        const UINT ibSize = (UINT)(inds.size() * sizeof(uint32_t));
-
-        D3D12_HEAP_PROPERTIES hp = {};
-        hp.Type = D3D12_HEAP_TYPE_UPLOAD;
-
-        D3D12_RESOURCE_DESC rd = {};
-        rd.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        rd.Width = ibSize;
-        rd.Height = 1;
-        rd.DepthOrArraySize = 1;
-        rd.MipLevels = 1;
-        rd.SampleDesc = { 1, 0 };
-        rd.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-
-        ThrowIfFailed(g_device->CreateCommittedResource(
-            &hp, D3D12_HEAP_FLAG_NONE, &rd,
-            D3D12_RESOURCE_STATE_GENERIC_READ,
-            nullptr, IID_PPV_ARGS(&g_modelIB)));
-
-        void* data = nullptr;
-        D3D12_RANGE rr = { 0, 0 };
-        ThrowIfFailed(g_modelIB->Map(0, &rr, &data));
-        memcpy(data, inds.data(), ibSize);
-        g_modelIB->Unmap(0, nullptr);
-
-        g_modelIBView.BufferLocation = g_modelIB->GetGPUVirtualAddress();
-        g_modelIBView.Format = DXGI_FORMAT_R32_UINT;
-        g_modelIBView.SizeInBytes = ibSize;
+        const BatchFrameTiming& t = timings[i];
+        char gpu[32];
+        if (t.gpuMs < 0.0) strcpy_s(gpu, "null"); else sprintf_s(gpu, "%.4f", t.gpuMs);
+        fprintf(f, "    { \"frame\": %u, \"time\": %.6f, \"image\": \"frame_%04u.png\", \"cpuMs\": %.4f, \"gpuMs\": %s, \"waitMs\": %.4f, \"writeMs\": %.4f }%s\n",
+            t.frame, t.time, t.frame, t.cpuMs, gpu, t.waitMs, t.writeMs, (i + 1 < timings.size()) ? "," : "");
     }
-
-    char buf[256];
-    sprintf_s(buf, "Model GPU upload OK. Verts: %zu | Indices: %zu\n", verts.size(), inds.size());
-    OutputDebugStringA(buf);
+    fprintf(f, "  ]\n}\n");
+    const bool ok = ferror(f) == 0;
+    fclose(f);
+    return ok;
 }
 
-//--------------------------------------------------------------------------------------
-// Init de matrices de cámara
-//--------------------------------------------------------------------------------------
-void InitCamera()
+// Batch con el rasterizador por software (-backend=software): no crea device, corre en cualquier máquina de CI.
+// Mismas escenas, cámara, pasos de tiempo y archivos de salida que el batch por D3D12.
+int RunSoftwareBatch(const BatchOptions& o)
 {
-    // Configura view / projection y guarda la posición de la cámara.
+    InitCamera();
+    SoftwareScene scene;
+    if (!BuildSoftwareScene(o.geom, o.sweepDim > 0, o.model, scene))
+    {
+        OutputDebugStringA(("Batch render: could not load " + o.model + "\n").c_str());
+        return 1;
+    }
 
-    XMVECTOR eye = XMVectorSet(1.5f, 1.2f, -2.0f, 0.0f);
-    XMVECTOR at = XMVectorSet(0, 0, 0, 0);
-    XMVECTOR up = XMVectorSet(0, 1, 0, 0);
+    SoftwareRasterizer raster;
+    SoftwareTarget target;
+    target.Resize(o.width, o.height);
+    std::vector<BatchFrameTiming> timings(o.frames);
 
-    g_view = XMMatrixLookAtLH(eye, at, up);
-    g_proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(60.f), float(Width) / float(Height), 0.1f, 100.0f);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (UINT f = 0; f < o.frames; ++f)
+    {
+        BatchFrameTiming& t = timings[f];
+        t.frame = f;
+        t.time = f * g_fixedTimestep;
+
+        SoftwareRasterStats st;
+        raster.Render(SoftwareSceneCB(scene, f, g_fixedTimestep), scene.draws, target, 0, st);
+        t.cpuMs = st.totalMs;
+
+        auto w0 = std::chrono::high_resolution_clock::now();
+        char name[64];
+        sprintf_s(name, "/frame_%04u.png", f);
+        if (!WritePng(o.outDir + name, target.width, target.height, target.color.data()))
+            OutputDebugStringA(("Batch render: could not write " + o.outDir + name + "\n").c_str());
+        t.writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - w0).count();
+    }
+    const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
 
-    XMStoreFloat3(&g_eyeWS, eye); // para PBR, vector V en shader.
+    char device[64];
+    sprintf_s(device, "software rasterizer, %u threads", Jobs().ThreadCount());
+    return WriteBatchTimings(o, device, timings, totalMs) ? 0 : 1;
 }
 
 //--------------------------------------------------------------------------------------
@@ -1161,129 +10855,275 @@ void UpdateCB()
     // delta t para rotación del cubo (acumulado solo si no está en pausa)
     float dt = std::chrono::duration<float>(t1 - g_prevTick).count();
     g_prevTick = t1;
-    if (!g_pauseRotation) {
+    if (g_fixedTimestep > 0.0f) { // batch: frame N = N pasos fijos, tarde lo que tarde cada frame
+        seconds = g_fixedFrame++ * g_fixedTimestep;
+        g_rotTime = seconds;
+    }
+    else if (!g_pauseRotation) {
         g_rotTime += dt;
     }
 
-    // Matriz de mundo: usar g_rotTime (no seconds) para la rotación del cubo
-    XMMATRIX mWorld =
-        XMMatrixRotationX(g_rotTime * 0.7f) *
-        XMMatrixRotationY(g_rotTime * 1.1f);
-
-    if (g_geomMode == 2) // modelo
+    const int geom = DrawnGeometry();
+    const XMMATRIX mWorld = SceneWorldMatrix(geom, g_rotTime, g_sweepEnabled);
+    XMMATRIX viewProj = g_view * g_proj;
+
+    // AABB de la malla que se dibuja este frame (el barrido usa la esfera)
+    const VertexQuantization& quant =
+        (g_sweepEnabled || geom == 1) ? g_sphereQuant :
+        (geom == 0) ? g_cubeQuant : g_modelQuant;
+    const CBData cb = BuildFrameCB(mWorld, viewProj, seconds, quant);
+
+    // Sub-asignación del frame actual (la GPU puede seguir leyendo la del frame anterior). Si la página se llena
+    // la dirección queda en 0 y BuildMainDraws saltea lo que la usa (queda contado en OverflowCount).
+    CBData* dst = g_uploadAllocator.AllocateConstants<CBData>(g_cbAddr);
+    if (dst) *dst = cb;
+
+    // Instancia única del draw normal: transform identidad + material desde presets / teclas
+    InstanceData material;
+    SetInstanceTransform(material, XMMatrixIdentity());
+    material.baseColor = g_baseColor;
+    material.metallic = g_metallic;   // 0..1, tecla M
+    material.roughness = g_roughness; // 0..1, tecla R
+    material.ao = g_ao;               // 0..1, tecla A
+    material._pad = XMFLOAT2(0, 0);
+    if (InstanceData* inst = g_uploadAllocator.AllocateConstants<InstanceData>(g_instanceAddr)) *inst = material;
+
+    // LOD de la esfera: la sola está en el origen con escala 1; la grilla del barrido es perpendicular a la vista
+    // y pasa por el origen, así que ninguna esfera está más cerca que la distancia de la cámara al origen.
+    if (g_sweepEnabled || geom == 1)
     {
-        mWorld = XMMatrixScaling(0.25f, 0.25f, 0.25f) * mWorld;
+        const float eyeDist = XMVectorGetX(XMVector3Length(XMLoadFloat3(&g_eyeWS)));
+        const float scale = g_sweepEnabled ? SweepSphereScale(g_sweepDim) : 1.0f;
+        const UINT lod = SelectSphereLod(scale, eyeDist - 0.5f * scale, g_proj);
+        if (lod != g_sphereLod) { g_sphereLod = lod; UpdateWindowTitle(); }
     }
 
-    XMMATRIX mvp = mWorld * g_view * g_proj;
+    // Instancias del modelo (jerarquía aplanada): transform de cada nodo + el mismo material de presets
+    if (geom == 2 && !g_sweepEnabled && !g_modelInstances.empty())
+    {
+        UploadAllocation a = g_uploadAllocator.Allocate(g_modelInstances.size() * sizeof(InstanceData));
+        g_modelInstanceAddr = a.gpu; // 0 si no entró: este frame no se dibuja el modelo
 
-    // luz direccional fija en mundo (arriba-derecha-atrás)
-    XMVECTOR L = XMVector3Normalize(XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f));
+        // Por bloques en el job system (escenas chicas en este hilo); cada bloque escribe un rango propio del upload
+        InstanceData* dstInst = reinterpret_cast<InstanceData*>(a.cpu);
+        if (dstInst) ParallelFor((UINT)g_modelInstances.size(), 4096, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; ++i)
+            {
+                dstInst[i] = material;
+                dstInst[i].world = g_modelInstances[i].world;
+                dstInst[i].normalWorld = g_modelNormalWorlds[i];
+            }
+        });
+    }
 
-    // Poblar CBData
-    CBData cb;
-    cb.mvp = XMMatrixTranspose(mvp);
-    cb.world = mWorld;
-    XMStoreFloat3(&cb.lightDir, L);
-    cb.ambient = 0.15f;      // ambiente base
-    cb.mode = g_mode;     // desde el toggle
+    // LOD por instancia según el error proyectado (o el forzado con la tecla L)
+    const bool drawModel = geom == 2 && !g_sweepEnabled && !g_modelInstances.empty() && g_cbAddr && g_modelInstanceAddr;
+    if (drawModel)
+    {
+        SelectModelLods(mWorld, g_proj, g_eyeWS);
+        if (++g_cullTitleFrames >= 30) { g_cullTitleFrames = 0; UpdateWindowTitle(); } // LOD y triángulos enviados en el título
+    }
 
-    cb.viewPos = g_eyeWS;     
-    cb.shininess = 64.0f;     // pruebitas: 32-128
-    cb.specIntensity = 0.6f;  // k_s
+    // Culling por meshlet: IB compactado del frame con lo que queda dentro del frustum y de frente a la cámara
+    g_culledThisFrame = false;
+    if (drawModel && g_meshletCulling && !g_modelMeshlets.empty())
+    {
+        CullModelMeshlets(ModelRuntimeView(), g_instanceLods.data(), mWorld, viewProj, g_eyeWS, g_culledIndices, g_culledDraws, g_cullStats);
 
-    // Material desde presets / teclas
-    cb.baseColor = g_baseColor;
-    cb.metallic = g_metallic;   // 0..1, tecla M
-    cb.roughness = g_roughness;  // 0..1, tecla R
-    cb.ao = g_ao;         // 0..1, tecla A
+        if (g_culledIndices.empty())
+        {
+            g_culledThisFrame = true; // todo afuera: no hay nada que dibujar
+        }
+        else
+        {
+            const UINT ibSize = (UINT)(g_culledIndices.size() * sizeof(uint32_t));
+            UploadAllocation ib = g_uploadAllocator.Allocate(ibSize, sizeof(uint32_t));
+            if (ib.cpu) // si no entra en la página se dibuja el modelo entero (queda contado en OverflowCount)
+            {
+                memcpy(ib.cpu, g_culledIndices.data(), ibSize);
+                g_culledIBView.BufferLocation = ib.gpu;
+                g_culledIBView.Format = DXGI_FORMAT_R32_UINT;
+                g_culledIBView.SizeInBytes = ibSize;
+                g_culledThisFrame = true;
+            }
+        }
+    }
+}
 
-    XMFLOAT3 lightPosWS;
-    if (g_lightPinnedFront) {
-        // vector forward de la cámara hacia el origen (0,0,0)
-        XMVECTOR eyeV = XMLoadFloat3(&g_eyeWS);
-        XMVECTOR toOrigin = XMVector3Normalize(XMVectorSubtract(XMVectorZero(), eyeV));
-        XMVECTOR posV = XMVectorAdd(eyeV, XMVectorScale(toOrigin, g_lightFrontDist));
-        XMStoreFloat3(&lightPosWS, posV);
+// Draws de la pasada principal según la geometría elegida, en orden de grabación.
+void BuildMainDraws(std::vector<DrawItem>& out)
+{
+    out.clear();
+    if (!g_cbAddr) return; // el CB del frame no entró en la página de upload: solo el clear
+
+    DrawItem d;
+    const int geom = DrawnGeometry();
+    if (g_sweepEnabled) // Barrido: toda la grilla de esferas en un solo draw instanciado
+    {
+        const SphereLod& lod = g_sphereLods[g_sphereLod];
+        d.vb = &g_sphereVBView; d.ib = &g_sphereIBView; d.instances = g_sweepInstances->GetGPUVirtualAddress();
+        d.indexCount = lod.indexCount; d.instanceCount = g_sweepInstanceCount; d.firstIndex = lod.firstIndex; d.baseVertex = lod.baseVertex;
+        out.push_back(d);
     }
-    else {
-        // órbita simple en XZ
-        float radius = 1.2f;                // 1.2 para que pase bien por delante
-        float angle = seconds;             // velocidad 1 rad/s
-        lightPosWS = XMFLOAT3(cosf(angle) * radius, 1.0f, sinf(angle) * radius);
+    else if (geom == 0) // Cubo (también placeholder mientras carga el modelo)
+    {
+        if (!g_instanceAddr) return; // la instancia no entró en la página de upload
+        d.vb = &g_vbView; d.ib = &g_ibView; d.instances = g_instanceAddr;
+        d.indexCount = 36; //36 índices para el cubo
+        out.push_back(d);
+    }
+    else if (geom == 1) // Esfera
+    {
+        if (!g_instanceAddr) return;
+        const SphereLod& lod = g_sphereLods[g_sphereLod];
+        d.vb = &g_sphereVBView; d.ib = &g_sphereIBView; d.instances = g_instanceAddr;
+        d.indexCount = lod.indexCount; d.firstIndex = lod.firstIndex; d.baseVertex = lod.baseVertex;
+        out.push_back(d);
+    }
+    else if (!g_modelInstanceAddr) // 2: Modelo, las instancias no entraron en la página de upload
+        return;
+    else if (g_culledThisFrame) // 2: Modelo, meshlets visibles: una draw por instancia sobre el IB compactado
+    {
+        d.vb = &g_modelVBView; d.ib = &g_culledIBView;
+        for (const CulledDraw& c : g_culledDraws)
+        {
+            d.instances = g_modelInstanceAddr + c.instance * sizeof(InstanceData);
+            d.indexCount = c.indexCount; d.firstIndex = c.firstIndex; d.baseVertex = c.baseVertex;
+            out.push_back(d);
+        }
+    }
+    else // 2: Modelo
+    {
+        d.vb = &g_modelVBView; d.ib = &g_modelIBView;
+        for (size_t di = 0; di < g_modelDraws.size(); ++di)
+        {
+            const ModelDraw& m = g_modelDraws[di];
+            const ModelSubmesh& sm = g_modelSubmeshes[m.submesh];
+            const ModelLod& lod = g_modelLods[sm.firstLod + g_drawLods[di]];
+            // SV_InstanceID no suma StartInstanceLocation: el offset de la primera instancia va en la dirección del SRV
+            d.instances = g_modelInstanceAddr + m.firstInstance * sizeof(InstanceData);
+            d.indexCount = lod.indexCount; d.instanceCount = m.instanceCount; d.firstIndex = lod.firstIndex; d.baseVertex = (INT)sm.baseVertex;
+            out.push_back(d);
+        }
     }
+}
 
-    // Colocar en el CB
-    cb.lightPos = lightPosWS;
-    cb.lightIntensity = g_lightIntensity;
-    cb.lightColor = g_lightColor;
+// Pasada principal del grafo: clear de color y depth y los draws de la geometría elegida. Los estados (RT y
+// DEPTH_WRITE) ya los pidió el grafo. Con muchos draws, los rangos se graban en paralelo en g_recordLists (después
+// de 'cl' en el envío) y el resto del frame sigue en la lista siguiente a la del último rango.
+void RecordMainPass(ID3D12GraphicsCommandList* cl)
+{
+    // RTV/DSV handles
+    PassState state = g_framePassState;
+    state.rtv = g_rtvHeap->GetCPUDescriptorHandleForHeapStart();
+    state.rtv.ptr += g_frameIndex * g_rtvDescriptorSize; //Calculo el handle del RTV del frame actual.
+    state.dsv = g_dsvHeap->GetCPUDescriptorHandleForHeapStart();
+    state.targets = true;
+
+    // Limpio color y depth
+    const float clearColor[4] = { 0.07f, 0.1f, 0.16f, 1.0f };
+    cl->ClearRenderTargetView(state.rtv, clearColor, 0, nullptr);
+    cl->ClearDepthStencilView(state.dsv, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+
+    // Bind del render target + depth al pipeline (OM = Output Merger).
+    cl->OMSetRenderTargets(1, &state.rtv, FALSE, &state.dsv);
 
-    *g_cbMapped = cb;
+    // Draw según geometría
+    BuildMainDraws(g_mainDraws);
+    const UINT lists = g_parallelRecording ? DrawListCount(g_mainDraws.size(), (std::min)(Jobs().ThreadCount(), MaxRecordLists - 1), MinDrawsPerList) : 1;
+    if (lists <= 1)
+    {
+        RecordDraws(cl, g_mainDraws.data(), g_mainDraws.size());
+        return;
+    }
 
+    ComPtr<ID3D12CommandAllocator>* allocs = g_recordAlloc[g_frameIndex];
+    auto open = [&](UINT j)
+    {
+        ID3D12GraphicsCommandList* list = g_recordLists[j].Get();
+        ThrowIfFailed(allocs[j]->Reset());
+        ThrowIfFailed(list->Reset(allocs[j].Get(), state.pso));
+        RecordPassState(list, state);
+        return list;
+    };
+    RecordDrawsParallel(g_mainDraws.data(), g_mainDraws.size(), lists, open,
+        [](UINT, ID3D12GraphicsCommandList* list) { ThrowIfFailed(list->Close()); });
+    for (UINT j = 0; j < lists; ++j) g_submitLists.push_back(g_recordLists[j].Get());
+
+    // Continuación: las pasadas que siguen (readback, present) se graban acá, detrás de los rangos
+    g_recordingList = open(lists);
+    g_submitLists.push_back(g_recordingList);
+    ++g_parallelFrames;
+    g_parallelLists += lists;
 }
 
 void RecordRender()
 {
     // Grabo la lista de comandos que el GPU va a ejecutar para este frame
 
-    // Limpio el allocator del frame, reseteo la command list y le asocio el PSO (g_pso).
+    // Limpio el allocator del frame, reseteo la command list y le asocio el PSO de la permutación actual (g_pipelines).
+
+    g_framePassState.pso = g_pipelines.Get(CurrentPipelineKey().Pack()).Get(); // PSO de la permutación actual
+    g_framePassState.rootSig = g_rootSig.Get();
+    g_framePassState.cb = g_cbAddr; //Bind del CBData de este frame (root param 0 → CBV en b0).
+    g_framePassState.instances = g_instanceAddr; //Bind de InstanceData (root param 1 → SRV en t0).
+    g_framePassState.viewport = g_viewport;
+    g_framePassState.scissor = g_scissorRect;
 
     ThrowIfFailed(g_cmdAlloc[g_frameIndex]->Reset());
-    ThrowIfFailed(g_cmdList->Reset(g_cmdAlloc[g_frameIndex].Get(), g_pso.Get()));
+    ThrowIfFailed(g_cmdList->Reset(g_cmdAlloc[g_frameIndex].Get(), g_framePassState.pso));
+    g_submitLists.assign(1, g_cmdList.Get());
+    g_recordingList = g_cmdList.Get();
 
-    // Seteo de estado de pipeline base
-    g_cmdList->SetGraphicsRootSignature(g_rootSig.Get());
-    g_cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST); //Topología triángulo
-    //g_cmdList->IASetVertexBuffers(0, 1, &g_vbView);
-    //g_cmdList->IASetIndexBuffer(&g_ibView);
-    g_cmdList->SetGraphicsRootConstantBufferView(0, g_cb->GetGPUVirtualAddress()); //Bind del constant buffer (root param 0 → CBV en b0).
-    g_cmdList->RSSetViewports(1, &g_viewport);
-    g_cmdList->RSSetScissorRects(1, &g_scissorRect);
+    // Seteo de estado de pipeline base (root signature, topología triángulo, CB, viewport/scissor, instancias)
+    if (g_batch.active) g_cmdList->EndQuery(g_batch.timestamps.Get(), D3D12_QUERY_TYPE_TIMESTAMP, g_frameIndex * 2); // batch: inicio del frame en GPU
+    RecordPassState(g_cmdList.Get(), g_framePassState);
 
     // Elegir el backbuffer actual
     auto bb = g_renderTargets[g_frameIndex].Get();
 
-    // Transition BB a Render Target
-    Transition(g_cmdList.Get(), bb, D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET);
-
-    // RTV/DSV handles
-    D3D12_CPU_DESCRIPTOR_HANDLE rtv = g_rtvHeap->GetCPUDescriptorHandleForHeapStart();
-    rtv.ptr += g_frameIndex * g_rtvDescriptorSize; //Calculo el handle del RTV del frame actual.
-    D3D12_CPU_DESCRIPTOR_HANDLE dsv = g_dsvHeap->GetCPUDescriptorHandleForHeapStart();
-
-    // Limpio color y depth
-    const float clearColor[4] = { 0.07f, 0.1f, 0.16f, 1.0f };
-    g_cmdList->ClearRenderTargetView(rtv, clearColor, 0, nullptr);
-    g_cmdList->ClearDepthStencilView(dsv, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+    // Grafo del frame: se declara entero y se compila cada vez (unos microsegundos, ver -benchmark-render-graph).
+    // El grafo infiere las barreras (en una ResourceBarrier por pasada) y la textura de depth es un transitorio suyo.
+    g_frameGraph.Reset();
+    const RgHandle color = g_frameGraph.Import("backbuffer", bb);
+    const RgHandle depth = g_frameGraph.CreateTexture("depth", DepthTextureDesc());
 
-    // Bind del render target + depth al pipeline (OM = Output Merger).
-    g_cmdList->OMSetRenderTargets(1, &rtv, FALSE, &dsv);
+    const UINT mainPass = g_frameGraph.AddPass("main", RecordMainPass);
+    g_frameGraph.Write(mainPass, color, D3D12_RESOURCE_STATE_RENDER_TARGET);
+    g_frameGraph.Write(mainPass, depth, D3D12_RESOURCE_STATE_DEPTH_WRITE);
 
-    
-    // Draw según geometría
-    if (g_geomMode == 0) // Cubo
+    if (g_batch.active) // Batch: copia del color al readback del slot y timestamp de fin
     {
-        g_cmdList->IASetVertexBuffers(0, 1, &g_vbView); //Set vertex buffer
-        g_cmdList->IASetIndexBuffer(&g_ibView); //Set index buffer
-        g_cmdList->DrawIndexedInstanced(36, 1, 0, 0, 0); //36 índices para el cubo
+        const RgHandle readback = g_frameGraph.Import("readback", g_batch.readback[g_frameIndex].Get());
+        const UINT readbackPass = g_frameGraph.AddPass("readback", [bb](ID3D12GraphicsCommandList* cl) { RecordBatchReadback(cl, bb); }, true);
+        g_frameGraph.Read(readbackPass, color, D3D12_RESOURCE_STATE_COPY_SOURCE);
+        g_frameGraph.Write(readbackPass, readback, D3D12_RESOURCE_STATE_COPY_DEST);
     }
-    else if (g_geomMode == 1) // Esfera
+
+    // A Present, listo para que el swap chain lo muestre
+    const UINT presentPass = g_frameGraph.AddPass("present", nullptr, true);
+    g_frameGraph.Read(presentPass, color, D3D12_RESOURCE_STATE_PRESENT);
+
+    const bool compiled = g_frameGraph.Compile([](const RgTextureDesc& d)
+        {
+            const D3D12_RESOURCE_DESC rd = TextureDesc(d);
+            return g_device->GetResourceAllocationInfo(0, 1, &rd);
+        });
+    if (!compiled)
     {
-        g_cmdList->IASetVertexBuffers(0, 1, &g_sphereVBView);
-        g_cmdList->IASetIndexBuffer(&g_sphereIBView);
-        g_cmdList->DrawIndexedInstanced(g_sphereIndexCount, 1, 0, 0, 0);
+        for (const std::string& e : g_frameGraph.Errors()) OutputDebugStringA(("Render graph: " + e + "\n").c_str());
+        ThrowIfFailed(E_FAIL);
     }
-    else // 2: Modelo 
-    {
-        g_cmdList->IASetVertexBuffers(0, 1, &g_modelVBView);
-        g_cmdList->IASetIndexBuffer(&g_modelIBView);
-        g_cmdList->DrawIndexedInstanced(g_modelIndexCount, 1, 0, 0, 0);
-}
+    g_transients.Realize(g_frameGraph, LastSubmittedFence());
+    UpdateDepthView(g_frameGraph.Physical(depth));
 
-    // Transition a Present listo para que el swap chain lo muestre
-    Transition(g_cmdList.Get(), bb, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
+    g_cmdListStates.Begin(&g_resourceStates);
+    g_frameGraph.Execute([]() { return g_recordingList; }, g_cmdListStates);
+    g_cmdListStates.Close();
 
     ThrowIfFailed(g_cmdList->Close()); //Cerrar la command list
+    if (g_recordingList != g_cmdList.Get()) ThrowIfFailed(g_recordingList->Close()); // la continuación de los draws en paralelo
 }
 
 void Present()
@@ -1292,19 +11132,110 @@ void Present()
 
     ThrowIfFailed(g_swapChain->Present(1, 0)); // vsync configurado
 
-    // Avanzar frame + Sincronización de frames con fences
-    const UINT64 fenceToSignal = ++g_fenceValue;
-    ThrowIfFailed(g_cmdQueue->Signal(g_fence.Get(), fenceToSignal));
+    // Marcar en la fence el fin del frame que acaba de usar este slot
+    g_frameScheduler.EndFrame(g_frameIndex);
+    g_uploadAllocator.EndFrame(g_frameScheduler.SlotFenceValue(g_frameIndex));
 
+    // Avanzar al próximo backbuffer
     g_frameIndex = g_swapChain->GetCurrentBackBufferIndex();
 
-    //Si el GPU todavía no llegó al valor de fence indicado, espero.
-    //Esto evita grabar comandos sobre recursos que el GPU todavía está usando.
+    //Si el GPU todavía está usando el slot que vamos a reutilizar (allocator, slice de CB, backbuffer), espero.
+    //Si ya lo liberó no se bloquea: la CPU graba el próximo frame mientras la GPU termina el actual.
+    g_frameScheduler.BeginFrame(g_frameIndex);
+    g_uploadAllocator.BeginFrame(g_frameIndex, g_gfxQueueFence.GetCompletedValue()); // la página de este slot ya se puede reciclar
+}
+
+//--------------------------------------------------------------------------------------
+// Batch (offscreen, sin ventana)
+//--------------------------------------------------------------------------------------
+
+// -batch-render: anima la escena a pasos fijos y guarda cada frame como <out>/frame_NNNN.png, más <out>/timings.json.
+// Sin ventana ni Present. -backend=warp usa el device por software de D3D12 y -backend=software el rasterizador en CPU,
+// así corre en máquinas de CI sin GPU. Devuelve el exit code del proceso.
+int RunBatchRender(const BatchOptions& o)
+{
+    ApplyBatchOptions(o);
+    CreateDirectoryA(o.outDir.c_str(), nullptr); // si ya existe se sobrescriben los frames
+    if (o.backend == "software") return RunSoftwareBatch(o);
+
+    g_forceWarp = (o.backend == "warp");
+    CreateFactoryAndDevice();
+    CreateOffscreenTargets(); // en lugar de ventana + swap chain
+    CreateDepthBuffer();
+    CreateCmdListAndFence();
+    CreateRootSigAndPSO();
+
+    CreateFrameUploadBuffer();
+    CreateGeometryUploader();
+    CreateCubeGeometry();
+    CreateSphereGeometry(0.5f, g_sphereKind);
+    InitCamera();
+
+    // En batch no hay placeholder: el modelo se espera entero antes del primer frame
+    if (o.geom == 2 && !g_sweepEnabled)
+    {
+        StartModelLoad(o.model, ModelBenchmarks());
+        while (g_modelState == ModelLoading)
+        {
+            PollModelLoad();
+            SubmitGeometryUploads(); // sin frames: el lote de cada paso de la subida sale igual
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        StopModelLoad();
+        if (g_modelState != ModelReady)
+        {
+            OutputDebugStringA(("Batch render: could not load " + o.model + "\n").c_str());
+            StopGeometryUploader();
+            g_gfxQueueFence.Shutdown();
+            return 1;
+        }
+    }
 
-    if (g_fence->GetCompletedValue() < fenceToSignal) {
-        ThrowIfFailed(g_fence->SetEventOnCompletion(fenceToSignal, g_fenceEvent));
-        WaitForSingleObject(g_fenceEvent, INFINITE);
+    std::vector<BatchFrameTiming> timings(o.frames);
+    std::vector<uint32_t> pixels;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (UINT f = 0; f < o.frames; ++f)
+    {
+        BatchFrameTiming& t = timings[f];
+        t.frame = f;
+        t.time = f * g_fixedTimestep;
+
+        auto c0 = std::chrono::high_resolution_clock::now();
+        UpdateMaterialSweep();
+        UpdateCB();
+        RecordRender();
+        SubmitGeometryUploads();
+        g_cmdQueue->ExecuteCommandLists((UINT)g_submitLists.size(), g_submitLists.data());
+        t.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - c0).count();
+        g_batch.slotFrame[g_frameIndex] = f;
+
+        // Lo mismo que Present() sin swap chain: cerrar el slot, pasar al siguiente y esperar solo si sigue en vuelo.
+        // El frame que estaba en ese slot ya terminó: se lee y se escribe mientras la GPU dibuja el que se acaba de enviar.
+        g_frameScheduler.EndFrame(g_frameIndex);
+        g_uploadAllocator.EndFrame(g_frameScheduler.SlotFenceValue(g_frameIndex));
+        g_frameIndex = (g_frameIndex + 1) % FrameCount;
+
+        auto w0 = std::chrono::high_resolution_clock::now();
+        g_frameScheduler.BeginFrame(g_frameIndex);
+        t.waitMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - w0).count();
+        g_uploadAllocator.BeginFrame(g_frameIndex, g_gfxQueueFence.GetCompletedValue());
+        ResolveBatchSlot(g_frameIndex, o.outDir, timings, pixels);
     }
+    WaitForGPU();
+    for (UINT i = 0; i < FrameCount; ++i) ResolveBatchSlot(i, o.outDir, timings, pixels);
+    const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+    char buf[256];
+    sprintf_s(buf, "Batch render: %u frames at %ux%u on %s in %.1f ms (%.1f fps) -> %s\n",
+        o.frames, o.width, o.height, g_adapterName, totalMs, o.frames * 1000.0 / totalMs, o.outDir.c_str());
+    OutputDebugStringA(buf);
+
+    g_gpuHeaps.LogStats("batch");
+
+    const bool ok = WriteBatchTimings(o, g_adapterName, timings, totalMs);
+    StopGeometryUploader();
+    g_gfxQueueFence.Shutdown();
+    return ok ? 0 : 1;
 }
 
 //--------------------------------------------------------------------------------------
@@ -1319,8 +11250,44 @@ void Present()
 //--------------------------------------------------------------------------------------
 // Main
 //--------------------------------------------------------------------------------------
-int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) //Aplicación
+int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR cmdLine, int) //Aplicación
 {
+    const std::string modelPath = "Models/Intergalactic_Spaceship-(Wavefront).obj";
+    ModelBenchmarks benchmarks;
+    benchmarks.meshCache = cmdLine && wcsstr(cmdLine, L"-benchmark-meshcache");
+    benchmarks.obj = cmdLine && wcsstr(cmdLine, L"-benchmark-obj");
+    benchmarks.simplify = cmdLine && wcsstr(cmdLine, L"-benchmark-simplify");
+    g_objFastPath = !(cmdLine && wcsstr(cmdLine, L"-no-fast-obj"));
+    if (cmdLine && wcsstr(cmdLine, L"-meshlet-stats")) return RunHeadlessMeshletStats(modelPath); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-benchmark-sphere")) return RunSphereBenchmark(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-brdf-selftest")) return RunBrdfSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-obj-selftest")) return RunObjParserSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-job-selftest")) return RunJobSystemSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-frame-scheduler-selftest")) return RunFrameSchedulerSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-heap-selftest")) return RunHeapAllocatorSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-upload-selftest")) return RunUploadSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-upload-allocator-selftest")) return RunUploadAllocatorSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-barrier-selftest")) return RunBarrierSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-render-graph-selftest")) return RunRenderGraphSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-benchmark-render-graph")) return RunRenderGraphBenchmark(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-benchmark-jobs")) return RunJobScalingBenchmark(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-benchmark-record")) return RunRecordScalingBenchmark(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-permutation-selftest")) return RunPermutationSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-shader-cache-selftest")) return RunShaderCacheSelfTest(); // sin ventana ni d3dcompiler
+    if (cmdLine && wcsstr(cmdLine, L"-pso-hash-selftest")) return RunPipelineDescSelfTest(); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-hot-reload-selftest")) return RunHotReloadSelfTest(); // sin ventana ni GPU, en un directorio temporal
+    g_pipelineLibraryEnabled = !(cmdLine && wcsstr(cmdLine, L"-no-pso-cache"));
+    g_placedResources = !(cmdLine && wcsstr(cmdLine, L"-committed-resources"));
+    g_parallelRecording = !(cmdLine && wcsstr(cmdLine, L"-serial-recording"));
+    if (cmdLine && wcsstr(cmdLine, L"-software-render")) return RunSoftwareRender(modelPath); // sin ventana ni GPU
+    if (cmdLine && wcsstr(cmdLine, L"-cube-sphere")) g_sphereKind = SphereCube;
+    if (cmdLine && wcsstr(cmdLine, L"-uv-sphere")) g_sphereKind = SphereUV;
+    if (cmdLine && wcsstr(cmdLine, L"-batch-render")) // offscreen a PNG + timings.json, sin ventana
+    {
+        BatchOptions batch;
+        return ParseBatchOptions(cmdLine, modelPath, batch) ? RunBatchRender(batch) : 1;
+    }
+
     CreateAppWindow(hInst);
     UpdateWindowTitle(); //Solo para ver parámetros
 
@@ -1330,15 +11297,21 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) //Aplicación
     CreateCmdListAndFence();
     CreateRootSigAndPSO();
 
-    CreateCubeGeometryAndCB();
-    CreateSphereGeometry(0.5f, 32, 32); // radio y teselación
-    CreateCustomModelGeometry("Models/Intergalactic_Spaceship-(Wavefront).obj");
+    CreateFrameUploadBuffer();
+    CreateGeometryUploader();
+    CreateCubeGeometry();
+    CreateSphereGeometry(0.5f, g_sphereKind); // radio y generador: todos los LODs en un VB/IB
+    StartModelLoad(modelPath, benchmarks); // en segundo plano: el primer frame no espera al modelo
+    g_hotReloadModelPath = modelPath;
+    if (!(cmdLine && wcsstr(cmdLine, L"-no-hot-reload"))) g_hotReload.Start(".", modelPath); // PBR.hlsl se compila desde el directorio actual
    
     InitCamera();
+    g_gpuHeaps.LogStats("startup");
 
     g_prevTick = std::chrono::high_resolution_clock::now();
 
     // Loop
+    bool firstFrameLogged = false;
     MSG msg = {};
     while (msg.message != WM_QUIT)  //Mientras la ventana siga viva, proceso mensajes; cuando estoy libre, renderizo.
     {
@@ -1349,15 +11322,54 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) //Aplicación
         }
         else
         {
+            PollModelLoad();
+            PollHotReload();
+            UpdateMaterialSweep();
             UpdateCB();
-            ID3D12CommandList* lists[] = { g_cmdList.Get() };
             RecordRender();
-            g_cmdQueue->ExecuteCommandLists(1, lists);
+            SubmitGeometryUploads();
+            g_cmdQueue->ExecuteCommandLists((UINT)g_submitLists.size(), g_submitLists.data()); // en el orden en que se grabaron
             Present();
+
+            if (!firstFrameLogged)
+            {
+                firstFrameLogged = true;
+                char buf[128];
+                sprintf_s(buf, "Time to first frame: %.2f ms\n",
+                    std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - g_t0).count());
+                OutputDebugStringA(buf);
+            }
         }
     }
 
+    StopHotReload();
+    StopModelLoad();
     WaitForGPU();
-    CloseHandle(g_fenceEvent);
+    g_retired.Collect(g_gfxQueueFence.GetCompletedValue());
+
+    char buf[256];
+    sprintf_s(buf, "Upload allocator: page %llu KB | high-water %llu bytes | overflows %llu\n",
+        g_uploadAllocator.PageSize() / 1024, g_uploadAllocator.HighWaterMark(), g_uploadAllocator.OverflowCount());
+    OutputDebugStringA(buf);
+    sprintf_s(buf, "Barriers: %llu transitions requested | %llu emitted in %llu ResourceBarrier calls | %llu already satisfied, %llu merged\n",
+        (unsigned long long)g_cmdListStates.Requested(), (unsigned long long)g_cmdListStates.Emitted(), (unsigned long long)g_cmdListStates.Calls(),
+        (unsigned long long)g_cmdListStates.Skipped(), (unsigned long long)g_cmdListStates.Merged());
+    OutputDebugStringA(buf);
+    sprintf_s(buf, "Render graph: %u passes (%zu culled) | transient heap %llu KB for %llu KB of transients | compile %.1f us avg\n",
+        g_frameGraph.PassCount(), g_frameGraph.Culled().size(), (unsigned long long)(g_transients.HeapSize() / 1024),
+        (unsigned long long)(g_frameGraph.UnaliasedSize() / 1024), g_frameGraph.CompileUsAvg());
+    OutputDebugStringA(buf);
+    sprintf_s(buf, "Command lists: %llu frames recorded in parallel (%.1f draw lists avg)%s\n", (unsigned long long)g_parallelFrames,
+        g_parallelFrames ? (double)g_parallelLists / g_parallelFrames : 0.0, g_parallelRecording ? "" : " | -serial-recording");
+    OutputDebugStringA(buf);
+    sprintf_s(buf, "PSO permutations: %zu built (%.2f ms) | %llu hits | %llu misses\n",
+        g_pipelines.Size(), g_pipelines.BuildMs(), (unsigned long long)g_pipelines.Hits(), (unsigned long long)g_pipelines.Misses());
+    OutputDebugStringA(buf);
+    g_gpuHeaps.LogStats("shutdown");
+    g_shaderCache.Flush(); // permutaciones compiladas durante la sesión
+    g_pipelineLibrary.Save();
+
+    StopGeometryUploader();
+    g_gfxQueueFence.Shutdown();
     return 0;
 }
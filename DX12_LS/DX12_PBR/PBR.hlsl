@@ -1,11 +1,22 @@
+// Permutaciones (ver PipelineKey en DX12_PBR.cpp): el PS se compila una vez por modo de iluminacin y feature, y la
+// tecla T cambia de PSO en lugar de elegir el resultado con un if por pixel. Cada modo calcula solo lo que usa.
+//   SHADING_MODE  0..5 (mismos modos que la tecla T)
+//   NORMAL_ALBEDO 1 = baseColor sale del color debug por normal (tecla N)
+#ifndef SHADING_MODE
+#define SHADING_MODE 5
+#endif
+#ifndef NORMAL_ALBEDO
+#define NORMAL_ALBEDO 0
+#endif
+
 cbuffer CB : register(b0)
 {
-    float4x4 mvp;
+    float4x4 viewProj;
     float4x4 world;
     float3 lightDir;
     float ambient; // (ya no la usamos para PBR directo, pero la dejamos)
 
-    int mode;
+    int mode; // ya no lo lee el PS: el modo es la permutacin (SHADING_MODE). Lo sigue usando el BRDF de referencia en CPU
     float3 _pad1;
 
     float3 viewPos;
@@ -13,28 +24,40 @@ cbuffer CB : register(b0)
     float specIntensity;
     float3 _pad2;
 
-    // Material
-    float3 baseColor;
-    float metallic;
-    float roughness;
-    float ao;
-    float2 _pad3;
-
     // --- NUEVO: punto de luz fsico ---
     float3 lightPos;
     float lightIntensity;
     float3 lightColor;
     float _pad4;
+
+    // Decuantizacin de la posicin (AABB de la malla, ver PackedVertex en DX12_PBR.cpp)
+    float3 posScale;
+    float _pad5;
+    float3 posBias;
+    float _pad6;
 }
 
+// Datos por instancia (mismo layout que InstanceData en DX12_PBR.cpp)
+struct InstanceData
+{
+    float4x4 world; // transform de la instancia, se aplica antes de la world del CB
+    float4x4 normalWorld; // inversa transpuesta de world: normales correctas con escala no uniforme
+    float3 baseColor;
+    float metallic;
+    float roughness;
+    float ao;
+    float2 _pad;
+};
+StructuredBuffer<InstanceData> instances : register(t0);
+
 // --------------------------------------------------
 // Structs
 // --------------------------------------------------
+// Mismo layout que PackedVertex: el IA ya convierte UNORM16/SNORM16 a float
 struct VSIn
 {
-    float3 pos : POSITION;
-    float3 col : COLOR0;
-    float3 nrm : NORMAL;
+    float4 pos : POSITION; // xyz en [0,1] relativos al AABB
+    float2 oct : NORMAL;   // normal codificada en el octaedro, [-1,1]^2
 };
 struct PSIn
 {
@@ -42,6 +65,8 @@ struct PSIn
     float3 col : COLOR0;
     float3 nrmWS : NORMAL;
     float3 posWS : TEXCOORD0;
+    nointerpolation float3 baseColor : TEXCOORD1; // material de la instancia (constante en todo el tringulo)
+    nointerpolation float3 material : TEXCOORD2;  // x = metallic, y = roughness, z = ao
 };
 
 // --------------------------------------------------
@@ -74,18 +99,36 @@ float3 FresnelSchlick(float cosTheta, float3 F0)
     return F0 + (1.0 - F0) * pow(1.0 - cosTheta, 5.0);
 }
 
+// Inversa de OctEncode() en DX12_PBR.cpp
+float3 OctDecode(float2 e)
+{
+    float3 n = float3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 // --------------------------------------------------
 // Vertex Shader
 // --------------------------------------------------
-PSIn VSMain(VSIn i)
+PSIn VSMain(VSIn i, uint instanceID : SV_InstanceID)
 {
     PSIn o;
-    float4 pWS = mul(float4(i.pos, 1), world);
-    o.pos = mul(float4(i.pos, 1), mvp);
-    float3x3 M = (float3x3) world;
-    o.nrmWS = normalize(mul(i.nrm, transpose(M))); // vlido porque tu world es rotacin pura    
-    o.col = i.col;
+    InstanceData inst = instances[instanceID];
+
+    float3 pos = i.pos.xyz * posScale + posBias;
+    float3 nrm = OctDecode(i.oct);
+
+    float4 pObj = mul(float4(pos, 1), inst.world); // espacio de la instancia (ej. celda de la grilla de materiales)
+    float4 pWS = mul(pObj, world);
+    o.pos = mul(pWS, viewProj);
+    float3 nObj = mul(nrm, (float3x3) inst.normalWorld); // la instancia puede escalar distinto por eje
+    o.nrmWS = normalize(mul(nObj, (float3x3) world)); // la world del CB es rotacin + escala uniforme: su 3x3 alcanza
+    o.col = 0.5 * (nrm + 1.0); // color debug por normal (antes vena en el vertex)
     o.posWS = pWS.xyz;
+    o.baseColor = inst.baseColor;
+    o.material = float3(inst.metallic, inst.roughness, inst.ao);
     return o;
 }
 
@@ -94,6 +137,24 @@ PSIn VSMain(VSIn i)
 // --------------------------------------------------
 float4 PSMain(PSIn i) : SV_TARGET
 {
+#if NORMAL_ALBEDO
+    float3 baseColor = i.col; // debug: color por normal en lugar del material
+#else
+    float3 baseColor = i.baseColor;
+#endif
+    float metallic = i.material.x;
+    float roughness = i.material.y;
+    float ao = i.material.z;
+
+    float3 color;
+
+#if SHADING_MODE == 0                // 0 = Unlit
+    color = baseColor;
+
+#elif SHADING_MODE == 1              // 1 = Ambient (placeholder)
+    color = baseColor * ambient;
+
+#else                                // 2..5: luz directa
     float3 N = normalize(i.nrmWS);
     float3 V = normalize(viewPos - i.posWS);
     
@@ -104,20 +165,22 @@ float4 PSMain(PSIn i) : SV_TARGET
     float3 L = Lvec / dist;
     
     //float3 L = normalize(-lightDir);
+    float NdotL = max(dot(N, L), 0.0);
+
+    //float3 radiance = float3(1.0, 1.0, 1.0); // luz blanca directa
+    float3 radiance = lightColor * (lightIntensity / dist2); // <- 1/r^2
+
+  #if SHADING_MODE == 2              // 2 = Difuso Lambert only
+    //color = baseColor * NdotL;
+    color = baseColor * radiance * NdotL;
+
+  #else                              // 3..5: Cook-Torrance
     float3 H = normalize(V + L);
 
-    float NdotL = max(dot(N, L), 0.0);
     float NdotV = max(dot(N, V), 0.0);
     float NdotH = max(dot(N, H), 0.0);
     float VoH = max(dot(V, H), 0.0);
 
-
-    
-    //float3 baseColor = i.col;
-    //float metallic = 0.8; // pods jugar con estos valores
-    //float roughness = 0.4;
-    //float ao = 1.0;
-
     float3 F0 = lerp(float3(0.04, 0.04, 0.04), baseColor, metallic);
 
     // Cook-Torrance
@@ -129,38 +192,28 @@ float4 PSMain(PSIn i) : SV_TARGET
     float denom = 4.0 * NdotV * NdotL + 1e-4;
     float3 specular = numerator / denom;
 
+    #if SHADING_MODE == 3            // 3 = Especular PBR only
+    //color = specular;
+    color = specular * radiance * NdotL;
+
+    #else
     float3 kS = F;
     float3 kD = (1.0 - kS) * (1.0 - metallic);
 
     float3 diffuse = kD * baseColor / 3.14159;
-    //float3 radiance = float3(1.0, 1.0, 1.0); // luz blanca directa
-    float3 radiance = lightColor * (lightIntensity / dist2); // <- 1/r^2
 
+      #if SHADING_MODE == 4          // 4 = Direct PBR (difuso+spec) sin ambient
+    //color = (diffuse + specular) * NdotL;
+    color = (diffuse + specular) * radiance * NdotL;
+
+      #else                          // 5 = PBR completo bsico (ambient placeholder + directo)
     float3 Lo = (diffuse + specular) * radiance * NdotL;
     float3 ambientC = float3(0.03, 0.03, 0.03) * baseColor * ao;
-
-    float3 color;
-    
-    if (mode == 0)                  // 0 = Unlit
-        color = baseColor;
-
-    else if (mode == 1)             // 1 = Ambient (placeholder)
-        color = baseColor * ambient;
-
-    else if (mode == 2)             // 2 = Difuso Lambert only
-        //color = baseColor * NdotL;
-        color = baseColor * radiance * NdotL;
-
-    else if (mode == 3)             // 3 = Especular PBR only
-        //color = specular;
-        color = specular * radiance * NdotL;
-
-    else if (mode == 4)             // 4 = Direct PBR (difuso+spec) sin ambient
-        //color = (diffuse + specular) * NdotL;
-        color = (diffuse + specular) * radiance * NdotL;
-
-    else if (mode == 5)             // 5 = PBR completo bsico (ambient placeholder + directo)
-        color = ambientC + Lo;
+    color = ambientC + Lo;
+      #endif
+    #endif
+  #endif
+#endif
 
     color = pow(color, 1.0 / 2.2); // gamma
 